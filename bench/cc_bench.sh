@@ -0,0 +1,92 @@
+#!/bin/bash
+# Congestion control benchmark: eight uploaders through one switch.
+#
+# On congestionTest.config hosts 0-7 each upload a random file to host 8
+# through switch 9, all at once.  Each run prints the aggregate rate,
+# Jain's fairness index over the eight uploads, the mean final RTT, the
+# window cuts and retransmits, and the switch's egress queue towards host
+# 8: packets dropped there and their average wait.  Each setting is run
+# in loss (Reno) and delay (Vegas, NET367_CC=delay) mode.
+#
+# Two settings:
+#   deep     The links as they are.  A link pipe holds some 580 frames,
+#            more than eight windows of XFER_WINDOW packets, so the
+#            backlog waits in the pipe into host 8 and the switch never
+#            queues or drops anything.
+#   shallow  NET367_PIPE=4096 cuts every link pipe to one page (about 36
+#            frames).  The link into host 8 is then the bottleneck, the
+#            backlog builds in the switch's egress queue and CoDel drops
+#            from it.
+#
+# To compare with the fixed 64-packet window the uploads had before
+# congestion control, point NET367 at a build of an earlier commit.
+#
+# usage: bench/cc_bench.sh [kilobytes]    (default 1500)
+
+. "$(dirname "$0")/sim.sh"
+
+size=${1:-1500}
+
+sim_setup
+for h in 0 1 2 3 4 5 6 7; do
+  mkdir "$SIM/u$h"
+  sim_random_file "$SIM/u$h/f$h.bin" "$size"
+done
+mkdir "$SIM/r8"
+
+# Start every upload, wait for them all, then dump the switch's queues
+commands() {
+  local h
+
+  for h in 0 1 2 3 4 5 6 7; do
+    printf "c\n$h\nm\nu$h\nsleep 0.1\n"
+  done
+  printf "c\n8\nm\nr8\nsleep 0.1\n"
+  for h in 0 1 2 3 4 5 6 7; do
+    printf "c\n$h\nu\nf$h.bin\n8\n"
+  done
+  for h in 0 1 2 3 4 5 6 7; do
+    printf "until 300 Upload of f$h.bin to 8\n"
+  done
+  for h in 0 1 2 3 4 5 6 7; do
+    printf "until 5 Verified f$h.bin\n"
+  done
+  printf "stats\nsleep 0.5\nq\n"
+}
+
+printf "%-8s %-6s %8s %13s %6s %7s %5s %8s %6s %8s\n" links mode seconds \
+  aggregate jain "RTT ms" cuts retrans drops "wait ms"
+for links in deep shallow; do
+  pipe=
+  [ $links = shallow ] && pipe=4096
+  for mode in loss delay; do
+    rm -f "$SIM"/r8/* "$SIM"/r8/.f*
+    commands | NET367_PIPE=$pipe NET367_CC=$mode sim_run \
+      "$BENCH_DIR/../congestionTest.config" 330
+    out=$SIM/out.txt
+
+    # Time and rate of each upload, then of the whole run
+    set -- $(grep -a "Upload of f.* to 8 complete" "$out" |
+      sed 's/.* \([0-9]*\) bytes in \([0-9.]*\) s (\([0-9.]*\) KB\/s), [0-9]* packets, \([0-9]*\) retransmits.*/\1 \2 \3 \4/' |
+      awk '{ b += $1; t = $2 > t ? $2 : t; s += $3; ss += $3 * $3; r += $4; n++ }
+           END { if (n) printf "%d %.2f %.1f %.3f %d", n, t, b / t / 1000, s * s / (n * ss), r }')
+    done=${1:-0} secs=$2 rate=$3 jain=$4 retrans=$5
+    # Final RTT and cuts, absent before congestion control
+    set -- $(grep -a "^Congestion control" "$out" |
+      sed 's/.*cut \([0-9]*\) times, RTT \([0-9.]*\) ms.*/\1 \2/' |
+      awk '{ c += $1; r += $2; n++ } END { if (n) printf "%.1f %d", r / n, c }')
+    rtt=${1:--} cuts=${2:--}
+    # Drops (CoDel, RED and tail) and average wait at the busiest port
+    set -- $(awk '/^Egress queues:/ { on = 1; next }
+                  on && /^[0-9]+\t/ { if ($3 > e) { e = $3; d = $5 + $6 + $7; w = $9 }; next }
+                  on && !/^Port/ { on = 0 }
+                  END { printf "%d %.1f", d, w / 1000 }' "$out")
+    printf "%-8s %-6s %8s %8s KB/s %6s %7s %5s %8s %6s %8s" $links $mode \
+      "$secs" "$rate" "$jain" "$rtt" "$cuts" "$retrans" "$1" "$2"
+    [ "$done" -ne 8 ] && printf "  (%d of 8 done)" "$done"
+    for h in 0 1 2 3 4 5 6 7; do
+      cmp -s "$SIM/u$h/f$h.bin" "$SIM/r8/f$h.bin" || printf "  (f$h.bin differs)"
+    done
+    echo
+  done
+done
@@ -0,0 +1,142 @@
+/**
+
+@file dns_bench.c
+@brief Benchmark of the naming table of the DNS server.
+
+Registers N names of the form "host<i>.eng.hawaii.edu", then looks them
+up in a scattered order, and looks up names that are not registered.
+Prints the rates and the slots probed per operation.  For up to 100000
+names it also times the linear strcmp scan the table replaced.
+
+Build with "make dns_bench" and run "./dns_bench [N ...]"; with no
+arguments it runs 20, 1000, 100000 and 1000000 names.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dns.h"
+
+/* Entry of the old naming table, searched from the start with strcmp */
+struct linear_entry {
+  char domain_name[MAX_NAME_LENGTH];
+  int physical_id;
+  int valid;
+};
+
+static double now_sec(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Index of the i-th lookup, scattered over the n names */
+static int pick(int i, int n) {
+  return (int)((unsigned int)i * 2654435761u % (unsigned int)n);
+}
+
+/**
+
+@brief Time the linear scan of the old table over the same names.
+@param names The names.
+@param n Number of names.
+@return Lookups per second.
+*/
+static double bench_linear(char **names, int n) {
+  struct linear_entry *table;
+  volatile long long sum = 0;
+  int lookups = n <= 1000 ? 1000000 : 20000;
+  double t;
+  char *q;
+  int i, j;
+
+  table = calloc(n + 1, sizeof(struct linear_entry));
+  for (i = 0; i < n; i++) {
+    strcpy(table[i].domain_name, names[i]);
+    table[i].physical_id = i;
+    table[i].valid = 1;
+  }
+  t = now_sec();
+  for (i = 0; i < lookups; i++) {
+    q = names[pick(i, n)];
+    for (j = 0; table[j].valid; j++) {
+      if (strcmp(table[j].domain_name, q) == 0) {
+        sum += table[j].physical_id;
+        break;
+      }
+    }
+  }
+  t = now_sec() - t;
+  free(table);
+  return lookups / t;
+}
+
+/**
+
+@brief Run the benchmark for one table size and print a line of results.
+@param n Number of names.
+*/
+static void bench(int n) {
+  struct dns_table table;
+  volatile long long sum = 0;
+  char buf[MAX_NAME_LENGTH];
+  char **names;
+  int lookups = n < 1000000 ? 4000000 : 4 * n;
+  double t_reg, t_hit, t_miss;
+  double t;
+  int i;
+
+  names = malloc(n * sizeof(char *));
+  for (i = 0; i < n; i++) {
+    snprintf(buf, sizeof(buf), "host%d.eng.hawaii.edu", i);
+    names[i] = strdup(buf);
+  }
+
+  init_dns_table(&table);
+  t = now_sec();
+  for (i = 0; i < n; i++) dns_register(&table, names[i], i & 127);
+  t_reg = now_sec() - t;
+
+  t = now_sec();
+  for (i = 0; i < lookups; i++) sum += dns_lookup(&table, names[pick(i, n)]);
+  t_hit = now_sec() - t;
+
+  t = now_sec();
+  for (i = 0; i < lookups / 4; i++) {
+    snprintf(buf, sizeof(buf), "miss%d.example", i);
+    sum += dns_lookup(&table, buf);
+  }
+  t_miss = now_sec() - t;
+
+  printf("%8d %10.2fM %10.2fM %10.2fM %8.2f %9d",
+         n, n / t_reg / 1e6, lookups / t_hit / 1e6,
+         lookups / 4 / t_miss / 1e6,
+         (double)table.probes / (table.lookups + table.registrations),
+         table.size);
+  if (n <= 100000) {
+    printf(" %10.3fM\n", bench_linear(names, n) / 1e6);
+  } else {
+    printf(" %11s\n", "-");
+  }
+
+  free_dns_table(&table);
+  for (i = 0; i < n; i++) free(names[i]);
+  free(names);
+}
+
+int main(int argc, char **argv) {
+  int sizes[] = {20, 1000, 100000, 1000000};
+  int i;
+
+  printf("%8s %11s %11s %11s %8s %9s %11s\n", "names", "register/s",
+         "hit/s", "miss/s", "probes", "slots", "linear/s");
+  if (argc > 1) {
+    for (i = 1; i < argc; i++) bench(atoi(argv[i]));
+  } else {
+    for (i = 0; i < 4; i++) bench(sizes[i]);
+  }
+  return 0;
+}
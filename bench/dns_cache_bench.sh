@@ -0,0 +1,64 @@
+#!/bin/bash
+# DNS cache benchmark: hit rate and lookup time of a host's name cache.
+#
+# On bench/dns.config hosts 1-3 register names with the DNS server, host
+# 100.  Host 0 then pings by name a skewed mix of those names and one
+# that is not registered, so most lookups repeat a recent one.  Halfway
+# through, host 3 registers one of the names again, which moves it and
+# makes the server invalidate it in host 0's cache.  Prints the hit rate
+# and the lookup times from the cache and from the server, and host 0's
+# cache statistics.
+#
+# usage: bench/dns_cache_bench.sh [lookups]    (default 200)
+
+. "$(dirname "$0")/sim.sh"
+
+lookups=${1:-200}
+
+sim_setup
+
+# Names looked up, the first most often: about half the lookups are for
+# alpha, a quarter for beta, and so on; nobody registers epsilon
+names=(alpha alpha alpha alpha alpha alpha alpha alpha
+       beta beta beta beta gamma gamma delta epsilon)
+
+commands() {
+  local i
+
+  printf "c\n1\nr\nalpha\nsleep 0.2\n"
+  printf "c\n2\nr\nbeta\nsleep 0.2\nr\ngamma\nsleep 0.2\n"
+  printf "c\n3\nr\ndelta\nsleep 0.2\n"
+  printf "c\n0\n"
+  for ((i = 0; i < lookups; i++)); do
+    if [ $i -eq $((lookups / 2)) ]; then
+      printf "c\n3\nr\nalpha\nsleep 0.2\nc\n0\n"
+    fi
+    printf "p\n2\n%s\n" "${names[RANDOM % ${#names[@]}]}"
+  done
+  # A name of its own marks the end of the lookups
+  printf "p\n2\nend.of.bench\nuntil 120 end.of.bench is not registered\n"
+  printf "stats\nsleep 0.5\nq\n"
+}
+
+RANDOM=1
+commands | sim_run "$BENCH_DIR/dns.config" 150
+out=$SIM/out.txt
+
+grep -a ": cache hit in \|: asked the server in " "$out" | grep -v end.of.bench |
+  sed 's/.*: cache hit in \([0-9]*\) us.*/cache \1/; s/.*: asked the server in \([0-9]*\) us.*/server \1/' |
+  sort -k2n | awk '
+    { t[$1, ++n[$1]] = $2 }
+    END {
+      total = n["cache"] + n["server"];
+      printf "%d lookups, %.1f%% answered from the cache\n", total,
+             total ? 100 * n["cache"] / total : 0;
+      split("cache server", h, " ");
+      for (k = 1; k <= 2; k++) {
+        m = n[h[k]];
+        if (m == 0) continue;
+        printf "  %-6s %4d lookups: p50 %6d us, p99 %6d us, max %6d us\n",
+               h[k], m, t[h[k], int((m + 1) / 2)], t[h[k], int((m * 99 + 99) / 100)],
+               t[h[k], m];
+      }
+    }'
+grep -a "^Host 0 DNS" "$out"
@@ -0,0 +1,141 @@
+/**
+
+@file io_bench.c
+@brief Benchmark of how disk writes delay a host's packet handling.
+
+A loop shaped like host_main() runs a pass every millisecond for 3 s.
+Each pass it answers the pings waiting in a pipe, collects completed I/O
+and writes 256 KB to a file in 64 KB blocks, each followed by an fsync,
+as a receiver writing out an upload does.  A second thread sends a
+timestamped ping every millisecond.  The time from send to answer is the
+delay a ping to the host would see.
+
+The run is made twice: with the I/O inline, as hosts did before the I/O
+pool, and with the pool's worker threads.  Writes are not submitted while
+IO_RING_SIZE are outstanding, so the pool's backlog stays bounded.
+
+Build with "make io_bench" and run "./io_bench [file]"; the file,
+/var/tmp/io_bench.out by default, should be on a real disk.
+*/
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "io_pool.h"
+
+#define RUN_USEC 3000000
+#define PINGS 3000
+#define BLOCK 65536
+#define BLOCKS_PER_PASS 4
+
+static int ping_pipe[2];
+
+static long long now_usec(void) {
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000LL + t.tv_nsec / 1000;
+}
+
+/* Send a timestamp every millisecond */
+static void *pinger(void *arg) {
+  long long t;
+  int i;
+
+  (void)arg;
+  for (i = 0; i < PINGS; i++) {
+    t = now_usec();
+    if (write(ping_pipe[1], &t, sizeof(t)) != sizeof(t)) break;
+    usleep(1000);
+  }
+  return NULL;
+}
+
+static int cmp_ll(const void *a, const void *b) {
+  long long x = *(const long long *)a;
+  long long y = *(const long long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/**
+
+@brief Run the host loop for RUN_USEC and print the ping delays.
+@param use_pool 1 to use the worker threads, 0 to do the I/O inline.
+@param path File to write.
+*/
+static void bench(int use_pool, char *path) {
+  static long long lat[PINGS];
+  struct io_pool pool;
+  struct io_file *f;
+  struct io_req *req;
+  pthread_t thread;
+  long long off = 0;
+  long long end;
+  long long t;
+  int outstanding = 0;
+  int n = 0;
+  char *buf;
+  int k;
+
+  if (use_pool) {
+    io_pool_init(&pool);
+  } else {
+    memset(&pool, 0, sizeof(pool));
+  }
+  if (pipe(ping_pipe) < 0) return;
+  fcntl(ping_pipe[0], F_SETFL, O_NONBLOCK);
+
+  f = io_file_new(&pool, -1);
+  io_submit(&pool, f, IO_OPEN_WRITE, strdup(path), 0, 0);
+  outstanding++;
+  pthread_create(&thread, NULL, pinger, NULL);
+
+  end = now_usec() + RUN_USEC;
+  while (now_usec() < end) {
+    while (n < PINGS && read(ping_pipe[0], &t, sizeof(t)) == sizeof(t)) {
+      lat[n++] = now_usec() - t;
+    }
+    while ((req = io_poll(&pool)) != NULL) {
+      outstanding--;
+      free(req);
+    }
+    for (k = 0; k < BLOCKS_PER_PASS && outstanding < IO_RING_SIZE; k++) {
+      buf = malloc(BLOCK);
+      memset(buf, (int)(off >> 16), BLOCK);
+      io_submit(&pool, f, IO_WRITE, buf, off, BLOCK);
+      io_submit(&pool, f, IO_FSYNC, NULL, 0, 0);
+      outstanding += 2;
+      off += BLOCK;
+    }
+    usleep(1000);
+  }
+  pthread_join(thread, NULL);
+
+  io_submit(&pool, f, IO_CLOSE, NULL, 0, 0);
+  if (use_pool) io_pool_shutdown(&pool);
+  while ((req = io_poll(&pool)) != NULL) free(req);
+  free(f);
+  close(ping_pipe[0]);
+  close(ping_pipe[1]);
+  unlink(path);
+
+  qsort(lat, n, sizeof(long long), cmp_ll);
+  printf("%-7s %5d pings: p50 %.2f ms, p99 %.2f ms, max %.2f ms; "
+         "%lld MB submitted\n",
+         use_pool ? "pool" : "inline", n, lat[n / 2] / 1000.0,
+         lat[n * 99 / 100] / 1000.0, lat[n - 1] / 1000.0, off >> 20);
+}
+
+int main(int argc, char **argv) {
+  char *path = argc > 1 ? argv[1] : "/var/tmp/io_bench.out";
+
+  bench(0, path);
+  bench(1, path);
+  return 0;
+}
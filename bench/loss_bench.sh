@@ -0,0 +1,53 @@
+#!/bin/bash
+# Upload benchmark under random loss (reliable transfer, SACK window).
+#
+# Uploads a random file from host 0 to host 1 on p2p.config once for each
+# loss rate, with NET367_LOSS dropping that share of the packets each host
+# receives, data and ACKs alike.  Prints the time, goodput and retransmits
+# of each upload, and whether the copy matches.
+#
+# usage: bench/loss_bench.sh [kilobytes [loss% ...]]    (default 300, 0 5 20)
+
+. "$(dirname "$0")/sim.sh"
+
+size=${1:-300}
+shift
+losses=${*:-0 5 20}
+
+sim_setup
+mkdir "$SIM/t0" "$SIM/t1"
+sim_random_file "$SIM/t0/bench.bin" "$size"
+
+printf "%6s %9s %10s %12s %s\n" loss seconds "KB/s" retransmits copy
+for loss in $losses; do
+  rm -f "$SIM"/t1/bench.bin "$SIM"/t1/.bench.bin*
+  NET367_LOSS=$loss sim_run "$BENCH_DIR/../p2p.config" 60 <<CMDS
+c
+0
+m
+t0
+sleep 0.2
+c
+1
+m
+t1
+sleep 0.2
+c
+0
+u
+bench.bin
+1
+until 50 Upload of bench.bin to 1
+until 5 Verified bench.bin
+q
+CMDS
+  line=$(grep -a "Upload of bench.bin to 1 complete" "$SIM/out.txt")
+  if [ -z "$line" ]; then
+    printf "%5s%% %9s\n" "$loss" "incomplete"
+    continue
+  fi
+  copy=differs
+  cmp -s "$SIM/t0/bench.bin" "$SIM/t1/bench.bin" && copy=equal
+  echo "$line" | sed 's/.* in \([0-9.]*\) s (\([0-9.]*\) KB\/s), [0-9]* packets, \([0-9]*\) retransmits.*/\1 \2 \3/' |
+    (read secs kbs retx; printf "%5s%% %9s %10s %12s %s\n" "$loss" "$secs" "$kbs" "$retx" "$copy")
+done
@@ -0,0 +1,73 @@
+#!/bin/bash
+# Compression benchmark: codec CPU cost, then plain against compressed
+# uploads.
+#
+# Makes three 3 MB inputs: a log of the simulator's kind of text, random
+# bytes, and one text block followed by random bytes.  Runs lz_bench on
+# them, then uploads the log from host 0 to host 1 on p2p.config with (u)
+# and with (k), and prints each upload's time and effective rate.
+#
+# usage: make lz_bench net367 && bench/lz_bench.sh
+
+. "$(dirname "$0")/sim.sh"
+
+LZ_BENCH=${LZ_BENCH:-$BENCH_DIR/../lz_bench}
+
+sim_setup
+mkdir "$SIM/t0" "$SIM/t1"
+awk 'BEGIN {
+  srand(1);
+  split("INFO WARN ERROR DEBUG", level, " ");
+  for (t = 0; size < 3000000; t += rand() * 0.5) {
+    line = sprintf("2026-10-18 12:%02d:%06.3f [%s] host %d: packet %d from %d to %d type %d len %d",
+                   int(t / 60) % 60, t % 60, level[int(rand() * 4) + 1],
+                   int(rand() * 8), int(rand() * 100000), int(rand() * 8),
+                   int(rand() * 8), int(rand() * 10), int(rand() * 100));
+    print line;
+    size += length(line) + 1;
+  }
+}' > "$SIM/t0/log.txt"
+sim_random_file "$SIM/t0/random.bin" 2930
+{ head -c 65536 "$SIM/t0/log.txt"; head -c 2934464 /dev/urandom; } > "$SIM/t0/mixed.bin"
+
+(cd "$SIM/t0" && "$LZ_BENCH" log.txt random.bin mixed.bin) || exit 1
+echo
+
+for cmd in u k; do
+  rm -f "$SIM"/t1/log.txt "$SIM"/t1/.log.txt*
+  sim_run "$BENCH_DIR/../p2p.config" 60 <<CMDS
+c
+0
+m
+t0
+sleep 0.2
+c
+1
+m
+t1
+sleep 0.2
+c
+0
+$cmd
+log.txt
+1
+until 50 Upload of log.txt to 1
+until 5 Verified log.txt
+sleep 0.5
+q
+CMDS
+  line=$(grep -a "Upload of log.txt to 1 complete" "$SIM/out.txt")
+  if [ -z "$line" ]; then
+    echo "$cmd: incomplete"
+    continue
+  fi
+  copy=differs
+  cmp -s "$SIM/t0/log.txt" "$SIM/t1/log.txt" && copy=equal
+  secs=$(echo "$line" | sed 's/.* in \([0-9.]*\) s .*/\1/')
+  if [ "$cmd" = k ]; then
+    echo "compressed: $secs s, $(grep -a "^Compressed" "$SIM/out.txt" |
+      sed 's/^Compressed //'), copy $copy"
+  else
+    echo "plain:      $secs s, $(echo "$line" | sed 's/.*(\([0-9.]* KB\/s\)).*/\1/'), copy $copy"
+  fi
+done
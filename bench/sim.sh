@@ -0,0 +1,64 @@
+# Helpers for the benchmarks that run the simulator, sourced by them.
+#
+# net367 reads the configuration file name and then manager commands from
+# stdin, and hosts find their directories at ../<dir>, so each run gets a
+# scratch directory holding bin/ (the simulator and configuration) and the
+# host directories next to it.  The benchmarks run ../net367 by default;
+# set NET367 to time another build, such as one of an earlier commit.
+
+BENCH_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+NET367=${NET367:-$BENCH_DIR/../net367}
+
+# Make a scratch directory in $SIM and copy the simulator into it.
+sim_setup() {
+  if [ ! -x "$NET367" ]; then
+    echo "$NET367 not found; run make first" >&2
+    exit 1
+  fi
+  SIM=$(mktemp -d "${TMPDIR:-/tmp}/net367-bench.XXXXXX")
+  trap 'rm -rf "$SIM"' EXIT
+  mkdir "$SIM/bin"
+  cp "$NET367" "$SIM/bin/net367"
+}
+
+# Write a file of random bytes: sim_random_file <path> <kilobytes>
+sim_random_file() {
+  head -c $(($2 * 1024)) /dev/urandom > "$1"
+}
+
+# Run the simulator: sim_run <config> <seconds> < commands
+# Command lines of the form "sleep N" pause the input instead of being
+# sent, "until N text" pauses until the output holds the text, for at
+# most N seconds, and "stats" sends SIGUSR1 to every node, so hosts and
+# switches print their statistics.  The output is left in $SIM/out.txt.
+sim_run() {
+  local config=$1 secs=$2 line n sid pid
+
+  rm -f "$SIM/out.txt"
+  cp "$config" "$SIM/bin/"
+  (
+    basename "$config"
+    while IFS= read -r line; do
+      case "$line" in
+        sleep*) $line ;;
+        until*)
+          set -- $line
+          for ((n = 0; n < $2 * 10; n++)); do
+            grep -aqF "${line#until $2 }" "$SIM/out.txt" 2>/dev/null && break
+            sleep 0.1
+          done ;;
+        stats)
+          # Every process of the run but the manager, which leads it
+          sid=$(cat "$SIM/bin/sid")
+          for pid in $(pgrep -s "$sid"); do
+            [ "$pid" != "$sid" ] && kill -USR1 "$pid"
+          done ;;
+        *) echo "$line" ;;
+      esac
+    done
+  ) | (cd "$SIM/bin" && timeout -s KILL "$secs" setsid sh -c \
+        'echo $$ > sid; exec stdbuf -oL ./net367' > "$SIM/out.txt" 2>&1) 2>/dev/null
+  # The simulator forks a process per node; take down its whole session
+  pkill -KILL -s "$(cat "$SIM/bin/sid")" 2>/dev/null
+  return 0
+}
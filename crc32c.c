@@ -0,0 +1,222 @@
+/**
+
+@file crc32c.c
+@brief CRC32C (Castagnoli) checksums.
+
+On x86 processors with SSE4.2 the checksum is computed with the crc32
+instruction, eight bytes at a time.  Elsewhere a portable slicing-by-8
+table implementation is used.  The choice is made once, on the first
+call, and both give the same results.
+
+crc32c_combine() joins the checksums of two consecutive pieces without
+the data, so pieces of a file checksummed separately, and out of order
+in time, still give the checksum of the whole file.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+#define CRC32C_POLY 0x82f63b78   /* Castagnoli polynomial, bit reversed */
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_use_hw;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+/**
+
+@brief Build the lookup tables and detect the crc32 instruction.
+*/
+static void crc32c_init() {
+  uint32_t c;
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (j = 0; j < 8; j++) {
+      c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    }
+    crc32c_table[0][i] = c;
+  }
+  for (i = 0; i < 256; i++) {
+    c = crc32c_table[0][i];
+    for (j = 1; j < 8; j++) {
+      c = crc32c_table[0][c & 0xff] ^ (c >> 8);
+      crc32c_table[j][i] = c;
+    }
+  }
+
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  crc32c_use_hw = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+/**
+
+@brief Portable checksum, eight bytes per step.
+@param crc Running checksum state (inverted).
+@param p Data.
+@param len Number of bytes.
+@return The new state.
+*/
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+  uint64_t w;
+
+  while (len >= 8) {
+    memcpy(&w, p, 8);
+    w ^= crc;   /* Little-endian: the low four bytes take the state */
+    crc = crc32c_table[7][w & 0xff] ^ crc32c_table[6][(w >> 8) & 0xff] ^
+          crc32c_table[5][(w >> 16) & 0xff] ^
+          crc32c_table[4][(w >> 24) & 0xff] ^
+          crc32c_table[3][(w >> 32) & 0xff] ^
+          crc32c_table[2][(w >> 40) & 0xff] ^
+          crc32c_table[1][(w >> 48) & 0xff] ^ crc32c_table[0][w >> 56];
+    p += 8;
+    len -= 8;
+  }
+  while (len-- > 0) {
+    crc = crc32c_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+/**
+
+@brief Checksum with the SSE4.2 crc32 instruction.
+@param crc Running checksum state (inverted).
+@param p Data.
+@param len Number of bytes.
+@return The new state.
+*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p,
+                             size_t len) {
+  uint64_t c = crc;
+  uint64_t w;
+
+  while (len >= 8) {
+    memcpy(&w, p, 8);
+    c = _mm_crc32_u64(c, w);
+    p += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)c;
+  while (len-- > 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return crc;
+}
+#endif
+
+/**
+
+@brief Compute the CRC32C of a buffer.
+@param crc Checksum of the data before buf, or 0.
+@param buf Data.
+@param len Number of bytes.
+@return The checksum of the data so far.
+*/
+unsigned int crc32c(unsigned int crc, const void *buf, size_t len) {
+  pthread_once(&crc32c_once, crc32c_init);
+#if defined(__x86_64__)
+  if (crc32c_use_hw) {
+    return ~crc32c_sse42(~crc, (const unsigned char *)buf, len);
+  }
+#endif
+  return ~crc32c_sw(~crc, (const unsigned char *)buf, len);
+}
+
+/**
+
+@brief Report which implementation crc32c() uses.
+@return 1 for the SSE4.2 instruction, 0 for the tables.
+*/
+int crc32c_hw() {
+  pthread_once(&crc32c_once, crc32c_init);
+  return crc32c_use_hw;
+}
+
+/**
+
+@brief Multiply a vector by a 32x32 matrix over GF(2).
+@param mat The matrix, one column per element.
+@param vec The vector.
+@return The product.
+*/
+static uint32_t gf2_times(const uint32_t *mat, uint32_t vec) {
+  uint32_t sum = 0;
+
+  while (vec) {
+    if (vec & 1) sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+/**
+
+@brief Square a 32x32 matrix over GF(2).
+@param square Result.
+@param mat The matrix.
+*/
+static void gf2_square(uint32_t *square, const uint32_t *mat) {
+  int n;
+
+  for (n = 0; n < 32; n++) {
+    square[n] = gf2_times(mat, mat[n]);
+  }
+}
+
+/**
+
+@brief Combine the checksums of two consecutive pieces of data.
+
+This is the method of zlib's crc32_combine(): crc1 is advanced over len2
+zero bytes by repeated squaring of the one-zero-bit operator, then
+crc2 is added.  It takes O(log len2) steps.
+
+@param crc1 Checksum of the first piece.
+@param crc2 Checksum of the second piece.
+@param len2 Length of the second piece.
+@return Checksum of the two pieces together.
+*/
+unsigned int crc32c_combine(unsigned int crc1, unsigned int crc2,
+                            long long len2) {
+  uint32_t even[32];
+  uint32_t odd[32];
+  uint32_t row;
+  int n;
+
+  if (len2 <= 0) return crc1;
+
+  /* Operator for one zero bit */
+  odd[0] = CRC32C_POLY;
+  row = 1;
+  for (n = 1; n < 32; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+  gf2_square(even, odd);   /* Two zero bits */
+  gf2_square(odd, even);   /* Four zero bits */
+
+  do {
+    gf2_square(even, odd);
+    if (len2 & 1) crc1 = gf2_times(even, crc1);
+    len2 >>= 1;
+    if (len2 == 0) break;
+    gf2_square(odd, even);
+    if (len2 & 1) crc1 = gf2_times(odd, crc1);
+    len2 >>= 1;
+  } while (len2 != 0);
+
+  return crc1 ^ crc2;
+}
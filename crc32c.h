@@ -0,0 +1,21 @@
+/*
+ * crc32c.h
+ *
+ * CRC32C (Castagnoli) checksums, used for the frame check sequence
+ * on every link and for the whole-file digest of transfers.
+ */
+
+#include <stddef.h>
+
+/*
+ * Checksum of buf, continuing from crc.  Start with crc = 0, so that
+ * crc32c(crc32c(0, a, m), b, n) is the checksum of a followed by b.
+ */
+unsigned int crc32c(unsigned int crc, const void *buf, size_t len);
+
+/* Checksum of A followed by B, from the checksums of A and B */
+unsigned int crc32c_combine(unsigned int crc1, unsigned int crc2,
+      long long len2);
+
+/* 1 if crc32c() uses the SSE4.2 crc32 instruction */
+int crc32c_hw();
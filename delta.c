@@ -0,0 +1,552 @@
+/**
+
+@file delta.c
+@brief rsync-style delta encoding of files.
+
+The signature of a file is a header followed by one entry per whole block
+of DELTA_SIG_HDR block size: the rsync weak checksum, which can be rolled
+one byte at a time, and a 64-bit FNV-1a hash to confirm a match.  The
+block size grows with the square root of the file, as in rsync, so the
+signature stays small for large files.
+
+To make a delta the sender slides a block-sized window over the new file,
+rolling the weak checksum.  A window whose checksum is in the signature
+and whose strong hash agrees is sent as a copy of that old block, and the
+window jumps past it; otherwise the window moves on by one byte and the
+byte it leaves becomes new data.  Runs of consecutive old blocks become a
+single copy op.
+
+The delta header carries the size and CRC32C of the new file, so the
+receiver can tell whether the file it rebuilt is the one that was sent,
+whatever hash collisions or changes to its old copy happened meanwhile.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "delta.h"
+
+/* Output written in large pieces */
+struct delta_out {
+  int fd;
+  int len;
+  int error;           /* -errno of the first failed write */
+  char buf[65536];
+};
+
+/* Signature entries, hashed by weak checksum */
+struct delta_sig {
+  int block;
+  long long blocks;
+  uint32_t *weak;
+  uint64_t *strong;
+  long long *chain;    /* Next entry with the same bucket, or -1 */
+  long long *bucket;   /* First entry of each bucket, or -1 */
+  unsigned int mask;
+};
+
+/**
+
+@brief Store a 32-bit value in big-endian order.
+@param buf Destination, at least 4 bytes.
+@param v Value to store.
+*/
+static void delta_put_u32(char *buf, uint32_t v) {
+  buf[0] = (char)(v >> 24);
+  buf[1] = (char)(v >> 16);
+  buf[2] = (char)(v >> 8);
+  buf[3] = (char)v;
+}
+
+/**
+
+@brief Load a 32-bit value stored in big-endian order.
+@param buf Source, at least 4 bytes.
+@return The value.
+*/
+static uint32_t delta_get_u32(const char *buf) {
+  return ((uint32_t)(unsigned char)buf[0] << 24) |
+         ((uint32_t)(unsigned char)buf[1] << 16) |
+         ((uint32_t)(unsigned char)buf[2] << 8) |
+         (uint32_t)(unsigned char)buf[3];
+}
+
+/**
+
+@brief Store a 64-bit value in big-endian order.
+@param buf Destination, at least 8 bytes.
+@param v Value to store.
+*/
+static void delta_put_u64(char *buf, uint64_t v) {
+  delta_put_u32(buf, (uint32_t)(v >> 32));
+  delta_put_u32(buf + 4, (uint32_t)v);
+}
+
+/**
+
+@brief Load a 64-bit value stored in big-endian order.
+@param buf Source, at least 8 bytes.
+@return The value.
+*/
+static uint64_t delta_get_u64(const char *buf) {
+  return ((uint64_t)delta_get_u32(buf) << 32) | delta_get_u32(buf + 4);
+}
+
+/**
+
+@brief Compute the rsync weak checksum of a block.
+@param p The block.
+@param len Its length.
+@param a Sum of the bytes, returned for rolling.
+@param b Sum of the running sums, returned for rolling.
+@return The checksum.
+*/
+static uint32_t delta_weak(const unsigned char *p, int len, uint32_t *a,
+                           uint32_t *b) {
+  uint32_t s1 = 0;
+  uint32_t s2 = 0;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    s1 += p[i];
+    s2 += s1;
+  }
+  *a = s1;
+  *b = s2;
+  return (s1 & 0xffff) | (s2 << 16);
+}
+
+/**
+
+@brief Compute the strong hash of a block (64-bit FNV-1a).
+@param p The block.
+@param len Its length.
+@return The hash.
+*/
+static uint64_t delta_strong(const unsigned char *p, int len) {
+  uint64_t h = 14695981039346656037ULL;
+  int i;
+
+  for (i = 0; i < len; i++) {
+    h = (h ^ p[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+/**
+
+@brief Choose the block size for a file.
+@param size Size of the file.
+@return The square root of the size, rounded up to 64 bytes and kept
+between DELTA_MIN_BLOCK and DELTA_MAX_BLOCK.
+*/
+static int delta_block_size(long long size) {
+  long long b = ((long long)sqrt((double)size) + 63) / 64 * 64;
+
+  if (b < DELTA_MIN_BLOCK) return DELTA_MIN_BLOCK;
+  if (b > DELTA_MAX_BLOCK) return DELTA_MAX_BLOCK;
+  return (int)b;
+}
+
+/**
+
+@brief Write bytes through the output buffer.
+@param o The output.
+@param data Bytes to write.
+@param len Number of bytes.
+*/
+static void delta_write(struct delta_out *o, const char *data, long long len) {
+  ssize_t n;
+  int k;
+
+  while (len > 0 && o->error == 0) {
+    k = len < (long long)sizeof(o->buf) - o->len
+            ? (int)len
+            : (int)sizeof(o->buf) - o->len;
+    memcpy(o->buf + o->len, data, k);
+    o->len += k;
+    data += k;
+    len -= k;
+    if (o->len == (int)sizeof(o->buf)) {
+      n = write(o->fd, o->buf, o->len);
+      if (n != o->len) o->error = n < 0 ? -errno : -EIO;
+      o->len = 0;
+    }
+  }
+}
+
+/**
+
+@brief Write out what is left in the output buffer.
+@param o The output.
+@return 0, or -errno of the first failed write.
+*/
+static int delta_flush(struct delta_out *o) {
+  ssize_t n;
+
+  if (o->len > 0 && o->error == 0) {
+    n = write(o->fd, o->buf, o->len);
+    if (n != o->len) o->error = n < 0 ? -errno : -EIO;
+  }
+  o->len = 0;
+  return o->error;
+}
+
+/**
+
+@brief Map a whole file for reading.
+@param fd The file.
+@param size Returns its size.
+@return The mapping, NULL for an empty file, or MAP_FAILED.
+*/
+static unsigned char *delta_map(int fd, long long *size) {
+  struct stat st;
+  void *map;
+
+  if (fstat(fd, &st) < 0) return (unsigned char *)MAP_FAILED;
+  *size = st.st_size;
+  if (st.st_size == 0) return NULL;
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map != MAP_FAILED) madvise(map, st.st_size, MADV_SEQUENTIAL);
+  return (unsigned char *)map;
+}
+
+/**
+
+@brief Write the signature of a file.
+@param old_fd The receiver's copy of the file, or -1 if it has none.
+@param out_fd Where the signature is written.
+@return 0 on success, or -errno.
+*/
+int delta_signature_file(int old_fd, int out_fd) {
+  struct delta_out *o;
+  unsigned char *map = NULL;
+  long long size = 0;
+  long long off;
+  char entry[DELTA_SIG_ENTRY];
+  uint32_t a, b;
+  int block;
+  int result;
+
+  if (old_fd >= 0) {
+    map = delta_map(old_fd, &size);
+    if (map == MAP_FAILED) return -errno;
+  }
+  block = delta_block_size(size);
+
+  o = (struct delta_out *)malloc(sizeof(struct delta_out));
+  o->fd = out_fd;
+  o->len = 0;
+  o->error = 0;
+  memcpy(entry, DELTA_SIG_MAGIC, 8);
+  delta_write(o, entry, 8);
+  delta_put_u32(entry, block);
+  delta_put_u64(entry + 4, size);
+  delta_write(o, entry, 12);
+
+  /* Only whole blocks; the tail of the file is always sent as data */
+  for (off = 0; off + block <= size; off += block) {
+    delta_put_u32(entry, delta_weak(map + off, block, &a, &b));
+    delta_put_u64(entry + 4, delta_strong(map + off, block));
+    delta_write(o, entry, DELTA_SIG_ENTRY);
+  }
+
+  result = delta_flush(o);
+  free(o);
+  if (map != NULL) munmap(map, size);
+  return result;
+}
+
+/**
+
+@brief Load a signature and index it by weak checksum.
+@param fd The signature.
+@param s Filled in; free with delta_sig_free().
+@return 0 on success, -EIO if the signature is malformed, or -errno.
+*/
+static int delta_sig_load(int fd, struct delta_sig *s) {
+  unsigned char *map;
+  long long size;
+  long long i;
+  unsigned int h;
+  int result = 0;
+
+  memset(s, 0, sizeof(struct delta_sig));
+  map = delta_map(fd, &size);
+  if (map == MAP_FAILED) return -errno;
+  if (size < DELTA_SIG_HDR || memcmp(map, DELTA_SIG_MAGIC, 8) != 0 ||
+      (size - DELTA_SIG_HDR) % DELTA_SIG_ENTRY != 0) {
+    if (map != NULL) munmap(map, size);
+    return -EIO;
+  }
+
+  s->block = (int)delta_get_u32((char *)map + 8);
+  s->blocks = (size - DELTA_SIG_HDR) / DELTA_SIG_ENTRY;
+  if (s->block < DELTA_MIN_BLOCK || s->block > DELTA_MAX_BLOCK) {
+    result = -EIO;
+  } else {
+    for (s->mask = 1; s->mask < 2 * s->blocks; s->mask <<= 1)
+      ;
+    s->weak = (uint32_t *)malloc((s->blocks + 1) * sizeof(uint32_t));
+    s->strong = (uint64_t *)malloc((s->blocks + 1) * sizeof(uint64_t));
+    s->chain = (long long *)malloc((s->blocks + 1) * sizeof(long long));
+    s->bucket = (long long *)malloc(s->mask * sizeof(long long));
+    s->mask--;
+    memset(s->bucket, 0xff, (s->mask + 1) * sizeof(long long));
+    /* Chained in reverse, so the earliest old block is tried first */
+    for (i = s->blocks - 1; i >= 0; i--) {
+      s->weak[i] = delta_get_u32((char *)map + DELTA_SIG_HDR +
+                                 i * DELTA_SIG_ENTRY);
+      s->strong[i] = delta_get_u64((char *)map + DELTA_SIG_HDR +
+                                   i * DELTA_SIG_ENTRY + 4);
+      h = (s->weak[i] * 2654435761u) & s->mask;
+      s->chain[i] = s->bucket[h];
+      s->bucket[h] = i;
+    }
+  }
+  munmap(map, size);
+  return result;
+}
+
+/**
+
+@brief Free a loaded signature.
+@param s The signature.
+*/
+static void delta_sig_free(struct delta_sig *s) {
+  free(s->weak);
+  free(s->strong);
+  free(s->chain);
+  free(s->bucket);
+}
+
+/**
+
+@brief Write a run of new bytes as data ops.
+@param o The output.
+@param p The bytes.
+@param len Number of bytes.
+*/
+static void delta_put_data(struct delta_out *o, const unsigned char *p,
+                           long long len) {
+  char op[5];
+  int k;
+
+  while (len > 0) {
+    k = len < DELTA_LITERAL_MAX ? (int)len : DELTA_LITERAL_MAX;
+    op[0] = DELTA_OP_DATA;
+    delta_put_u32(op + 1, k);
+    delta_write(o, op, 5);
+    delta_write(o, (const char *)p, k);
+    p += k;
+    len -= k;
+  }
+}
+
+/**
+
+@brief Write a copy op.
+@param o The output.
+@param first First old block.
+@param count Number of consecutive old blocks.
+*/
+static void delta_put_copy(struct delta_out *o, long long first,
+                           long long count) {
+  char op[9];
+
+  if (count == 0) return;
+  op[0] = DELTA_OP_COPY;
+  delta_put_u32(op + 1, (uint32_t)first);
+  delta_put_u32(op + 5, (uint32_t)count);
+  delta_write(o, op, 9);
+}
+
+/**
+
+@brief Write the delta from the file a signature describes to a new file.
+@param sig_fd The receiver's signature.
+@param new_fd The new file.
+@param out_fd Where the delta is written.
+@return 0 on success, -EIO if the signature is malformed, or -errno.
+*/
+int delta_make_file(int sig_fd, int new_fd, int out_fd) {
+  struct delta_sig s;
+  struct delta_out *o;
+  unsigned char *map;
+  long long size;
+  long long i;
+  long long lit = 0;       /* Start of the new bytes not yet written */
+  long long copy_first = 0;
+  long long copy_count = 0;
+  long long j;
+  uint64_t strong;
+  int have_strong;
+  uint32_t a = 0, b = 0;
+  uint32_t weak;
+  char hdr[DELTA_HDR];
+  int block;
+  int result;
+
+  result = delta_sig_load(sig_fd, &s);
+  if (result < 0) return result;
+  map = delta_map(new_fd, &size);
+  if (map == MAP_FAILED) {
+    delta_sig_free(&s);
+    return -errno;
+  }
+  block = s.block;
+
+  o = (struct delta_out *)malloc(sizeof(struct delta_out));
+  o->fd = out_fd;
+  o->len = 0;
+  o->error = 0;
+  memcpy(hdr, DELTA_MAGIC, 8);
+  delta_put_u32(hdr + 8, block);
+  delta_put_u64(hdr + 12, size);
+  delta_put_u32(hdr + 20, crc32c(0, map, size));
+  delta_write(o, hdr, DELTA_HDR);
+
+  i = 0;
+  if (s.blocks > 0 && size >= block) delta_weak(map, block, &a, &b);
+  while (s.blocks > 0 && i + block <= size) {
+    weak = (a & 0xffff) | (b << 16);
+    have_strong = 0;
+    strong = 0;
+    for (j = s.bucket[(weak * 2654435761u) & s.mask]; j >= 0;
+         j = s.chain[j]) {
+      if (s.weak[j] != weak) continue;
+      if (!have_strong) {
+        strong = delta_strong(map + i, block);
+        have_strong = 1;
+      }
+      if (s.strong[j] == strong) break;
+    }
+
+    if (j >= 0) {
+      /* Old block j is at i */
+      if (i > lit) {
+        delta_put_copy(o, copy_first, copy_count);
+        copy_count = 0;
+        delta_put_data(o, map + lit, i - lit);
+      }
+      if (copy_count > 0 && j == copy_first + copy_count) {
+        copy_count++;
+      } else {
+        delta_put_copy(o, copy_first, copy_count);
+        copy_first = j;
+        copy_count = 1;
+      }
+      i += block;
+      lit = i;
+      if (i + block <= size) delta_weak(map + i, block, &a, &b);
+    } else {
+      /* Roll the window on by one byte */
+      if (i + block < size) {
+        a += map[i + block] - map[i];
+        b += a - (uint32_t)block * map[i];
+      }
+      i++;
+    }
+  }
+  delta_put_copy(o, copy_first, copy_count);
+  delta_put_data(o, map + lit, size - lit);
+
+  result = delta_flush(o);
+  free(o);
+  if (map != NULL) munmap(map, size);
+  delta_sig_free(&s);
+  return result;
+}
+
+/**
+
+@brief Rebuild a file from the old copy and a delta.
+@param old_fd The receiver's old copy, or -1 if it has none.
+@param delta_fd The delta.
+@param out_fd Where the new file is written.
+@return 0 if the rebuilt file has the size and CRC32C the delta names,
+-EIO if it does not or the delta is malformed, or -errno.
+*/
+int delta_apply_file(int old_fd, int delta_fd, int out_fd) {
+  struct delta_out *o;
+  unsigned char *old = NULL;
+  unsigned char *d;
+  long long old_size = 0;
+  long long dsize;
+  long long size;
+  long long pos;
+  long long written = 0;
+  long long first, count;
+  unsigned int crc = 0;
+  unsigned int len;
+  int block;
+  int result = 0;
+
+  d = delta_map(delta_fd, &dsize);
+  if (d == MAP_FAILED) return -errno;
+  if (dsize < DELTA_HDR || memcmp(d, DELTA_MAGIC, 8) != 0) {
+    if (d != NULL) munmap(d, dsize);
+    return -EIO;
+  }
+  if (old_fd >= 0) {
+    old = delta_map(old_fd, &old_size);
+    if (old == MAP_FAILED) {
+      munmap(d, dsize);
+      return -errno;
+    }
+  }
+  block = (int)delta_get_u32((char *)d + 8);
+  size = (long long)delta_get_u64((char *)d + 12);
+
+  o = (struct delta_out *)malloc(sizeof(struct delta_out));
+  o->fd = out_fd;
+  o->len = 0;
+  o->error = 0;
+
+  pos = DELTA_HDR;
+  while (pos < dsize && result == 0) {
+    if (d[pos] == DELTA_OP_COPY && dsize - pos >= 9) {
+      first = delta_get_u32((char *)d + pos + 1);
+      count = delta_get_u32((char *)d + pos + 5);
+      pos += 9;
+      if ((first + count) * block > old_size) {
+        result = -EIO;
+        break;
+      }
+      delta_write(o, (char *)old + first * block, count * block);
+      crc = crc32c(crc, old + first * block, count * block);
+      written += count * block;
+    } else if (d[pos] == DELTA_OP_DATA && dsize - pos >= 5) {
+      len = delta_get_u32((char *)d + pos + 1);
+      pos += 5;
+      if (len > DELTA_LITERAL_MAX || len > dsize - pos) {
+        result = -EIO;
+        break;
+      }
+      delta_write(o, (char *)d + pos, len);
+      crc = crc32c(crc, d + pos, len);
+      written += len;
+      pos += len;
+    } else {
+      result = -EIO;
+    }
+  }
+
+  if (result == 0) result = delta_flush(o);
+  if (result == 0 &&
+      (written != size || crc != delta_get_u32((char *)d + 20))) {
+    result = -EIO;
+  }
+  free(o);
+  if (old != NULL) munmap(old, old_size);
+  munmap(d, dsize);
+  return result;
+}
@@ -0,0 +1,31 @@
+/*
+ * delta.h
+ *
+ * rsync-style delta encoding.  The receiver of an upload describes the
+ * copy of the file it already has with a signature, one weak rolling
+ * checksum and one strong hash per block.  The sender finds those
+ * blocks in the new file and sends a delta: copies of old blocks and
+ * the bytes in between.
+ */
+
+#define DELTA_SIG_MAGIC "N367SIG1"
+#define DELTA_SIG_HDR 20      /* Magic, block size and old file size */
+#define DELTA_SIG_ENTRY 12    /* Weak checksum and strong hash of a block */
+#define DELTA_MAGIC "N367DLT1"
+#define DELTA_HDR 24          /* Magic, block size, new size and its CRC32C */
+#define DELTA_MIN_BLOCK 512
+#define DELTA_MAX_BLOCK 65536
+#define DELTA_LITERAL_MAX 65536   /* Largest run of new bytes in one op */
+
+/* Ops of a delta */
+#define DELTA_OP_COPY 'C'     /* First block and number of blocks of the old file */
+#define DELTA_OP_DATA 'D'     /* Length and the bytes */
+
+/* Write the signature of old_fd (-1 if there is no old file) to out_fd */
+int delta_signature_file(int old_fd, int out_fd);
+
+/* Write the delta that turns the file described by sig_fd into new_fd */
+int delta_make_file(int sig_fd, int new_fd, int out_fd);
+
+/* Rebuild the new file from old_fd and the delta; -EIO if it does not check */
+int delta_apply_file(int old_fd, int delta_fd, int out_fd);
@@ -1,28 +1,198 @@
-/*
-   This file contains the functions neccesary for the dns server. I will move them into the right files after writing them. 
+/**
+
+@file dns.c
+@brief Naming table of the DNS server.
+
+The table is an open-addressing hash table keyed by domain name.  A name
+hashes (FNV-1a) to a slot and is kept in the first empty slot from there
+on (linear probing), so registering, updating and looking up a name take
+a few probes on average, however many names there are.  Each slot holds
+the name's hash next to its id, and names are only compared when the
+hashes match.  When the table gets DNS_TABLE_LOAD percent full it doubles
+and every name is put in its slot of the new table.  Names are never
+removed, so the probing needs no tombstones.
 */
 
+#include <stdlib.h>
+
 #include "dns.h"
 
-void init_dns_table(struct dns_entry * naming_table) {
-   for(int i = 0; i < TABLE_SIZE; i++) {
-      naming_table[i].domain_name[0] = '\0';   // empty string
-      naming_table[i].physical_id = -1;        // no id
-      naming_table[i].valid = 0;               // not available    
+/**
+
+@brief Hash a domain name.
+@param domain_name The name.
+@return The 32-bit FNV-1a hash of the name.
+*/
+unsigned int dns_hash(char *domain_name) {
+   unsigned int h = 2166136261u;
+   unsigned char *b;
+
+   for (b = (unsigned char *)domain_name; *b != '\0'; b++) {
+      h = (h ^ *b) * 16777619u;
+   }
+   return h;
+}
+
+/**
+
+@brief Find the slot of a name, or the empty slot where it would go.
+@param naming_table Pointer to the table.
+@param domain_name The name.
+@param hash Hash of the name.
+@return Pointer to the slot.
+*/
+static struct dns_entry *dns_find(struct dns_table *naming_table,
+      char *domain_name, unsigned int hash) {
+   unsigned int mask = naming_table->size - 1;
+   unsigned int i;
+   struct dns_entry *e;
+
+   for (i = hash & mask; ; i = (i + 1) & mask) {
+      naming_table->probes++;
+      e = &naming_table->slot[i];
+      if (e->domain_name == NULL) return e;
+      if (e->hash == hash && strcmp(e->domain_name, domain_name) == 0) {
+         return e;
+      }
    }
 }
 
-void print_dns_table (struct dns_entry * naming_table) {
+/**
+
+@brief Double the number of slots of the table.
+@param naming_table Pointer to the table.
+*/
+static void dns_grow(struct dns_table *naming_table) {
+   struct dns_entry *old = naming_table->slot;
+   int old_size = naming_table->size;
+   unsigned int mask;
+   unsigned int j;
    int i;
-   for (i = 0; i < TABLE_SIZE; i++) {
-      printf("Domain Name: %s\n", naming_table[i].domain_name);
-      printf("Physical ID: %d\n", naming_table[i].physical_id);
-      printf("Valid: %d\n", naming_table[i].valid);
+
+   naming_table->size *= 2;
+   naming_table->slot = (struct dns_entry *)
+      calloc(naming_table->size, sizeof(struct dns_entry));
+   mask = naming_table->size - 1;
+   for (i = 0; i < old_size; i++) {
+      if (old[i].domain_name == NULL) continue;
+      for (j = old[i].hash & mask; naming_table->slot[j].domain_name != NULL;
+            j = (j + 1) & mask)
+         ;
+      naming_table->slot[j] = old[i];
    }
+   free(old);
+   naming_table->grows++;
 }
 
+/**
+
+@brief Initialize an empty table of DNS_TABLE_INIT slots.
+@param naming_table Pointer to the table.
+*/
+void init_dns_table(struct dns_table *naming_table) {
+   memset(naming_table, 0, sizeof(struct dns_table));
+   naming_table->size = DNS_TABLE_INIT;
+   naming_table->slot = (struct dns_entry *)
+      calloc(naming_table->size, sizeof(struct dns_entry));
+}
 
+/**
 
-/*
- In the main file we can create a struct dns_entry dns_server[TABLE_SIZE]. Then pass &dns_server into the init_dns_server function
- */
+@brief Free the names and slots of a table.
+@param naming_table Pointer to the table.
+*/
+void free_dns_table(struct dns_table *naming_table) {
+   int i;
+
+   for (i = 0; i < naming_table->size; i++) {
+      free(naming_table->slot[i].domain_name);
+   }
+   free(naming_table->slot);
+   naming_table->slot = NULL;
+   naming_table->size = 0;
+   naming_table->count = 0;
+}
+
+/**
+
+@brief Register a name for a host, or move the name to a new host.
+
+A name longer than MAX_NAME_LENGTH - 1 characters is cut short.
+
+@param naming_table Pointer to the table.
+@param domain_name The name.
+@param physical_id ID of the host.
+@return The id the name had before, or -1 if it is new.
+*/
+int dns_register(struct dns_table *naming_table, char *domain_name,
+      int physical_id) {
+   char name[MAX_NAME_LENGTH];
+   struct dns_entry *e;
+   unsigned int hash;
+   int old_id;
+
+   naming_table->registrations++;
+   strncpy(name, domain_name, MAX_NAME_LENGTH - 1);
+   name[MAX_NAME_LENGTH - 1] = '\0';
+   hash = dns_hash(name);
+   e = dns_find(naming_table, name, hash);
+   if (e->domain_name != NULL) {
+      old_id = e->physical_id;
+      e->physical_id = physical_id;
+      return old_id;
+   }
+
+   if ((naming_table->count + 1) * 100 > naming_table->size * DNS_TABLE_LOAD) {
+      dns_grow(naming_table);
+      e = dns_find(naming_table, name, hash);
+   }
+   e->domain_name = strdup(name);
+   e->hash = hash;
+   e->physical_id = physical_id;
+   naming_table->count++;
+   return -1;
+}
+
+/**
+
+@brief Look up the host of a name, cut short like dns_register() does.
+@param naming_table Pointer to the table.
+@param domain_name The name.
+@return ID of the host, or -1 if the name is not registered.
+*/
+int dns_lookup(struct dns_table *naming_table, char *domain_name) {
+   char name[MAX_NAME_LENGTH];
+   struct dns_entry *e;
+
+   naming_table->lookups++;
+   strncpy(name, domain_name, MAX_NAME_LENGTH - 1);
+   name[MAX_NAME_LENGTH - 1] = '\0';
+   e = dns_find(naming_table, name, dns_hash(name));
+   return e->domain_name != NULL ? e->physical_id : -1;
+}
+
+/**
+
+@brief Print the names registered, for debugging, and the statistics of
+the table.
+@param naming_table Pointer to the table.
+*/
+void print_dns_table(struct dns_table *naming_table) {
+   int i;
+
+   for (i = 0; i < naming_table->size; i++) {
+      if (naming_table->slot[i].domain_name == NULL) continue;
+      printf("Domain Name: %s\n", naming_table->slot[i].domain_name);
+      printf("Physical ID: %d\n", naming_table->slot[i].physical_id);
+      printf("Slot: %d\n", i);
+   }
+   printf("DNS table: %d names in %d slots (%.1f%% full), grown %d times, "
+         "%lld registrations, %lld lookups, %.2f probes per operation\n",
+         naming_table->count, naming_table->size,
+         100.0 * naming_table->count / naming_table->size, naming_table->grows,
+         naming_table->registrations, naming_table->lookups,
+         naming_table->lookups + naming_table->registrations > 0
+         ? (double)naming_table->probes
+            / (naming_table->lookups + naming_table->registrations)
+         : 0.0);
+}
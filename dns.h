@@ -2,20 +2,51 @@
 #include <string.h>
 
 #define DNS_SERVER_PHYS_ID 100
-#define TABLE_SIZE 20
+#define DNS_TABLE_INIT 64      /* Slots of a new naming table, a power of two */
+#define DNS_TABLE_LOAD 75      /* Percent of the slots in use before it doubles */
 #define MAX_NAME_LENGTH 50
+#define DNS_TTL 30000             /* Time an answer holds, in milliseconds (30 s) */
+#define DNS_NEG_TTL 5000          /* Time a name stays unregistered, in milliseconds (5 s) */
+#define DNS_MAX_HOSTS 128         /* Host ids told when a name changes */
 
 #define PING_BY_ID 1
 #define PING_BY_NAME 2
 
 
 
+/*
+ * Slot of the naming table.  The name is kept with its hash, so most
+ * slots probed are passed over without comparing names.
+ */
 struct dns_entry {
-   char domain_name[MAX_NAME_LENGTH];
+   char *domain_name;      /* NULL if the slot is empty */
+   unsigned int hash;
    int physical_id;
-   int valid;
  };
 
-void init_dns_table(struct dns_entry * naming_table);
-void print_dns_table(struct dns_entry * naming_table);
+/*
+ * Naming table of the DNS server, an open-addressing hash table with
+ * linear probing, keyed by domain name.  It doubles when it gets
+ * DNS_TABLE_LOAD percent full, so it holds any number of names.
+ */
+struct dns_table {
+   struct dns_entry *slot;
+   int size;               /* Number of slots, a power of two */
+   int count;              /* Names registered */
+   char clients[DNS_MAX_HOSTS];   /* Hosts that looked up names, which
+                                     cache the answers */
 
+   /* Statistics */
+   long long lookups;
+   long long registrations;
+   long long probes;       /* Slots looked at by lookups and registrations */
+   int grows;
+};
+
+unsigned int dns_hash(char *domain_name);
+void init_dns_table(struct dns_table *naming_table);
+void free_dns_table(struct dns_table *naming_table);
+int dns_register(struct dns_table *naming_table, char *domain_name,
+      int physical_id);
+int dns_lookup(struct dns_table *naming_table, char *domain_name);
+void print_dns_table(struct dns_table *naming_table);
@@ -0,0 +1,295 @@
+/**
+
+@file dns_cache.c
+@brief Cache of the names a host has looked up.
+
+A host looking up a name for the manager first looks in its cache.  An
+answer still within its time to live is reported at once; otherwise the
+host asks the DNS server with a PKT_PING_DOMAIN packet, and reports the
+answer when the PKT_REPLY_DOMAIN comes back.  The reply carries the id,
+or DNS_NOT_REGISTERED, the time to live in milliseconds and the name, and
+every reply is kept, so a name that is not registered is not asked for
+again either until its shorter time to live (DNS_NEG_TTL) has passed.
+
+The cache holds DNS_CACHE_SIZE names.  When it is full, the name used
+least recently makes room.  When a name is registered, or moves to
+another host, the server sends a PKT_DNS_INVALIDATE with the name to every
+host that has looked names up, and each drops its answer for the name.
+
+Each report to the manager says how the name was answered, how long it
+took and the share of lookups answered by the cache.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "packet.h"
+#include "time_util.h"
+#include "timer.h"
+#include "dns.h"
+#include "dns_cache.h"
+
+/**
+
+@brief Find the entry of a name.
+@param dc Pointer to the cache.
+@param domain_name The name.
+@param hash Hash of the name.
+@return Pointer to the entry, or NULL if the name is not in the cache.
+*/
+static struct dns_cache_entry *dns_cache_find(struct dns_cache *dc,
+                                              char *domain_name,
+                                              unsigned int hash) {
+  struct dns_cache_entry *e;
+  int i;
+
+  for (i = 0; i < DNS_CACHE_SIZE; i++) {
+    e = &dc->entry[i];
+    if (e->domain_name[0] != '\0' && e->hash == hash &&
+        strcmp(e->domain_name, domain_name) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/**
+
+@brief Keep an answer of the server, in place of an older answer for the
+name, or in a free entry, or in the entry used least recently.
+@param dc Pointer to the cache.
+@param domain_name The name.
+@param physical_id Its id, or DNS_NOT_REGISTERED.
+@param expires When the answer runs out.
+*/
+static void dns_cache_insert(struct dns_cache *dc, char *domain_name,
+                             int physical_id, long long expires) {
+  unsigned int hash = dns_hash(domain_name);
+  struct dns_cache_entry *e;
+  int i;
+
+  e = dns_cache_find(dc, domain_name, hash);
+  for (i = 0; e == NULL && i < DNS_CACHE_SIZE; i++) {
+    if (dc->entry[i].domain_name[0] == '\0') e = &dc->entry[i];
+  }
+  if (e == NULL) {
+    e = &dc->entry[0];
+    for (i = 1; i < DNS_CACHE_SIZE; i++) {
+      if (dc->entry[i].last_used < e->last_used) e = &dc->entry[i];
+    }
+    dc->evictions++;
+  }
+  strcpy(e->domain_name, domain_name);
+  e->hash = hash;
+  e->physical_id = physical_id;
+  e->expires = expires;
+  e->last_used = dc->lookups;
+}
+
+/**
+
+@brief Report how a name was answered to the manager.
+
+The message starts with the id, or DNS_NOT_REGISTERED or DNS_NO_ANSWER,
+for the manager to act on, followed by a description.
+
+@param dc Pointer to the cache.
+@param domain_name The name.
+@param physical_id The answer.
+@param how How it was answered.
+@param elapsed Time it took, in microseconds.
+*/
+static void dns_cache_report(struct dns_cache *dc, char *domain_name,
+                             int physical_id, char *how, long long elapsed) {
+  char msg[200];
+  int n;
+
+  if (physical_id >= 0) {
+    n = sprintf(msg, "%d %s is host %d", physical_id, domain_name,
+                physical_id);
+  } else if (physical_id == DNS_NOT_REGISTERED) {
+    n = sprintf(msg, "%d %s is not registered", physical_id, domain_name);
+  } else {
+    n = sprintf(msg, "%d %s was not answered", physical_id, domain_name);
+  }
+  snprintf(msg + n, sizeof(msg) - n,
+           ": %s in %lld us, cache hit rate %.1f%% (%lld of %lld)", how,
+           elapsed, dc->lookups > 0 ? 100.0 * dc->hits / dc->lookups : 0.0,
+           dc->hits, dc->lookups);
+  write(dc->man_fd, msg, strlen(msg) + 1);
+}
+
+/**
+
+@brief Give up on a lookup the server did not answer, when its timer
+goes off.
+@param arg Pointer to the cache.
+*/
+static void dns_cache_timed_out(void *arg) {
+  struct dns_cache *dc = (struct dns_cache *)arg;
+
+  dc->pending = 0;
+  dc->timeouts++;
+  dns_cache_report(dc, dc->pending_name, DNS_NO_ANSWER, "no answer",
+                   time_now_usec() - dc->pending_since);
+}
+
+/**
+
+@brief Initialize an empty cache.
+@param dc Pointer to the cache.
+@param host_id ID of this host.
+@param man_fd Pipe to the manager.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+@param timers Pointer to the host's timer wheel.
+*/
+void dns_cache_init(struct dns_cache *dc, int host_id, int man_fd,
+                    struct net_port **node_port, int node_port_num,
+                    struct timer_wheel *timers) {
+  memset(dc, 0, sizeof(struct dns_cache));
+  dc->host_id = host_id;
+  dc->man_fd = man_fd;
+  dc->node_port = node_port;
+  dc->node_port_num = node_port_num;
+  dc->timers = timers;
+  timer_init(&dc->timer, dns_cache_timed_out, dc);
+}
+
+/**
+
+@brief Look up a name for the manager, in the cache or else at the DNS
+server.
+@param dc Pointer to the cache.
+@param domain_name The name.
+*/
+void dns_cache_resolve(struct dns_cache *dc, char *domain_name) {
+  long long now = time_now_usec();
+  char name[MAX_NAME_LENGTH];
+  struct dns_cache_entry *e;
+  struct packet pkt;
+  int k;
+
+  strncpy(name, domain_name, MAX_NAME_LENGTH - 1);
+  name[MAX_NAME_LENGTH - 1] = '\0';
+  dc->lookups++;
+
+  e = dns_cache_find(dc, name, dns_hash(name));
+  if (e != NULL && e->expires > now) {
+    e->last_used = dc->lookups;
+    dc->hits++;
+    if (e->physical_id < 0) dc->negative_hits++;
+    now = time_now_usec() - now;
+    dc->hit_time += now;
+    dns_cache_report(dc, name, e->physical_id, "cache hit", now);
+    return;
+  }
+  if (e != NULL) {
+    e->domain_name[0] = '\0';
+    dc->expired++;
+  }
+
+  if (dc->pending) {
+    dns_cache_report(dc, name, DNS_NO_ANSWER,
+                     "another lookup is waiting for the server", 0);
+    return;
+  }
+  dc->pending = 1;
+  strcpy(dc->pending_name, name);
+  dc->pending_since = now;
+
+  pkt.src = (char)dc->host_id;
+  pkt.dst = (char)DNS_SERVER_PHYS_ID;
+  pkt.type = (char)PKT_PING_DOMAIN;
+  strcpy(pkt.payload, name);
+  pkt.length = strlen(name);
+  for (k = 0; k < dc->node_port_num; k++) {
+    packet_send(dc->node_port[k], &pkt);
+  }
+  timer_add(dc->timers, &dc->timer, now + DNS_LOOKUP_TIMEOUT);
+}
+
+/**
+
+@brief Keep an answer of the DNS server, and report it if the manager is
+waiting for it.
+
+The payload is the id, the time to live in milliseconds and the name, as
+text.  An answer without a time to live is reported but not kept.
+
+@param dc Pointer to the cache.
+@param pkt The PKT_REPLY_DOMAIN packet.
+*/
+void dns_cache_answer(struct dns_cache *dc, struct packet *pkt) {
+  long long now = time_now_usec();
+  char name[MAX_NAME_LENGTH];
+  int physical_id;
+  int ttl;
+  int n;
+
+  n = pkt->length < PAYLOAD_MAX ? pkt->length : PAYLOAD_MAX - 1;
+  if (n < 0) return;
+  pkt->payload[n] = '\0';
+  if (sscanf(pkt->payload, "%d %d %49s", &physical_id, &ttl, name) != 3) {
+    return;
+  }
+  if (physical_id < 0) physical_id = DNS_NOT_REGISTERED;
+  dc->answers++;
+  if (ttl > 0) {
+    dns_cache_insert(dc, name, physical_id, now + (long long)ttl * 1000);
+  }
+
+  if (dc->pending && strcmp(name, dc->pending_name) == 0) {
+    timer_cancel(dc->timers, &dc->timer);
+    dc->pending = 0;
+    now -= dc->pending_since;
+    dc->miss_time += now;
+    if (now > dc->miss_time_max) dc->miss_time_max = now;
+    dns_cache_report(dc, name, physical_id, "asked the server", now);
+  }
+}
+
+/**
+
+@brief Drop the answer for a name that was registered or moved.
+@param dc Pointer to the cache.
+@param pkt The PKT_DNS_INVALIDATE packet, holding the name.
+*/
+void dns_cache_invalidate(struct dns_cache *dc, struct packet *pkt) {
+  struct dns_cache_entry *e;
+  int n;
+
+  n = pkt->length < MAX_NAME_LENGTH ? pkt->length : MAX_NAME_LENGTH - 1;
+  if (n < 0) return;
+  pkt->payload[n] = '\0';
+  e = dns_cache_find(dc, pkt->payload, dns_hash(pkt->payload));
+  if (e != NULL) {
+    e->domain_name[0] = '\0';
+    dc->invalidations++;
+  }
+}
+
+/**
+
+@brief Print the statistics of the cache of a host.
+@param dc Pointer to the cache.
+*/
+void display_dns_cache_stats(struct dns_cache *dc) {
+  long long misses = dc->lookups - dc->hits;
+
+  printf("Host %d DNS cache: %lld lookups, %.1f%% hits (%lld negative), "
+         "%lld expired, %lld evicted, %lld invalidated, %lld timed out\n",
+         dc->host_id, dc->lookups,
+         dc->lookups > 0 ? 100.0 * dc->hits / dc->lookups : 0.0,
+         dc->negative_hits, dc->expired, dc->evictions, dc->invalidations,
+         dc->timeouts);
+  printf("Host %d DNS lookup time: %.1f us from the cache, %.0f us from the "
+         "server (max %lld us)\n",
+         dc->host_id, dc->hits > 0 ? (double)dc->hit_time / dc->hits : 0.0,
+         misses - dc->timeouts > 0
+             ? (double)dc->miss_time / (misses - dc->timeouts)
+             : 0.0,
+         dc->miss_time_max);
+}
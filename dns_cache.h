@@ -0,0 +1,58 @@
+/*
+ * dns_cache.h
+ *
+ * Names a host has looked up, kept with the id the DNS server gave for
+ * each, or the answer that it is not registered, for as long as the
+ * server says the answer holds.
+ * Requires main.h, packet.h, timer.h and dns.h to be included first.
+ */
+
+#define DNS_CACHE_SIZE 64         /* Names a host remembers; the least recently used goes */
+#define DNS_LOOKUP_TIMEOUT 1000000   /* Time to wait for the server to answer (1 s) */
+
+#define DNS_NOT_REGISTERED -1     /* Answers reported to the manager besides an id */
+#define DNS_NO_ANSWER -2
+
+struct dns_cache_entry {
+   char domain_name[MAX_NAME_LENGTH];   /* Empty if the entry is free */
+   unsigned int hash;
+   int physical_id;         /* DNS_NOT_REGISTERED for a negative answer */
+   long long expires;       /* Monotonic clock, in microseconds */
+   long long last_used;     /* Lookup count when it was last used */
+};
+
+struct dns_cache {
+   int host_id;
+   int man_fd;              /* Pipe the answers are reported on */
+   struct net_port **node_port;
+   int node_port_num;
+   struct timer_wheel *timers;
+   struct dns_cache_entry entry[DNS_CACHE_SIZE];
+
+   /* The lookup waiting for the server; the manager waits for one at a time */
+   int pending;
+   char pending_name[MAX_NAME_LENGTH];
+   long long pending_since;
+   struct timer timer;      /* Goes off after DNS_LOOKUP_TIMEOUT */
+
+   /* Statistics */
+   long long lookups;
+   long long hits;
+   long long negative_hits;
+   long long expired;       /* Misses on answers that had run out */
+   long long evictions;
+   long long invalidations;
+   long long timeouts;
+   long long hit_time;      /* Total time to answer from the cache, microseconds */
+   long long miss_time;     /* Total time to answer through the server */
+   long long miss_time_max;
+   long long answers;       /* Answers that came from the server */
+};
+
+void dns_cache_init(struct dns_cache *dc, int host_id, int man_fd,
+      struct net_port **node_port, int node_port_num,
+      struct timer_wheel *timers);
+void dns_cache_resolve(struct dns_cache *dc, char *domain_name);
+void dns_cache_answer(struct dns_cache *dc, struct packet *pkt);
+void dns_cache_invalidate(struct dns_cache *dc, struct packet *pkt);
+void display_dns_cache_stats(struct dns_cache *dc);
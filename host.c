@@ -3,29 +3,27 @@
  * 
  * @brief Implements the host main loop.
  * 
- * Assignment 4.1 was to allow the download and upload of files of 
- * up to 1000 bytes from other hosts without changing the packet 
- * capacity (100 bytes). I did this by modifying the upload code.
+ * Each pass of the loop takes a command from the manager and packets 
+ * from the links, turns them into jobs, and runs the jobs queued at the 
+ * start of the pass. Jobs are scheduled in three classes, control, 
+ * interactive and bulk, so pings and DNS packets are not held up by 
+ * transfers. An upload is pumped by a JOB_FILE_UPLOAD_SEND_CONT job once 
+ * per pass. The host then advances its timer wheel (see timer.c), which 
+ * times pings, retransmissions and idle transfer sessions, and sleeps 
+ * until the next timer is due, or for 10 ms if none is due sooner.
  * 
- * When a user wants to upload a file to another host, the file is 
- * first opened and read, and then broken down into smaller packets. 
- * The initial packet, containing the file name, is sent as a 
- * PKT_FILE_UPLOAD_START packet, followed by one or more PKT_FILE_UPLOAD_CONT 
- * packets containing the actual file content. These packets are sent via the 
- * network using the JOB_SEND_PKT_ALL_PORTS job type, which ensures that the 
- * packets are transmitted through all available ports. Once the entire file 
- * has been sent, a PKT_FILE_UPLOAD_END packet is transmitted to signal the 
- * completion of the file transfer. On the receiving host, the packets are 
- * processed and reassembled, and the file is stored in the destination host's
- *  designated directory.
+ * The protocols live in their own files: uploads in transfer.c, 
+ * downloads, swarms and the tracker in swarm.c, pings in ping.c, traces 
+ * in trace.c, the DNS host's naming table in dns.c and every host's 
+ * cache of the names it looks up in dns_cache.c.
  * 
- * When a user wants to download a file, the filename is sent along with a 
- * PKT_FILE_DOWNLOAD_SEND packet, which contains the filename in the payload.
- * The receiving host then reads the file name, it initiates an upload job
- * to itself with the src of the packet as the dst.
+ * Sending SIGUSR1 to a host prints the queue depth and waiting time of 
+ * each job class, the ping, DNS cache and timer statistics, and on the 
+ * DNS host the naming table.
  * 
 */
 
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,13 +40,28 @@
 #include "switch.h"
 #include "host_util.h"
 #include "dns.h"
+#include "io_pool.h"
+#include "time_util.h"
+#include "timer.h"
+#include "transfer.h"
+#include "swarm.h"
+#include "ping.h"
+#include "trace.h"
+#include "dns_cache.h"
 
 #define MAX_NAME_LENGTH 50
 #define DNS_SERVER_PHYS_ID 100
-#define TABLE_SIZE 20
 #define PING_BY_ID 1
 #define PING_BY_NAME 2
 
+static volatile sig_atomic_t g_show_job_stats = 0;
+
+/* SIGUSR1 handler, requests a dump of the job queue statistics */
+static void request_job_stats(int sig) {
+  (void)sig;
+  g_show_job_stats = 1;
+}
+
 
 void host_main(int host_id)
 {
@@ -57,7 +70,7 @@ void host_main(int host_id)
 if (host_id == 100) {
    printf("Currently in DNS Server\n");
 }
-struct dns_entry naming_table[TABLE_SIZE];
+struct dns_table naming_table;
 
 /* State */
 char dir[MAX_DIR_NAME];
@@ -73,17 +86,21 @@ struct net_port *node_port_list;
 struct net_port **node_port;  // Array of pointers to node ports
 int node_port_num;            // Number of node ports
 
-int ping_reply_received;
+int mcast_joined[MCAST_MAX_GROUPS];  // Multicast groups this host belongs to
+int group;
 
 int i, k, n;
+int burst;
+int loss_pct;    // Percentage of incoming packets to drop, for testing
 int dst;
+int count;       // Pings of a flood, its time and its rate
+double seconds;
+int rate;
+long long bytes; // Bytes of a throughput test
 int domain_id;
 char name[MAX_FILE_NAME];
-char string[PKT_PAYLOAD_MAX+1];
 char domain_name[MAX_NAME_LENGTH];
 
-FILE *fp;
-
 struct packet *in_packet; /* Incoming packet */
 struct packet *new_packet;
 
@@ -92,12 +109,41 @@ struct host_job *new_job;
 struct host_job *new_job2;
 
 struct job_queue job_q;
+struct timer_wheel timers;  // Ping timeouts and transfer timers
+struct ping_table pings;    // Pings waiting for their replies
+struct trace_table traces;  // Trace waiting to come back
+struct dns_cache dns_cache; // Names looked up, and the lookup waiting
+long long next_timer;
+long long now;
+
+struct xfer_table xfers;    // Uploads being sent and received
+struct io_pool io_pool;     // Threads doing the transfers' disk I/O
+struct io_req *io_req;
+struct swarm_table swarms;  // Downloads from several hosts, and the tracker
+
+if (io_pool_init(&io_pool) == 0) {
+	printf("Host %d: no I/O threads, file I/O runs inline\n", host_id);
+}
+timer_wheel_init(&timers, time_now_usec());
+xfer_table_init(&xfers, &io_pool, &timers);
+swarm_table_init(&swarms, host_id);
+xfers.swarm = &swarms;
 
-struct file_buf f_buf_upload;  
-struct file_buf f_buf_download; 
+/*
+ * NET367_LOSS=<percent> makes the host drop that share of the
+ * packets it receives, to test the transfers under loss
+ */
+loss_pct = getenv("NET367_LOSS") != NULL ? atoi(getenv("NET367_LOSS")) : 0;
+srand(host_id + 1);
+signal(SIGUSR1, request_job_stats);
 
-file_buf_init(&f_buf_upload);
-file_buf_init(&f_buf_download);
+/*
+ * NET367_CC=delay makes the host's uploads back off as queues build
+ * up, rather than only once packets are lost
+ */
+if (getenv("NET367_CC") != NULL && strcmp(getenv("NET367_CC"), "delay") == 0) {
+	xfers.cc = XFER_CC_DELAY;
+}
 
 /*
  * Initialize pipes 
@@ -131,6 +177,17 @@ for (k = 0; k < node_port_num; k++) {
 
 /* Initialize the job queue */
 job_q_init(&job_q);
+init_dns_table(&naming_table);
+ping_table_init(&pings, host_id, man_port->send_fd, node_port, node_port_num,
+	&timers);
+trace_table_init(&traces, host_id, man_port->send_fd, node_port,
+	node_port_num, &timers);
+dns_cache_init(&dns_cache, host_id, man_port->send_fd, node_port,
+	node_port_num, &timers);
+
+for (i = 0; i < MCAST_MAX_GROUPS; i++) {
+   mcast_joined[i] = 0;
+}
 
 while(1) {
 	/* Execute command from manager, if any */
@@ -157,34 +214,72 @@ while(1) {
 				break;
 
 			case 'p': // Sending ping request
-				// Create new ping request packet
+				/* The reply or time out is reported (see ping.c) */
 				sscanf(man_msg, "%d", &dst);
-				new_packet = (struct packet *) 
-						malloc(sizeof(struct packet));	
-				new_packet->src =  (char)host_id;
-				new_packet->dst =  (char)dst;
-				new_packet->type = (char) PKT_PING_REQ;
-				new_packet->length = 0;
-				new_job = (struct host_job *) 
-						malloc(sizeof(struct host_job));
-				new_job->packet = new_packet;
-				new_job->type = JOB_SEND_PKT_ALL_PORTS;
-				job_q_add(&job_q, new_job);
+				if (!ping_send(&pings, dst)) {
+					n = sprintf(man_reply_msg,
+						"Ping not sent: too many outstanding");
+					write(man_port->send_fd, man_reply_msg, n+1);
+				}
+				break;
+
+			case 'f': /* Flood a host with pings, report the RTTs */
+				count = 0;
+				seconds = 0;
+				rate = 0;
+				sscanf(man_msg, "%d %d %lf %d", &dst, &count, &seconds,
+					&rate);
+				if (!ping_flood_start(&pings, dst, count, seconds,
+						rate)) {
+					n = sprintf(man_reply_msg, "Flood not started: "
+						"one is running, or no count or time given");
+					write(man_port->send_fd, man_reply_msg, n+1);
+				}
+				break;
+
+			case 'e': /* Trace the path to a host */
+				/* The path or time out is reported (see trace.c) */
+				sscanf(man_msg, "%d", &dst);
+				if (!trace_send(&traces, dst)) {
+					n = sprintf(man_reply_msg,
+						"Trace not sent: one is running");
+					write(man_port->send_fd, man_reply_msg, n+1);
+				}
+				break;
 
-				new_job2 = (struct host_job *) 
+			case 't': /* Send a host synthetic data, report the throughput */
+				bytes = 0;
+				seconds = 0;
+				sscanf(man_msg, "%d %lld %lf", &dst, &bytes, &seconds);
+				if (bytes <= 0 && seconds <= 0) {
+					printf("Throughput test needs a byte count or a time\n");
+					break;
+				}
+				new_job = (struct host_job *)
 						malloc(sizeof(struct host_job));
-				ping_reply_received = 0;
-				new_job2->type = JOB_PING_WAIT_FOR_REPLY;
-				new_job2->ping_timer = 10;
-				job_q_add(&job_q, new_job2);
+				new_job->type = JOB_FILE_UPLOAD_SEND;
+				new_job->file_upload_dst = dst;
+				new_job->file_upload_opts = XFER_OPT_TEST;
+				new_job->file_upload_length = bytes;
+				new_job->file_upload_seconds = seconds;
+				job_q_add(&job_q, new_job);
 				break;
 
 			case 'u': /* Upload a file to a host */
+			case 'z': /* Upload a file to a host using splice() */
+			case 'k': /* Upload a file to a host compressed */
+			case 'y': /* Upload the changes to a file to a host */
+			case 'x': /* Upload the chunks a host does not store */
 				sscanf(man_msg, "%d %s", &dst, name);
 				new_job = (struct host_job *) 
 						malloc(sizeof(struct host_job));
 				new_job->type = (char)JOB_FILE_UPLOAD_SEND;
 				new_job->file_upload_dst = dst;	
+				new_job->file_upload_opts =
+					man_cmd == 'z' ? XFER_OPT_SPLICE
+					: man_cmd == 'k' ? XFER_OPT_COMPRESS
+					: man_cmd == 'y' ? XFER_OPT_DELTA
+					: man_cmd == 'x' ? XFER_OPT_DEDUP : 0;
 				for (i=0; name[i] != '\0'; i++) {
 					new_job->fname_upload[i] = name[i];
 				}
@@ -192,17 +287,36 @@ while(1) {
 				job_q_add(&job_q, new_job);
             break;
 
-			case 'd': /* Donwload a file to a host */
-            sscanf(man_msg, "%d %s", &dst, name);
+			case 'd': /* Download a file from a host */
+            sscanf(man_msg, "%d %d %s", &dst, &k, name);
             new_job = (struct host_job *) malloc(sizeof(struct host_job));
             new_job->type = JOB_FILE_DOWNLOAD_SEND;
             new_job->file_download_dst = dst;
+            new_job->file_download_depth = k;
             for (i=0; name[i] != '\0'; i++) {
                new_job->fname_download[i] = name[i];
             }
             new_job->fname_download[i] = '\0';
             job_q_add(&job_q, new_job);
             break;
+         case 'w': /* Download a file from every host that has it */
+            sscanf(man_msg, "%s", name);
+            if (dir_valid != 1) {
+               printf("No valid directory to download to\n");
+            } else if (!swarm_start(&swarms, dir, name)) {
+               printf("Download of %s already running, or too many\n",
+                     name);
+            }
+            break;
+
+         case 'a': /* Tell the tracker this host has a file */
+            sscanf(man_msg, "%s", name);
+            if (dir_valid != 1 || !swarm_announce(&swarms, dir, name,
+                  node_port, node_port_num)) {
+               printf("File was not found\n");
+            }
+            break;
+
          case 'r': /* Register a Domain Name For a Host */
             sscanf(man_msg, "%s", domain_name);
             printf("Register command received for %s via manager\n", domain_name);
@@ -230,17 +344,23 @@ while(1) {
          case 'n': /* Ping a Host by Domain Name */
             sscanf(man_msg, "%s", domain_name);
             printf("Ping by name command received for %s via manager\n", domain_name);
-            new_packet = (struct packet*)
+            // Answered from the cache, or else by the DNS server
+            dns_cache_resolve(&dns_cache, domain_name);
+            break;
+
+         case 'j': /* Join a multicast group */
+         case 'l': /* Leave a multicast group */
+            sscanf(man_msg, "%d", &group);
+            if (group < 0 || group >= MCAST_MAX_GROUPS) break;
+            if ((man_cmd == 'j') == mcast_joined[group]) break;
+            mcast_joined[group] = (man_cmd == 'j');
+            new_packet = (struct packet *)
                malloc(sizeof(struct packet));
             new_packet->src = (char)host_id;
-            new_packet->dst = (char)DNS_SERVER_PHYS_ID;
-            new_packet->type = (char) PKT_PING_DOMAIN;
-            for (i = 0; domain_name[i] != '\0'; i++) {
-               new_packet->payload[i] = domain_name[i];
-            }
-            new_packet->payload[i] = '\0';
-            new_packet->length = i;
-            printf("Verify that payload contains domain name %s\n", new_packet->payload);
+            new_packet->dst = (char)MCAST_ADDR(group);
+            new_packet->type = (man_cmd == 'j') ?
+               (char) PKT_MCAST_JOIN : (char) PKT_MCAST_LEAVE;
+            new_packet->length = 0;
             new_job = (struct host_job *)malloc(sizeof(struct host_job));
             new_job->packet = new_packet;
             new_job->type = JOB_SEND_PKT_ALL_PORTS;
@@ -258,11 +378,23 @@ while(1) {
  	 */
 
 	for (k = 0; k < node_port_num; k++) { /* Scan all ports */
+	   /* Read everything waiting on the port, up to a burst limit */
+	   for (burst = 0; burst < HOST_RECV_BURST; burst++) {
 
 		in_packet = (struct packet *) malloc(sizeof(struct packet));
 		n = packet_recv(node_port[k], in_packet);
+		if (n <= 0) {
+			free(in_packet);
+			break;
+		}
+		if (loss_pct > 0 && rand() % 100 < loss_pct) {
+			free(in_packet);
+			continue;
+		}
 
-		if ((n > 0) && ((int) in_packet->dst == host_id)) {
+		if (((int) in_packet->dst == host_id
+            || (IS_MCAST_ADDR((int) in_packet->dst)
+               && mcast_joined[MCAST_GROUP((int) in_packet->dst)]))) {
 			new_job = (struct host_job *) 
 				malloc(sizeof(struct host_job));
 			new_job->in_port_index = k;
@@ -281,7 +413,92 @@ while(1) {
 					break;
 
 				case (char) PKT_PING_REPLY:
-					ping_reply_received = 1;
+					ping_reply(&pings, in_packet);
+					free(in_packet);
+					free(new_job);
+					break;
+
+				case (char) PKT_TRACE_REQ:
+					trace_request(&traces, in_packet, k);
+					free(in_packet);
+					free(new_job);
+					break;
+
+				case (char) PKT_TRACE_REPLY:
+					trace_reply(&traces, in_packet, k);
+					free(in_packet);
+					free(new_job);
+					break;
+
+				case (char) PKT_FILE_ACK:
+					xfer_send_ack(&xfers, in_packet);
+					free(in_packet);
+					free(new_job);
+					break;
+
+				/*
+				 * A host sending us a delta wants the
+				 * signature of our copy, and a host
+				 * sending us chunks wants to know which
+				 * we lack.  Either is sent back as an
+				 * upload of its own
+				 */
+				case (char) PKT_FILE_SIG_REQ:
+				case (char) PKT_FILE_WANT_REQ:
+					n = in_packet->length;
+					if (n >= MAX_FILE_NAME) n = MAX_FILE_NAME - 1;
+					memcpy(new_job->fname_upload,
+						in_packet->payload, n);
+					new_job->fname_upload[n] = '\0';
+					if (xfer_sig_pending(&xfers, in_packet->src,
+							new_job->fname_upload)) {
+						/* Already on its way */
+						free(new_job);
+					} else {
+						new_job->type = JOB_FILE_UPLOAD_SEND;
+						new_job->file_upload_dst =
+							in_packet->src;
+						new_job->file_upload_opts =
+							in_packet->type ==
+							(char) PKT_FILE_SIG_REQ ?
+							XFER_OPT_SIG : XFER_OPT_WANT;
+						job_q_add(&job_q, new_job);
+					}
+					free(in_packet);
+					break;
+
+				/*
+				 * A host downloading from several hosts
+				 * wants a range of the file, sent as an
+				 * upload of its own
+				 */
+				case (char) PKT_FILE_RANGE_REQ:
+					if (!swarm_range_request(in_packet,
+							new_job->fname_upload,
+							&new_job->file_upload_offset,
+							&new_job->file_upload_length)
+						|| xfer_range_pending(&xfers,
+							in_packet->src,
+							new_job->fname_upload,
+							new_job->file_upload_offset)) {
+						free(new_job);
+					} else {
+						new_job->type = JOB_FILE_UPLOAD_SEND;
+						new_job->file_upload_dst =
+							in_packet->src;
+						new_job->file_upload_opts =
+							XFER_OPT_RANGE;
+						job_q_add(&job_q, new_job);
+					}
+					free(in_packet);
+					break;
+
+				case (char) PKT_TRACKER_ANNOUNCE:
+				case (char) PKT_TRACKER_QUERY:
+				case (char) PKT_TRACKER_REPLY:
+				case (char) PKT_FILE_DOWNLOAD_RECV:
+					swarm_packet(&swarms, in_packet, node_port,
+						node_port_num);
 					free(in_packet);
 					free(new_job);
 					break;
@@ -314,7 +531,6 @@ while(1) {
 					job_q_add(&job_q, new_job);
 					break;
             case (char) PKT_FILE_DOWNLOAD_SEND:
-               
                new_job->type = JOB_FILE_DOWNLOAD_RECV;
                job_q_add(&job_q, new_job);
 				   break;
@@ -332,8 +548,16 @@ while(1) {
                break;
             
             case (char) PKT_REPLY_DOMAIN: 
-               new_job->type = JOB_REPLY_PHYS_ID;
-               job_q_add(&job_q, new_job);
+               dns_cache_answer(&dns_cache, in_packet);
+               free(in_packet);
+               free(new_job);
+               break;
+
+            case (char) PKT_DNS_INVALIDATE:
+               dns_cache_invalidate(&dns_cache, in_packet);
+               free(in_packet);
+               free(new_job);
+               break;
 
             default:
 					free(in_packet);
@@ -343,18 +567,28 @@ while(1) {
 		else {
 			free(in_packet);
 		}
+	   }
 	}
 
-	/*
- 	 * Execute one job in the job queue
- 	 */
+	/* Completed disk reads and writes become jobs too */
+	while ((io_req = io_poll(&io_pool)) != NULL) {
+		new_job = (struct host_job *) malloc(sizeof(struct host_job));
+		new_job->type = JOB_IO_DONE;
+		new_job->io_req = io_req;
+		job_q_add(&job_q, new_job);
+	}
 
-	
-      if (job_q_num(&job_q) > 0) {
-        
+	/* Timers that are due run now, and may queue jobs */
+	timer_wheel_advance(&timers, time_now_usec());
 
-		/* Get a new job from the job queue */
-		new_job = job_q_remove(&job_q);
+	/*
+ 	 * Execute the jobs that are in the job queue now, most urgent 
+ 	 * class first.  Jobs added while they run, including jobs that 
+ 	 * put themselves back, wait for the next pass of the loop, 
+ 	 * except control jobs such as ping replies (see host_util.c).
+ 	 */
+	job_q_start_pass(&job_q);
+	while ((new_job = job_q_remove(&job_q)) != NULL) {
 
       //if (host_id == 0)display_host_job_info(new_job, host_id);
 
@@ -380,7 +614,11 @@ while(1) {
 			new_packet->dst = new_job->packet->src;
 			new_packet->src =  host_id;
 			new_packet->type = PKT_PING_REPLY;
-			new_packet->length = 0;
+
+			/* The identifier and sequence number go back as they came */
+			new_packet->length = new_job->packet->length;
+			memcpy(new_packet->payload, new_job->packet->payload,
+				new_packet->length);
 
 			/* Create job for the ping reply */
 			new_job2 = (struct host_job *)
@@ -396,277 +634,165 @@ while(1) {
 			free(new_job);
 			break;
 
-		case JOB_PING_WAIT_FOR_REPLY:
-			/* Wait for a ping reply packet */
-			if (ping_reply_received == 1) {
-				n = sprintf(man_reply_msg, "Ping acked!"); 
-				man_reply_msg[n] = '\0';
-				write(man_port->send_fd, man_reply_msg, n+1);
-				free(new_job);
-			}
-			else if (new_job->ping_timer > 1) {
-				new_job->ping_timer--;
-				job_q_add(&job_q, new_job);
-			}
-			else { /* Time out */
-				n = sprintf(man_reply_msg, "Ping time out!"); 
-				man_reply_msg[n] = '\0';
-				write(man_port->send_fd, man_reply_msg, n+1);
-				free(new_job);
-			}
-
-			break;	
-
-
+      /* Pull a file from a host, ranges at a time (see swarm.c) */
       case JOB_FILE_DOWNLOAD_SEND:
-            if (dir_valid == 1) {
-            new_packet = (struct packet *) malloc(sizeof(struct packet));
-            new_packet->src = (char)host_id;
-            new_packet->dst = new_job->file_download_dst;
-            new_packet->type = PKT_FILE_DOWNLOAD_SEND;
-            for(i=0; new_job->fname_upload[i] != '\0'; i++) {
-               new_packet->payload[i] = new_job->fname_upload[i];
-            }
-            new_packet->length = i;
-            new_packet->payload[i] = '\0';
-
-            // Create a new job to send the packet to the job queue
-            new_job2 = (struct host_job *) malloc(sizeof(struct host_job));
-            new_job2->type = JOB_SEND_PKT_ALL_PORTS;
-            new_job2->packet = new_packet;
-            job_q_add(&job_q, new_job2);
+            if (dir_valid != 1) {
+               printf("No valid directory to download to\n");
+            } else if (!swarm_fetch(&swarms, dir,
+                  new_job->fname_download,
+                  new_job->file_download_dst,
+                  new_job->file_download_depth)) {
+               printf("Download of %s already running, or too many\n",
+                     new_job->fname_download);
             }
             free(new_job);
             break;
 
+      /* A host wants to pull a file; tell it the size */
       case JOB_FILE_DOWNLOAD_RECV:
-            
-            
-            new_job2 = (struct host_job *) malloc(sizeof(struct host_job));
-            new_job2->type = JOB_FILE_UPLOAD_SEND;
-            strcpy(new_job2->fname_upload, new_job->packet->payload);
-            new_job2->fname_upload[i] = '\0';
-            new_job2->file_upload_dst = new_job->packet->src;
-            job_q_add(&job_q, new_job2);
-            printf("\n\ndownload recv\n\n");
+            if (dir_valid == 1) {
+               swarm_describe(&swarms, dir, new_job->packet, node_port,
+                     node_port_num);
+            }
+            free(new_job->packet);
+            free(new_job);
             break;
 
          /* The next three jobs deal with uploading a file */
 case JOB_FILE_UPLOAD_SEND:
 
-			/* Open file */
-			if (dir_valid == 1) {
-				n = sprintf(name, "../%s/%s",  dir, new_job->fname_upload);
-				name[n] = '\0';
-            printf("debug: name = %s\n", name);
-            fp = fopen(name, "r");
-				if (fp != NULL) {
-
-				        /* 
-					 * Create first packet which
-					 * has the file name 
-					 */
-					new_packet = (struct packet *) 
-						malloc(sizeof(struct packet));
-					new_packet->dst 
-						=(char)new_job->file_upload_dst;
-					new_packet->src = (char)host_id;
-					new_packet->type 
-						= (char)PKT_FILE_UPLOAD_START;
-					for (i=0; 
-						new_job->fname_upload[i]!= '\0'; 
-						i++) {
-						new_packet->payload[i] = 
-							new_job->fname_upload[i];
-					}
-					new_packet->length = i;
-
-					/* 
-					 * Create a job to send the packet
-					 * and put it in the job queue
-					 */
-					new_job2 = (struct host_job *)
-						malloc(sizeof(struct host_job));
-					new_job2->type = JOB_SEND_PKT_ALL_PORTS;
-					new_job2->packet = new_packet;
-					job_q_add(&job_q, new_job2);
-
-					/* 
-					 * Create the second packet which
-					 * has the file contents
-					 */
-					
-
-               int maxFileBuff = MAX_FILE_BUFFER;
-               while ((n  = fread(string,sizeof(char),PKT_PAYLOAD_MAX, fp)) > 0 && maxFileBuff > 0) {
-               
-               maxFileBuff -= PKT_PAYLOAD_MAX;
-
-               new_packet = (struct packet *) 
-						malloc(sizeof(struct packet));
-					new_packet->dst 
-						= (char)new_job->file_upload_dst;
-					new_packet->src =  (char)host_id;
-					new_packet->type = (char)PKT_FILE_UPLOAD_CONT;
-
-
-					string[n] = '\0';
-
-					for (i=0; i<n; i++) {
-						new_packet->payload[i] 
-							= string[i];
-					}
-
-					new_packet->length = n;
-
-					/*
-					 * Create a job to send the packet
-					 * and put the job in the job queue
-					 */
-
-					new_job2 = (struct host_job *)
-						malloc(sizeof(struct host_job));
-					new_job2->type 
-						= JOB_SEND_PKT_ALL_PORTS;
-					new_job2->packet = new_packet;
-					job_q_add(&job_q, new_job2);
-
-               
-               }
-               
-               fclose(fp);
-               // add test end job and packet
-               
-               new_packet = (struct packet *) malloc(sizeof(struct packet));
-               new_packet->src = (char)host_id;
-               new_packet->dst = (char)new_job->file_upload_dst;
-               new_packet->type = (char)PKT_FILE_UPLOAD_END;
-               new_packet->length = 0;
-               strcpy(new_packet->payload, "No Data");
-
-               new_job2 = (struct host_job *) malloc(sizeof(struct host_job));
-               new_job2->type = JOB_SEND_PKT_ALL_PORTS;
-               new_job2->packet = new_packet;
-               job_q_add(&job_q, new_job2);
+			if (dir_valid != 1
+					&& !(new_job->file_upload_opts & XFER_OPT_TEST)) {
+				free(new_job);
+			}
+			else if (xfer_send_count(&xfers) >= XFER_MAX_SESSIONS) {
+				/* Wait for one of the uploads to finish */
+				job_q_add(&job_q, new_job);
+			}
+			else if ((new_job->xfer =
+					new_job->file_upload_opts & XFER_OPT_TEST
+					? xfer_send_test(&xfers,
+						new_job->file_upload_dst,
+						new_job->file_upload_length,
+						new_job->file_upload_seconds)
+					: xfer_send_open(&xfers, dir,
+						new_job->fname_upload,
+						new_job->file_upload_dst,
+						new_job->file_upload_opts)) != NULL) {
+				if ((new_job->file_upload_opts & XFER_OPT_RANGE)
+					&& !xfer_send_range(new_job->xfer,
+						new_job->file_upload_offset,
+						new_job->file_upload_length)) {
+					printf("Range of %s is not in the file\n",
+						new_job->fname_upload);
+					xfer_send_close(&xfers, new_job->xfer);
 					free(new_job);
+					break;
 				}
-				else {  
-					/* Didn't open file */
-               printf("File was not found\n");
-				}
+				/* 
+				 * Each upload is driven by its own
+				 * JOB_FILE_UPLOAD_SEND_CONT job which runs
+				 * once per pass until the transfer ends
+				 */
+				new_job->type = JOB_FILE_UPLOAD_SEND_CONT;
+				job_q_add(&job_q, new_job);
+			}
+			else if (new_job->file_upload_opts & XFER_OPT_WANT) {
+				/* No manifest yet; the sender asks again */
+				free(new_job);
+			}
+			else {  
+				/* Didn't open file */
+            printf("File was not found\n");
+            free(new_job);
 			}
 			break;
 
-case JOB_FILE_UPLOAD_RECV_START:
-
-			/* Initialize the file buffer data structure */
-			file_buf_init(&f_buf_upload);
-
-			/* 
-			 * Transfer the file name in the packet payload
-			 * to the file buffer data structure
-			 */
-			file_buf_put_name(&f_buf_upload, 
-				new_job->packet->payload, 
-				new_job->packet->length);
+      case JOB_FILE_UPLOAD_SEND_CONT:
 
-			free(new_job->packet);
-			free(new_job);
-			break;
+         /*
+          * Resend lost packets and send new ones while the window
+          * has room.  Only the window is held in memory, however
+          * large the file.
+          */
+         if (xfer_send_pump(new_job->xfer, host_id, node_port,
+               node_port_num)) {
+            xfer_send_close(&xfers, new_job->xfer);
+            free(new_job);
+         }
+         else {
+            job_q_add(&job_q, new_job);
+         }
+         break;
 
+      case JOB_FILE_UPLOAD_RECV_START:
 		case JOB_FILE_UPLOAD_RECV_CONT:
+      case JOB_FILE_UPLOAD_RECV_END:
 
 			/* 
-			 * Download packet payload into file buffer 
-			 * data structure 
+			 * Find the packet's session, put it in order,
+			 * write what can be written, and acknowledge it
 			 */
-			file_buf_add(&f_buf_upload, 
-				new_job->packet->payload,
-				new_job->packet->length);
+			xfer_recv_packet(&xfers, new_job->packet, dir, dir_valid,
+				host_id, node_port, node_port_num);
 
 			free(new_job->packet);
 			free(new_job);
-         break;
-
-      case JOB_FILE_UPLOAD_RECV_END:
-
-			if (dir_valid == 1) {
-
-				/* 
-				 * Get file name from the file buffer 
-				 * Then open the file
-				 */
-				file_buf_get_name(&f_buf_upload, string);
-				n = sprintf(name, "../%s/%s", dir, string);
-            printf("debug: name = %s\n", name);
-				name[n] = '\0';
-				fp = fopen(name, "w");
-            printf("debug: file opened\n");
-
-				if (fp != NULL) {
-					/* 
-					 * Write contents in the file
-					 * buffer into file
-					 */
-
-               while (f_buf_upload.occ > 0) {
-						n = file_buf_remove(
-							&f_buf_upload, 
-							string,
-							PKT_PAYLOAD_MAX);
-						string[n] = '\0';
-						n = fwrite(string,
-							sizeof(char),
-							n, 
-							fp);
-					}
-
-					fclose(fp);
-				}
-            else {
-               printf("No valid directory to receieve upload\n");
-            }
-			}
-
 			break;
       /* DNS JOBS */
       case JOB_REGISTER_DOMAIN_NAME:
+         n = new_job->packet->length;
+         if (n < 0 || n >= PKT_PAYLOAD_MAX) n = PKT_PAYLOAD_MAX - 1;
+         new_job->packet->payload[n] = '\0';  // Terminating char at end of payload
          printf("Starting job to register %s as id %d\n", new_job->packet->payload, new_job->packet->src);
-         i = 0;
-         // Search valid entries and check if the physical id is already in the tablei
-         while(naming_table[i].valid != 0) {
-            if (new_job->packet->src == naming_table[i].physical_id) { // src = host_id registering node
-               i++;
-               break;   // If so break
+         // A name registered again moves to the host registering it
+         domain_id = dns_register(&naming_table, new_job->packet->payload,
+               new_job->packet->src);
+         if (domain_id >= 0) {
+            printf("Moved %s from %d to %d, %d names registered\n",
+                  new_job->packet->payload, domain_id, new_job->packet->src,
+                  naming_table.count);
+         } else {
+            printf("Registered %s as %d, %d names registered\n",
+                  new_job->packet->payload, new_job->packet->src,
+                  naming_table.count);
+         }
+         /*
+          * Hosts that looked up names may have cached the old answer,
+          * or that the name was not registered, so tell them to drop it
+          */
+         if (domain_id != new_job->packet->src) {
+            for (i = 0; i < DNS_MAX_HOSTS; i++) {
+               if (!naming_table.clients[i]) continue;
+               new_packet = (struct packet*)
+                  malloc(sizeof(struct packet));
+               new_packet->src = (char) host_id;
+               new_packet->dst = (char) i;
+               new_packet->type = (char) PKT_DNS_INVALIDATE;
+               strcpy(new_packet->payload, new_job->packet->payload);
+               new_packet->length = strlen(new_packet->payload);
+               new_job2 = (struct host_job*)
+                  malloc(sizeof(struct host_job));
+               new_job2->type = JOB_SEND_PKT_ALL_PORTS;
+               new_job2->packet = new_packet;
+               job_q_add(&job_q, new_job2);
             }
-            i++;
          }
-         // Else add the domain name to the table
-         memset(naming_table[i].domain_name, 0, 50);    // Clear any trash from the domain name attribute
-         new_job->packet->payload[new_job->packet->length] = '\0';  // Terminating char at end of payload
-         strcpy(naming_table[i].domain_name, new_job->packet->payload); // Add payload w/ '\0' to the table
-         naming_table[i].valid = 1;
-         naming_table[i].physical_id = new_job->packet->src;
-         // debug
-         printf("Registered %s as %d at naming_table[%d]\n", 
-               naming_table[i].domain_name, naming_table[i].physical_id, i);
-         print_dns_table(naming_table);
+         free(new_job->packet);
+         free(new_job);
          break;
 
       case JOB_REQ_PHYS_ID:
-         domain_id = -1;
-         i = 0;
-         int found = 0;
-         n = 0;
+         n = new_job->packet->length;
+         if (n < 0 || n >= PKT_PAYLOAD_MAX) n = PKT_PAYLOAD_MAX - 1;
+         new_job->packet->payload[n] = '\0';
          //debug
          printf("DNS server has received id request\n");
-         while (naming_table[i].valid != 0) { 
-           if (strcmp(naming_table[i].domain_name, new_job->packet->payload) == 0) {
-              domain_id = naming_table[i].physical_id;
-              found = 1;
-              break;
-           }
-           i++;
+         domain_id = dns_lookup(&naming_table, new_job->packet->payload);
+         int found = domain_id >= 0;
+         // The host caches the answer, so it is told when the name changes
+         if ((unsigned char)new_job->packet->src < DNS_MAX_HOSTS) {
+            naming_table.clients[(unsigned char)new_job->packet->src] = 1;
          }
          // Create a new job request packet for a reply
          // This is from the naming table to whatever node made the initial request
@@ -677,12 +803,16 @@ case JOB_FILE_UPLOAD_RECV_START:
          new_packet->type = (char)PKT_REPLY_DOMAIN;
          if (found == 1) {
             printf("Found the id %d in the naming_table\n", domain_id);
-            n = sprintf(new_packet->payload, "%d", domain_id);
+            // The id, how long it may be cached (ms) and the name
+            n = sprintf(new_packet->payload, "%d %d %.*s", domain_id, DNS_TTL,
+                  MAX_NAME_LENGTH - 1, new_job->packet->payload);
             new_packet->payload[n] = '\0';
          }
          else {
-            printf("No id %d exists in the naming table\n", domain_id);
-            n = sprintf(new_packet->payload, "%d", -1);
+            printf("%s is not in the naming table\n",
+                  new_job->packet->payload);
+            n = sprintf(new_packet->payload, "%d %d %.*s", -1, DNS_NEG_TTL,
+                  MAX_NAME_LENGTH - 1, new_job->packet->payload);
             new_packet->payload[n] = '\0';
          }
          // debug
@@ -699,20 +829,43 @@ case JOB_FILE_UPLOAD_RECV_START:
          free(new_job);
          break;
       
-      case JOB_REPLY_PHYS_ID:
-         n = sprintf(man_reply_msg, "%s", new_job->packet->payload);   // receive domain_id
-         man_reply_msg[n] = '\0';
-         write(man_port->send_fd, man_reply_msg, n);
+      case JOB_IO_DONE:
+         xfer_io_done(&xfers, new_job->io_req);
          free(new_job);
          break;
+
      
       }
 
 	}
 	
 
-	/* The host goes to sleep for 10 ms */
-	usleep(TENMILLISEC);
+	/* Ask for more ranges of the swarm downloads */
+	swarm_pump(&swarms, node_port, node_port_num);
+
+	/* Ask the senders of group uploads for the packets lost */
+	xfer_recv_pump(&xfers, host_id, node_port, node_port_num);
+
+	if (g_show_job_stats) {
+		g_show_job_stats = 0;
+		display_job_stats(&job_q, host_id);
+		display_ping_stats(&pings);
+		display_dns_cache_stats(&dns_cache);
+		printf("Host %d timers: %d pending, %lld fired, %lld cancelled\n",
+			host_id, timers.count, timers.fired, timers.cancelled);
+		if (host_id == DNS_SERVER_PHYS_ID) {
+			print_dns_table(&naming_table);
+		}
+	}
+
+	/* The host sleeps for 10 ms, or until the next timer is due */
+	now = time_now_usec();
+	next_timer = timer_wheel_next(&timers);
+	if (next_timer < 0 || next_timer - now > TENMILLISEC) {
+		usleep(TENMILLISEC);
+	} else if (next_timer > now) {
+		usleep(next_timer - now);
+	}
 
 } /* End of while loop */
 
@@ -4,38 +4,37 @@
 
 #include <stdio.h>
 
-#define MAX_FILE_BUFFER 1000
 #define MAX_MSG_LENGTH 100
 #define MAX_DIR_NAME 100
 #define MAX_FILE_NAME 100
 #define PKT_PAYLOAD_MAX 100
 #define TENMILLISEC 10000   /* 10 millisecond sleep */
-
-struct file_buf {
-   char name[MAX_FILE_NAME];
-   int name_length;
-   char buffer[MAX_FILE_BUFFER+1];
-   int head;
-   int tail;
-   int occ;
-   FILE *fd;
-};
+#define FILE_WRITE_BUFFER 65536  /* stdio buffer for files being received */
+#define HOST_RECV_BURST 64  /* Packets read from a port per pass of the loop */
+#define JOB_AGE_LIMIT 30000 /* A job waiting this long goes ahead of higher classes (30 ms) */
 
 
 enum host_job_type {
 	JOB_SEND_PKT_ALL_PORTS,
-	JOB_PING_SEND_REQ,	
 	JOB_PING_SEND_REPLY,
-	JOB_PING_WAIT_FOR_REPLY,
 	JOB_FILE_DOWNLOAD_SEND,
    JOB_FILE_DOWNLOAD_RECV,
    JOB_FILE_UPLOAD_SEND,
+   JOB_FILE_UPLOAD_SEND_CONT,
 	JOB_FILE_UPLOAD_RECV_START,
 	JOB_FILE_UPLOAD_RECV_CONT,
    JOB_FILE_UPLOAD_RECV_END,
    JOB_REGISTER_DOMAIN_NAME,
    JOB_REQ_PHYS_ID,
-   JOB_REPLY_PHYS_ID,
+   JOB_IO_DONE,
+};
+
+/* Scheduling classes of jobs, most urgent first */
+enum job_class {
+   JOB_CLASS_CONTROL,       /* Pings and DNS packets, run in the pass they are queued */
+   JOB_CLASS_INTERACTIVE,   /* Commands from the manager and their timers */
+   JOB_CLASS_BULK,          /* Transfer packets, windows and disk I/O */
+   JOB_CLASSES
 };
 
 struct host_job {
@@ -45,16 +44,38 @@ struct host_job {
 	int out_port_index;
 	char fname_download[100];
 	char fname_upload[100];
-	int ping_timer;
 	int file_upload_dst;
 	int file_download_dst;
+   int file_download_depth;  /* Ranges to keep asked for, 0 for the default */
+   int file_upload_opts;     /* XFER_OPT_ bits of the upload */
+   long long file_upload_offset;   /* Range to upload, with XFER_OPT_RANGE */
+   long long file_upload_length;
+   double file_upload_seconds;     /* Length of a test, with XFER_OPT_TEST */
+   struct xfer_send *xfer;   /* Session of an upload in progress */
+   struct io_req *io_req;    /* Completed disk I/O request */
+   enum job_class job_class;
+   long long queued_time;    /* When it was added to the job queue */
    struct host_job *next;
 };
 
+/* One class of the job queue, first in first out */
+struct job_level {
+   struct host_job *head;
+   struct host_job *tail;
+   int occ;
+   int ready;               /* Jobs queued before this pass, still to run in it */
+
+   /* Statistics */
+   int max_occ;
+   long long added;
+   long long run;
+   long long aged;          /* Run ahead of a higher class after JOB_AGE_LIMIT */
+   long long wait_total;    /* Microseconds between queueing and running */
+   long long wait_max;
+};
 
 struct job_queue {
-	struct host_job *head;
-	struct host_job *tail;
+   struct job_level level[JOB_CLASSES];
 	int occ;
 };
 
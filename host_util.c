@@ -3,6 +3,14 @@
 @file host_util.c
 
 @brief This file contains implementations of functions related to the host and its operations.
+
+The job queue has one first-in first-out level per job class (enum
+job_class).  Each pass of the host loop runs the jobs queued before it
+started, control jobs first, then interactive, then bulk, so a ping reply
+does not wait behind the packets of a transfer.  Control jobs queued
+during the pass run in it too; the other classes' wait for the next pass,
+since some of them put themselves back every pass.  A job that has waited
+JOB_AGE_LIMIT goes ahead of the higher classes, so none of them starves.
 */
 
 #include <fcntl.h>
@@ -18,8 +26,12 @@
 #include "net.h"
 #include "packet.h"
 #include "switch.h"
+#include "time_util.h"
 #include "host_util.h"
 
+static const char *job_class_name[JOB_CLASSES] = {"control", "interactive",
+                                                  "bulk"};
+
 /**
 
 @brief Display the job information for a given host job and host ID.
@@ -33,15 +45,9 @@ void display_host_job_info(struct host_job *job, int hostid) {
     case JOB_SEND_PKT_ALL_PORTS:
       job_type_str = "JOB_SEND_PKT_ALL_PORTS";
       break;
-    case JOB_PING_SEND_REQ:
-      job_type_str = "JOB_PING_SEND_REQ";
-      break;
     case JOB_PING_SEND_REPLY:
       job_type_str = "JOB_PING_SEND_REPLY";
       break;
-    case JOB_PING_WAIT_FOR_REPLY:
-      job_type_str = "JOB_PING_WAIT_FOR_REPLY";
-      break;
     case JOB_FILE_DOWNLOAD_SEND:
       job_type_str = "JOB_FILE_DOWNLOAD_SEND";
       break;
@@ -51,6 +57,9 @@ void display_host_job_info(struct host_job *job, int hostid) {
     case JOB_FILE_UPLOAD_SEND:
       job_type_str = "JOB_FILE_UPLOAD_SEND";
       break;
+    case JOB_FILE_UPLOAD_SEND_CONT:
+      job_type_str = "JOB_FILE_UPLOAD_SEND_CONT";
+      break;
     case JOB_FILE_UPLOAD_RECV_START:
       job_type_str = "JOB_FILE_UPLOAD_RECV_START";
       break;
@@ -60,6 +69,9 @@ void display_host_job_info(struct host_job *job, int hostid) {
     case JOB_FILE_UPLOAD_RECV_END:
       job_type_str = "JOB_FILE_UPLOAD_RECV_END";
       break;
+    case JOB_IO_DONE:
+      job_type_str = "JOB_IO_DONE";
+      break;
     default:
       job_type_str = "Unknown Job Type";
   }
@@ -70,7 +82,6 @@ void display_host_job_info(struct host_job *job, int hostid) {
   printf("Output Port Index: %d\n", job->out_port_index);
   printf("Download Filename: %s\n", job->fname_download);
   printf("Upload Filename: %s\n", job->fname_upload);
-  printf("Ping Timer: %d\n", job->ping_timer);
   printf("File Upload Destination: %d\n", job->file_upload_dst);
   printf("File Download Destination: %d\n", job->file_download_dst);
   printf("Next Job: %p\n", job->next);  // assuming next is a pointer
@@ -80,91 +91,6 @@ void display_host_job_info(struct host_job *job, int hostid) {
 
 /**
 
-@brief Initialize the file buffer data structure.
-@param f Pointer to the file buffer structure.
-*/
-void file_buf_init(struct file_buf *f) {
-  f->head = 0;
-  f->tail = MAX_FILE_BUFFER;
-  f->occ = 0;
-  f->name_length = 0;
-}
-
-/**
-
-@brief Get the file name in the file buffer and store it in name.
-Terminate the string in name with the null character.
-@param f Pointer to the file buffer structure.
-@param name Character array to store the file name.
-*/
-void file_buf_get_name(struct file_buf *f, char name[]) {
-  int i;
-
-  for (i = 0; i < f->name_length; i++) {
-    name[i] = f->name[i];
-  }
-  name[f->name_length] = '\0';
-}
-
-/**
-
-@brief Put name[] into the file name in the file buffer.
-@param f Pointer to the file buffer structure.
-@param name Character array containing the file name.
-@param length Length of the name array.
-*/
-void file_buf_put_name(struct file_buf *f, char name[], int length) {
-  int i;
-
-  for (i = 0; i < length; i++) {
-    f->name[i] = name[i];
-  }
-  f->name_length = length;
-}
-
-/**
-
-@brief Add 'length' bytes in string[] to the file buffer.
-@param f Pointer to the file buffer structure.
-@param string Character array containing the bytes to add.
-@param length Length of the string array.
-@return The number of bytes added.
-*/
-int file_buf_add(struct file_buf *f, char string[], int length) {
-  int i = 0;
-
-  while (i < length && f->occ < MAX_FILE_BUFFER) {
-    f->tail = (f->tail + 1) % (MAX_FILE_BUFFER + 1);
-    f->buffer[f->tail] = string[i];
-    i++;
-    f->occ++;
-  }
-  return (i);
-}
-
-/**
-
-@brief Remove bytes from the file buffer and store them in string[].
-@param f Pointer to the file buffer structure.
-@param string Character array to store the removed bytes.
-@param length Number of bytes to remove.
-@return The number of bytes removed.
-*/
-int file_buf_remove(struct file_buf *f, char string[], int length) {
-  int i = 0;
-
-  while (i < length && f->occ > 0) {
-    string[i] = f->buffer[f->head];
-    f->head = (f->head + 1) % (MAX_FILE_BUFFER + 1);
-    i++;
-    f->occ--;
-  }
-
-  return (i);
-}
-
-/**
-
 @brief Get the manager command message and extract the command character.
 @param port Pointer to the manager port at the host.
 @param msg Character array to store the command message.
@@ -206,9 +132,9 @@ void reply_display_host_state(struct man_port_at_host *port, char dir[],
   char reply_msg[MAX_MSG_LENGTH];
 
   if (dir_valid == 1) {
-    n = sprintf(reply_msg, "%s %d", dir, host_id);
+    n = sprintf(reply_msg, "%s %d %lld", dir, host_id, packet_crc_errors());
   } else {
-    n = sprintf(reply_msg, "None %d", host_id);
+    n = sprintf(reply_msg, "None %d %lld", host_id, packet_crc_errors());
   }
 
   write(port->send_fd, reply_msg, n);
@@ -216,35 +142,113 @@ void reply_display_host_state(struct man_port_at_host *port, char dir[],
 
 /**
 
-@brief Add a job to the job queue.
+@brief Get the scheduling class of a job.
+@param j Pointer to the host job structure.
+@return The job's class.
+*/
+static enum job_class job_q_class(struct host_job *j) {
+  switch (j->type) {
+    case JOB_SEND_PKT_ALL_PORTS:
+    case JOB_PING_SEND_REPLY:
+    case JOB_REQ_PHYS_ID:
+      return JOB_CLASS_CONTROL;
+    case JOB_FILE_DOWNLOAD_SEND:
+    case JOB_FILE_DOWNLOAD_RECV:
+    case JOB_FILE_UPLOAD_SEND:
+    case JOB_REGISTER_DOMAIN_NAME:
+      return JOB_CLASS_INTERACTIVE;
+    default:
+      return JOB_CLASS_BULK;
+  }
+}
+
+/**
+
+@brief Add a job to the job queue, at the end of its class.
 @param j_q Pointer to the job queue structure.
 @param j Pointer to the host job structure.
 */
 void job_q_add(struct job_queue *j_q, struct host_job *j) {
-  if (j_q->head == NULL) {
-    j_q->head = j;
-    j_q->tail = j;
-    j_q->occ = 1;
+  struct job_level *l;
+
+  j->job_class = job_q_class(j);
+  j->queued_time = time_now_usec();
+  j->next = NULL;
+  l = &j_q->level[j->job_class];
+  if (l->head == NULL) {
+    l->head = j;
   } else {
-    (j_q->tail)->next = j;
-    j->next = NULL;
-    j_q->tail = j;
-    j_q->occ++;
+    (l->tail)->next = j;
   }
+  l->tail = j;
+  l->occ++;
+  l->added++;
+  if (l->occ > l->max_occ) l->max_occ = l->occ;
+  j_q->occ++;
 }
 
 /**
 
-@brief Remove job from the job queue, and return pointer to the job.
+@brief Start a pass of the host loop.
+
+The jobs queued now are the ones job_q_remove() returns in this pass,
+along with control jobs queued during it.
+
 @param j_q Pointer to the job queue structure.
-@return Pointer to the removed host job.
+*/
+void job_q_start_pass(struct job_queue *j_q) {
+  int c;
+
+  for (c = 0; c < JOB_CLASSES; c++) {
+    j_q->level[c].ready = j_q->level[c].occ;
+  }
+}
+
+/**
+
+@brief Remove the next job to run in this pass, and return pointer to the job.
+
+The most urgent class with a job to run goes first, unless the job at the
+head of a less urgent class has waited JOB_AGE_LIMIT; then the job that
+has waited longest goes first.
+
+@param j_q Pointer to the job queue structure.
+@return Pointer to the removed host job, or NULL when the pass is done.
 */
 struct host_job *job_q_remove(struct job_queue *j_q) {
+  struct job_level *l;
   struct host_job *j;
+  long long now = time_now_usec();
+  int first = -1;
+  int pick = -1;
+  int c;
+
+  for (c = 0; c < JOB_CLASSES; c++) {
+    l = &j_q->level[c];
+    if (l->occ == 0 || (c != JOB_CLASS_CONTROL && l->ready == 0)) continue;
+    if (first < 0) first = c;
+    if (now - l->head->queued_time >= JOB_AGE_LIMIT &&
+        (pick < 0 ||
+         l->head->queued_time < j_q->level[pick].head->queued_time)) {
+      pick = c;
+    }
+  }
+  if (first < 0) return (NULL);
+  if (pick < 0) {
+    pick = first;
+  } else if (pick != first) {
+    j_q->level[pick].aged++;
+  }
 
-  if (j_q->occ == 0) return (NULL);
-  j = j_q->head;
-  j_q->head = (j_q->head)->next;
+  l = &j_q->level[pick];
+  j = l->head;
+  l->head = j->next;
+  if (l->head == NULL) l->tail = NULL;
+  l->occ--;
+  if (l->ready > 0) l->ready--;
+  l->run++;
+  l->wait_total += now - j->queued_time;
+  if (now - j->queued_time > l->wait_max) l->wait_max = now - j->queued_time;
   j_q->occ--;
   return (j);
 }
@@ -256,9 +260,27 @@ struct host_job *job_q_remove(struct job_queue *j_q) {
 @return void.
 */
 void job_q_init(struct job_queue *j_q) {
-  j_q->occ = 0;
-  j_q->head = NULL;
-  j_q->tail = NULL;
+  memset(j_q, 0, sizeof(struct job_queue));
+}
+
+/**
+
+@brief Print the queue depth and waiting time of each class of jobs.
+@param j_q Pointer to the job queue structure.
+@param host_id ID of the host.
+*/
+void display_job_stats(struct job_queue *j_q, int host_id) {
+  struct job_level *l;
+  int c;
+
+  printf("Host %d job queue:\n", host_id);
+  printf("Class\t\tQlen\tMax\tAdded\tRun\tAged\tAvgWait\tMaxWait\n");
+  for (c = 0; c < JOB_CLASSES; c++) {
+    l = &j_q->level[c];
+    printf("%-11s\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n",
+           job_class_name[c], l->occ, l->max_occ, l->added, l->run, l->aged,
+           l->run > 0 ? l->wait_total / l->run : 0, l->wait_max);
+  }
 }
 
 /**
@@ -279,20 +301,20 @@ const char *get_job_type_string(int job_type) {
   switch (job_type) {
     case JOB_SEND_PKT_ALL_PORTS:
       return "JOB_SEND_PKT_ALL_PORTS";
-    case JOB_PING_SEND_REQ:
-      return "JOB_PING_SEND_REQ";
     case JOB_PING_SEND_REPLY:
       return "JOB_PING_SEND_REPLY";
-    case JOB_PING_WAIT_FOR_REPLY:
-      return "JOB_PING_WAIT_FOR_REPLY";
     case JOB_FILE_UPLOAD_SEND:
       return "JOB_FILE_UPLOAD_SEND";
+    case JOB_FILE_UPLOAD_SEND_CONT:
+      return "JOB_FILE_UPLOAD_SEND_CONT";
     case JOB_FILE_UPLOAD_RECV_START:
       return "JOB_FILE_UPLOAD_RECV_START";
     case JOB_FILE_UPLOAD_RECV_CONT:
       return "JOB_FILE_UPLOAD_RECV_CONT";
     case JOB_FILE_UPLOAD_RECV_END:
       return "JOB_FILE_UPLOAD_RECV_END";
+    case JOB_IO_DONE:
+      return "JOB_IO_DONE";
     case JOB_FILE_DOWNLOAD_SEND:
       return "JOB_FILE_DOWNLOAD_SEND";
     case JOB_FILE_DOWNLOAD_RECV:
@@ -340,6 +362,42 @@ void display_packet_info(struct packet *pkt) {
     case PKT_FILE_DOWNLOAD_SEND:
       type_string = "PKT_FILE_DOWNLOAD_SEND";
       break;
+    case PKT_FILE_DOWNLOAD_RECV:
+      type_string = "PKT_FILE_DOWNLOAD_RECV";
+      break;
+    case PKT_FILE_SIG_REQ:
+      type_string = "PKT_FILE_SIG_REQ";
+      break;
+    case PKT_FILE_WANT_REQ:
+      type_string = "PKT_FILE_WANT_REQ";
+      break;
+    case PKT_FILE_RANGE_REQ:
+      type_string = "PKT_FILE_RANGE_REQ";
+      break;
+    case PKT_TRACKER_ANNOUNCE:
+      type_string = "PKT_TRACKER_ANNOUNCE";
+      break;
+    case PKT_TRACKER_QUERY:
+      type_string = "PKT_TRACKER_QUERY";
+      break;
+    case PKT_TRACKER_REPLY:
+      type_string = "PKT_TRACKER_REPLY";
+      break;
+    case PKT_TRACE_REQ:
+      type_string = "PKT_TRACE_REQ";
+      break;
+    case PKT_TRACE_REPLY:
+      type_string = "PKT_TRACE_REPLY";
+      break;
+    case PKT_DNS_INVALIDATE:
+      type_string = "PKT_DNS_INVALIDATE";
+      break;
+    case PKT_MCAST_JOIN:
+      type_string = "PKT_MCAST_JOIN";
+      break;
+    case PKT_MCAST_LEAVE:
+      type_string = "PKT_MCAST_LEAVE";
+      break;
     default:
       type_string = "UNKNOWN_PACKET_TYPE";
       break;
@@ -359,25 +417,27 @@ void display_packet_info(struct packet *pkt) {
 @return void.
 */
 void print_job_queue_contents(struct job_queue *queue) {
-  struct host_job *current_job = queue->head;
+  struct host_job *current_job;
+  int c;
 
   printf("\n\n\n\nPrinting job queue contents:\n\n\n\n");
-  while (current_job != NULL) {
-    printf("Job type: %s\n", get_job_type_string(current_job->type));
-    printf("Input port index: %d\n", current_job->in_port_index);
-    printf("Output port index: %d\n", current_job->out_port_index);
-
-    if (current_job->packet != NULL) {
-      printf("Packet data: %s\n", current_job->packet->payload);
-    } else {
-      printf("Packet data: NULL\n");
+  for (c = 0; c < JOB_CLASSES; c++) {
+    for (current_job = queue->level[c].head; current_job != NULL;
+         current_job = current_job->next) {
+      printf("Job type: %s (%s)\n", get_job_type_string(current_job->type),
+             job_class_name[c]);
+      printf("Input port index: %d\n", current_job->in_port_index);
+      printf("Output port index: %d\n", current_job->out_port_index);
+
+      if (current_job->packet != NULL) {
+        printf("Packet data: %s\n", current_job->packet->payload);
+      } else {
+        printf("Packet data: NULL\n");
+      }
+
+      printf("Download file name: %s\n", current_job->fname_download);
+      printf("Upload file name: %s\n", current_job->fname_upload);
+      printf("File upload destination: %d\n", current_job->file_upload_dst);
     }
-
-    printf("Download file name: %s\n", current_job->fname_download);
-    printf("Upload file name: %s\n", current_job->fname_upload);
-    printf("Ping timer: %d\n", current_job->ping_timer);
-    printf("File upload destination: %d\n", current_job->file_upload_dst);
-
-    current_job = current_job->next;
   }
 }
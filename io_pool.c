@@ -0,0 +1,473 @@
+/**
+
+@file io_pool.c
+@brief Disk I/O worker threads for the host.
+
+The host loop handles packets, manager commands and jobs on a single
+thread, so a file read or write that waits on the disk would hold up ping
+replies and DNS answers as well.  Disk I/O for file transfers is instead
+handed to a small pool of worker threads.
+
+Each worker has a request ring filled by the host and a completion ring
+emptied by the host.  Both rings have exactly one producer and one
+consumer, so they are lock-free; a semaphore only wakes a worker that has
+nothing to do.  The host collects completions with io_poll() once per pass
+and queues them as jobs.  The host gives a worker at most IO_RING_SIZE
+requests that have not been collected, so the worker always finds room
+for a completion, and keeps any more in a backlog, so submitting never
+waits on the worker.
+
+All requests for one file go to the same worker, which keeps them in
+order: the file is opened before it is written and closed after the last
+write.  It also means reads complete in file order, so the host can chain
+the CRC32C of each read into the checksum of the whole file.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "delta.h"
+#include "io_pool.h"
+#include "lz.h"
+#include "store.h"
+
+/**
+
+@brief Add a request to a ring.
+@param r The ring; the caller must be its only producer.
+@param req The request.
+@return 0 on success, or -1 if the ring is full.
+*/
+static int io_ring_put(struct io_ring *r, struct io_req *req) {
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+  if (tail - head == IO_RING_SIZE) return -1;
+  r->req[tail % IO_RING_SIZE] = req;
+  atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  return 0;
+}
+
+/**
+
+@brief Take the oldest request from a ring.
+@param r The ring; the caller must be its only consumer.
+@return The request, or NULL if the ring is empty.
+*/
+static struct io_req *io_ring_get(struct io_ring *r) {
+  unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  struct io_req *req;
+
+  if (head == tail) return NULL;
+  req = r->req[head % IO_RING_SIZE];
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+  return req;
+}
+
+/**
+
+@brief Let data built in memory take the place of a file.
+
+Used by the requests that turn a file into what is actually sent, so the
+requests that follow read the new data through the same io_file.
+
+@param f The file.
+@param out Memory file holding the data.
+@param result 0 or a positive value if the data is complete, or -errno.
+@return 1 if out replaced the file, otherwise result.
+*/
+static int io_replace(struct io_file *f, int out, int result) {
+  if (result < 0) {
+    close(out);
+    return result;
+  }
+  if (f->fd >= 0) close(f->fd);
+  f->fd = out;
+  return 1;
+}
+
+/**
+
+@brief Carry out one request.
+@param req The request; its result is filled in.
+@param scratch Buffer of 64 KB that read-ahead data is read into.
+*/
+static void io_run(struct io_req *req, char *scratch) {
+  struct io_file *f = req->file;
+  long long off;
+  long long end;
+  ssize_t n;
+  char *tmp;
+  int old;
+  int out;
+
+  req->result = 0;
+  switch (req->op) {
+    case IO_OPEN_WRITE:
+    case IO_OPEN_KEEP:
+      /* A new file, not a truncated one, in case it is linked to the store */
+      if (req->op == IO_OPEN_WRITE) unlink(req->buf);
+      /* Read access too, to check the file once it is written */
+      f->fd = open(req->buf,
+                   O_RDWR | O_CREAT | (req->op == IO_OPEN_WRITE ? O_TRUNC : 0),
+                   0644);
+      if (f->fd < 0) {
+        req->result = -errno;
+      } else if (req->offset > 0) {
+        /* Reserve the blocks now; not every file system can */
+        fallocate(f->fd, 0, 0, req->offset);
+      }
+      break;
+    case IO_WRITE:
+      if (f->fd < 0) {
+        req->result = -EBADF;
+        break;
+      }
+      for (off = 0; off < req->length; off += n) {
+        n = pwrite(f->fd, req->buf + off, req->length - off,
+                   f->base + req->offset + off);
+        if (n <= 0) {
+          req->result = n < 0 ? -errno : -EIO;
+          break;
+        }
+      }
+      if (req->result == 0) req->result = req->length;
+      break;
+    case IO_READAHEAD:
+    case IO_CHECKSUM:
+      /* Reading the data is what brings it into the page cache */
+      req->crc = 0;
+      end = req->offset + req->length;
+      n = 0;   /* A zero-length request reads nothing */
+      for (off = req->offset; off < end; off += n) {
+        n = pread(f->fd, scratch, end - off < 65536 ? end - off : 65536,
+                  f->base + off);
+        if (n <= 0) break;
+        req->crc = crc32c(req->crc, scratch, n);
+      }
+      if (n < 0) {
+        req->result = -errno;
+      } else if (req->op == IO_READAHEAD) {
+        req->result = off - req->offset;   /* Short if the file shrank */
+      } else {
+        req->result = off == end ? req->length : -EIO;
+      }
+      break;
+    case IO_COMPRESS:
+      /*
+       * The stream is built in memory, and takes the place of the file
+       * for the requests that follow.  The result is 1 if it did, 0 if
+       * the file did not compress and is kept.
+       */
+      out = memfd_create("net367-lz", 0);
+      if (out < 0) {
+        req->result = -errno;
+        break;
+      }
+      req->result = lz_compress_file(f->fd, out);
+      if (req->result == 1) {
+        io_replace(f, out, 0);
+      } else {
+        close(out);
+      }
+      break;
+    case IO_SIGNATURE:
+      /* A file that could not be opened (fd -1) has an empty signature */
+      out = memfd_create("net367-sig", 0);
+      if (out < 0) {
+        req->result = -errno;
+        break;
+      }
+      req->result = io_replace(f, out, delta_signature_file(f->fd, out));
+      break;
+    case IO_DELTA:
+      old = open(req->buf, O_RDONLY);
+      out = old < 0 ? -1 : memfd_create("net367-delta", 0);
+      if (out < 0) {
+        req->result = -errno;
+        if (old >= 0) close(old);
+        break;
+      }
+      req->result = io_replace(f, out, delta_make_file(old, f->fd, out));
+      close(old);
+      break;
+    case IO_PATCH:
+      /* Build the new file beside the old one, then rename it over */
+      tmp = (char *)malloc(strlen(req->buf) + 7);
+      sprintf(tmp, "%s.patch", req->buf);
+      old = open(req->buf, O_RDONLY);
+      out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (out < 0) {
+        req->result = -errno;
+      } else {
+        req->result = delta_apply_file(old, f->fd, out);
+        if (req->result == 0 && fsync(out) < 0) req->result = -errno;
+        close(out);
+        if (req->result == 0 && rename(tmp, req->buf) < 0) {
+          req->result = -errno;
+        }
+        if (req->result < 0) unlink(tmp);
+      }
+      if (old >= 0) close(old);
+      free(tmp);
+      break;
+    case IO_MANIFEST:
+      out = memfd_create("net367-manifest", 0);
+      if (out < 0) {
+        req->result = -errno;
+        break;
+      }
+      req->result = io_replace(f, out, store_manifest_file(f->fd, out));
+      break;
+    case IO_WANT:
+      out = memfd_create("net367-want", 0);
+      if (out < 0) {
+        req->result = -errno;
+        break;
+      }
+      req->result = io_replace(f, out, store_want_file(f->fd, req->buf, out));
+      break;
+    case IO_PACK:
+      old = req->buf == NULL ? -1 : open(req->buf, O_RDONLY);
+      out = req->buf != NULL && old < 0 ? -1 : memfd_create("net367-pack", 0);
+      if (out < 0) {
+        req->result = -errno;
+        if (old >= 0) close(old);
+        break;
+      }
+      req->result = io_replace(
+          f, out, store_pack_file(old, (unsigned int)req->offset, f->fd, out));
+      if (old >= 0) close(old);
+      break;
+    case IO_ASSEMBLE:
+      req->result = store_assemble_file(f->fd, req->buf);
+      break;
+    case IO_DECOMPRESS:
+      unlink(req->buf);
+      out = open(req->buf, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (out < 0) {
+        req->result = -errno;
+        break;
+      }
+      req->result = lz_decompress_file(f->fd, out);
+      if (req->result == 0 && fsync(out) < 0) req->result = -errno;
+      close(out);
+      break;
+    case IO_FSYNC:
+      if (f->fd >= 0 && fsync(f->fd) < 0) req->result = -errno;
+      break;
+    case IO_UNLINK:
+      if (unlink(req->buf) < 0) req->result = -errno;
+      break;
+    case IO_CLOSE:
+      if (f->fd >= 0 && close(f->fd) < 0) req->result = -errno;
+      f->fd = -1;
+      break;
+  }
+}
+
+/**
+
+@brief Main loop of a worker thread.
+@param arg Pointer to the worker.
+@return NULL when the pool is shut down.
+*/
+static void *io_worker_main(void *arg) {
+  struct io_worker *w = (struct io_worker *)arg;
+  struct io_req *req;
+
+  for (;;) {
+    sem_wait(&w->wake);
+    req = io_ring_get(&w->sub);
+    if (req == NULL) {
+      if (atomic_load(&w->pool->stop)) break;
+      continue;
+    }
+    io_run(req, w->scratch);
+    /* There is room: the host never has more requests out than slots */
+    io_ring_put(&w->done, req);
+  }
+  return NULL;
+}
+
+/**
+
+@brief Start the worker threads.
+
+If no thread can be started the pool still works, doing each request
+inline when it is submitted.
+
+@param pool Pointer to the pool.
+@return The number of workers started.
+*/
+int io_pool_init(struct io_pool *pool) {
+  struct io_worker *w;
+  int i;
+
+  memset(pool, 0, sizeof(struct io_pool));
+  for (i = 0; i < IO_POOL_THREADS; i++) {
+    w = &pool->worker[i];
+    w->pool = pool;
+    sem_init(&w->wake, 0, 0);
+    if (pthread_create(&w->thread, NULL, io_worker_main, w) != 0) {
+      sem_destroy(&w->wake);
+      break;
+    }
+    pool->num++;
+  }
+  return pool->num;
+}
+
+/**
+
+@brief Stop the worker threads after they finish the requests queued.
+@param pool Pointer to the pool.
+*/
+void io_pool_shutdown(struct io_pool *pool) {
+  int i;
+
+  atomic_store(&pool->stop, 1);
+  for (i = 0; i < pool->num; i++) {
+    sem_post(&pool->worker[i].wake);
+  }
+  for (i = 0; i < pool->num; i++) {
+    pthread_join(pool->worker[i].thread, NULL);
+    sem_destroy(&pool->worker[i].wake);
+  }
+  pool->num = 0;
+}
+
+/**
+
+@brief Create a file handle and choose its worker.
+@param pool Pointer to the pool.
+@param fd Descriptor of an open file, or -1 if it will be opened with
+IO_OPEN_WRITE.  The pool closes it with IO_CLOSE.
+@return The new file.
+*/
+struct io_file *io_file_new(struct io_pool *pool, int fd) {
+  struct io_file *f = (struct io_file *)calloc(1, sizeof(struct io_file));
+
+  f->fd = fd;
+  if (pool->num > 0) {
+    f->worker = pool->next;
+    pool->next = (pool->next + 1) % pool->num;
+  }
+  return f;
+}
+
+/**
+
+@brief Hand a worker the requests of its backlog, as far as its rings
+have room for them and their completions.
+@param w The worker.
+*/
+static void io_worker_feed(struct io_worker *w) {
+  struct io_req *req;
+
+  while (w->backlog_head != NULL && w->outstanding < IO_RING_SIZE) {
+    req = w->backlog_head;
+    w->backlog_head = req->next;
+    if (w->backlog_head == NULL) w->backlog_tail = NULL;
+    req->next = NULL;
+    io_ring_put(&w->sub, req);
+    w->outstanding++;
+    sem_post(&w->wake);
+  }
+}
+
+/**
+
+@brief Queue a request for a file.
+
+The request is run by the file's worker, or inline if there are no
+workers.  If the worker already has IO_RING_SIZE requests out, which only
+happens when the disk is far behind, the request waits in the worker's
+backlog until io_poll() collects some of them; the host does not wait.
+
+@param pool Pointer to the pool.
+@param f The file.
+@param op The operation.
+@param buf Path for IO_OPEN_WRITE, IO_OPEN_KEEP, IO_DECOMPRESS, IO_DELTA,
+IO_PATCH, IO_WANT, IO_PACK, IO_ASSEMBLE and IO_UNLINK or data for
+IO_WRITE, allocated with malloc(); the pool frees it when the request
+completes.  NULL otherwise.
+@param offset File offset for IO_WRITE, IO_READAHEAD and IO_CHECKSUM,
+counted from the file's base, file size to preallocate when opening,
+manifest CRC32C for IO_PACK.
+@param length Number of bytes for IO_WRITE, IO_READAHEAD and IO_CHECKSUM.
+*/
+void io_submit(struct io_pool *pool, struct io_file *f, enum io_op op,
+               char *buf, long long offset, int length) {
+  struct io_req *req = (struct io_req *)malloc(sizeof(struct io_req));
+  struct io_worker *w;
+  static char scratch[65536];
+
+  req->op = op;
+  req->file = f;
+  req->buf = buf;
+  req->offset = offset;
+  req->length = length;
+  req->next = NULL;
+
+  if (pool->num == 0) {
+    io_run(req, scratch);
+    if (pool->inline_tail == NULL) {
+      pool->inline_head = req;
+    } else {
+      pool->inline_tail->next = req;
+    }
+    pool->inline_tail = req;
+    return;
+  }
+
+  w = &pool->worker[f->worker];
+  if (w->backlog_tail == NULL) {
+    w->backlog_head = req;
+  } else {
+    w->backlog_tail->next = req;
+  }
+  w->backlog_tail = req;
+  io_worker_feed(w);
+}
+
+/**
+
+@brief Collect one completed request.
+
+The caller handles the result and then frees the request with free();
+the request's buffer has already been freed.
+
+@param pool Pointer to the pool.
+@return A completed request, or NULL if none is waiting.
+*/
+struct io_req *io_poll(struct io_pool *pool) {
+  struct io_req *req;
+  int i;
+
+  req = pool->inline_head;
+  if (req != NULL) {
+    pool->inline_head = req->next;
+    if (pool->inline_head == NULL) pool->inline_tail = NULL;
+  }
+  for (i = 0; req == NULL && i < pool->num; i++) {
+    req = io_ring_get(&pool->worker[i].done);
+    if (req != NULL) {
+      pool->worker[i].outstanding--;
+      io_worker_feed(&pool->worker[i]);
+    }
+  }
+  if (req != NULL) {
+    free(req->buf);
+    req->buf = NULL;
+  }
+  return req;
+}
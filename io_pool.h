@@ -0,0 +1,103 @@
+/*
+ * io_pool.h
+ *
+ * Disk I/O worker threads for the host.  The host submits requests
+ * and collects the completed ones in its main loop, so a slow disk
+ * does not hold up packet processing.
+ */
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+#define IO_POOL_THREADS 2
+#define IO_RING_SIZE 1024    /* Requests queued per worker, a power of two */
+#define IO_READAHEAD_BYTES (256 * 1024)  /* File data read ahead of an upload */
+
+enum io_op {
+   IO_OPEN_WRITE,   /* Create the file named by buf, preallocated to offset */
+   IO_OPEN_KEEP,    /* The same, but keep what the file already holds */
+   IO_WRITE,        /* Write buf at offset */
+   IO_READAHEAD,    /* Read length bytes at offset into the page cache */
+   IO_CHECKSUM,     /* Read length bytes at offset for their CRC32C only */
+   IO_COMPRESS,     /* Replace the file with its compressed stream (lz.h) */
+   IO_DECOMPRESS,   /* Decompress the file into the file named by buf */
+   IO_SIGNATURE,    /* Replace the file with its delta signature (delta.h) */
+   IO_DELTA,        /* Replace the file with its delta from the signature in buf */
+   IO_PATCH,        /* Apply the delta in the file to the file named by buf */
+   IO_MANIFEST,     /* Replace the file with its chunk manifest (store.h) */
+   IO_WANT,         /* Replace the manifest with the chunks the store in buf lacks */
+   IO_PACK,         /* Replace the file with the chunks the want list in buf asks
+                       for, all if buf is NULL; offset is the manifest's CRC32C */
+   IO_ASSEMBLE,     /* Build the file named by buf from the pack and the store */
+   IO_FSYNC,
+   IO_UNLINK,       /* Remove the file named by buf */
+   IO_CLOSE
+};
+
+/*
+ * A file whose I/O is done by the pool.  All requests for a file go to
+ * the same worker, so they run in the order they were submitted, and
+ * the close completes last.  The host frees the file when the close
+ * completes.
+ */
+struct io_file {
+   int worker;
+   int fd;              /* Used by the worker once requests are submitted */
+   long long ready;     /* Host side: bytes read ahead so far */
+   int error;           /* Host side: a request failed */
+   int read_failed;     /* Host side: a read-ahead failed or came up short */
+   unsigned int crc;    /* Host side: CRC32C of the bytes read from 0 */
+   long long crc_len;   /*   up to crc_len, in order */
+   long long base;      /* File offset that request offsets count from */
+   void *owner;         /* Host side: for the code that opened the file */
+};
+
+struct io_req {
+   enum io_op op;
+   struct io_file *file;
+   char *buf;           /* Path or data, freed when the request completes */
+   long long offset;
+   int length;
+   int result;          /* Bytes transferred or 0, or -errno on failure */
+   unsigned int crc;    /* CRC32C of the bytes read, for reads */
+   struct io_req *next; /* Completions of inline requests, or the backlog */
+};
+
+/*
+ * Single-producer single-consumer ring.  Each side only writes its own
+ * index, so no locks are needed.
+ */
+struct io_ring {
+   struct io_req *req[IO_RING_SIZE];
+   atomic_uint head;    /* Next slot to take, written by the consumer */
+   atomic_uint tail;    /* Next slot to fill, written by the producer */
+};
+
+struct io_worker {
+   pthread_t thread;
+   sem_t wake;          /* Posted once per submitted request */
+   struct io_ring sub;  /* Host to worker */
+   struct io_ring done; /* Worker to host */
+   int outstanding;     /* Host side: requests given and not collected */
+   struct io_req *backlog_head;  /* Host side: requests waiting for room */
+   struct io_req *backlog_tail;
+   char scratch[65536]; /* Destination of read-ahead data */
+   struct io_pool *pool;
+};
+
+struct io_pool {
+   int num;             /* Running workers, 0 to do the I/O inline */
+   int next;            /* Worker for the next new file */
+   atomic_int stop;
+   struct io_req *inline_head;  /* Completions of inline requests */
+   struct io_req *inline_tail;
+   struct io_worker worker[IO_POOL_THREADS];
+};
+
+int io_pool_init(struct io_pool *pool);
+void io_pool_shutdown(struct io_pool *pool);
+struct io_file *io_file_new(struct io_pool *pool, int fd);
+void io_submit(struct io_pool *pool, struct io_file *f, enum io_op op,
+      char *buf, long long offset, int length);
+struct io_req *io_poll(struct io_pool *pool);
@@ -0,0 +1,412 @@
+/**
+
+@file lz.c
+@brief Fast LZ77 compression for file transfers.
+
+Blocks are compressed in the LZ4 block format: each sequence is a token
+byte holding the literal count and match length, the literals, and a
+2-byte little-endian offset back to the match in the last 64 KB.  The
+compressor finds matches through a hash table of 4-byte sequences and
+takes the first one it finds, trading ratio for speed; after a run of
+misses it skips ahead faster, so data that does not compress costs little.
+
+A file is compressed as a stream of independent blocks of LZ_BLOCK bytes,
+each preceded by its stored length and its original length.  A block
+that would not shrink by at least an eighth is stored as it is, with
+LZ_STORED set in its length, so the stream is never much larger than the
+file.  If the first block already does not compress, lz_compress_file()
+gives up on the whole file.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lz.h"
+
+#define LZ_HASH_LOG 14
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5   /* A block ends with at least this many literals */
+#define LZ_MATCH_LIMIT 12    /* No match starts this close to the end */
+#define LZ_MAX_OFFSET 65535
+#define LZ_SKIP_SHIFT 6      /* Step grows by one every 64 misses */
+
+/**
+
+@brief Load 4 bytes in host order.
+@param p Source.
+@return The bytes as an integer.
+*/
+static uint32_t lz_read32(const unsigned char *p) {
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  return v;
+}
+
+/**
+
+@brief Hash the 4 bytes at a position.
+@param v The bytes.
+@return Index into the hash table.
+*/
+static unsigned int lz_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+/**
+
+@brief Append a length that did not fit in the token.
+@param dst Output buffer.
+@param op Position in dst.
+@param len Remaining length, already reduced by 15.
+@return The new position.
+*/
+static int lz_put_len(unsigned char *dst, int op, int len) {
+  while (len >= 255) {
+    dst[op++] = 255;
+    len -= 255;
+  }
+  dst[op++] = (unsigned char)len;
+  return op;
+}
+
+/**
+
+@brief Append one sequence: literals, then a match unless it is the last.
+@param dst Output buffer.
+@param op Position in dst.
+@param cap Size of dst.
+@param lit The literals.
+@param lit_len Number of literals.
+@param offset Distance back to the match.
+@param match_len Length of the match, or 0 for the last sequence.
+@return The new position, or -1 if the sequence does not fit.
+*/
+static int lz_put_seq(unsigned char *dst, int op, int cap,
+                      const unsigned char *lit, int lit_len, int offset,
+                      int match_len) {
+  int token;
+
+  if (op + 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1 > cap) {
+    return -1;
+  }
+  token = (lit_len < 15 ? lit_len : 15) << 4;
+  if (match_len > 0) {
+    token |= match_len - LZ_MIN_MATCH < 15 ? match_len - LZ_MIN_MATCH : 15;
+  }
+  dst[op++] = (unsigned char)token;
+  if (lit_len >= 15) op = lz_put_len(dst, op, lit_len - 15);
+  memcpy(dst + op, lit, lit_len);
+  op += lit_len;
+  if (match_len > 0) {
+    dst[op++] = (unsigned char)offset;
+    dst[op++] = (unsigned char)(offset >> 8);
+    if (match_len - LZ_MIN_MATCH >= 15) {
+      op = lz_put_len(dst, op, match_len - LZ_MIN_MATCH - 15);
+    }
+  }
+  return op;
+}
+
+/**
+
+@brief Compress a block.
+@param src Data to compress.
+@param n Number of bytes at src.
+@param dst Output buffer.
+@param cap Size of dst; the call fails rather than write more.
+@return The compressed size, or -1 if it would exceed cap.
+*/
+int lz_compress(const char *src, int n, char *dst, int cap) {
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  int *table;
+  int anchor = 0;
+  int ip = 0;
+  int op = 0;
+  int ref;
+  int len;
+  unsigned int h;
+
+  table = (int *)calloc(1 << LZ_HASH_LOG, sizeof(int));
+  if (table == NULL) return -1;
+
+  while (ip < n - LZ_MATCH_LIMIT) {
+    h = lz_hash(lz_read32(in + ip));
+    ref = table[h] - 1;   /* Positions are stored plus one, 0 is empty */
+    table[h] = ip + 1;
+    if (ref < 0 || ip - ref > LZ_MAX_OFFSET ||
+        lz_read32(in + ref) != lz_read32(in + ip)) {
+      ip += 1 + ((ip - anchor) >> LZ_SKIP_SHIFT);
+      continue;
+    }
+
+    len = LZ_MIN_MATCH;
+    while (ip + len < n - LZ_LAST_LITERALS && in[ref + len] == in[ip + len]) {
+      len++;
+    }
+    op = lz_put_seq(out, op, cap, in + anchor, ip - anchor, ip - ref, len);
+    if (op < 0) break;
+    ip += len;
+    anchor = ip;
+    if (ip < n - LZ_MATCH_LIMIT) {
+      table[lz_hash(lz_read32(in + ip - 2))] = ip - 1;
+    }
+  }
+  if (op >= 0) {
+    op = lz_put_seq(out, op, cap, in + anchor, n - anchor, 0, 0);
+  }
+
+  free(table);
+  return op;
+}
+
+/**
+
+@brief Read a length continued past the token.
+@param in Input buffer.
+@param ip Position in in, advanced past the length bytes.
+@param n Size of in.
+@return The extra length, or -1 if the input ends first.
+*/
+static int lz_get_len(const unsigned char *in, int *ip, int n) {
+  int len = 0;
+  int b;
+
+  do {
+    if (*ip >= n) return -1;
+    b = in[(*ip)++];
+    len += b;
+  } while (b == 255);
+  return len;
+}
+
+/**
+
+@brief Decompress a block.
+
+The input is not trusted: every length and offset is checked against the
+buffers.
+
+@param src Compressed data.
+@param n Number of bytes at src.
+@param dst Output buffer.
+@param cap Size of dst.
+@return The decompressed size, or -1 if the data is invalid.
+*/
+int lz_decompress(const char *src, int n, char *dst, int cap) {
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  int ip = 0;
+  int op = 0;
+  int token;
+  int lit;
+  int len;
+  int off;
+  int extra;
+
+  while (ip < n) {
+    token = in[ip++];
+    lit = token >> 4;
+    if (lit == 15) {
+      if ((extra = lz_get_len(in, &ip, n)) < 0) return -1;
+      lit += extra;
+    }
+    if (lit > n - ip || lit > cap - op) return -1;
+    memcpy(out + op, in + ip, lit);
+    ip += lit;
+    op += lit;
+    if (ip == n) break;   /* The last sequence has no match */
+
+    if (n - ip < 2) return -1;
+    off = in[ip] | (in[ip + 1] << 8);
+    ip += 2;
+    len = token & 15;
+    if (len == 15) {
+      if ((extra = lz_get_len(in, &ip, n)) < 0) return -1;
+      len += extra;
+    }
+    len += LZ_MIN_MATCH;
+    if (off == 0 || off > op || len > cap - op) return -1;
+    if (off >= len) {
+      memcpy(out + op, out + op - off, len);
+      op += len;
+    } else {
+      /* The match overlaps what it produces, copy a byte at a time */
+      while (len-- > 0) {
+        out[op] = out[op - off];
+        op++;
+      }
+    }
+  }
+  return op;
+}
+
+/**
+
+@brief Read exactly len bytes at offset.
+@return Bytes read (less only at end of file), or -errno.
+*/
+static int lz_pread_full(int fd, char *buf, int len, long long offset) {
+  int got = 0;
+  ssize_t n;
+
+  while (got < len) {
+    n = pread(fd, buf + got, len - got, offset + got);
+    if (n < 0) return -errno;
+    if (n == 0) break;
+    got += n;
+  }
+  return got;
+}
+
+/**
+
+@brief Write exactly len bytes.
+@return 0, or -errno.
+*/
+static int lz_write_full(int fd, const char *buf, int len) {
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n <= 0) return n < 0 ? -errno : -EIO;
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+
+@brief Store a 32-bit value in big-endian order.
+@param buf Destination, at least 4 bytes.
+@param v Value to store.
+*/
+static void lz_put_u32(char *buf, uint32_t v) {
+  buf[0] = (char)(v >> 24);
+  buf[1] = (char)(v >> 16);
+  buf[2] = (char)(v >> 8);
+  buf[3] = (char)v;
+}
+
+/**
+
+@brief Load a 32-bit value stored in big-endian order.
+@param buf Source, at least 4 bytes.
+@return The value.
+*/
+static uint32_t lz_get_u32(const char *buf) {
+  return ((uint32_t)(unsigned char)buf[0] << 24) |
+         ((uint32_t)(unsigned char)buf[1] << 16) |
+         ((uint32_t)(unsigned char)buf[2] << 8) |
+         (uint32_t)(unsigned char)buf[3];
+}
+
+/**
+
+@brief Compress a file into a block stream.
+@param in_fd File to compress, read from offset 0.
+@param out_fd Where the stream is written, at its current position.
+@return 1 if the stream was written, 0 if the first block did not
+compress and nothing was written, or -errno.
+*/
+int lz_compress_file(int in_fd, int out_fd) {
+  char *raw = (char *)malloc(LZ_BLOCK);
+  char *blk = (char *)malloc(LZ_BLOCK_HDR + LZ_BLOCK);
+  long long offset = 0;
+  int result = 1;
+  int n;
+  int c;
+
+  if (raw == NULL || blk == NULL) {
+    result = -ENOMEM;
+  }
+  while (result == 1) {
+    n = lz_pread_full(in_fd, raw, LZ_BLOCK, offset);
+    if (n <= 0) {
+      if (n < 0) result = n;
+      break;
+    }
+    /* Keep the block only if it saves at least an eighth */
+    c = lz_compress(raw, n, blk + LZ_BLOCK_HDR, n - n / 8);
+    if (c < 0) {
+      if (offset == 0) {
+        result = 0;
+        break;
+      }
+      memcpy(blk + LZ_BLOCK_HDR, raw, n);
+      lz_put_u32(blk, LZ_STORED | (uint32_t)n);
+      c = n;
+    } else {
+      lz_put_u32(blk, (uint32_t)c);
+    }
+    lz_put_u32(blk + 4, (uint32_t)n);
+    if ((c = lz_write_full(out_fd, blk, LZ_BLOCK_HDR + c)) < 0) {
+      result = c;
+    }
+    offset += n;
+  }
+
+  free(raw);
+  free(blk);
+  return result;
+}
+
+/**
+
+@brief Decompress a block stream into a file.
+@param in_fd The stream, read from offset 0.
+@param out_fd Where the file is written, at its current position.
+@return 0 on success, -EIO if the stream is damaged, or -errno.
+*/
+int lz_decompress_file(int in_fd, int out_fd) {
+  char *raw = (char *)malloc(LZ_BLOCK);
+  char *blk = (char *)malloc(LZ_BLOCK_HDR + LZ_BLOCK);
+  long long offset = 0;
+  uint32_t stored;
+  uint32_t orig;
+  int result = 0;
+  int len;
+  int n;
+
+  if (raw == NULL || blk == NULL) {
+    result = -ENOMEM;
+  }
+  while (result == 0) {
+    n = lz_pread_full(in_fd, blk, LZ_BLOCK_HDR, offset);
+    if (n <= 0) {
+      result = n;
+      break;
+    }
+    stored = lz_get_u32(blk);
+    orig = lz_get_u32(blk + 4);
+    len = (int)(stored & ~LZ_STORED);
+    if (n < LZ_BLOCK_HDR || orig > LZ_BLOCK || len > LZ_BLOCK ||
+        ((stored & LZ_STORED) && (uint32_t)len != orig)) {
+      result = -EIO;
+      break;
+    }
+    n = lz_pread_full(in_fd, blk + LZ_BLOCK_HDR, len, offset + LZ_BLOCK_HDR);
+    if (n != len) {
+      result = n < 0 ? n : -EIO;
+      break;
+    }
+    if (stored & LZ_STORED) {
+      memcpy(raw, blk + LZ_BLOCK_HDR, len);
+    } else if (lz_decompress(blk + LZ_BLOCK_HDR, len, raw, LZ_BLOCK) !=
+               (int)orig) {
+      result = -EIO;
+      break;
+    }
+    result = lz_write_full(out_fd, raw, orig);
+    offset += LZ_BLOCK_HDR + len;
+  }
+
+  free(raw);
+  free(blk);
+  return result;
+}
@@ -0,0 +1,27 @@
+/*
+ * lz.h
+ *
+ * Fast LZ77 block compression (the LZ4 block format) and the block
+ * stream used to compress files for transfer.
+ */
+
+#define LZ_BLOCK (64 * 1024)     /* Bytes of file per compressed block */
+#define LZ_BLOCK_HDR 8           /* Stored length and original length */
+#define LZ_STORED 0x80000000u    /* Block kept uncompressed */
+#define LZ_BOUND(n) ((n) + (n) / 255 + 16)   /* Worst case compressed size */
+
+/* Compress n bytes into at most cap bytes; -1 if they do not fit */
+int lz_compress(const char *src, int n, char *dst, int cap);
+
+/* Decompress n bytes into at most cap bytes; -1 if the data is invalid */
+int lz_decompress(const char *src, int n, char *dst, int cap);
+
+/*
+ * Compress the file in_fd into out_fd as a block stream.  Returns 1 if
+ * the stream was written, 0 if the start of the file compressed too
+ * poorly to bother, or -errno.
+ */
+int lz_compress_file(int in_fd, int out_fd);
+
+/* Decompress the block stream in_fd into out_fd; 0 or -errno */
+int lz_decompress_file(int in_fd, int out_fd);
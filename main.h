@@ -1,5 +1,15 @@
 
 #define BCAST_ADDR 100
+
+/*
+ * Multicast group addresses.  Group g (0 <= g < MCAST_MAX_GROUPS)
+ * is addressed as MCAST_ADDR_BASE + g in the packet dst field.
+ */
+#define MCAST_ADDR_BASE 110
+#define MCAST_MAX_GROUPS 16
+#define IS_MCAST_ADDR(a) ((a) >= MCAST_ADDR_BASE && (a) < MCAST_ADDR_BASE + MCAST_MAX_GROUPS)
+#define MCAST_ADDR(g) (MCAST_ADDR_BASE + (g))
+#define MCAST_GROUP(a) ((a) - MCAST_ADDR_BASE)
 #define PAYLOAD_MAX 100
 #define STRING_MAX 100
 #define NAME_LENGTH 100
@@ -30,6 +40,12 @@ struct net_port { /* port to communicate with another node */
 	int pipe_recv_fd;
 	struct net_port *next;
    int sock_host_id;
+   int splice_fd[2];    /* Staging pipe for spliced frames, -1 until used */
+   int splice_pending;  /* Bytes staged but not yet moved to the link */
+   char splice_tail[PAYLOAD_MAX + 8];  /* Rest of a frame the staging pipe had no room for */
+   int splice_tail_len;
+   char recv_buf[PAYLOAD_MAX + 8];  /* Partly received frame */
+   int recv_len;
 };
 
 /* Packet sent between nodes  */
@@ -54,3 +70,15 @@ struct packet { /* struct for a packet */
 #define PKT_REGISTER_DOMAIN 7
 #define PKT_PING_DOMAIN 8
 #define PKT_REPLY_DOMAIN 9
+#define PKT_MCAST_JOIN 10
+#define PKT_MCAST_LEAVE 11
+#define PKT_FILE_ACK 12
+#define PKT_FILE_SIG_REQ 13
+#define PKT_FILE_WANT_REQ 14
+#define PKT_FILE_RANGE_REQ 15
+#define PKT_TRACKER_ANNOUNCE 16
+#define PKT_TRACKER_QUERY 17
+#define PKT_TRACKER_REPLY 18
+#define PKT_TRACE_REQ 19
+#define PKT_TRACE_REPLY 20
+#define PKT_DNS_INVALIDATE 21
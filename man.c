@@ -5,8 +5,8 @@
 This file contains the implementation of a manager which is responsible
 for managing multiple hosts. It allows the user to interact with the
 hosts and perform various actions like changing the current host, displaying
-host's state, pinging a host, uploading a file to a host, and downloading a file
-from a host.
+host's state, pinging a host, uploading a file to a host or a multicast group,
+and downloading a file from a host or from every host that has it.
 */
 
 #include "man.h"
@@ -22,6 +22,9 @@ from a host.
 #include "main.h"
 #include "net.h"
 #include "dns.h"
+#include "packet.h"
+#include "timer.h"
+#include "dns_cache.h"
 
 #define MAXBUFFER 1000
 #define PIPE_WRITE 1
@@ -31,7 +34,6 @@ from a host.
 
 #define MAX_NAME_LENGTH 50
 #define DNS_SERVER_PHYS_ID 100
-#define TABLE_SIZE 20
 #define PING_BY_ID 1
 #define PING_BY_NAME 2
 
@@ -65,9 +67,21 @@ char man_get_user_cmd(int curr_host) {
     printf("   (h) Display all hosts\n");
     printf("   (c) Change host\n");
     printf("   (p) Ping a host\n");
+    printf("   (f) Flood a host with pings and show the RTT distribution\n");
+    printf("   (e) Trace the path to a host and show the time of each hop\n");
+    printf("   (t) Send a host test data and show the throughput\n");
     printf("   (r) Register domain name\n");
     printf("   (u) Upload a file to a host\n");
+    printf("   (z) Upload a file to a host with zero-copy splice\n");
+    printf("   (k) Upload a file to a host compressed\n");
+    printf("   (y) Upload only the changes to a file a host already has\n");
+    printf("   (x) Upload only the chunks a host does not already store\n");
     printf("   (d) Download a file from a host\n");
+    printf("   (w) Download a file from every host that has it\n");
+    printf("   (a) Tell the tracker the host has a file\n");
+    printf("   (j) Join a multicast group\n");
+    printf("   (l) Leave a multicast group\n");
+    printf("   (g) Upload a file to a multicast group\n");
     printf("   (q) Quit\n");
     printf("   Enter Command: ");
     do {
@@ -81,10 +95,22 @@ char man_get_user_cmd(int curr_host) {
       case 'h':
       case 'c':
       case 'p':
+      case 'f':
+      case 'e':
+      case 't':
       case 'u':
+      case 'z':
+      case 'k':
+      case 'y':
+      case 'x':
       case 'd':
+      case 'w':
+      case 'a':
       case 'q':
       case 'r':
+      case 'j':
+      case 'l':
+      case 'g':
         return cmd;
       default:
         printf("Invalid: you entered %c\n\n", cmd);
@@ -153,6 +179,7 @@ void display_host_state(struct man_port_at_man *curr_host) {
   char msg[MAN_MSG_LENGTH];
   char reply[MAN_MSG_LENGTH];
   char dir[NAME_LENGTH];
+  long long crc_errors = 0;
   int host_id;
   int n;
 
@@ -165,9 +192,10 @@ void display_host_state(struct man_port_at_man *curr_host) {
     n = read(curr_host->recv_fd, reply, MAN_MSG_LENGTH);
   }
   reply[n] = '\0';
-  sscanf(reply, "%s %d", dir, &host_id);
+  sscanf(reply, "%s %d %lld", dir, &host_id, &crc_errors);
   printf("Host %d state: \n", host_id);
   printf("    Directory = %s\n", dir);
+  printf("    Corrupt frames dropped = %lld\n", crc_errors);
 }
 
 /**
@@ -248,15 +276,20 @@ void ping(struct man_port_at_man *curr_host) {
       n = read(curr_host->recv_fd, reply, MAN_MSG_LENGTH);
      }
      reply[n] = '\0';
-     // Finish implementation HERE
-     // reply buffer stores the domain name from the dns server
-     // we convert it to a physical id and send a normal ping request
+     // The reply starts with the id, from the host's DNS cache or the
+     // DNS server, followed by how the name was answered
      int ping_id = atoi(reply);
+     if (strchr(reply, ' ') != NULL) {
+        printf("%s\n", strchr(reply, ' ') + 1);
+     }
      n = sprintf(msg, "p %d", ping_id);
      if (ping_id == curr_host->host_id){
         printf("Host is pinging itself\n");
      }
-     else if (ping_id < 0) { //returns -1 if not available
+     else if (ping_id == DNS_NO_ANSWER) {
+        printf("The DNS server did not answer\n");
+     }
+     else if (ping_id == DNS_NOT_REGISTERED) {
         printf("This domain name is not registered\n");
      }
      else { // If valid ping id send the ping request and wait to receive the acked msg
@@ -276,6 +309,103 @@ void ping(struct man_port_at_man *curr_host) {
   }
 }
 
+/**
+
+@brief Flood a host with pings from the current host.
+This function prompts the user for the host to ping, the number of pings
+and the time to send them for (0 for no limit, but not both), and the
+rate (0 to send a ping whenever a reply comes back).  It waits for the
+host to report the loss and the distribution of the round-trip times and
+displays it on the console.
+@param curr_host Pointer to the current host.
+*/
+void ping_flood(struct man_port_at_man *curr_host) {
+  char msg[MAN_MSG_LENGTH];
+  char reply[MAN_MSG_LENGTH];
+  int host_to_ping;
+  int count;
+  double seconds;
+  int rate;
+  int n;
+
+  printf("Enter id of host to ping: ");
+  scanf("%d", &host_to_ping);
+  printf("Enter number of pings (0 for no limit): ");
+  scanf("%d", &count);
+  printf("Enter seconds to ping for (0 for no limit): ");
+  scanf("%lf", &seconds);
+  printf("Enter pings per second (0 for as fast as they come back): ");
+  scanf("%d", &rate);
+
+  n = sprintf(msg, "f %d %d %f %d", host_to_ping, count, seconds, rate);
+  write(curr_host->send_fd, msg, n);
+  n = 0;
+  while (n <= 0) {
+    usleep(TENMILLISEC);
+    n = read(curr_host->recv_fd, reply, MAN_MSG_LENGTH);
+  }
+  reply[n] = '\0';
+  printf("%s\n", reply);
+}
+
+/**
+
+@brief Trace the path from the current host to another host.
+This function prompts the user for the host to trace.  The current host
+sends a trace packet that every switch and host on the way stamps, there
+and back, and the path is displayed with the time spent on each hop.
+@param curr_host Pointer to the current host.
+*/
+void trace_path(struct man_port_at_man *curr_host) {
+  char msg[MAN_MSG_LENGTH];
+  char reply[MAN_MSG_LENGTH];
+  int host_to_trace;
+  int n;
+
+  printf("Enter id of host to trace: ");
+  scanf("%d", &host_to_trace);
+
+  n = sprintf(msg, "e %d", host_to_trace);
+  write(curr_host->send_fd, msg, n);
+  n = 0;
+  while (n <= 0) {
+    usleep(TENMILLISEC);
+    n = read(curr_host->recv_fd, reply, MAN_MSG_LENGTH - 1);
+  }
+  reply[n] = '\0';
+  printf("%s\n", reply);
+}
+
+/**
+
+@brief Measure the throughput from the current host to another host.
+This function prompts the user for the destination, the number of bytes
+to send and the time to send for (0 for no limit, but not both).  The
+current host streams synthetic data to the destination over the same
+reliable transfer as an upload, and both hosts display the goodput,
+packet rate, losses and retransmissions when it ends.
+@param curr_host Pointer to the current host.
+*/
+void throughput_test(struct man_port_at_man *curr_host) {
+  char msg[MAN_MSG_LENGTH];
+  int host_id;
+  long long bytes;
+  double seconds;
+  int n;
+
+  printf("Enter id of host to send to: ");
+  scanf("%d", &host_id);
+  printf("Enter bytes to send (0 for no limit): ");
+  scanf("%lld", &bytes);
+  printf("Enter seconds to send for (0 for no limit): ");
+  scanf("%lf", &seconds);
+  printf("\n");
+
+  n = sprintf(msg, "t %d %lld %f", host_id, bytes, seconds);
+  write(curr_host->send_fd, msg, n);
+  usleep(TENMILLISEC);
+}
+
 // Send command to man to register domain name
 void register_domain_name(struct man_port_at_man *curr_host) {
    char msg[MAN_MSG_LENGTH];
@@ -293,11 +423,16 @@ void register_domain_name(struct man_port_at_man *curr_host) {
 @brief Upload a file from the current host to another host.
 This function prompts the user to enter the name of the file to transfer and the ID of the
 destination host. It then sends a command message to the current host to upload the file to
-the specified host.
+the specified host.  The command is 'u' for a normal upload, 'z' to have the
+host send the file data with splice() on its pipe links, 'k' to have it
+compress the file first, 'y' to have it send only what differs from the
+destination's copy of the file, or 'x' to have it send only the chunks
+missing from the destination's chunk store.
 @param curr_host Pointer to the current host.
+@param cmd 'u', 'z', 'k', 'y' or 'x'.
 @return 0 on success, -1 on failure.
 */
-int file_upload(struct man_port_at_man *curr_host) {
+int file_upload(struct man_port_at_man *curr_host, char cmd) {
   int n;
   int host_id;
   char name[NAME_LENGTH];
@@ -309,7 +444,66 @@ int file_upload(struct man_port_at_man *curr_host) {
   scanf("%d", &host_id);
   printf("\n");
 
-  n = sprintf(msg, "u %d %s", host_id, name);
+  n = snprintf(msg, sizeof(msg), "%c %d %s", cmd, host_id, name);
+  if (n >= (int)sizeof(msg)) n = sizeof(msg) - 1;   /* Name cut short */
+  write(curr_host->send_fd, msg, n);
+  usleep(TENMILLISEC);
+}
+
+/**
+
+@brief Join or leave a multicast group.
+This function prompts the user for a group number and sends a command message
+to the current host to join ('j') or leave ('l') the group.  The host announces
+the change to the switches, which only forward group traffic towards members.
+@param curr_host Pointer to the current host.
+@param cmd 'j' to join the group, 'l' to leave it.
+*/
+void mcast_membership(struct man_port_at_man *curr_host, char cmd) {
+  int n;
+  int group;
+  char msg[NAME_LENGTH];
+
+  printf("Enter multicast group (0-%d): ", MCAST_MAX_GROUPS - 1);
+  scanf("%d", &group);
+  printf("\n");
+  if (group < 0 || group >= MCAST_MAX_GROUPS) {
+    printf("Invalid group\n");
+    return;
+  }
+
+  n = sprintf(msg, "%c %d", cmd, group);
+  write(curr_host->send_fd, msg, n);
+  usleep(TENMILLISEC);
+}
+
+/**
+
+@brief Upload a file from the current host to a multicast group.
+This function prompts the user to enter the name of the file and the group
+number.  The file is sent once, addressed to the group, and the switches
+replicate it to every member; members ask the host for the packets they
+miss.
+@param curr_host Pointer to the current host.
+*/
+void file_upload_group(struct man_port_at_man *curr_host) {
+  int n;
+  int group;
+  char name[NAME_LENGTH];
+  char msg[NAME_LENGTH];
+
+  printf("Enter file name to upload: ");
+  scanf("%s", name);
+  printf("Enter multicast group (0-%d): ", MCAST_MAX_GROUPS - 1);
+  scanf("%d", &group);
+  printf("\n");
+  if (group < 0 || group >= MCAST_MAX_GROUPS) {
+    printf("Invalid group\n");
+    return;
+  }
+
+  n = snprintf(msg, sizeof(msg), "u %d %s", MCAST_ADDR(group), name);
+  if (n >= (int)sizeof(msg)) n = sizeof(msg) - 1;   /* Name cut short */
   write(curr_host->send_fd, msg, n);
   usleep(TENMILLISEC);
 }
@@ -317,30 +511,59 @@ int file_upload(struct man_port_at_man *curr_host) {
 /**
 
 @brief Download a file from a host.
-This function prompts the user to enter the name of the file to download and the ID of the
-host from which to download the file. It then sends a command message to the current host to
-download the file from the specified host.
+This function prompts the user to enter the name of the file to download, the ID of the
+host from which to download the file, and how many ranges of it to keep asked for at once.
+It then sends a command message to the current host to pull the file from the specified host.
 @param curr_host Pointer to the current host.
-@return 0 on success, -1 on failure.
 */
-int file_download(struct man_port_at_man *curr_host) {
+void file_download(struct man_port_at_man *curr_host) {
   int n;
   int host_id;
+  int depth;
   char name[NAME_LENGTH];
   char msg[NAME_LENGTH];
 
   printf("Enter file name to download: ");
   scanf("%s", name);
-  printf("Enter host id of destination: ");
+  printf("Enter host id of source: ");
   scanf("%d", &host_id);
+  printf("Enter ranges to keep asked for (0 for the default): ");
+  scanf("%d", &depth);
   printf("\n");
 
-  n = sprintf(msg, "u %d %s", host_id, name);
+  n = snprintf(msg, sizeof(msg), "d %d %d %s", host_id, depth, name);
+  if (n >= (int)sizeof(msg)) n = sizeof(msg) - 1;   /* Name cut short */
   write(curr_host->send_fd, msg, n);
   usleep(TENMILLISEC);
 }
 
 
+/**
+
+@brief Download a file from every host that has it, or announce a file.
+This function prompts the user to enter the name of a file.  With 'w' the
+current host asks the tracker, kept by the DNS host, which hosts have the
+file and downloads different ranges of it from each of them at once.
+With 'a' the current host tells the tracker that it has the file, so that
+it is one of the hosts asked.
+@param curr_host Pointer to the current host.
+@param cmd 'w' to download the file, 'a' to announce it.
+*/
+void file_swarm(struct man_port_at_man *curr_host, char cmd) {
+  int n;
+  char name[NAME_LENGTH];
+  char msg[NAME_LENGTH];
+
+  printf("Enter file name to %s: ", cmd == 'w' ? "download" : "announce");
+  scanf("%s", name);
+  printf("\n");
+
+  n = snprintf(msg, sizeof(msg), "%c %s", cmd, name);
+  if (n >= (int)sizeof(msg)) n = sizeof(msg) - 1;   /* Name cut short */
+  write(curr_host->send_fd, msg, n);
+  usleep(TENMILLISEC);
+}
+
 /**
 
 @brief Main loop of the manager.
@@ -378,16 +601,40 @@ void man_main() {
       case 'p': /* Ping a host from the current host */
         ping(curr_host);
         break;
+      case 'f': /* Flood a host with pings from the current host */
+        ping_flood(curr_host);
+        break;
+      case 'e': /* Trace the path to a host */
+        trace_path(curr_host);
+        break;
+      case 't': /* Measure the throughput to a host */
+        throughput_test(curr_host);
+        break;
       case 'u': /* Upload a file from the current host
                    to another host */
-        file_upload(curr_host);
+      case 'z': /* The same, sending the data with splice() */
+      case 'k': /* The same, compressing the file first */
+      case 'y': /* The same, sending only the changes */
+      case 'x': /* The same, sending only chunks not stored there */
+        file_upload(curr_host, cmd);
         break;
       case 'd': /* Download a file from a host */
         file_download(curr_host);
         break;
+      case 'w': /* Download a file from every host that has it */
+      case 'a': /* Tell the tracker the current host has a file */
+        file_swarm(curr_host, cmd);
+        break;
       case 'r': /* Register a domain name for the current host */
         register_domain_name(curr_host);
         break;
+      case 'j': /* Join a multicast group */
+      case 'l': /* Leave a multicast group */
+        mcast_membership(curr_host, cmd);
+        break;
+      case 'g': /* Upload a file to a multicast group */
+        file_upload_group(curr_host);
+        break;
       case 'q': /* Quit */
         return;
       default:
@@ -12,6 +12,7 @@ file.
 
 */
 
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -77,6 +78,11 @@ void create_node_list();
  */
 void create_port_list();
 
+/*
+ * Clears the per-port send and receive state of a new port
+ */
+static void net_port_init(struct net_port *p);
+
 /*
  * Creates ports at the manager and ports at the hosts so that
  * the manager can communicate with the hosts.  The list of
@@ -374,6 +380,22 @@ void create_node_list() {
 
 /**
 
+\brief Clears the per-port state of a new port.
+
+No splice staging pipe is open and no partial frame has been received.  The
+staging pipe is opened by the process that first splices on the port.
+\param p Port to initialize.
+*/
+static void net_port_init(struct net_port *p) {
+  p->splice_fd[0] = -1;
+  p->splice_fd[1] = -1;
+  p->splice_pending = 0;
+  p->splice_tail_len = 0;
+  p->recv_len = 0;
+}
+
+/**
+
 \brief Creates a port list based on the network configuration.
 
 This function reads the global network link data and creates a linked list
@@ -388,8 +410,16 @@ void create_port_list() {
   int node0, node1;
   int fd01[2];
   int fd10[2];
+  int pipe_bytes;
   int i;
 
+  /*
+   * NET367_PIPE=<bytes> shrinks every link pipe to that size (a page at
+   * least), so a busy link fills up and packets queue at the switches,
+   * to test congestion
+   */
+  pipe_bytes = getenv("NET367_PIPE") != NULL ? atoi(getenv("NET367_PIPE")) : 0;
+
   g_port_list = NULL;
   for (i = 0; i < g_net_link_num; i++) {
     if (g_net_link[i].type == PIPE) {
@@ -399,10 +429,12 @@ void create_port_list() {
       p0 = (struct net_port *)malloc(sizeof(struct net_port));
       p0->type = g_net_link[i].type;
       p0->pipe_host_id = node0;
+      net_port_init(p0);
 
       p1 = (struct net_port *)malloc(sizeof(struct net_port));
       p1->type = g_net_link[i].type;
       p1->pipe_host_id = node1;
+      net_port_init(p1);
 
       pipe(fd01); /* Create a pipe */
                   /* Make the pipe nonblocking at both ends */
@@ -422,6 +454,11 @@ void create_port_list() {
       p1->pipe_send_fd = fd10[PIPE_WRITE];
       p0->pipe_recv_fd = fd10[PIPE_READ];
 
+      if (pipe_bytes > 0) {
+        fcntl(fd01[PIPE_WRITE], F_SETPIPE_SZ, pipe_bytes);
+        fcntl(fd10[PIPE_WRITE], F_SETPIPE_SZ, pipe_bytes);
+      }
+
       p0->sock_host_id = -1;
       p1->sock_host_id = -1;
 
@@ -433,6 +470,7 @@ void create_port_list() {
       p0 = (struct net_port *)malloc(sizeof(struct net_port));
       p0->type = g_net_link[i].type;
       p0->sock_host_id = g_net_data->switch_host_id;
+      net_port_init(p0);
 
       p0->next = g_port_list;
       g_port_list = p0;
@@ -4,10 +4,15 @@
 
 This file provides an implementation for sending and receiving packets between hosts using either pipes or sockets as the underlying communication mechanism.
 
-The implementation includes two main functions:
+The implementation includes these main functions:
 
 packet_send(): Sends a packet through the specified network port.
+packet_send_iov(): Sends a packet whose payload is split between the packet and a separate buffer, without copying the buffer.
+packet_send_splice(): Sends a packet whose payload continues in a file, moving the file pages into the pipe with splice().
+packet_splice_flush(): Moves spliced frames that did not fit in the link yet.
 packet_recv(): Receives a packet from the specified network port.
+
+Every frame on a link ends with a 4-byte frame check sequence, the CRC32C of the frame header and payload, most significant byte first.  packet_recv() drops frames whose check sequence does not match, as a NIC drops frames with a bad FCS; the transfer protocol retransmits what is lost.  Setting NET367_CORRUPT to a percentage flips one bit in that share of received frames, to exercise the check.
 The file depends on the host.h, main.h, net.h, sockets.h, and packet.h header files.
 
 @see host.h
@@ -17,18 +22,139 @@ The file depends on the host.h, main.h, net.h, sockets.h, and packet.h header fi
 @see packet.h
 */
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "crc32c.h"
 #include "host.h"
 #include "main.h"
 #include "net.h"
 #include "sockets.h"
 #include "packet.h"
 
+static long long corrupt_frames;   /* Frames dropped for a bad FCS */
+static int corrupt_pct = -1;       /* NET367_CORRUPT, read on first use */
+
+/**
+@brief Stores a frame check sequence.
+@param fcs Where to store the 4 bytes.
+@param crc CRC32C of the frame header and payload.
+*/
+static void fcs_put(char *fcs, unsigned int crc) {
+  fcs[0] = (char)(crc >> 24);
+  fcs[1] = (char)(crc >> 16);
+  fcs[2] = (char)(crc >> 8);
+  fcs[3] = (char)crc;
+}
+
+/**
+@brief Returns the number of received frames dropped for a bad frame check sequence.
+*/
+long long packet_crc_errors() {
+  return (corrupt_frames);
+}
+
+/**
+@brief Opens the staging pipe used to splice frames on a port.
+
+The staging pipe and the link pipe are enlarged, since every spliced frame takes up to three pipe buffers (header and one or two file pages) instead of sharing one.
+
+@param port Pointer to the net_port structure of a pipe link.
+@return 0 on success, or -1 if the pipe could not be created.
+*/
+static int splice_stage_open(struct net_port *port) {
+  if (port->splice_fd[0] >= 0) return (0);
+
+  if (pipe(port->splice_fd) < 0) {
+    port->splice_fd[0] = -1;
+    port->splice_fd[1] = -1;
+    return (-1);
+  }
+  fcntl(port->splice_fd[0], F_SETFL,
+        fcntl(port->splice_fd[0], F_GETFL) | O_NONBLOCK);
+  fcntl(port->splice_fd[1], F_SETFL,
+        fcntl(port->splice_fd[1], F_GETFL) | O_NONBLOCK);
+  fcntl(port->splice_fd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+  fcntl(port->pipe_send_fd, F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+  port->splice_pending = 0;
+  port->splice_tail_len = 0;
+  return (0);
+}
+
+/**
+@brief Moves staged frames from the staging pipe into the link.
+
+Frames are built in the staging pipe, and splice() moves the pipe buffers to the link by reference.  When the link is full only part of the staged bytes move; the rest stays in the staging pipe, in order, for the next call.  The rest of a frame that the staging pipe had no room for (see splice_stage_write()) is staged as the link drains.
+
+@param port Pointer to the net_port structure to flush.
+@return The number of bytes not yet on the link, staged or waiting to be.
+*/
+int packet_splice_flush(struct net_port *port) {
+  ssize_t n;
+  int moved;
+
+  do {
+    moved = 0;
+    while (port->splice_pending > 0) {
+      n = splice(port->splice_fd[0], NULL, port->pipe_send_fd, NULL,
+                 port->splice_pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n <= 0) break;
+      port->splice_pending -= n;
+      moved = 1;
+    }
+    if (port->splice_tail_len > 0) {
+      n = write(port->splice_fd[1], port->splice_tail, port->splice_tail_len);
+      if (n > 0) {
+        port->splice_pending += n;
+        port->splice_tail_len -= n;
+        memmove(port->splice_tail, port->splice_tail + n,
+                port->splice_tail_len);
+        moved = 1;
+      }
+    }
+  } while (moved && port->splice_pending > 0);
+
+  return (port->splice_pending + port->splice_tail_len);
+}
+
+/**
+@brief Stages part of a frame.
+
+The frame must be finished, since the link has no other way to find where the next frame starts.  When the staging pipe has no room left, the frames staged before this one are moved on to the link.  If the link is full too, the rest of the frame is kept in the port and staged by packet_splice_flush() once the far end reads, and the link takes no other frame until then, so the host never waits for it.
+
+@param port Pointer to the net_port structure of a pipe link.
+@param buf Bytes to add to the frame.
+@param len Number of bytes.
+@return 0 once every byte is staged or kept, or -1 if the staging pipe failed.
+*/
+static int splice_stage_write(struct net_port *port, char *buf, int len) {
+  ssize_t n;
+  int left;
+
+  while (len > 0 && port->splice_tail_len == 0) {
+    n = write(port->splice_fd[1], buf, len);
+    if (n > 0) {
+      buf += n;
+      len -= n;
+      port->splice_pending += n;
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN) return (-1);
+    left = port->splice_pending;
+    if (left == 0 || packet_splice_flush(port) >= left) break;
+  }
+  memcpy(port->splice_tail + port->splice_tail_len, buf, len);
+  port->splice_tail_len += len;
+  return (0);
+}
+
 /**
 @brief Sends a packet through the specified network port.
 
@@ -36,10 +162,13 @@ The packet_send() function constructs a message from the given packet and sends
 
 @param port Pointer to the net_port structure containing the network port information to send the packet through.
 @param p Pointer to the packet structure containing the packet information to send.
+@return The number of bytes written, or a negative value if the link could not
+take the packet (e.g., a full nonblocking pipe returns EAGAIN).
 */
-void packet_send(struct net_port *port, struct packet *p) {
-  char msg[PAYLOAD_MAX + 4];
+int packet_send(struct net_port *port, struct packet *p) {
+  char msg[PAYLOAD_MAX + 4 + FRAME_FCS_LEN];
   int i;
+  int n = -1;
 
   if (port->type == PIPE) {
     msg[0] = (char)p->src;
@@ -49,14 +178,151 @@ void packet_send(struct net_port *port, struct packet *p) {
     for (i = 0; i < p->length; i++) {
       msg[i + 4] = p->payload[i];
     }
-    write(port->pipe_send_fd, msg, p->length + 4);
+    fcs_put(msg + p->length + 4, crc32c(0, msg, p->length + 4));
+    if ((port->splice_pending > 0 || port->splice_tail_len > 0) &&
+        packet_splice_flush(port) > 0) {
+      /* Queue behind the spliced frames so frames stay whole and in order */
+      if (port->splice_tail_len > 0 ||
+          port->splice_pending + p->length + 4 + FRAME_FCS_LEN >
+              SPLICE_STAGE_MAX ||
+          splice_stage_write(port, msg, p->length + 4 + FRAME_FCS_LEN) < 0) {
+        return (-1);
+      }
+      n = p->length + 4 + FRAME_FCS_LEN;
+      packet_splice_flush(port);
+    } else {
+      n = write(port->pipe_send_fd, msg, p->length + 4 + FRAME_FCS_LEN);
+    }
   } else if (port->type == SOCKET) {
     struct net_data **g_net_data_ptr = get_g_net_data();
     struct net_data *g_net_data = *g_net_data_ptr;
     create_client(g_net_data->send_domain, g_net_data->send_port, p);
+    n = p->length + 4 + FRAME_FCS_LEN;
   }
 
-  return;
+  return (n);
+}
+
+/**
+@brief Sends a packet whose payload continues in a separate buffer.
+
+The packet carries the first p->length bytes of the payload (typically a protocol header) and the remaining bytes are taken from data, for example a memory-mapped file.  On a pipe the frame header, the packet payload, data and the frame check sequence are written with one writev() so data is copied only once, into the kernel.  The frame is at most PIPE_BUF bytes, so the write is still atomic.  A socket link needs a contiguous packet, so the payload is assembled first.
+
+@param port Pointer to the net_port structure to send the packet through.
+@param p Pointer to the packet holding the header fields and the first part of the payload.
+@param data Pointer to the rest of the payload.
+@param length Number of bytes at data.  p->length + length must not exceed PAYLOAD_MAX.
+@return The number of bytes written, or a negative value if the link could not take the packet.
+*/
+int packet_send_iov(struct net_port *port, struct packet *p, char *data,
+                    int length) {
+  char hdr[4];
+  char fcs[FRAME_FCS_LEN];
+  struct iovec iov[4];
+  unsigned int crc;
+  struct packet whole;
+  int n = -1;
+
+  if (port->type == PIPE && port->splice_pending == 0 &&
+      port->splice_tail_len == 0) {
+    hdr[0] = (char)p->src;
+    hdr[1] = (char)p->dst;
+    hdr[2] = (char)p->type;
+    hdr[3] = (char)(p->length + length);
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = 4;
+    iov[1].iov_base = p->payload;
+    iov[1].iov_len = p->length;
+    iov[2].iov_base = data;
+    iov[2].iov_len = length;
+    crc = crc32c(0, hdr, 4);
+    crc = crc32c(crc, p->payload, p->length);
+    fcs_put(fcs, crc32c(crc, data, length));
+    iov[3].iov_base = fcs;
+    iov[3].iov_len = FRAME_FCS_LEN;
+    n = writev(port->pipe_send_fd, iov, 4);
+  } else {
+    whole = *p;
+    memcpy(whole.payload + p->length, data, length);
+    whole.length = p->length + length;
+    n = packet_send(port, &whole);
+  }
+
+  return (n);
+}
+
+/**
+@brief Sends a packet whose payload continues in a file, without copying the file data.
+
+On a pipe the frame is built in the port's staging pipe: the frame header and packet payload are written (a few bytes), then splice() adds the file pages by reference, and the frame check sequence is written after them, and the whole frame is spliced on to the link.  The file data never enters the staging buffer in user space; the check sequence is computed from data, a mapping of the same bytes.  The frame is only staged if the staging pipe has room for all of it.  If splice() moves only part of the data, the rest is copied from data, and once the header is staged the rest of the frame is always staged after it, or kept in the port until the link drains (see splice_stage_write()), so a frame is never left half built.  A socket link reads the data with pread() and sends a normal packet.
+
+The file must not change while frames referencing it may still be in a pipe.
+
+@param port Pointer to the net_port structure to send the packet through.
+@param p Pointer to the packet holding the header fields and the first part of the payload.
+@param fd File descriptor of the file holding the rest of the payload.
+@param offset File offset of the rest of the payload.
+@param data The same bytes in memory, for the frame check sequence.
+@param length Number of bytes to take from the file.  p->length + length must not exceed PAYLOAD_MAX.
+@return The number of bytes accepted, or a negative value if the link could not take the packet.
+*/
+int packet_send_splice(struct net_port *port, struct packet *p, int fd,
+                       long long offset, char *data, int length) {
+  char msg[PAYLOAD_MAX + 4];
+  char fcs[FRAME_FCS_LEN];
+  unsigned int crc;
+  struct packet whole;
+  loff_t off;
+  ssize_t n;
+  int total;
+  int i;
+
+  if (port->type != PIPE || splice_stage_open(port) < 0) {
+    whole = *p;
+    if (pread(fd, whole.payload + p->length, length, offset) != length) {
+      return (-1);
+    }
+    whole.length = p->length + length;
+    return (packet_send(port, &whole));
+  }
+
+  total = 4 + p->length + length + FRAME_FCS_LEN;
+  if (port->splice_tail_len > 0) packet_splice_flush(port);
+  if (port->splice_tail_len > 0 ||
+      (port->splice_pending + total > SPLICE_STAGE_MAX &&
+       packet_splice_flush(port) + total > SPLICE_STAGE_MAX)) {
+    return (-1);
+  }
+
+  msg[0] = (char)p->src;
+  msg[1] = (char)p->dst;
+  msg[2] = (char)p->type;
+  msg[3] = (char)(p->length + length);
+  for (i = 0; i < p->length; i++) {
+    msg[i + 4] = p->payload[i];
+  }
+  if (splice_stage_write(port, msg, p->length + 4) < 0) return (-1);
+  crc = crc32c(0, msg, p->length + 4);
+  fcs_put(fcs, crc32c(crc, data, length));
+
+  off = offset;
+  n = 0;
+  while (n < length && port->splice_tail_len == 0) {
+    ssize_t m = splice(fd, &off, port->splice_fd[1], NULL, length - n,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (m <= 0) break;
+    n += m;
+    port->splice_pending += m;
+  }
+  /* The header is already staged, so finish the frame by copying */
+  if (splice_stage_write(port, data + n, length - n) < 0 ||
+      splice_stage_write(port, fcs, FRAME_FCS_LEN) < 0) {
+    /* The staging pipe broke; the rest of the frame is lost with it */
+    return (-1);
+  }
+
+  packet_splice_flush(port);
+  return (total);
 }
 
 /**
@@ -64,30 +330,78 @@ void packet_send(struct net_port *port, struct packet *p) {
 
 The packet_recv() function reads a message from the specified network port and extracts the packet information from it. The function returns the number of bytes received, or a negative value in case of an error.
 
+Exactly one packet is read per call.  The 4-byte header is read first and then only the number of payload bytes it announces, so packets queued back to back in the pipe are not merged into a single read.  The frame check sequence that follows the payload is verified, and a frame that fails it is dropped and counted.  A frame moved by splice() may arrive in pieces, so the bytes read so far are kept in the port and the call returns 0 until the frame is complete.
+
 @param port Pointer to the net_port structure containing the network port information to receive the packet from.
 @param p Pointer to the packet structure to store the received packet information.
-@return The number of bytes received, or a negative value in case of an error.
+@return The number of bytes received, or a negative value in case of an error or a corrupt frame.
 */
 int packet_recv(struct net_port *port, struct packet *p) {
-  char msg[PAYLOAD_MAX + 4];
+  char *msg = port->recv_buf;
+  int fd;
+  unsigned int crc;
+  char *env;
+  int want;
+  int len;
   int n;
   int i;
 
   if (port->type == PIPE) {
-    n = read(port->pipe_recv_fd, msg, PAYLOAD_MAX + 4);
+    fd = port->pipe_recv_fd;
   } else if (port->type == SOCKET) {
     struct net_data **g_net_data_ptr = get_g_net_data();
     struct net_data *g_net_data = *g_net_data_ptr;
-    n = read(g_net_data->server_pipe, msg, PAYLOAD_MAX + 4);
+    fd = g_net_data->server_pipe;
+  } else {
+    return (-1);
   }
-  if (n > 0) {
-    p->src = (char)msg[0];
-    p->dst = (char)msg[1];
-    p->type = (char)msg[2];
-    p->length = (int)msg[3];
-    for (i = 0; i < p->length; i++) {
-      p->payload[i] = msg[i + 4];
+
+  /* Read the header, then the payload it announces and the check sequence */
+  for (;;) {
+    if (port->recv_len < 4) {
+      want = 4 - port->recv_len;
+    } else {
+      want = 4 + (unsigned char)msg[3] + FRAME_FCS_LEN - port->recv_len;
+      if ((unsigned char)msg[3] > PAYLOAD_MAX) {
+        port->recv_len = 0;
+        return (-1);
+      }
+      if (want == 0) break;
+    }
+    n = read(fd, msg + port->recv_len, want);
+    if (n <= 0) {
+      return (port->recv_len > 0 ? 0 : n);
     }
+    port->recv_len += n;
+  }
+
+  n = port->recv_len;
+  port->recv_len = 0;
+  len = n - FRAME_FCS_LEN;
+
+  if (corrupt_pct < 0) {
+    env = getenv("NET367_CORRUPT");
+    corrupt_pct = env != NULL ? atoi(env) : 0;
+  }
+  if (corrupt_pct > 0 && rand() % 100 < corrupt_pct) {
+    msg[rand() % len] ^= (char)(1 << (rand() % 8));
+  }
+
+  crc = crc32c(0, msg, len);
+  if ((unsigned char)msg[len] != (crc >> 24) ||
+      (unsigned char)msg[len + 1] != ((crc >> 16) & 0xff) ||
+      (unsigned char)msg[len + 2] != ((crc >> 8) & 0xff) ||
+      (unsigned char)msg[len + 3] != (crc & 0xff)) {
+    corrupt_frames++;
+    return (-1);
+  }
+
+  p->src = (char)msg[0];
+  p->dst = (char)msg[1];
+  p->type = (char)msg[2];
+  p->length = (unsigned char)msg[3];
+  for (i = 0; i < p->length; i++) {
+    p->payload[i] = msg[i + 4];
   }
 
   return (n);
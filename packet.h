@@ -1,11 +1,33 @@
 /* Definitions and prototypes for the link (link.c)
  */
 
+/*
+ * Spliced frames are staged in a per-port pipe and moved to the link by
+ * reference.  Both pipes are enlarged to SPLICE_PIPE_SIZE, and at most
+ * SPLICE_STAGE_MAX bytes are staged so the staging pipe never runs out
+ * of buffers in the middle of a frame.
+ */
+#define SPLICE_PIPE_SIZE (1 << 20)
+#define SPLICE_STAGE_MAX 4096
+
+/* Every frame ends with the CRC32C of its header and payload */
+#define FRAME_FCS_LEN 4
+
 
 // receive packet on port
 int packet_recv(struct net_port *port, struct packet *p);
 
-// send packet on port
-void packet_send(struct net_port *port, struct packet *p);
+// send packet on port, returns bytes written or -1 if the link is full
+int packet_send(struct net_port *port, struct packet *p);
+
+// send packet whose payload continues at data, without copying data
+int packet_send_iov(struct net_port *port, struct packet *p, char *data, int length);
+
+// send packet whose payload continues in file fd at offset, using splice()
+int packet_send_splice(struct net_port *port, struct packet *p, int fd, long long offset, char *data, int length);
 
+// move staged spliced frames to the link, returns bytes not yet on it
+int packet_splice_flush(struct net_port *port);
 
+// number of received frames dropped for a bad frame check sequence
+long long packet_crc_errors();
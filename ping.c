@@ -0,0 +1,432 @@
+/**
+
+@file ping.c
+@brief Pings with identifiers, sequence numbers and round-trip times.
+
+A ping request (PKT_PING_REQ) starts with a 16-bit identifier and a
+32-bit sequence number, and the host that is pinged echoes the payload
+back in its PKT_PING_REPLY.  Every ping command of a host gets a new
+identifier, and the pings it sends are numbered from 0.
+
+The pinging host keeps each request in its table of outstanding pings,
+with the time it was sent on the monotonic clock, until the reply with
+the same source, identifier and sequence number arrives.  The
+round-trip time is then reported to the manager in microseconds.  Each
+request has a timer in the host's timer wheel, and one that goes off
+before its reply is reported as timed out and leaves the table, so a
+reply that comes later, or one that answers a ping of an earlier command,
+is not taken for the reply of another ping.
+
+A flood sends pings to one host under one identifier, either at a rate
+or, like ping -f, a new one whenever a reply comes back and at least
+every PING_FLOOD_INTERVAL.  It stops after a number of pings or a time,
+and once the last reply is in or timed out it reports the loss and the
+minimum, mean, median, 99th and 99.9th percentile and maximum round-trip
+time.  The times are kept in an HDR-style histogram: a bucket per
+microsecond below PING_HIST_SUB, then PING_HIST_SUB / 2 buckets for each
+power of two, so every percentile is within 1.6% of the exact one while
+the histogram has a fixed size and recording is O(1).
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "packet.h"
+#include "time_util.h"
+#include "timer.h"
+#include "ping.h"
+
+/**
+
+@brief Store a 32-bit value in big-endian order.
+@param buf Destination, at least 4 bytes.
+@param v Value to store.
+*/
+static void ping_put_u32(char *buf, unsigned int v) {
+  buf[0] = (char)(v >> 24);
+  buf[1] = (char)(v >> 16);
+  buf[2] = (char)(v >> 8);
+  buf[3] = (char)v;
+}
+
+/**
+
+@brief Load a 32-bit value stored in big-endian order.
+@param buf Source, at least 4 bytes.
+@return The value.
+*/
+static unsigned int ping_get_u32(char *buf) {
+  return ((unsigned int)(unsigned char)buf[0] << 24) |
+         ((unsigned int)(unsigned char)buf[1] << 16) |
+         ((unsigned int)(unsigned char)buf[2] << 8) |
+         (unsigned int)(unsigned char)buf[3];
+}
+
+/**
+
+@brief Find the bucket of a value in a histogram.
+@param v The value, from 0 to PING_HIST_MAX.
+@return Index of its bucket.
+*/
+static int ping_hist_index(long long v) {
+  int e;
+
+  if (v < PING_HIST_SUB) return (int)v;
+  for (e = PING_HIST_SUB_BITS; (v >> (e + 1)) != 0; e++)
+    ;
+  return PING_HIST_SUB + (e - PING_HIST_SUB_BITS) * (PING_HIST_SUB / 2) +
+         (int)(v >> (e - PING_HIST_SUB_BITS + 1)) - PING_HIST_SUB / 2;
+}
+
+/**
+
+@brief Find the highest value recorded in a bucket of a histogram.
+@param i Index of the bucket.
+@return The value.
+*/
+static long long ping_hist_highest(int i) {
+  int k;
+  int e;
+  long long sub;
+
+  if (i < PING_HIST_SUB) return i;
+  k = i - PING_HIST_SUB;
+  e = k / (PING_HIST_SUB / 2) + PING_HIST_SUB_BITS;
+  sub = k % (PING_HIST_SUB / 2) + PING_HIST_SUB / 2;
+  return ((sub + 1) << (e - PING_HIST_SUB_BITS + 1)) - 1;
+}
+
+/**
+
+@brief Record a value in a histogram.
+@param h Pointer to the histogram.
+@param v The value.
+*/
+static void ping_hist_record(struct ping_hist *h, long long v) {
+  if (v < 0) v = 0;
+  if (v > PING_HIST_MAX) v = PING_HIST_MAX;
+  h->count[ping_hist_index(v)]++;
+  if (h->n == 0 || v < h->min) h->min = v;
+  if (v > h->max) h->max = v;
+  h->sum += v;
+  h->n++;
+}
+
+/**
+
+@brief Find the value below which a share of the values in a histogram
+fall.
+@param h Pointer to the histogram, not empty.
+@param pct The share, in percent.
+@return The highest value of the bucket of that value, at most the
+largest value recorded.
+*/
+static long long ping_hist_percentile(struct ping_hist *h, double pct) {
+  long long rank = (long long)(pct / 100.0 * h->n + 0.999999);
+  long long seen = 0;
+  int i;
+
+  if (rank < 1) rank = 1;
+  for (i = 0; i < PING_HIST_BUCKETS; i++) {
+    seen += h->count[i];
+    if (seen >= rank) break;
+  }
+  return ping_hist_highest(i) < h->max ? ping_hist_highest(i) : h->max;
+}
+
+/**
+
+@brief Send a message to the manager.
+@param pt Pointer to the table.
+@param msg The message.
+*/
+static void ping_report(struct ping_table *pt, char *msg) {
+  write(pt->man_fd, msg, strlen(msg) + 1);
+}
+
+static void ping_flood_pump(struct ping_table *pt, int replied);
+static void ping_flood_due(void *arg);
+
+/**
+
+@brief Report a ping whose reply did not come in time, when its timer
+goes off.
+@param arg Pointer to the ping.
+*/
+static void ping_timed_out(void *arg) {
+  struct ping_req *r = (struct ping_req *)arg;
+  struct ping_table *pt = r->table;
+  char msg[100];
+
+  r->used = 0;
+  pt->outstanding--;
+  pt->timeouts++;
+  if (r->flood) {
+    pt->flood.outstanding--;
+    pt->flood.lost++;
+    ping_flood_pump(pt, 0);
+    return;
+  }
+  snprintf(msg, sizeof(msg), "Ping time out! to %d: id=%u seq=%u", r->dst,
+           r->id, r->seq);
+  ping_report(pt, msg);
+}
+
+/**
+
+@brief Initialize the table with no pings outstanding.
+@param pt Pointer to the table.
+@param host_id ID of this host.
+@param man_fd Pipe to the manager.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+@param timers Pointer to the host's timer wheel.
+*/
+void ping_table_init(struct ping_table *pt, int host_id, int man_fd,
+                     struct net_port **node_port, int node_port_num,
+                     struct timer_wheel *timers) {
+  int i;
+
+  memset(pt, 0, sizeof(struct ping_table));
+  pt->host_id = host_id;
+  pt->man_fd = man_fd;
+  pt->node_port = node_port;
+  pt->node_port_num = node_port_num;
+  pt->timers = timers;
+  pt->next_id = (unsigned int)host_id << 8;
+  for (i = 0; i < PING_MAX_OUTSTANDING; i++) {
+    pt->req[i].table = pt;
+    timer_init(&pt->req[i].timer, ping_timed_out, &pt->req[i]);
+  }
+  timer_init(&pt->flood.timer, ping_flood_due, pt);
+}
+
+/**
+
+@brief Send a ping request and keep it in the table until its reply.
+@param pt Pointer to the table.
+@param dst Host to ping.
+@param id Identifier of the ping.
+@param seq Sequence number of the ping.
+@param flood Whether the flood sends it.
+@return Pointer to the request, or NULL if too many are outstanding.
+*/
+static struct ping_req *ping_send_req(struct ping_table *pt, int dst,
+                                      unsigned int id, unsigned int seq,
+                                      int flood) {
+  struct ping_req *r;
+  struct packet pkt;
+  int i;
+  int k;
+
+  for (i = 0; i < PING_MAX_OUTSTANDING && pt->req[i].used; i++)
+    ;
+  if (i == PING_MAX_OUTSTANDING) return NULL;
+  r = &pt->req[i];
+  r->used = 1;
+  r->flood = flood;
+  r->dst = dst;
+  r->id = id;
+  r->seq = seq;
+
+  pkt.src = (char)pt->host_id;
+  pkt.dst = (char)dst;
+  pkt.type = (char)PKT_PING_REQ;
+  pkt.payload[0] = (char)(id >> 8);
+  pkt.payload[1] = (char)id;
+  ping_put_u32(pkt.payload + 2, seq);
+  pkt.length = PING_HDR_LEN;
+
+  r->sent_time = time_now_usec();
+  for (k = 0; k < pt->node_port_num; k++) {
+    packet_send(pt->node_port[k], &pkt);
+  }
+  timer_add(pt->timers, &r->timer, r->sent_time + PING_TIMEOUT);
+  pt->outstanding++;
+  pt->sent++;
+  return r;
+}
+
+/**
+
+@brief Send a ping and report its reply or time out to the manager.
+@param pt Pointer to the table.
+@param dst Host to ping.
+@return 1 if the ping was sent, 0 if too many are outstanding.
+*/
+int ping_send(struct ping_table *pt, int dst) {
+  return ping_send_req(pt, dst, pt->next_id++ & 0xffff, 0, 0) != NULL;
+}
+
+/**
+
+@brief Report the results of a flood to the manager and end it.
+@param pt Pointer to the table.
+*/
+static void ping_flood_finish(struct ping_table *pt) {
+  struct ping_flood *f = &pt->flood;
+  struct ping_hist *h = &f->hist;
+  char msg[300];
+  double secs;
+  int n;
+
+  secs = (time_now_usec() - f->start_time) / 1e6;
+  n = snprintf(msg, sizeof(msg), "Flood to %d: %u sent, %lld received, "
+               "%.1f%% loss, %.3f s (%.0f pings/s)", f->dst, f->seq,
+               f->received, f->seq > 0 ? 100.0 * f->lost / f->seq : 0.0,
+               secs, secs > 0 ? f->seq / secs : 0.0);
+  if (h->n > 0 && n < (int)sizeof(msg)) {
+    snprintf(msg + n, sizeof(msg) - n, "\nrtt min/avg/p50/p99/p99.9/max = "
+             "%lld/%.0f/%lld/%lld/%lld/%lld us", h->min,
+             (double)h->sum / h->n, ping_hist_percentile(h, 50.0),
+             ping_hist_percentile(h, 99.0), ping_hist_percentile(h, 99.9),
+             h->max);
+  }
+  timer_cancel(pt->timers, &f->timer);
+  f->active = 0;
+  ping_report(pt, msg);
+}
+
+/**
+
+@brief Send the flood's pings that are due, and end it once it has sent
+them all and has their results.
+@param pt Pointer to the table.
+@param replied Whether a reply just came, which without a rate lets the
+next ping go.
+*/
+static void ping_flood_pump(struct ping_table *pt, int replied) {
+  struct ping_flood *f = &pt->flood;
+  long long now = time_now_usec();
+
+  if (!f->active) return;
+  while ((f->count == 0 || f->seq < (unsigned int)f->count) &&
+         (f->end_time == 0 || now < f->end_time)) {
+    if (f->next_time > now && !(replied && f->interval == 0)) break;
+    if (ping_send_req(pt, f->dst, f->id, f->seq, 1) == NULL) break;
+    f->seq++;
+    f->outstanding++;
+    if (f->interval == 0) {
+      f->next_time = now + PING_FLOOD_INTERVAL;
+      break;
+    }
+    f->next_time += f->interval;
+  }
+
+  if ((f->count == 0 || f->seq < (unsigned int)f->count) &&
+      (f->end_time == 0 || now < f->end_time)) {
+    timer_add(pt->timers, &f->timer, f->next_time);
+  } else if (f->outstanding == 0) {
+    ping_flood_finish(pt);
+  } else {
+    timer_cancel(pt->timers, &f->timer);
+  }
+}
+
+/**
+
+@brief Send the flood's next pings, when its timer goes off.
+@param arg Pointer to the table.
+*/
+static void ping_flood_due(void *arg) {
+  ping_flood_pump((struct ping_table *)arg, 0);
+}
+
+/**
+
+@brief Start a flood of pings to a host.
+@param pt Pointer to the table.
+@param dst Host to ping.
+@param count Pings to send, or 0 for no limit.
+@param seconds Time to send for, or 0 for no limit.
+@param rate Pings per second, or 0 to send one whenever a reply comes
+back and at least every PING_FLOOD_INTERVAL.
+@return 1 if the flood started, 0 if one is running or there is no
+limit on it.
+*/
+int ping_flood_start(struct ping_table *pt, int dst, int count,
+                     double seconds, int rate) {
+  struct ping_flood *f = &pt->flood;
+
+  if (f->active || count < 0 || seconds < 0 || rate < 0) return 0;
+  if (count == 0 && seconds == 0) return 0;
+  memset(&f->hist, 0, sizeof(struct ping_hist));
+  f->active = 1;
+  f->dst = dst;
+  f->id = pt->next_id++ & 0xffff;
+  f->seq = 0;
+  f->count = count;
+  f->start_time = time_now_usec();
+  f->end_time = seconds > 0 ? f->start_time + (long long)(seconds * 1e6) : 0;
+  f->interval = rate > 0 ? 1000000 / rate : 0;
+  if (rate > 0 && f->interval == 0) f->interval = 1;
+  f->next_time = f->start_time;
+  f->outstanding = 0;
+  f->received = 0;
+  f->lost = 0;
+  ping_flood_pump(pt, 0);
+  return 1;
+}
+
+/**
+
+@brief Match a ping reply to its request and report the round-trip time,
+or record it in the flood's histogram.
+@param pt Pointer to the table.
+@param pkt The PKT_PING_REPLY packet.
+*/
+void ping_reply(struct ping_table *pt, struct packet *pkt) {
+  long long rtt = time_now_usec();
+  struct ping_req *r;
+  unsigned int id;
+  unsigned int seq;
+  char msg[100];
+  int i;
+
+  if (pkt->length < PING_HDR_LEN) {
+    pt->unmatched++;
+    return;
+  }
+  id = ((unsigned int)(unsigned char)pkt->payload[0] << 8) |
+       (unsigned char)pkt->payload[1];
+  seq = ping_get_u32(pkt->payload + 2);
+
+  for (i = 0; i < PING_MAX_OUTSTANDING; i++) {
+    r = &pt->req[i];
+    if (r->used && r->dst == pkt->src && r->id == id && r->seq == seq) break;
+  }
+  if (i == PING_MAX_OUTSTANDING) {
+    pt->unmatched++;
+    return;
+  }
+  rtt -= r->sent_time;
+  timer_cancel(pt->timers, &r->timer);
+  r->used = 0;
+  pt->outstanding--;
+  pt->acked++;
+
+  if (r->flood) {
+    pt->flood.outstanding--;
+    pt->flood.received++;
+    ping_hist_record(&pt->flood.hist, rtt);
+    ping_flood_pump(pt, 1);
+    return;
+  }
+  snprintf(msg, sizeof(msg), "Ping acked! from %d: id=%u seq=%u time=%lld us",
+           pkt->src, id, seq, rtt);
+  ping_report(pt, msg);
+}
+
+/**
+
+@brief Print the ping statistics of a host.
+@param pt Pointer to the table.
+*/
+void display_ping_stats(struct ping_table *pt) {
+  printf("Host %d pings: %lld sent, %lld acked, %lld timed out, "
+         "%lld unmatched replies, %d outstanding\n",
+         pt->host_id, pt->sent, pt->acked, pt->timeouts, pt->unmatched,
+         pt->outstanding);
+}
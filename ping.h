@@ -0,0 +1,95 @@
+/*
+ * ping.h
+ *
+ * Pings of a host.  Each request carries an identifier and a sequence
+ * number, and waits in the host's table of outstanding pings until its
+ * reply comes back or its timer goes off.  A flood sends many pings and
+ * reports the distribution of their round-trip times.
+ * Requires main.h, packet.h and timer.h to be included first.
+ */
+
+#define PING_MAX_OUTSTANDING 64   /* Pings a host waits for at once */
+#define PING_TIMEOUT 100000       /* Time to wait for a ping reply (100 ms) */
+#define PING_HDR_LEN 6            /* Identifier and sequence number in the payload */
+#define PING_FLOOD_INTERVAL 10000 /* Flood without a rate: a ping per reply, or per 10 ms */
+
+/*
+ * Histogram of round-trip times in microseconds, HDR style: exact below
+ * PING_HIST_SUB, then PING_HIST_SUB / 2 buckets for every power of two,
+ * so a value is recorded within 1.6% up to PING_HIST_MAX.
+ */
+#define PING_HIST_SUB_BITS 7
+#define PING_HIST_SUB (1 << PING_HIST_SUB_BITS)
+#define PING_HIST_MAX_BITS 31
+#define PING_HIST_MAX ((1LL << PING_HIST_MAX_BITS) - 1)   /* About 36 minutes */
+#define PING_HIST_BUCKETS \
+   (PING_HIST_SUB + (PING_HIST_MAX_BITS - PING_HIST_SUB_BITS) * PING_HIST_SUB / 2)
+
+struct ping_table;
+
+/* A ping waiting for its reply */
+struct ping_req {
+   struct timer timer;      /* Goes off after PING_TIMEOUT */
+   struct ping_table *table;
+   int used;
+   int flood;               /* Sent by the flood, which counts its result */
+   int dst;
+   unsigned int id;         /* 16 bits, one per ping command */
+   unsigned int seq;
+   long long sent_time;     /* Monotonic clock, in microseconds */
+};
+
+struct ping_hist {
+   long long count[PING_HIST_BUCKETS];
+   long long n;
+   long long min;
+   long long max;
+   long long sum;
+};
+
+/* Pings sent to one host as fast as they come back, or at a rate */
+struct ping_flood {
+   int active;
+   int dst;
+   unsigned int id;
+   unsigned int seq;        /* Next to send */
+   int count;               /* Pings to send, 0 for no limit */
+   long long end_time;      /* Stop sending then, 0 for no limit */
+   long long interval;      /* Between pings, 0 to send on every reply */
+   long long next_time;     /* Of the next ping */
+   struct timer timer;      /* Goes off at next_time */
+   int outstanding;
+   long long start_time;
+
+   /* Results */
+   long long received;
+   long long lost;
+   struct ping_hist hist;
+};
+
+struct ping_table {
+   int host_id;
+   int man_fd;              /* Pipe the results are reported on */
+   struct net_port **node_port;
+   int node_port_num;
+   struct timer_wheel *timers;
+   unsigned int next_id;
+   struct ping_req req[PING_MAX_OUTSTANDING];
+   int outstanding;
+   struct ping_flood flood;
+
+   /* Statistics */
+   long long sent;
+   long long acked;
+   long long timeouts;
+   long long unmatched;     /* Replies too late, or to no ping of this host */
+};
+
+void ping_table_init(struct ping_table *pt, int host_id, int man_fd,
+      struct net_port **node_port, int node_port_num,
+      struct timer_wheel *timers);
+int ping_send(struct ping_table *pt, int dst);
+int ping_flood_start(struct ping_table *pt, int dst, int count,
+      double seconds, int rate);
+void ping_reply(struct ping_table *pt, struct packet *pkt);
+void display_ping_stats(struct ping_table *pt);
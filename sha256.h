@@ -0,0 +1,24 @@
+/*
+ * sha256.h
+ *
+ * SHA-256, the content hash that names chunks in the chunk store.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_LEN 32
+
+struct sha256 {
+   uint32_t h[8];
+   uint64_t len;        /* Bytes hashed so far */
+   unsigned char buf[64];
+   int used;            /* Bytes waiting in buf */
+};
+
+void sha256_init(struct sha256 *s);
+void sha256_update(struct sha256 *s, const void *data, size_t len);
+void sha256_final(struct sha256 *s, unsigned char out[SHA256_LEN]);
+
+/* Hash of one buffer */
+void sha256(const void *data, size_t len, unsigned char out[SHA256_LEN]);
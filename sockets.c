@@ -31,6 +31,7 @@ in a network. The client socket is set to non-blocking mode to allow for asynchr
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include "crc32c.h"
 #include "host.h"
 #include "main.h"
 #include "net.h"
@@ -39,14 +40,15 @@ in a network. The client socket is set to non-blocking mode to allow for asynchr
 /**
 @brief Sends a packet by writing its message format to the given pipe.
 
-This function converts the given packet to a message format and writes the message to the specified pipe file descriptor.
+This function converts the given packet to a message format, followed by the CRC32C frame check sequence that packet_recv() verifies, and writes the message to the specified pipe file descriptor.
 
 @param pipe_fd The file descriptor of the pipe to write the message to.
 @param p Pointer to the packet structure to be sent.
 */
 
 void send_packet(int pipe_fd, struct packet *p) {
-  char msg[PAYLOAD_MAX + 4];
+  char msg[PAYLOAD_MAX + 8];
+  unsigned int crc;
   int i;
 
   // Convert the packet to a message format
@@ -57,9 +59,14 @@ void send_packet(int pipe_fd, struct packet *p) {
   for (i = 0; i < p->length; i++) {
     msg[i + 4] = p->payload[i];
   }
+  crc = crc32c(0, msg, p->length + 4);
+  msg[p->length + 4] = (char)(crc >> 24);
+  msg[p->length + 5] = (char)(crc >> 16);
+  msg[p->length + 6] = (char)(crc >> 8);
+  msg[p->length + 7] = (char)crc;
 
   // Write the message to the pipe
-  write(pipe_fd, msg, p->length + 4);
+  write(pipe_fd, msg, p->length + 8);
 }
 
 /**
@@ -143,7 +150,7 @@ void create_server(int port, int pipe_fd) {
     }
 
     // Read data from the client and send it to the pipe
-    char buffer[PAYLOAD_MAX + 4] = {0};
+    char buffer[PAYLOAD_MAX + 8] = {0};
     int valread = read(client_fd, buffer, sizeof(buffer));
     write(pipe_fd, buffer, valread);
 
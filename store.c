@@ -0,0 +1,719 @@
+/**
+
+@file store.c
+@brief Content-addressed chunk store.
+
+Each host keeps a store in .store in its directory.  A file is split into
+chunks of STORE_CHUNK bytes, each named by its SHA-256.  The store holds
+whole files as objects named f-<hash of the manifest>, and an index entry
+c-<hash of a chunk> per chunk, giving an object that holds the chunk and
+its offset there.  The file a user sees is a hard link to its object, so
+the same content received many times, under any name, is stored once.
+
+An upload that deduplicates first sends the manifest of the file: its
+size and the hash of every chunk.  The receiver answers with a want list,
+a bit per chunk it could not find in its store, and the sender packs only
+those chunks.  The receiver then assembles the file from the pack, its
+store and chunks repeated within the file.  A chunk copied from another
+object is cloned (FICLONERANGE) where the file system shares blocks, and
+written out otherwise.
+
+Every chunk taken from the store is read back and its hash checked, so a
+stored file that was changed or removed since costs a transfer, never a
+wrong file.  Nothing is removed from the store; deleting .store frees it.
+*/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crc32c.h"
+#include "sha256.h"
+#include "store.h"
+
+/* A manifest, loaded whole */
+struct store_manifest {
+  char *raw;           /* The manifest as sent */
+  long long raw_len;
+  unsigned int crc;    /* CRC32C of raw */
+  long long size;      /* Size of the file */
+  int chunk;
+  long long count;
+  unsigned char *hash; /* count SHA-256 hashes */
+};
+
+/**
+
+@brief Store a 32-bit value in big-endian order.
+@param buf Destination, at least 4 bytes.
+@param v Value to store.
+*/
+static void store_put_u32(char *buf, uint32_t v) {
+  buf[0] = (char)(v >> 24);
+  buf[1] = (char)(v >> 16);
+  buf[2] = (char)(v >> 8);
+  buf[3] = (char)v;
+}
+
+/**
+
+@brief Load a 32-bit value stored in big-endian order.
+@param buf Source, at least 4 bytes.
+@return The value.
+*/
+static uint32_t store_get_u32(const char *buf) {
+  return ((uint32_t)(unsigned char)buf[0] << 24) |
+         ((uint32_t)(unsigned char)buf[1] << 16) |
+         ((uint32_t)(unsigned char)buf[2] << 8) |
+         (uint32_t)(unsigned char)buf[3];
+}
+
+/**
+
+@brief Store a 64-bit value in big-endian order.
+@param buf Destination, at least 8 bytes.
+@param v Value to store.
+*/
+static void store_put_u64(char *buf, uint64_t v) {
+  store_put_u32(buf, (uint32_t)(v >> 32));
+  store_put_u32(buf + 4, (uint32_t)v);
+}
+
+/**
+
+@brief Load a 64-bit value stored in big-endian order.
+@param buf Source, at least 8 bytes.
+@return The value.
+*/
+static uint64_t store_get_u64(const char *buf) {
+  return (uint64_t)store_get_u32(buf) << 32 | store_get_u32(buf + 4);
+}
+
+/**
+
+@brief Read exactly len bytes at offset.
+@return Bytes read (less only at end of file), or -errno.
+*/
+static long long store_pread_full(int fd, void *buf, long long len,
+                                  long long offset) {
+  long long got = 0;
+  ssize_t n;
+
+  while (got < len) {
+    n = pread(fd, (char *)buf + got, len - got, offset + got);
+    if (n < 0) return -errno;
+    if (n == 0) break;
+    got += n;
+  }
+  return got;
+}
+
+/**
+
+@brief Write exactly len bytes at the current position.
+@return 0, or -errno.
+*/
+static int store_write_full(int fd, const void *buf, long long len) {
+  const char *p = (const char *)buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, p, len);
+    if (n <= 0) return n < 0 ? -errno : -EIO;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+
+@brief Write exactly len bytes at offset.
+@return 0, or -errno.
+*/
+static int store_pwrite_full(int fd, const void *buf, long long len,
+                             long long offset) {
+  const char *p = (const char *)buf;
+  ssize_t n;
+
+  while (len > 0) {
+    n = pwrite(fd, p, len, offset);
+    if (n <= 0) return n < 0 ? -errno : -EIO;
+    p += n;
+    len -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+/**
+
+@brief Name a store entry by a hash.
+@param path Returns store/<prefix>-<hash in hex>, cut short if it does
+not fit.
+@param size Size of path.
+@param store The store directory.
+@param prefix "f" for an object, "c" for an index entry.
+@param hash The hash.
+*/
+static void store_name(char *path, size_t size, char *store, char *prefix,
+                       const unsigned char *hash) {
+  size_t n;
+  int i;
+
+  n = (size_t)snprintf(path, size, "%s/%s-", store, prefix);
+  for (i = 0; i < SHA256_LEN && n < size; i++) {
+    n += (size_t)snprintf(path + n, size - n, "%02x", hash[i]);
+  }
+}
+
+/**
+
+@brief Load a manifest and check that it is well formed.
+@param fd The manifest.
+@param m Filled in; free m->raw when done.
+@return 0, -EIO if the manifest is malformed, or -errno.
+*/
+static int store_manifest_load(int fd, struct store_manifest *m) {
+  struct stat st;
+  long long n;
+
+  m->raw = NULL;
+  if (fstat(fd, &st) < 0) return -errno;
+  if (st.st_size < STORE_MANIFEST_HDR) return -EIO;
+  m->raw_len = st.st_size;
+  m->raw = (char *)malloc(m->raw_len);
+  if (m->raw == NULL) return -ENOMEM;
+  n = store_pread_full(fd, m->raw, m->raw_len, 0);
+  if (n != m->raw_len) return n < 0 ? (int)n : -EIO;
+
+  m->size = (long long)store_get_u64(m->raw + 8);
+  m->chunk = (int)store_get_u32(m->raw + 16);
+  m->count = store_get_u32(m->raw + 20);
+  m->hash = (unsigned char *)m->raw + STORE_MANIFEST_HDR;
+  m->crc = crc32c(0, m->raw, m->raw_len);
+  if (memcmp(m->raw, STORE_MANIFEST_MAGIC, 8) != 0 || m->chunk <= 0 ||
+      m->size < 0 || m->count != (m->size + m->chunk - 1) / m->chunk ||
+      m->raw_len != STORE_MANIFEST_HDR + m->count * STORE_MANIFEST_ENTRY) {
+    return -EIO;
+  }
+  return 0;
+}
+
+/**
+
+@brief Length of a chunk of the file.
+@param m The manifest.
+@param i Chunk number.
+@return Its length; only the last chunk is short.
+*/
+static int store_chunk_len(struct store_manifest *m, long long i) {
+  long long left = m->size - i * m->chunk;
+
+  return left < m->chunk ? (int)left : m->chunk;
+}
+
+/**
+
+@brief Find the first chunk of the file with the same hash as each chunk.
+
+Chunks are hashed into an open-addressed table on the first bytes of
+their hash, which are as good as random.
+
+@param m The manifest.
+@return Array of count chunk numbers, or NULL if out of memory.
+*/
+static long long *store_firsts(struct store_manifest *m) {
+  long long *first;
+  long long *table;
+  long long size;
+  long long i;
+  long long j;
+  uint32_t h;
+
+  first = (long long *)malloc((m->count + 1) * sizeof(long long));
+  for (size = 16; size < 2 * m->count; size *= 2)
+    ;
+  table = (long long *)malloc(size * sizeof(long long));
+  if (first == NULL || table == NULL) {
+    free(first);
+    free(table);
+    return NULL;
+  }
+  memset(table, 0xff, size * sizeof(long long));
+
+  for (i = 0; i < m->count; i++) {
+    memcpy(&h, m->hash + i * STORE_MANIFEST_ENTRY, 4);
+    for (j = h & (size - 1);; j = (j + 1) & (size - 1)) {
+      if (table[j] < 0) {
+        table[j] = i;
+        first[i] = i;
+        break;
+      }
+      if (memcmp(m->hash + table[j] * STORE_MANIFEST_ENTRY,
+                 m->hash + i * STORE_MANIFEST_ENTRY,
+                 STORE_MANIFEST_ENTRY) == 0) {
+        first[i] = table[j];
+        break;
+      }
+    }
+  }
+  free(table);
+  return first;
+}
+
+/**
+
+@brief Look a chunk up in the store and read it.
+@param store The store directory.
+@param hash Hash of the chunk.
+@param len Length of the chunk.
+@param buf Returns the chunk, at least len bytes.
+@param src_fd If not NULL, returns the object holding it, left open.
+@param src_off If not NULL, returns its offset in the object.
+@return 1 if the chunk was found and its hash checked, 0 otherwise.
+*/
+static int store_find(char *store, const unsigned char *hash, int len,
+                      char *buf, int *src_fd, long long *src_off) {
+  char path[PATH_MAX];
+  char entry[STORE_INDEX_LEN];
+  unsigned char check[SHA256_LEN];
+  long long off;
+  int fd;
+  int n;
+
+  store_name(path, sizeof(path), store, "c", hash);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  n = (int)store_pread_full(fd, entry, STORE_INDEX_LEN, 0);
+  close(fd);
+  if (n != STORE_INDEX_LEN) return 0;
+
+  store_name(path, sizeof(path), store, "f", (unsigned char *)entry);
+  off = (long long)store_get_u64(entry + SHA256_LEN);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  if (store_pread_full(fd, buf, len, off) != len) {
+    close(fd);
+    return 0;
+  }
+  sha256(buf, len, check);
+  if (memcmp(check, hash, SHA256_LEN) != 0) {
+    close(fd);
+    return 0;
+  }
+  if (src_fd != NULL) {
+    *src_fd = fd;
+    *src_off = off;
+  } else {
+    close(fd);
+  }
+  return 1;
+}
+
+/**
+
+@brief Check that an object still holds the file of a manifest.
+@param path The object.
+@param m The manifest.
+@param buf Scratch space of a chunk.
+@return 1 if every chunk matches, 0 otherwise.
+*/
+static int store_object_ok(char *path, struct store_manifest *m, char *buf) {
+  unsigned char check[SHA256_LEN];
+  struct stat st;
+  long long i;
+  int len;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  if (fstat(fd, &st) < 0 || st.st_size != m->size) {
+    close(fd);
+    return 0;
+  }
+  for (i = 0; i < m->count; i++) {
+    len = store_chunk_len(m, i);
+    if (store_pread_full(fd, buf, len, i * m->chunk) != len) break;
+    sha256(buf, len, check);
+    if (memcmp(check, m->hash + i * STORE_MANIFEST_ENTRY, SHA256_LEN) != 0) {
+      break;
+    }
+  }
+  close(fd);
+  return i == m->count;
+}
+
+/**
+
+@brief Write the manifest of a file.
+@param fd The file.
+@param out_fd Where the manifest is written.
+@return 0 on success, or -errno.
+*/
+int store_manifest_file(int fd, int out_fd) {
+  unsigned char hash[SHA256_LEN];
+  char hdr[STORE_MANIFEST_HDR];
+  struct stat st;
+  char *map = NULL;
+  long long count;
+  long long i;
+  int result;
+  int len;
+
+  if (fstat(fd, &st) < 0) return -errno;
+  if (st.st_size > 0) {
+    map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return -errno;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+  }
+  count = (st.st_size + STORE_CHUNK - 1) / STORE_CHUNK;
+
+  memcpy(hdr, STORE_MANIFEST_MAGIC, 8);
+  store_put_u64(hdr + 8, st.st_size);
+  store_put_u32(hdr + 16, STORE_CHUNK);
+  store_put_u32(hdr + 20, (uint32_t)count);
+  result = store_write_full(out_fd, hdr, STORE_MANIFEST_HDR);
+  for (i = 0; i < count && result == 0; i++) {
+    len = st.st_size - i * STORE_CHUNK < STORE_CHUNK
+              ? (int)(st.st_size - i * STORE_CHUNK)
+              : STORE_CHUNK;
+    sha256(map + i * STORE_CHUNK, len, hash);
+    result = store_write_full(out_fd, hash, SHA256_LEN);
+  }
+
+  if (map != NULL) munmap(map, st.st_size);
+  return result;
+}
+
+/**
+
+@brief Write the want list for a manifest.
+@param manifest_fd The manifest from the sender.
+@param store The store directory.
+@param out_fd Where the want list is written.
+@return 0 on success, -EIO if the manifest is malformed, or -errno.
+*/
+int store_want_file(int manifest_fd, char *store, int out_fd) {
+  struct store_manifest m;
+  char hdr[STORE_WANT_HDR];
+  unsigned char *bits;
+  long long *first;
+  char *buf;
+  long long i;
+  int result;
+
+  result = store_manifest_load(manifest_fd, &m);
+  if (result < 0) {
+    free(m.raw);
+    return result;
+  }
+  first = store_firsts(&m);
+  bits = (unsigned char *)calloc(m.count / 8 + 1, 1);
+  buf = (char *)malloc(m.chunk);
+  if (first == NULL || bits == NULL || buf == NULL) {
+    result = -ENOMEM;
+  }
+
+  for (i = 0; i < m.count && result == 0; i++) {
+    if (first[i] == i &&
+        !store_find(store, m.hash + i * STORE_MANIFEST_ENTRY,
+                    store_chunk_len(&m, i), buf, NULL, NULL)) {
+      bits[i / 8] |= 1 << (i % 8);
+    }
+  }
+  if (result == 0) {
+    memcpy(hdr, STORE_WANT_MAGIC, 8);
+    store_put_u32(hdr + 8, m.crc);
+    store_put_u32(hdr + 12, (uint32_t)m.count);
+    result = store_write_full(out_fd, hdr, STORE_WANT_HDR);
+  }
+  if (result == 0) {
+    result = store_write_full(out_fd, bits, (m.count + 7) / 8);
+  }
+
+  free(buf);
+  free(bits);
+  free(first);
+  free(m.raw);
+  return result;
+}
+
+/**
+
+@brief Write the chunks the receiver wants.
+@param want_fd The want list, or -1 to send every chunk.
+@param manifest_crc CRC32C of the manifest that was sent.
+@param fd The file.
+@param out_fd Where the pack is written.
+@return 0 on success, -ESTALE if the want list answers another manifest,
+-EIO if it is malformed, or -errno.
+*/
+int store_pack_file(int want_fd, unsigned int manifest_crc, int fd,
+                    int out_fd) {
+  char hdr[STORE_PACK_HDR];
+  unsigned char *bits;
+  struct stat st;
+  char *map = NULL;
+  long long count;
+  long long wanted;
+  long long i;
+  int result = 0;
+  int len;
+
+  if (fstat(fd, &st) < 0) return -errno;
+  count = (st.st_size + STORE_CHUNK - 1) / STORE_CHUNK;
+  bits = (unsigned char *)malloc(count / 8 + 1);
+  if (bits == NULL) return -ENOMEM;
+  memset(bits, 0xff, count / 8 + 1);
+  if (want_fd >= 0) {
+    if (store_pread_full(want_fd, hdr, STORE_WANT_HDR, 0) != STORE_WANT_HDR ||
+        memcmp(hdr, STORE_WANT_MAGIC, 8) != 0) {
+      result = -EIO;
+    } else if (store_get_u32(hdr + 8) != manifest_crc) {
+      result = -ESTALE;
+    } else if (store_get_u32(hdr + 12) != count ||
+               store_pread_full(want_fd, bits, (count + 7) / 8,
+                                STORE_WANT_HDR) != (count + 7) / 8) {
+      result = -EIO;
+    }
+  }
+  if (result == 0 && st.st_size > 0) {
+    map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+      result = -errno;
+    }
+  }
+
+  wanted = 0;
+  for (i = 0; i < count; i++) {
+    if (bits[i / 8] & (1 << (i % 8))) wanted++;
+  }
+  if (result == 0) {
+    memcpy(hdr, STORE_PACK_MAGIC, 8);
+    store_put_u32(hdr + 8, manifest_crc);
+    store_put_u32(hdr + 12, (uint32_t)wanted);
+    result = store_write_full(out_fd, hdr, STORE_PACK_HDR);
+  }
+  for (i = 0; i < count && result == 0; i++) {
+    if (!(bits[i / 8] & (1 << (i % 8)))) continue;
+    len = st.st_size - i * STORE_CHUNK < STORE_CHUNK
+              ? (int)(st.st_size - i * STORE_CHUNK)
+              : STORE_CHUNK;
+    store_put_u32(hdr, (uint32_t)i);
+    result = store_write_full(out_fd, hdr, 4);
+    if (result == 0) {
+      result = store_write_full(out_fd, map + i * STORE_CHUNK, len);
+    }
+  }
+
+  if (map != NULL) munmap(map, st.st_size);
+  free(bits);
+  return result;
+}
+
+/**
+
+@brief Put a chunk into the file being assembled.
+
+The chunk is cloned from where it was found if the file system can share
+the blocks, and written from buf otherwise.
+
+@param out The file being assembled.
+@param off Offset of the chunk in it.
+@param buf The chunk, already checked.
+@param len Length of the chunk.
+@param src_fd File the chunk was read from, or -1.
+@param src_off Offset of the chunk there.
+@return 0, or -errno.
+*/
+static int store_put_chunk(int out, long long off, char *buf, int len,
+                           int src_fd, long long src_off) {
+  struct file_clone_range clone;
+
+  if (src_fd >= 0) {
+    clone.src_fd = src_fd;
+    clone.src_offset = src_off;
+    clone.src_length = len;
+    clone.dest_offset = off;
+    if (ioctl(out, FICLONERANGE, &clone) == 0) return 0;
+  }
+  return store_pwrite_full(out, buf, len, off);
+}
+
+/**
+
+@brief Assemble a file from a pack and the store, and add it to the store.
+
+The manifest .<name>.manifest beside the file says which chunks make the
+file.  Each comes from the pack, from the store, or from earlier in the
+file, and is checked against its hash.  If the store already holds the
+whole file, the file is just linked to it.  Otherwise it is built beside
+the target, linked into the store with index entries for its new chunks,
+and renamed over the target.  The manifest is removed.
+
+@param pack_fd The pack.
+@param path The file to build.
+@return Number of chunks that did not come in the pack, or -errno.
+*/
+int store_assemble_file(int pack_fd, char *path) {
+  char store[PATH_MAX];
+  char mpath[PATH_MAX];
+  char tmp[PATH_MAX];
+  char obj[PATH_MAX];
+  char idx[PATH_MAX];
+  char entry[STORE_INDEX_LEN];
+  unsigned char hash[SHA256_LEN];
+  unsigned char fhash[SHA256_LEN];
+  struct store_manifest m;
+  unsigned char *fresh = NULL;
+  long long *first = NULL;
+  char *buf = NULL;
+  char *slash;
+  long long pos;
+  long long next;
+  long long src_off;
+  long long i;
+  int src_fd;
+  int reused = 0;
+  int result;
+  int len;
+  int out = -1;
+  int fd;
+
+  slash = strrchr(path, '/');
+  if (slash == NULL || strlen(path) + 16 > PATH_MAX) return -EINVAL;
+  snprintf(store, sizeof(store), "%.*s/%s", (int)(slash - path), path,
+           STORE_DIR);
+  snprintf(mpath, sizeof(mpath), "%.*s/.%s.manifest", (int)(slash - path),
+           path, slash + 1);
+  snprintf(tmp, sizeof(tmp), "%.*s/.%s.assemble", (int)(slash - path), path,
+           slash + 1);
+
+  fd = open(mpath, O_RDONLY);
+  if (fd < 0) return -errno;
+  result = store_manifest_load(fd, &m);
+  close(fd);
+  if (result == 0 &&
+      (store_pread_full(pack_fd, entry, STORE_PACK_HDR, 0) != STORE_PACK_HDR ||
+       memcmp(entry, STORE_PACK_MAGIC, 8) != 0)) {
+    result = -EIO;
+  } else if (result == 0 && store_get_u32(entry + 8) != m.crc) {
+    result = -ESTALE;
+  }
+  if (result == 0) {
+    first = store_firsts(&m);
+    fresh = (unsigned char *)calloc(m.count / 8 + 1, 1);
+    buf = (char *)malloc(m.chunk);
+    if (first == NULL || fresh == NULL || buf == NULL) result = -ENOMEM;
+  }
+  if (result == 0 && mkdir(store, 0755) < 0 && errno != EEXIST) {
+    result = -errno;
+  }
+  if (result == 0) {
+    sha256(m.raw, m.raw_len, fhash);
+    store_name(obj, sizeof(obj), store, "f", fhash);
+  }
+
+  /* The same file was stored before: link it, nothing to build */
+  if (result == 0 && store_object_ok(obj, &m, buf)) {
+    unlink(tmp);
+    if (link(obj, tmp) < 0 || rename(tmp, path) < 0) result = -errno;
+    unlink(tmp);   /* Left behind if path already was the object */
+    reused = (int)m.count;
+    goto done;
+  }
+
+  if (result == 0) {
+    unlink(tmp);
+    out = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) result = -errno;
+  }
+  pos = STORE_PACK_HDR;
+  next = -1;
+  if (result == 0 && store_pread_full(pack_fd, entry, 4, pos) == 4) {
+    next = store_get_u32(entry);
+  }
+  for (i = 0; i < m.count && result == 0; i++) {
+    len = store_chunk_len(&m, i);
+    src_fd = -1;
+    src_off = 0;
+    if (next == i) {
+      if (store_pread_full(pack_fd, buf, len, pos + 4) != len) {
+        result = -EIO;
+        break;
+      }
+      pos += 4 + len;
+      next = store_pread_full(pack_fd, entry, 4, pos) == 4
+                 ? (long long)store_get_u32(entry)
+                 : -1;
+      fresh[i / 8] |= 1 << (i % 8);
+    } else if (first[i] < i) {
+      src_off = (long long)first[i] * m.chunk;
+      if (store_pread_full(out, buf, len, src_off) != len) {
+        result = -EIO;
+        break;
+      }
+      src_fd = dup(out);
+      reused++;
+    } else if (store_find(store, m.hash + i * STORE_MANIFEST_ENTRY, len, buf,
+                          &src_fd, &src_off)) {
+      reused++;
+    } else {
+      result = -EIO;   /* Neither sent nor stored */
+      break;
+    }
+    sha256(buf, len, hash);
+    if (memcmp(hash, m.hash + i * STORE_MANIFEST_ENTRY, SHA256_LEN) != 0) {
+      result = -EIO;
+    } else {
+      result = store_put_chunk(out, (long long)i * m.chunk, buf, len, src_fd,
+                               src_off);
+    }
+    if (src_fd >= 0) close(src_fd);
+  }
+  if (result == 0 && ftruncate(out, m.size) < 0) result = -errno;
+  if (result == 0 && fsync(out) < 0) result = -errno;
+
+  /* Into the store, replacing an object that no longer checks */
+  if (result == 0) {
+    unlink(obj);
+    if (link(tmp, obj) < 0) result = -errno;
+  }
+  memcpy(entry, fhash, SHA256_LEN);
+  for (i = 0; i < m.count && result == 0; i++) {
+    if (!(fresh[i / 8] & (1 << (i % 8)))) continue;
+    store_name(idx, sizeof(idx), store, "c",
+               m.hash + i * STORE_MANIFEST_ENTRY);
+    store_put_u64(entry + SHA256_LEN, (uint64_t)i * m.chunk);
+    fd = open(idx, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      result = -errno;
+    } else {
+      result = store_write_full(fd, entry, STORE_INDEX_LEN);
+      close(fd);
+    }
+  }
+  if (result == 0 && rename(tmp, path) < 0) result = -errno;
+  if (result < 0) unlink(tmp);
+
+done:
+  if (out >= 0) close(out);
+  if (result == 0) unlink(mpath);
+  free(buf);
+  free(fresh);
+  free(first);
+  free(m.raw);
+  return result < 0 ? result : reused;
+}
@@ -0,0 +1,42 @@
+/*
+ * store.h
+ *
+ * Content-addressed chunk store of a host, kept in .store in the host
+ * directory, and the manifest, want list and pack exchanged to upload
+ * only the chunks the receiver does not already store.
+ */
+
+#define STORE_DIR ".store"
+#define STORE_CHUNK (64 * 1024)   /* Bytes of file per chunk */
+#define STORE_MANIFEST_MAGIC "N367MAN1"
+#define STORE_MANIFEST_HDR 24     /* Magic, file size, chunk size and count */
+#define STORE_MANIFEST_ENTRY 32   /* SHA-256 of a chunk */
+#define STORE_WANT_MAGIC "N367WNT1"
+#define STORE_WANT_HDR 16         /* Magic, CRC32C of the manifest and count */
+#define STORE_PACK_MAGIC "N367PCK1"
+#define STORE_PACK_HDR 16         /* Magic, CRC32C of the manifest and count */
+#define STORE_INDEX_LEN 40        /* Object holding a chunk and its offset */
+
+/* Write the manifest of the file fd, one hash per chunk, to out_fd */
+int store_manifest_file(int fd, int out_fd);
+
+/*
+ * Write the want list for a manifest to out_fd: a bit per chunk that is
+ * neither in the store nor earlier in the same file.
+ */
+int store_want_file(int manifest_fd, char *store, int out_fd);
+
+/*
+ * Write the chunks of fd that the want list asks for (all of them if
+ * want_fd is -1) to out_fd.  -ESTALE if the want list is for another
+ * manifest than manifest_crc.
+ */
+int store_pack_file(int want_fd, unsigned int manifest_crc, int fd,
+      int out_fd);
+
+/*
+ * Build the file path from the pack and the store, following the
+ * manifest .<name>.manifest beside it, and add it to the store.
+ * Returns the number of chunks that were already there, or -errno.
+ */
+int store_assemble_file(int pack_fd, char *path);
@@ -0,0 +1,1030 @@
+/**
+
+@file swarm.c
+@brief Downloads of a file by ranges, from one host or several at once.
+
+A host that has a file can announce it to the tracker, which is kept by
+the DNS host, with a PKT_TRACKER_ANNOUNCE packet carrying the file's size,
+CRC32C and name.  The size and CRC32C tell versions of a file apart, and
+the tracker only lists the hosts that have the latest one announced.  A host that wants the file asks the tracker with a
+PKT_TRACKER_QUERY and gets back the size and a list of up to
+SWARM_MAX_PEERS hosts that have it.  Each reply starts the list at a
+different host, so that hundreds of downloads do not all go to the first
+hosts that announced the file.
+
+The download splits the file into ranges of SWARM_PIECE bytes and asks
+each host for SWARM_PEER_DEPTH of them at a time with PKT_FILE_RANGE_REQ.
+A host answers a request with an upload of just that range (transfer.c),
+which the downloader writes into .<name>.swarm at the range's offset.
+Whenever a range arrives its host is asked for the next missing one, so
+fast hosts end up sending most of the file.  Once every range has been
+asked for, a host with nothing to do is also asked for the range that a
+slower host is furthest from delivering.  A range that does not arrive in
+time is asked of another host, and a host that fails SWARM_MAX_FAILURES
+ranges is not asked again.
+
+When every range has arrived, each checked against its digest, the
+ranges' CRC32Cs are combined into the file's, without reading it again.
+If it matches the tracker's the file is renamed into place and announced,
+so the host sends it to the hosts that download it later.
+
+A download from one host skips the tracker.  It asks the host for the
+file's size and CRC32C with a PKT_FILE_DOWNLOAD_SEND, answered by a
+PKT_FILE_DOWNLOAD_RECV laid out like the tracker's reply with just the
+host itself in the list, then pulls the ranges from it as above.  The
+downloader chooses how many ranges it keeps asked for, so it keeps the
+host sending without being flooded.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "host.h"
+#include "packet.h"
+#include "dns.h"
+#include "crc32c.h"
+#include "time_util.h"
+#include "swarm.h"
+
+/**
+
+@brief Store a 32-bit value in big-endian order.
+@param buf Destination, at least 4 bytes.
+@param v Value to store.
+*/
+static void swarm_put_u32(char *buf, unsigned int v) {
+  buf[0] = (char)(v >> 24);
+  buf[1] = (char)(v >> 16);
+  buf[2] = (char)(v >> 8);
+  buf[3] = (char)v;
+}
+
+/**
+
+@brief Load a 32-bit value stored in big-endian order.
+@param buf Source, at least 4 bytes.
+@return The value.
+*/
+static unsigned int swarm_get_u32(char *buf) {
+  return ((unsigned int)(unsigned char)buf[0] << 24) |
+         ((unsigned int)(unsigned char)buf[1] << 16) |
+         ((unsigned int)(unsigned char)buf[2] << 8) |
+         (unsigned int)(unsigned char)buf[3];
+}
+
+/**
+
+@brief Store a 64-bit value in big-endian order.
+@param buf Destination, at least 8 bytes.
+@param v Value to store.
+*/
+static void swarm_put_u64(char *buf, long long v) {
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    buf[i] = (char)((unsigned long long)v >> (56 - 8 * i));
+  }
+}
+
+/**
+
+@brief Load a 64-bit value stored in big-endian order.
+@param buf Source, at least 8 bytes.
+@return The value.
+*/
+static long long swarm_get_u64(char *buf) {
+  unsigned long long v = 0;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    v = (v << 8) | (unsigned char)buf[i];
+  }
+  return (long long)v;
+}
+
+/**
+
+@brief Send a packet on all ports of the host.
+@param pkt Packet to send.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void swarm_send(struct packet *pkt, struct net_port **node_port,
+                       int node_port_num) {
+  int k;
+
+  for (k = 0; k < node_port_num; k++) {
+    packet_send(node_port[k], pkt);
+  }
+}
+
+/**
+
+@brief Copy the name at the end of a packet.
+@param pkt The packet.
+@param start Offset of the name in the payload.
+@param name Destination, MAX_FILE_NAME bytes.
+@return 1 if there is a name, 0 otherwise.
+*/
+static int swarm_packet_name(struct packet *pkt, int start, char *name) {
+  int n = pkt->length - start;
+
+  if (n <= 0) return 0;
+  if (n >= MAX_FILE_NAME) n = MAX_FILE_NAME - 1;
+  memcpy(name, pkt->payload + start, n);
+  name[n] = '\0';
+  return name[0] != '\0';
+}
+
+/**
+
+@brief Tell the tracker that this host has a version of a file.
+@param st Pointer to the table.
+@param name Name of the file.
+@param size Size of the file.
+@param crc CRC32C of the file.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void swarm_send_announce(struct swarm_table *st, char *name,
+                                long long size, unsigned int crc,
+                                struct net_port **node_port,
+                                int node_port_num) {
+  struct packet pkt;
+  int n;
+
+  pkt.src = (char)st->host_id;
+  pkt.dst = (char)DNS_SERVER_PHYS_ID;
+  pkt.type = (char)PKT_TRACKER_ANNOUNCE;
+  swarm_put_u64(pkt.payload, size);
+  swarm_put_u32(pkt.payload + 8, crc);
+  n = strnlen(name, PKT_PAYLOAD_MAX - SWARM_ANNOUNCE_LEN);
+  memcpy(pkt.payload + SWARM_ANNOUNCE_LEN, name, n);
+  pkt.length = SWARM_ANNOUNCE_LEN + n;
+  swarm_send(&pkt, node_port, node_port_num);
+}
+
+/**
+
+@brief Initialize the table with no downloads and no tracked files.
+@param st Pointer to the table.
+@param host_id ID of this host.
+*/
+void swarm_table_init(struct swarm_table *st, int host_id) {
+  memset(st, 0, sizeof(struct swarm_table));
+  st->host_id = host_id;
+}
+
+/**
+
+@brief Find the download of a file.
+@param st Pointer to the table.
+@param name Name of the file.
+@return Pointer to the download, or NULL if there is none.
+*/
+static struct swarm *swarm_find(struct swarm_table *st, char *name) {
+  int i;
+
+  for (i = 0; i < SWARM_MAX; i++) {
+    if (st->dl[i] != NULL && strcmp(st->dl[i]->name, name) == 0) {
+      return st->dl[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+
+@brief Add a download that has yet to learn the file's size.
+@param st Pointer to the table.
+@param dir Host directory to store the file in.
+@param name Name of the file.
+@param src Host to download from, or -1 to ask the tracker.
+@param depth Ranges to ask of one host at a time.
+@return 1 if the download started, 0 if it is already running or too
+many are.
+*/
+static int swarm_new(struct swarm_table *st, char dir[], char name[], int src,
+                     int depth) {
+  struct swarm *sw;
+  int i;
+
+  if (swarm_find(st, name) != NULL) return 0;
+  for (i = 0; i < SWARM_MAX && st->dl[i] != NULL; i++)
+    ;
+  if (i == SWARM_MAX) return 0;
+
+  sw = (struct swarm *)calloc(1, sizeof(struct swarm));
+  strncpy(sw->name, name, MAX_FILE_NAME - 1);
+  sprintf(sw->path, "../%s/%s", dir, name);
+  sprintf(sw->part, "../%s/.%s.swarm", dir, name);
+  sw->source = src;
+  sw->depth = depth;
+  sw->querying = 1;
+  sw->query_time = 0;
+  sw->start_time = time_now_usec();
+  st->dl[i] = sw;
+  return 1;
+}
+
+/**
+
+@brief Start downloading a file from the hosts that have it.
+
+The tracker is asked which hosts those are, from swarm_pump().
+
+@param st Pointer to the table.
+@param dir Host directory to store the file in.
+@param name Name of the file.
+@return 1 if the download started, 0 if it is already running or too
+many are.
+*/
+int swarm_start(struct swarm_table *st, char dir[], char name[]) {
+  return swarm_new(st, dir, name, -1, SWARM_PEER_DEPTH);
+}
+
+/**
+
+@brief Start downloading a file from one host.
+
+The host is asked for the file's size, from swarm_pump(), then for its
+ranges.
+
+@param st Pointer to the table.
+@param dir Host directory to store the file in.
+@param name Name of the file.
+@param src Host to download from.
+@param depth Ranges to keep asked for, 0 for SWARM_FETCH_DEPTH; at most
+SWARM_MAX_DEPTH.
+@return 1 if the download started, 0 if it is already running or too
+many are.
+*/
+int swarm_fetch(struct swarm_table *st, char dir[], char name[], int src,
+                int depth) {
+  if (depth <= 0) depth = SWARM_FETCH_DEPTH;
+  if (depth > SWARM_MAX_DEPTH) depth = SWARM_MAX_DEPTH;
+  return swarm_new(st, dir, name, src, depth);
+}
+
+/**
+
+@brief Check whether ranges of a file are being downloaded.
+@param st Pointer to the table, or NULL.
+@param name Name of the file.
+@return 1 if a download of the file has started receiving ranges.
+*/
+int swarm_expects(struct swarm_table *st, char *name) {
+  struct swarm *sw;
+
+  if (st == NULL) return 0;
+  sw = swarm_find(st, name);
+  return sw != NULL && !sw->querying;
+}
+
+/**
+
+@brief End a download and free it.
+@param st Pointer to the table.
+@param sw Pointer to the download.
+@param keep 1 if the file is complete, 0 to remove what was received.
+*/
+static void swarm_free(struct swarm_table *st, struct swarm *sw, int keep) {
+  int i;
+
+  if (!keep && !sw->querying) unlink(sw->part);
+  for (i = 0; i < SWARM_MAX; i++) {
+    if (st->dl[i] == sw) st->dl[i] = NULL;
+  }
+  free(sw->piece);
+  free(sw);
+}
+
+/**
+
+@brief Expected time for a host to send one range.
+@param sw Pointer to the download.
+@param p Index of the host.
+@return Microseconds, or 0 while the host's rate is not known.
+*/
+static long long swarm_expected(struct swarm *sw, int p) {
+  if (sw->peer[p].rate <= 0) return 0;
+  return (long long)(SWARM_PIECE / sw->peer[p].rate * 1e6);
+}
+
+/**
+
+@brief Find the host of a download that sent a range.
+@param sw Pointer to the download.
+@param id ID of the host.
+@return Index of the host, or -1 if it is not one of the download's.
+*/
+static int swarm_peer_index(struct swarm *sw, int id) {
+  int p;
+
+  for (p = 0; p < sw->peers; p++) {
+    if (sw->peer[p].id == id) return p;
+  }
+  return -1;
+}
+
+/**
+
+@brief Count a range a host did not deliver.
+@param sw Pointer to the download.
+@param p Index of the host.
+*/
+static void swarm_fail(struct swarm *sw, int p) {
+  if (++sw->peer[p].failures == SWARM_MAX_FAILURES) {
+    printf("Download of %s: dropped host %d after %d failed ranges\n",
+           sw->name, sw->peer[p].id, SWARM_MAX_FAILURES);
+  }
+}
+
+/**
+
+@brief Forget that a host was asked for a range.
+@param sw Pointer to the download.
+@param c Index of the piece.
+@param k Which copy of the request.
+*/
+static void swarm_unask(struct swarm *sw, int c, int k) {
+  struct swarm_piece *pc = &sw->piece[c];
+
+  if (pc->peer[k] < 0) return;
+  sw->peer[pc->peer[k]].asked--;
+  pc->peer[k] = -1;
+  if (pc->state == SWARM_ASKED && pc->peer[0] < 0 && pc->peer[1] < 0) {
+    pc->state = SWARM_MISSING;
+  }
+}
+
+/**
+
+@brief Ask a host for a range of the file.
+@param st Pointer to the table.
+@param sw Pointer to the download.
+@param c Index of the piece.
+@param p Index of the host.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void swarm_ask(struct swarm_table *st, struct swarm *sw, int c, int p,
+                      struct net_port **node_port, int node_port_num) {
+  struct swarm_piece *pc = &sw->piece[c];
+  struct packet pkt;
+  long long offset = (long long)c * SWARM_PIECE;
+  int k;
+  int n;
+
+  k = pc->peer[0] < 0 ? 0 : 1;
+  pc->peer[k] = p;
+  pc->asked_time[k] = time_now_usec();
+  pc->state = SWARM_ASKED;
+  sw->peer[p].asked++;
+  sw->asked++;
+
+  pkt.src = (char)st->host_id;
+  pkt.dst = (char)sw->peer[p].id;
+  pkt.type = (char)PKT_FILE_RANGE_REQ;
+  swarm_put_u64(pkt.payload, offset);
+  swarm_put_u64(pkt.payload + 8, sw->size - offset < SWARM_PIECE
+                                     ? sw->size - offset
+                                     : SWARM_PIECE);
+  n = strnlen(sw->name, PKT_PAYLOAD_MAX - SWARM_RANGE_LEN);
+  memcpy(pkt.payload + SWARM_RANGE_LEN, sw->name, n);
+  pkt.length = SWARM_RANGE_LEN + n;
+  swarm_send(&pkt, node_port, node_port_num);
+}
+
+/**
+
+@brief Pick a range for a host that has room for one more.
+
+The lowest missing range comes first.  When none is missing, the range
+that the slowest host is furthest from delivering is taken, provided this
+host is expected to deliver it sooner.
+
+@param sw Pointer to the download.
+@param p Index of the host.
+@param now Current time.
+@return Index of the piece, or -1 if there is nothing for the host.
+*/
+static int swarm_pick(struct swarm *sw, int p, long long now) {
+  struct swarm_piece *pc;
+  long long left, best_left;
+  int best;
+  int c;
+  int h;
+
+  for (c = 0; c < sw->pieces; c++) {
+    if (sw->piece[c].state == SWARM_MISSING) return c;
+  }
+
+  best = -1;
+  best_left = swarm_expected(sw, p);
+  if (best_left == 0) return -1;   /* Not known to be faster than anyone */
+  for (c = 0; c < sw->pieces; c++) {
+    pc = &sw->piece[c];
+    if (pc->state != SWARM_ASKED || pc->peer[1] >= 0) continue;
+    h = pc->peer[0];
+    if (h == p) continue;
+    left = pc->asked_time[0] +
+           (swarm_expected(sw, h) > 0 ? swarm_expected(sw, h)
+                                      : SWARM_ASK_TIMEOUT) -
+           now;
+    if (left > best_left) {
+      best_left = left;
+      best = c;
+    }
+  }
+  return best;
+}
+
+/**
+
+@brief Finish a download whose ranges have all arrived.
+
+Each range was synced when it arrived.  If the ranges add up to the
+version of the file the tracker or the source listed, the file is
+renamed into place.  A swarm download then announces it to the tracker.
+
+@param st Pointer to the table.
+@param sw Pointer to the download.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void swarm_finish(struct swarm_table *st, struct swarm *sw,
+                         struct net_port **node_port, int node_port_num) {
+  unsigned int crc = 0;
+  long long length;
+  double secs;
+  int c;
+  int p;
+
+  for (c = 0; c < sw->pieces; c++) {
+    length = sw->size - (long long)c * SWARM_PIECE < SWARM_PIECE
+                 ? sw->size - (long long)c * SWARM_PIECE
+                 : SWARM_PIECE;
+    crc = crc32c_combine(crc, sw->piece[c].crc, length);
+  }
+  if (crc != sw->crc) {
+    printf("Download of %s failed: CRC32C %08x, expected %08x\n", sw->name,
+           crc, sw->crc);
+    swarm_free(st, sw, 0);
+    return;
+  }
+  if (rename(sw->part, sw->path) < 0) {
+    printf("Download of %s failed: cannot rename %s\n", sw->name, sw->part);
+    swarm_free(st, sw, 0);
+    return;
+  }
+  secs = (time_now_usec() - sw->start_time) / 1e6;
+  if (sw->source >= 0) {
+    printf("Download of %s from %d complete: %lld bytes in %.3f s "
+           "(%.1f KB/s), %d ranges asked, %d at a time\n",
+           sw->name, sw->source, sw->size, secs,
+           secs > 0 ? sw->size / secs / 1000 : 0.0, sw->asked, sw->depth);
+    swarm_free(st, sw, 1);
+    return;
+  }
+  printf("Swarm download of %s complete: %lld bytes from %d hosts in %.3f s "
+         "(%.1f KB/s), %d ranges asked, %d received twice\n",
+         sw->name, sw->size, sw->peers, secs,
+         secs > 0 ? sw->size / secs / 1000 : 0.0, sw->asked, sw->duplicates);
+  for (p = 0; p < sw->peers; p++) {
+    printf("  from %d: %lld bytes, %.1f KB/s per range%s\n", sw->peer[p].id,
+           sw->peer[p].bytes, sw->peer[p].rate / 1000,
+           sw->peer[p].failures >= SWARM_MAX_FAILURES ? ", dropped" : "");
+  }
+
+  /* This host can now send the file to others */
+  swarm_send_announce(st, sw->name, sw->size, crc, node_port, node_port_num);
+  swarm_free(st, sw, 1);
+}
+
+/**
+
+@brief Handle a range that was received.
+
+Called when the range's upload has been written, synced and checked.  The
+host that sent it is given its next range on the next pass.
+
+@param st Pointer to the table, or NULL.
+@param name Name of the file.
+@param src Host that sent the range.
+@param offset File offset of the range.
+@param length Number of bytes in the range.
+@param crc CRC32C of the range as written.
+@param ok 1 if the range matched its digest.
+*/
+void swarm_range_done(struct swarm_table *st, char *name, int src,
+                      long long offset, long long length, unsigned int crc,
+                      int ok) {
+  struct swarm_piece *pc;
+  struct swarm *sw;
+  double rate;
+  int c;
+  int k;
+  int p;
+
+  if (st == NULL || (sw = swarm_find(st, name)) == NULL) return;
+  c = (int)(offset / SWARM_PIECE);
+  if (offset % SWARM_PIECE != 0 || c >= sw->pieces) return;
+  pc = &sw->piece[c];
+  p = swarm_peer_index(sw, src);
+
+  for (k = 0; k < SWARM_COPIES; k++) {
+    if (p >= 0 && pc->peer[k] == p) break;
+  }
+  if (k < SWARM_COPIES && ok) {
+    rate = length / ((time_now_usec() - pc->asked_time[k]) / 1e6 + 1e-6);
+    sw->peer[p].rate = sw->peer[p].rate > 0
+                           ? 0.7 * sw->peer[p].rate + 0.3 * rate
+                           : rate;
+  }
+  if (k < SWARM_COPIES) swarm_unask(sw, c, k);
+
+  if (!ok) {
+    printf("Range at %lld of %s from %d was damaged\n", offset, name, src);
+    if (p >= 0) swarm_fail(sw, p);
+    return;
+  }
+  if (pc->state == SWARM_DONE) {
+    sw->duplicates++;
+    return;
+  }
+  pc->state = SWARM_DONE;
+  pc->crc = crc;
+  sw->done++;
+  if (p >= 0) sw->peer[p].bytes += length;
+
+  /* The other host asked for it has better things to send */
+  for (k = 0; k < SWARM_COPIES; k++) {
+    if (pc->peer[k] >= 0) {
+      sw->peer[pc->peer[k]].asked--;
+      pc->peer[k] = -1;
+    }
+  }
+}
+
+/**
+
+@brief Give up on ranges that are overdue, and drop hosts that keep failing.
+@param sw Pointer to the download.
+@param now Current time.
+*/
+static void swarm_expire(struct swarm *sw, long long now) {
+  struct swarm_piece *pc;
+  int c;
+  int k;
+  int p;
+
+  for (c = 0; c < sw->pieces; c++) {
+    pc = &sw->piece[c];
+    if (pc->state != SWARM_ASKED) continue;
+    for (k = 0; k < SWARM_COPIES; k++) {
+      p = pc->peer[k];
+      if (p < 0 ||
+          now - pc->asked_time[k] <
+              SWARM_ASK_TIMEOUT + 4 * swarm_expected(sw, p)) {
+        continue;
+      }
+      swarm_fail(sw, p);
+      swarm_unask(sw, c, k);
+    }
+  }
+}
+
+/**
+
+@brief Make the file of a download whose hosts are known.
+@param sw Pointer to the download.
+@return 1 if the file was made, 0 otherwise.
+*/
+static int swarm_create(struct swarm *sw) {
+  int fd;
+  int c;
+
+  /* A new file, in case an old one is linked to the chunk store */
+  unlink(sw->part);
+  fd = open(sw->part, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return 0;
+  if (ftruncate(fd, sw->size) < 0) {
+    close(fd);
+    return 0;
+  }
+  close(fd);
+
+  sw->pieces = (int)((sw->size + SWARM_PIECE - 1) / SWARM_PIECE);
+  sw->piece = (struct swarm_piece *)calloc(sw->pieces + 1,
+                                           sizeof(struct swarm_piece));
+  for (c = 0; c < sw->pieces; c++) {
+    sw->piece[c].peer[0] = -1;
+    sw->piece[c].peer[1] = -1;
+  }
+  return 1;
+}
+
+/**
+
+@brief Drive the downloads.
+
+Runs once per pass of the host loop.  A download waiting for the tracker,
+or for the size from its source, asks again every SWARM_QUERY_RETRY.  Otherwise overdue ranges are
+given up, every host with room is asked for another range, and a
+download with every range received is finished.
+
+@param st Pointer to the table.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+void swarm_pump(struct swarm_table *st, struct net_port **node_port,
+                int node_port_num) {
+  struct swarm *sw;
+  struct packet pkt;
+  long long now = time_now_usec();
+  int alive;
+  int i;
+  int p;
+  int c;
+  int n;
+
+  for (i = 0; i < SWARM_MAX; i++) {
+    if ((sw = st->dl[i]) == NULL) continue;
+
+    if (sw->querying) {
+      if (now - sw->start_time >= SWARM_QUERY_TIMEOUT) {
+        if (sw->source >= 0) {
+          printf("Download of %s failed: no answer from %d\n", sw->name,
+                 sw->source);
+        } else {
+          printf("Download of %s failed: no answer from the tracker\n",
+                 sw->name);
+        }
+        swarm_free(st, sw, 0);
+      } else if (now - sw->query_time >= SWARM_QUERY_RETRY) {
+        pkt.src = (char)st->host_id;
+        if (sw->source >= 0) {
+          pkt.dst = (char)sw->source;
+          pkt.type = (char)PKT_FILE_DOWNLOAD_SEND;
+        } else {
+          pkt.dst = (char)DNS_SERVER_PHYS_ID;
+          pkt.type = (char)PKT_TRACKER_QUERY;
+        }
+        n = strnlen(sw->name, PKT_PAYLOAD_MAX);
+        memcpy(pkt.payload, sw->name, n);
+        pkt.length = n;
+        swarm_send(&pkt, node_port, node_port_num);
+        sw->query_time = now;
+      }
+      continue;
+    }
+
+    if (sw->done == sw->pieces) {
+      swarm_finish(st, sw, node_port, node_port_num);
+      continue;
+    }
+
+    swarm_expire(sw, now);
+
+    alive = 0;
+    for (p = 0; p < sw->peers; p++) {
+      if (sw->peer[p].failures >= SWARM_MAX_FAILURES) continue;
+      alive++;
+      while (sw->peer[p].asked < sw->depth &&
+             (c = swarm_pick(sw, p, now)) >= 0) {
+        swarm_ask(st, sw, c, p, node_port, node_port_num);
+      }
+    }
+    if (alive == 0) {
+      printf("Download of %s failed: %d of %d ranges received, no host "
+             "left to ask\n",
+             sw->name, sw->done, sw->pieces);
+      swarm_free(st, sw, 0);
+    }
+  }
+}
+
+/**
+
+@brief Read a file of the host for its size and CRC32C.
+@param dir Host directory holding the file.
+@param name Name of the file.
+@param size Set to the size of the file.
+@param crc Set to the CRC32C of the file.
+@return 1 on success, 0 if there is no such file.
+*/
+static int swarm_file_crc(char dir[], char name[], long long *size,
+                          unsigned int *crc) {
+  char path[MAX_DIR_NAME + MAX_FILE_NAME + 5];
+  struct stat sb;
+  char *map;
+  int fd;
+
+  sprintf(path, "../%s/%s", dir, name);
+  fd = open(path, O_RDONLY);
+  if (fd < 0) return 0;
+  if (fstat(fd, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+    close(fd);
+    return 0;
+  }
+  *crc = 0;
+  if (sb.st_size > 0) {
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return 0;
+    }
+    *crc = crc32c(0, map, sb.st_size);
+    munmap(map, sb.st_size);
+  }
+  close(fd);
+  *size = sb.st_size;
+  return 1;
+}
+
+/**
+
+@brief Tell the tracker that this host has a file.
+
+The file is read once here for its CRC32C.
+
+@param st Pointer to the table.
+@param dir Host directory holding the file.
+@param name Name of the file.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+@return 1 if the file was announced, 0 if there is no such file.
+*/
+int swarm_announce(struct swarm_table *st, char dir[], char name[],
+                   struct net_port **node_port, int node_port_num) {
+  unsigned int crc;
+  long long size;
+
+  if (!swarm_file_crc(dir, name, &size, &crc)) return 0;
+  swarm_send_announce(st, name, size, crc, node_port, node_port_num);
+  return 1;
+}
+
+/**
+
+@brief Record at the tracker that a host has a file.
+
+A new size or CRC32C means a new version of the file, and only the host
+that announced it has that one.
+
+@param st Pointer to the table.
+@param pkt The PKT_TRACKER_ANNOUNCE packet.
+*/
+static void swarm_tracker_announce(struct swarm_table *st,
+                                   struct packet *pkt) {
+  struct swarm_tracked *tf = NULL;
+  char name[MAX_FILE_NAME];
+  unsigned int crc;
+  long long size;
+  int i;
+
+  if (!swarm_packet_name(pkt, SWARM_ANNOUNCE_LEN, name)) return;
+  size = swarm_get_u64(pkt->payload);
+  crc = swarm_get_u32(pkt->payload + 8);
+
+  for (i = 0; i < SWARM_TRACKED_FILES; i++) {
+    if (st->tracked[i] != NULL && strcmp(st->tracked[i]->name, name) == 0) {
+      tf = st->tracked[i];
+      break;
+    }
+  }
+  if (tf == NULL) {
+    for (i = 0; i < SWARM_TRACKED_FILES && st->tracked[i] != NULL; i++)
+      ;
+    if (i == SWARM_TRACKED_FILES) {
+      printf("Tracker full, %s from %d not recorded\n", name, pkt->src);
+      return;
+    }
+    tf = (struct swarm_tracked *)calloc(1, sizeof(struct swarm_tracked));
+    strcpy(tf->name, name);
+    tf->size = size;
+    tf->crc = crc;
+    st->tracked[i] = tf;
+  }
+  if (tf->size != size || tf->crc != crc) {
+    tf->size = size;
+    tf->crc = crc;
+    tf->hosts = 0;
+    tf->next = 0;
+  }
+
+  for (i = 0; i < tf->hosts; i++) {
+    if (tf->host[i] == pkt->src) return;
+  }
+  if (tf->hosts == SWARM_TRACKED_HOSTS) return;   /* Enough to go round */
+  tf->host[tf->hosts++] = pkt->src;
+  printf("Tracker: %d has %s (%lld bytes, CRC32C %08x), %d hosts\n",
+         pkt->src, name, size, crc, tf->hosts);
+}
+
+/**
+
+@brief Answer a query to the tracker with the hosts that have a file.
+
+The list starts where the last one stopped and leaves out the host that
+asked.  An unknown file gets an empty list.
+
+@param st Pointer to the table.
+@param pkt The PKT_TRACKER_QUERY packet.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void swarm_tracker_query(struct swarm_table *st, struct packet *pkt,
+                                struct net_port **node_port,
+                                int node_port_num) {
+  struct swarm_tracked *tf = NULL;
+  char name[MAX_FILE_NAME];
+  struct packet reply;
+  int count;
+  int max;
+  int n;
+  int i;
+  int j;
+
+  if (!swarm_packet_name(pkt, 0, name)) return;
+  for (i = 0; i < SWARM_TRACKED_FILES; i++) {
+    if (st->tracked[i] != NULL && strcmp(st->tracked[i]->name, name) == 0) {
+      tf = st->tracked[i];
+      break;
+    }
+  }
+
+  n = strnlen(name, PKT_PAYLOAD_MAX - SWARM_REPLY_LEN - 1);
+  max = PKT_PAYLOAD_MAX - SWARM_REPLY_LEN - n;
+  if (max > SWARM_MAX_PEERS) max = SWARM_MAX_PEERS;
+  count = 0;
+  if (tf != NULL) {
+    for (j = 0; j < tf->hosts && count < max; j++) {
+      i = (tf->next + j) % tf->hosts;
+      if (tf->host[i] == pkt->src) continue;
+      reply.payload[SWARM_REPLY_LEN + count++] = (char)tf->host[i];
+    }
+    tf->next = tf->hosts > 0 ? (tf->next + count) % tf->hosts : 0;
+  }
+
+  reply.src = (char)st->host_id;
+  reply.dst = pkt->src;
+  reply.type = (char)PKT_TRACKER_REPLY;
+  swarm_put_u64(reply.payload, tf != NULL ? tf->size : 0);
+  swarm_put_u32(reply.payload + 8, tf != NULL ? tf->crc : 0);
+  reply.payload[12] = (char)count;
+  memcpy(reply.payload + SWARM_REPLY_LEN + count, name, n);
+  reply.length = SWARM_REPLY_LEN + count + n;
+  swarm_send(&reply, node_port, node_port_num);
+}
+
+/**
+
+@brief Take the list of hosts for a download.
+
+The list comes from the tracker, or from the source of a download from
+one host, which lists only itself.
+
+@param st Pointer to the table.
+@param pkt The PKT_TRACKER_REPLY or PKT_FILE_DOWNLOAD_RECV packet.
+*/
+static void swarm_hosts_reply(struct swarm_table *st, struct packet *pkt) {
+  char name[MAX_FILE_NAME];
+  struct swarm *sw;
+  int count;
+  int p;
+
+  if (pkt->length < SWARM_REPLY_LEN) return;
+  count = (unsigned char)pkt->payload[12];
+  if (SWARM_REPLY_LEN + count > pkt->length ||
+      !swarm_packet_name(pkt, SWARM_REPLY_LEN + count, name)) {
+    return;
+  }
+  sw = swarm_find(st, name);
+  if (sw == NULL || !sw->querying) return;
+  if (pkt->type != (char)(sw->source >= 0 ? PKT_FILE_DOWNLOAD_RECV
+                                          : PKT_TRACKER_REPLY) ||
+      (sw->source >= 0 && (unsigned char)pkt->src != sw->source)) {
+    return;
+  }
+
+  if (count == 0) {
+    if (sw->source >= 0) {
+      printf("Download of %s failed: %d does not have it\n", name,
+             sw->source);
+    } else {
+      printf("Download of %s failed: no host has it\n", name);
+    }
+    swarm_free(st, sw, 0);
+    return;
+  }
+  sw->size = swarm_get_u64(pkt->payload);
+  sw->crc = swarm_get_u32(pkt->payload + 8);
+  if (count > SWARM_MAX_PEERS) count = SWARM_MAX_PEERS;
+  for (p = 0; p < count; p++) {
+    sw->peer[p].id = (unsigned char)pkt->payload[SWARM_REPLY_LEN + p];
+  }
+  sw->peers = count;
+  if (!swarm_create(sw)) {
+    printf("Download of %s failed: cannot create %s\n", name, sw->part);
+    swarm_free(st, sw, 0);
+    return;
+  }
+  sw->querying = 0;
+  if (sw->source >= 0) {
+    printf("Downloading %s (%lld bytes) from %d in %d ranges, %d at a time\n",
+           name, sw->size, sw->source, sw->pieces, sw->depth);
+  } else {
+    printf("Downloading %s (%lld bytes) from %d hosts in %d ranges\n", name,
+           sw->size, count, sw->pieces);
+  }
+}
+
+/**
+
+@brief Answer a host that wants to download a file from this one.
+
+The reply gives the file's size and CRC32C and lists this host, or no
+host if it does not have the file.
+
+@param st Pointer to the table.
+@param dir Host directory holding the file.
+@param pkt The PKT_FILE_DOWNLOAD_SEND packet.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+void swarm_describe(struct swarm_table *st, char dir[], struct packet *pkt,
+                    struct net_port **node_port, int node_port_num) {
+  char name[MAX_FILE_NAME];
+  struct packet reply;
+  unsigned int crc = 0;
+  long long size = 0;
+  int count;
+  int n;
+
+  if (!swarm_packet_name(pkt, 0, name)) return;
+  count = swarm_file_crc(dir, name, &size, &crc);
+
+  n = strnlen(name, PKT_PAYLOAD_MAX - SWARM_REPLY_LEN - 1);
+  reply.src = (char)st->host_id;
+  reply.dst = pkt->src;
+  reply.type = (char)PKT_FILE_DOWNLOAD_RECV;
+  swarm_put_u64(reply.payload, size);
+  swarm_put_u32(reply.payload + 8, crc);
+  reply.payload[12] = (char)count;
+  reply.payload[SWARM_REPLY_LEN] = (char)st->host_id;
+  memcpy(reply.payload + SWARM_REPLY_LEN + count, name, n);
+  reply.length = SWARM_REPLY_LEN + count + n;
+  swarm_send(&reply, node_port, node_port_num);
+}
+
+/**
+
+@brief Handle a tracker packet, or a source's answer to a download.
+
+Announcements and queries are for the tracker, replies for a download.
+
+@param st Pointer to the table.
+@param pkt The PKT_TRACKER_ANNOUNCE, _QUERY or _REPLY packet, or a
+PKT_FILE_DOWNLOAD_RECV.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+void swarm_packet(struct swarm_table *st, struct packet *pkt,
+                  struct net_port **node_port, int node_port_num) {
+  if (pkt->type == (char)PKT_TRACKER_ANNOUNCE) {
+    swarm_tracker_announce(st, pkt);
+  } else if (pkt->type == (char)PKT_TRACKER_QUERY) {
+    swarm_tracker_query(st, pkt, node_port, node_port_num);
+  } else if (pkt->type == (char)PKT_TRACKER_REPLY ||
+             pkt->type == (char)PKT_FILE_DOWNLOAD_RECV) {
+    swarm_hosts_reply(st, pkt);
+  }
+}
+
+/**
+
+@brief Read a request for a range of a file.
+@param pkt The PKT_FILE_RANGE_REQ packet.
+@param name Name of the file, MAX_FILE_NAME bytes.
+@param offset File offset of the range.
+@param length Number of bytes in the range.
+@return 1 if the request is well formed, 0 otherwise.
+*/
+int swarm_range_request(struct packet *pkt, char *name, long long *offset,
+                        long long *length) {
+  if (pkt->length < SWARM_RANGE_LEN ||
+      !swarm_packet_name(pkt, SWARM_RANGE_LEN, name)) {
+    return 0;
+  }
+  *offset = swarm_get_u64(pkt->payload);
+  *length = swarm_get_u64(pkt->payload + 8);
+  return 1;
+}
@@ -0,0 +1,102 @@
+/*
+ * swarm.h
+ *
+ * Downloads of a file by ranges, from one host or from every host that
+ * has it, and the tracker that tells a host which hosts have a file.
+ * Requires main.h, host.h and packet.h to be included first.
+ */
+
+#define SWARM_PIECE (128 * 1024)  /* Bytes of the file asked for in one range */
+#define SWARM_MAX 8               /* Downloads a host runs at once */
+#define SWARM_MAX_PEERS 16        /* Hosts a download asks for ranges */
+#define SWARM_PEER_DEPTH 2        /* Ranges asked of one host at a time */
+#define SWARM_FETCH_DEPTH 4       /* The same, downloading from one host */
+#define SWARM_MAX_DEPTH 16        /* Most ranges a download may ask of one host */
+#define SWARM_COPIES 2            /* Hosts asked for one range near the end */
+#define SWARM_ASK_TIMEOUT 5000000 /* Ask again after 5 s plus the expected time */
+#define SWARM_MAX_FAILURES 3      /* Ranges a host fails before it is dropped */
+#define SWARM_QUERY_RETRY 1000000 /* Ask the tracker again after 1 s */
+#define SWARM_QUERY_TIMEOUT 5000000  /* Give up on the tracker after 5 s */
+#define SWARM_RANGE_LEN 16        /* Offset and length before the name in a range request */
+#define SWARM_ANNOUNCE_LEN 12     /* File size and CRC32C before the name in an announcement */
+#define SWARM_REPLY_LEN 13        /* File size, CRC32C and host count before the hosts in a reply */
+#define SWARM_TRACKED_FILES 64    /* Files the tracker knows */
+#define SWARM_TRACKED_HOSTS 64    /* Hosts the tracker knows for a file */
+
+#define SWARM_MISSING 0
+#define SWARM_ASKED 1
+#define SWARM_DONE 2
+
+/* A host a download gets ranges from */
+struct swarm_peer {
+   int id;
+   int asked;           /* Ranges asked of it and not yet received */
+   int failures;        /* Ranges it did not deliver; dropped at SWARM_MAX_FAILURES */
+   long long bytes;     /* Received from it */
+   double rate;         /* Bytes per second per range, smoothed; 0 until known */
+};
+
+/* A range of the file, and the hosts it has been asked of */
+struct swarm_piece {
+   int state;           /* SWARM_MISSING, SWARM_ASKED or SWARM_DONE */
+   int peer[SWARM_COPIES];          /* Index of a host asked, or -1 */
+   long long asked_time[SWARM_COPIES];
+   unsigned int crc;    /* CRC32C of the range, once received */
+};
+
+struct swarm {
+   char name[MAX_FILE_NAME];
+   char path[MAX_DIR_NAME + MAX_FILE_NAME + 10];   /* The file */
+   char part[MAX_DIR_NAME + MAX_FILE_NAME + 10];   /* .<name>.swarm until complete */
+   long long size;
+   unsigned int crc;    /* CRC32C of the file, from the tracker or the source */
+   int source;          /* Host to download from, or -1 to ask the tracker */
+   int depth;           /* Ranges asked of one host at a time */
+   int querying;        /* Waiting for the list of hosts, or the file's size */
+   long long query_time;
+   struct swarm_piece *piece;
+   int pieces;
+   int done;            /* Pieces received */
+   struct swarm_peer peer[SWARM_MAX_PEERS];
+   int peers;
+
+   /* Statistics */
+   long long start_time;
+   int asked;           /* Range requests sent */
+   int duplicates;      /* Ranges received after another host delivered them */
+};
+
+/* A file the tracker knows, and the hosts that announced it */
+struct swarm_tracked {
+   char name[MAX_FILE_NAME];
+   long long size;
+   unsigned int crc;    /* With the size, tells versions of the file apart */
+   int host[SWARM_TRACKED_HOSTS];
+   int hosts;
+   int next;            /* Where the next list of hosts starts */
+};
+
+/* Downloads of a host, and the tracker's files if it is the tracker */
+struct swarm_table {
+   int host_id;
+   struct swarm *dl[SWARM_MAX];
+   struct swarm_tracked *tracked[SWARM_TRACKED_FILES];
+};
+
+void swarm_table_init(struct swarm_table *st, int host_id);
+int swarm_start(struct swarm_table *st, char dir[], char name[]);
+int swarm_fetch(struct swarm_table *st, char dir[], char name[], int src,
+      int depth);
+int swarm_expects(struct swarm_table *st, char *name);
+void swarm_range_done(struct swarm_table *st, char *name, int src,
+      long long offset, long long length, unsigned int crc, int ok);
+void swarm_pump(struct swarm_table *st, struct net_port **node_port,
+      int node_port_num);
+int swarm_announce(struct swarm_table *st, char dir[], char name[],
+      struct net_port **node_port, int node_port_num);
+void swarm_packet(struct swarm_table *st, struct packet *pkt,
+      struct net_port **node_port, int node_port_num);
+void swarm_describe(struct swarm_table *st, char dir[], struct packet *pkt,
+      struct net_port **node_port, int node_port_num);
+int swarm_range_request(struct packet *pkt, char *name, long long *offset,
+      long long *length);
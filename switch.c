@@ -11,9 +11,16 @@ This file contains the main program for a network switch application, handling n
 \li Adding source hosts to the forwarding table.
 \li Sending packets to all network ports.
 \li Checking if a host is in the forwarding table.
+\li Queueing packets at each egress port under CoDel or RED.
+\li Replicating multicast packets onto ports with group members.
+\li Stamping trace packets with the switch id, ports and time as they leave.
 
 The main program manages the forwarding table, which is used to keep track of host IDs and their associated ports. When a packet is received, the main program checks if the destination host is in the forwarding table. If so, it forwards the packet to the appropriate port. If not, it broadcasts the packet to all network ports.
 
+Forwarded packets are not written to the link directly.  They are placed in a per-port egress queue which is drained whenever the link has room, so a full pipe delays packets instead of losing them.  The queues are managed with CoDel (or RED, see SWITCH_AQM_MODE) to keep the queueing delay bounded under sustained load.  Sending SIGUSR1 to the switch prints the per-port queue statistics.
+
+Multicast group membership is learned by snooping PKT_MCAST_JOIN and PKT_MCAST_LEAVE packets, which are then flooded on to the other ports so that every switch learns which of its ports lead to members.  A packet addressed to a group is replicated only onto ports with members.
+
 */
 
 
@@ -34,6 +41,14 @@ The main program manages the forwarding table, which is used to keep track of ho
 #include "switch.h"
 #include "switch_util.h"
 
+static volatile sig_atomic_t g_show_stats = 0;
+
+/* SIGUSR1 handler, requests a dump of the egress queue statistics */
+static void request_stats(int sig) {
+  (void)sig;
+  g_show_stats = 1;
+}
+
 void switch_main(int host_id) {
   // initialization
   struct net_port *node_port_list;
@@ -45,8 +60,11 @@ void switch_main(int host_id) {
   struct net_port *p;
   int i, k, n;
   struct forward_table table;
+  struct egress_queue *egress;
+  struct mcast_table mcast;
 
   init_forward_table(&table);
+  init_mcast_table(&mcast);
 
   node_port_list = net_get_port_list(host_id);
 
@@ -65,6 +83,13 @@ void switch_main(int host_id) {
     p = p->next;
   }
 
+  egress = (struct egress_queue *)malloc(node_port_num *
+                                         sizeof(struct egress_queue));
+  for (k = 0; k < node_port_num; k++) {
+    egress_queue_init(&egress[k], SWITCH_AQM_MODE);
+  }
+  signal(SIGUSR1, request_stats);
+
   // display_forward_table(table);
 
   // socket
@@ -130,18 +155,41 @@ void switch_main(int host_id) {
           //              display_forward_table(table);
           // add packet routing here
           // check whole table
-          if (is_host_in_table(&table, in_packet->dst)) {
-            // port is in table, send it
-            packet_send(node_port[table.port[in_packet->dst]], in_packet);
+          if (IS_MCAST_ADDR((int)in_packet->dst)) {
+            add_src_to_table(&table, in_packet, k);
+            if (in_packet->type == PKT_MCAST_JOIN ||
+                in_packet->type == PKT_MCAST_LEAVE) {
+              // learn membership, then pass it on to the other switches
+              mcast_update_membership(&mcast, in_packet, k);
+              egress_enqueue_all_ports(node_port_num, egress, in_packet, k, k);
+            } else {
+              mcast_replicate(&mcast, node_port_num, egress, in_packet, k);
+            }
+
+          } else if (is_host_in_table(&table, in_packet->dst)) {
+            // port is in table, queue it on that port
             add_src_to_table(&table, in_packet, k);
+            egress_enqueue(&egress[table.port[in_packet->dst]], in_packet, k);
 
           } else {
             // port is not in table
             add_src_to_table(&table, in_packet, k);
-            send_to_all_ports(node_port_num, node_port, in_packet);
+            egress_enqueue_all_ports(node_port_num, egress, in_packet, k, -1);
           }
+        } else {
+          free(in_packet);
         }
       }
+
+      // send queued packets while the links have room
+      for (k = 0; k < node_port_num; k++) {
+        egress_drain(&egress[k], node_port[k], host_id, k);
+      }
+
+      if (g_show_stats) {
+        g_show_stats = 0;
+        display_egress_stats(node_port_num, egress);
+      }
     }
   }
 }
@@ -1,4 +1,24 @@
-#define MAX_TABLE_SIZE 100
+#define MAX_TABLE_SIZE 128   /* Host ids are a char, so 0-127 */
+
+/*
+ * Egress queue limits and active queue management (AQM) parameters.
+ * Times are in microseconds.
+ */
+#define EGRESS_QUEUE_LIMIT 1000   /* Hard cap, packets beyond it are tail dropped */
+#define CODEL_TARGET 5000         /* Acceptable standing queue delay (5 ms) */
+#define CODEL_INTERVAL 100000     /* Window for the delay to drop below target (100 ms) */
+#define RED_MIN_TH 50             /* Average queue length where RED starts dropping */
+#define RED_MAX_TH 500            /* Average queue length where RED drops everything */
+#define RED_MAX_P 0.1             /* Drop probability at RED_MAX_TH */
+#define RED_WEIGHT 0.002          /* EWMA weight of the average queue length */
+
+enum aqm_mode {
+   AQM_NONE,    /* Plain FIFO with tail drop */
+   AQM_CODEL,   /* Controlled delay, drops at dequeue on sojourn time */
+   AQM_RED      /* Random early detection, drops at enqueue on queue length */
+};
+
+#define SWITCH_AQM_MODE AQM_CODEL
 
 void switch_main(int);
 
@@ -6,6 +26,7 @@ struct switch_job {
    struct packet *packet;
    int in_port_index;
    int out_port_index;
+   long long enq_time;   /* When the packet entered the egress queue */
    struct switch_job *next;
 };
 
@@ -15,11 +36,52 @@ struct switch_job_queue {
    int occ;
 };
 
+/*
+ * Per-port egress queue.  Packets wait here until the outgoing link
+ * accepts them, and the AQM keeps the standing queue short.
+ */
+struct egress_queue {
+   struct switch_job_queue q;
+   struct switch_job *pending;   /* Passed AQM, waiting for link space */
+   enum aqm_mode mode;
+
+   /* CoDel state */
+   long long first_above_time;
+   long long drop_next;
+   int drop_count;
+   int last_count;
+   int dropping;
+
+   /* RED state */
+   double red_avg;
+
+   /* Statistics */
+   int enqueued;
+   int sent;
+   int codel_drops;
+   int red_drops;
+   int tail_drops;
+   long long sojourn_last;
+   long long sojourn_max;
+   long long sojourn_total;
+};
+
 void display_port_info(struct net_port*);
 
 struct forward_table {
    int size;
-   int valid[100];
-   int HostID[100];
-   int port[100];
+   int valid[MAX_TABLE_SIZE];
+   int HostID[MAX_TABLE_SIZE];
+   int port[MAX_TABLE_SIZE];
+};
+
+/*
+ * Multicast membership, learned from join/leave packets.
+ * members[g][k] counts the hosts reached through port k that
+ * have joined group g.
+ */
+#define MCAST_MAX_PORTS 100
+
+struct mcast_table {
+   int members[MCAST_MAX_GROUPS][MCAST_MAX_PORTS];
 };
@@ -12,6 +12,8 @@ The implementation includes functions to:
 \li Add a source host to the forwarding table.
 \li Send a packet to all network ports.
 \li Check if a host is in the forwarding table.
+\li Track multicast group membership per port and replicate group traffic.
+\li Queue packets at each egress port and manage the queues with CoDel or RED.
 \li The file depends on the main.h, packet.h, and switch.h header files.
 
 @see main.h
@@ -19,12 +21,17 @@ The implementation includes functions to:
 @see switch.h
 */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "main.h"
 #include "packet.h"
 #include "switch.h"
+#include "time_util.h"
+#include "timer.h"
+#include "trace.h"
 
 /**
 @brief Displays the information of a network port.
@@ -55,7 +62,7 @@ void display_forward_table(struct forward_table table) {
   printf("Forward table:\n");
   printf("Size: %d\n", table.size);
   printf("Valid\tHost ID\tPort\n");
-  for (i = 0; i < 100; i++) {
+  for (i = 0; i < MAX_TABLE_SIZE; i++) {
     if (table.valid[i] != 0 || table.HostID[i] != -1) {
       printf("%d\t%d\t%d\n", table.valid[i], table.HostID[i], table.port[i]);
     }
@@ -128,3 +135,347 @@ int is_host_in_table(struct forward_table *table, char dst) {
   // table->valid[(int)dst]);
   return table->valid[(int)dst];
 }
+
+/**
+@brief Initializes an egress queue.
+
+This function empties the queue, clears the AQM state and statistics, and selects the queue management discipline.
+
+@param eq Pointer to the egress_queue structure to initialize.
+@param mode The AQM discipline to apply to the queue.
+*/
+void egress_queue_init(struct egress_queue *eq, enum aqm_mode mode) {
+  memset(eq, 0, sizeof(struct egress_queue));
+  eq->mode = mode;
+}
+
+/**
+@brief Removes the packet at the head of an egress queue.
+
+@param eq Pointer to the egress_queue structure.
+@return Pointer to the removed job, or NULL if the queue is empty.
+*/
+static struct switch_job *egress_pop(struct egress_queue *eq) {
+  struct switch_job *j;
+
+  if (eq->q.occ == 0) return (NULL);
+  j = eq->q.head;
+  eq->q.head = j->next;
+  if (eq->q.head == NULL) eq->q.tail = NULL;
+  eq->q.occ--;
+  return (j);
+}
+
+/**
+@brief Drops a queued packet and frees its memory.
+
+@param j Pointer to the switch_job holding the packet to drop.
+*/
+static void egress_drop(struct switch_job *j) {
+  free(j->packet);
+  free(j);
+}
+
+/**
+@brief Adds a packet to an egress queue.
+
+The queue takes ownership of the packet.  The packet is stamped with the current time so that its sojourn time can be measured when it leaves.  In RED mode the packet may be dropped early based on the average queue length, and in every mode it is tail dropped if the queue is at EGRESS_QUEUE_LIMIT.
+
+@param eq Pointer to the egress_queue structure.
+@param pkt Pointer to the packet to queue.
+@param in_port_index The index of the port the packet arrived on.
+*/
+void egress_enqueue(struct egress_queue *eq, struct packet *pkt,
+                    int in_port_index) {
+  struct switch_job *j;
+  double p;
+
+  if (eq->mode == AQM_RED) {
+    eq->red_avg = (1 - RED_WEIGHT) * eq->red_avg + RED_WEIGHT * eq->q.occ;
+    if (eq->red_avg >= RED_MAX_TH) {
+      eq->red_drops++;
+      free(pkt);
+      return;
+    } else if (eq->red_avg > RED_MIN_TH) {
+      p = RED_MAX_P * (eq->red_avg - RED_MIN_TH) / (RED_MAX_TH - RED_MIN_TH);
+      if ((double)rand() / RAND_MAX < p) {
+        eq->red_drops++;
+        free(pkt);
+        return;
+      }
+    }
+  }
+
+  if (eq->q.occ >= EGRESS_QUEUE_LIMIT) {
+    eq->tail_drops++;
+    free(pkt);
+    return;
+  }
+
+  j = (struct switch_job *)malloc(sizeof(struct switch_job));
+  j->packet = pkt;
+  j->in_port_index = in_port_index;
+  j->enq_time = time_now_usec();
+  j->next = NULL;
+
+  if (eq->q.tail == NULL) {
+    eq->q.head = j;
+  } else {
+    eq->q.tail->next = j;
+  }
+  eq->q.tail = j;
+  eq->q.occ++;
+  eq->enqueued++;
+}
+
+/**
+@brief Queues a copy of a packet at every egress port.
+
+This is the queued counterpart of send_to_all_ports() and is used to flood packets whose destination is not yet in the forwarding table.  The original packet is freed.
+
+@param node_port_num The number of network ports.
+@param egress Array of egress queues, one per port.
+@param pkt Pointer to the packet to flood.
+@param in_port_index The index of the port the packet arrived on.
+@param skip_port Port to leave out of the flood, or -1 to use every port.
+*/
+void egress_enqueue_all_ports(int node_port_num, struct egress_queue *egress,
+                              struct packet *pkt, int in_port_index,
+                              int skip_port) {
+  struct packet *copy;
+
+  for (int k = 0; k < node_port_num; k++) {
+    if (k == skip_port) continue;
+    copy = (struct packet *)malloc(sizeof(struct packet));
+    memcpy(copy, pkt, sizeof(struct packet));
+    egress_enqueue(&egress[k], copy, in_port_index);
+  }
+  free(pkt);
+}
+
+/**
+@brief Computes the next CoDel drop time.
+
+Drops are spaced by interval / sqrt(count) so the drop rate rises slowly while the queue stays above target.
+
+@param t The time of the current drop.
+@param count The number of drops in the current dropping state.
+@return The time of the next drop.
+*/
+static long long codel_control_law(long long t, int count) {
+  return t + (long long)(CODEL_INTERVAL / sqrt((double)count));
+}
+
+/**
+@brief Decides whether CoDel may drop the packet just dequeued.
+
+The packet may be dropped only if the sojourn time has stayed above CODEL_TARGET for at least CODEL_INTERVAL, and there is more than one packet queued.
+
+@param eq Pointer to the egress_queue structure.
+@param j Pointer to the job just removed from the queue.
+@param now The current time.
+@return 1 if the packet may be dropped, 0 otherwise.
+*/
+static int codel_ok_to_drop(struct egress_queue *eq, struct switch_job *j,
+                            long long now) {
+  long long sojourn = now - j->enq_time;
+
+  eq->sojourn_last = sojourn;
+  eq->sojourn_total += sojourn;
+  if (sojourn > eq->sojourn_max) eq->sojourn_max = sojourn;
+
+  if (sojourn < CODEL_TARGET || eq->q.occ == 0) {
+    eq->first_above_time = 0;
+    return 0;
+  }
+  if (eq->first_above_time == 0) {
+    eq->first_above_time = now + CODEL_INTERVAL;
+    return 0;
+  }
+  return now >= eq->first_above_time;
+}
+
+/**
+@brief Removes the next packet to transmit from an egress queue.
+
+In CoDel mode this runs the dequeue side of the algorithm (RFC 8289), which may drop one or more packets at the head of the queue before returning one.  In the other modes it simply removes the head packet.
+
+@param eq Pointer to the egress_queue structure.
+@return Pointer to the job to transmit, or NULL if the queue is empty.
+*/
+static struct switch_job *egress_dequeue(struct egress_queue *eq) {
+  struct switch_job *j;
+  long long now;
+  int ok_to_drop;
+  int delta;
+
+  j = egress_pop(eq);
+  if (eq->mode != AQM_CODEL) {
+    if (j != NULL) {
+      eq->sojourn_last = time_now_usec() - j->enq_time;
+      eq->sojourn_total += eq->sojourn_last;
+      if (eq->sojourn_last > eq->sojourn_max) {
+        eq->sojourn_max = eq->sojourn_last;
+      }
+    }
+    return (j);
+  }
+
+  if (j == NULL) {
+    eq->first_above_time = 0;
+    eq->dropping = 0;
+    return (NULL);
+  }
+
+  now = time_now_usec();
+  ok_to_drop = codel_ok_to_drop(eq, j, now);
+
+  if (eq->dropping) {
+    if (!ok_to_drop) {
+      eq->dropping = 0;
+    }
+    while (eq->dropping && now >= eq->drop_next) {
+      egress_drop(j);
+      eq->codel_drops++;
+      eq->drop_count++;
+      j = egress_pop(eq);
+      if (j == NULL || !codel_ok_to_drop(eq, j, now)) {
+        eq->dropping = 0;
+      } else {
+        eq->drop_next = codel_control_law(eq->drop_next, eq->drop_count);
+      }
+    }
+  } else if (ok_to_drop) {
+    egress_drop(j);
+    eq->codel_drops++;
+    j = egress_pop(eq);
+    eq->dropping = 1;
+
+    /* Resume near the previous drop rate if we were dropping recently */
+    delta = eq->drop_count - eq->last_count;
+    if (delta > 1 && now - eq->drop_next < 16 * CODEL_INTERVAL) {
+      eq->drop_count = delta;
+    } else {
+      eq->drop_count = 1;
+    }
+    eq->drop_next = codel_control_law(now, eq->drop_count);
+    eq->last_count = eq->drop_count;
+  }
+
+  return (j);
+}
+
+/**
+@brief Transmits queued packets until the egress queue is empty or the link is full.
+
+A packet that passed the AQM but could not be written because the link is full is held as the pending packet and retried first on the next call, so packets leave the port in order.  A trace packet is stamped once, when it leaves the queue.
+
+@param eq Pointer to the egress_queue structure.
+@param port Pointer to the net_port the queue transmits on.
+@param switch_id The ID of the switch, for trace stamps.
+@param port_index The index of the port, for trace stamps.
+*/
+void egress_drain(struct egress_queue *eq, struct net_port *port,
+                  int switch_id, int port_index) {
+  struct switch_job *j;
+
+  while (1) {
+    if (eq->pending != NULL) {
+      j = eq->pending;
+      eq->pending = NULL;
+    } else {
+      j = egress_dequeue(eq);
+      if (j == NULL) return;
+      trace_stamp(j->packet, switch_id, TRACE_SWITCH, j->in_port_index,
+                  port_index);
+    }
+    if (packet_send(port, j->packet) < 0) {
+      eq->pending = j;
+      return;
+    }
+    eq->sent++;
+    egress_drop(j);
+  }
+}
+
+/**
+@brief Displays the statistics of every egress queue.
+
+For each port this prints the current queue length, the packets queued and sent, the drops by cause, and the last, average and maximum sojourn times in microseconds.
+
+@param node_port_num The number of network ports.
+@param egress Array of egress queues, one per port.
+*/
+void display_egress_stats(int node_port_num, struct egress_queue *egress) {
+  struct egress_queue *eq;
+  long long avg;
+
+  printf("Egress queues:\n");
+  printf("Port\tQlen\tEnq\tSent\tCoDel\tRED\tTail\tLast\tAvg\tMax\n");
+  for (int k = 0; k < node_port_num; k++) {
+    eq = &egress[k];
+    avg = eq->sent + eq->codel_drops > 0
+              ? eq->sojourn_total / (eq->sent + eq->codel_drops)
+              : 0;
+    printf("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%lld\t%lld\t%lld\n", k,
+           eq->q.occ, eq->enqueued, eq->sent, eq->codel_drops, eq->red_drops,
+           eq->tail_drops, eq->sojourn_last, avg, eq->sojourn_max);
+  }
+  printf("Corrupt frames dropped: %lld\n", packet_crc_errors());
+}
+
+/**
+@brief Initializes the multicast membership table.
+
+@param mt Pointer to the mcast_table structure to initialize.
+*/
+void init_mcast_table(struct mcast_table *mt) {
+  memset(mt, 0, sizeof(struct mcast_table));
+}
+
+/**
+@brief Updates multicast membership from a join or leave packet.
+
+A join received on a port means one more member of the group lies behind that port, and a leave means one fewer.  The counts let several hosts behind the same port join and leave independently.
+
+@param mt Pointer to the mcast_table structure.
+@param pkt Pointer to the PKT_MCAST_JOIN or PKT_MCAST_LEAVE packet.
+@param port_index The index of the port the packet arrived on.
+*/
+void mcast_update_membership(struct mcast_table *mt, struct packet *pkt,
+                             int port_index) {
+  int g = MCAST_GROUP((int)pkt->dst);
+
+  if (port_index >= MCAST_MAX_PORTS) return;
+  if (pkt->type == PKT_MCAST_JOIN) {
+    mt->members[g][port_index]++;
+  } else if (pkt->type == PKT_MCAST_LEAVE && mt->members[g][port_index] > 0) {
+    mt->members[g][port_index]--;
+  }
+}
+
+/**
+@brief Replicates a multicast packet onto the ports that have group members.
+
+The packet is queued once on every port with at least one member of the destination group, other than the port it arrived on.  Ports without members never see the packet.  The original packet is freed.
+
+@param mt Pointer to the mcast_table structure.
+@param node_port_num The number of network ports.
+@param egress Array of egress queues, one per port.
+@param pkt Pointer to the multicast packet.
+@param in_port_index The index of the port the packet arrived on.
+*/
+void mcast_replicate(struct mcast_table *mt, int node_port_num,
+                     struct egress_queue *egress, struct packet *pkt,
+                     int in_port_index) {
+  struct packet *copy;
+  int g = MCAST_GROUP((int)pkt->dst);
+
+  for (int k = 0; k < node_port_num && k < MCAST_MAX_PORTS; k++) {
+    if (k == in_port_index || mt->members[g][k] == 0) continue;
+    copy = (struct packet *)malloc(sizeof(struct packet));
+    memcpy(copy, pkt, sizeof(struct packet));
+    egress_enqueue(&egress[k], copy, in_port_index);
+  }
+  free(pkt);
+}
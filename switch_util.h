@@ -4,3 +4,11 @@ void init_forward_table(struct forward_table *table);
 void add_src_to_table(struct forward_table *table, struct packet *pkt, int port_index);
 void send_to_all_ports(int node_port_num, struct net_port **node_port, struct packet *pkt);
 int is_host_in_table(struct forward_table *table, char dst);
+void egress_queue_init(struct egress_queue *eq, enum aqm_mode mode);
+void egress_enqueue(struct egress_queue *eq, struct packet *pkt, int in_port_index);
+void egress_enqueue_all_ports(int node_port_num, struct egress_queue *egress, struct packet *pkt, int in_port_index, int skip_port);
+void egress_drain(struct egress_queue *eq, struct net_port *port, int switch_id, int port_index);
+void display_egress_stats(int node_port_num, struct egress_queue *egress);
+void init_mcast_table(struct mcast_table *mt);
+void mcast_update_membership(struct mcast_table *mt, struct packet *pkt, int port_index);
+void mcast_replicate(struct mcast_table *mt, int node_port_num, struct egress_queue *egress, struct packet *pkt, int in_port_index);
@@ -0,0 +1,24 @@
+/**
+
+@file time_util.c
+@brief Monotonic time helpers shared by the host and switch.
+
+Timestamps are taken from CLOCK_MONOTONIC so that they are unaffected by
+changes to the wall clock, which matters when measuring queueing delay.
+*/
+
+#include <time.h>
+
+#include "time_util.h"
+
+/**
+
+@brief Get the current monotonic time.
+@return Microseconds since an arbitrary fixed point in the past.
+*/
+long long time_now_usec() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
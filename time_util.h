@@ -0,0 +1,6 @@
+/*
+ * time_util.h
+ */
+
+/* Monotonic clock in microseconds, used for queue and RTT timestamps */
+long long time_now_usec();
@@ -0,0 +1,238 @@
+/**
+
+@file timer.c
+@brief Hierarchical timer wheel.
+
+Time is counted in ticks of TIMER_TICK.  The wheel has TIMER_LEVELS
+levels of TIMER_SLOTS slots.  A timer due within TIMER_SLOTS ticks goes
+in the first level, in the slot of its tick; one due later goes in the
+level whose slots are just coarse enough, in the slot of its tick's
+digit at that level.  Adding and cancelling a timer are O(1), since each
+slot is a doubly linked list.
+
+Each tick the wheel expires the first level's slot for that tick.  When
+the first level wraps around, the next slot of the second level is
+emptied and its timers are added again, now landing in the first level,
+and so on up the levels, so every timer moves down at most
+TIMER_LEVELS - 1 times before it expires.
+
+The host advances the wheel once per pass of its loop and sleeps no
+longer than until the next timer in the first level, so a timer fires
+within a tick of its time rather than on the next 10 ms pass.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "timer.h"
+
+/**
+
+@brief Make a list head with no timers.
+@param head The list head.
+*/
+static void timer_list_init(struct timer *head) {
+  head->next = head;
+  head->prev = head;
+}
+
+/**
+
+@brief Take a timer out of its list.
+@param t The timer.
+*/
+static void timer_unlink(struct timer *t) {
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = t;
+  t->prev = t;
+}
+
+/**
+
+@brief Initialize a wheel with no timers.
+@param tw Pointer to the wheel.
+@param now Current time in microseconds.
+*/
+void timer_wheel_init(struct timer_wheel *tw, long long now) {
+  int l;
+  int s;
+
+  memset(tw, 0, sizeof(struct timer_wheel));
+  for (l = 0; l < TIMER_LEVELS; l++) {
+    for (s = 0; s < TIMER_SLOTS; s++) {
+      timer_list_init(&tw->slot[l][s]);
+    }
+  }
+  tw->now_tick = now / TIMER_TICK;
+}
+
+/**
+
+@brief Initialize a timer that is not pending.
+@param t Pointer to the timer.
+@param fn Function to call when it expires.
+@param arg Argument to pass to fn.
+*/
+void timer_init(struct timer *t, void (*fn)(void *arg), void *arg) {
+  timer_list_init(t);
+  t->expires = 0;
+  t->pending = 0;
+  t->fn = fn;
+  t->arg = arg;
+}
+
+/**
+
+@brief Put a timer in the slot for its tick.
+@param tw Pointer to the wheel.
+@param t Pointer to the timer, not in any list.
+*/
+static void timer_place(struct timer_wheel *tw, struct timer *t) {
+  struct timer *head;
+  long long delta = t->expires - tw->now_tick;
+  int shift;
+  int l;
+
+  for (l = 0; l < TIMER_LEVELS - 1; l++) {
+    if (delta < (1LL << ((l + 1) * TIMER_SLOT_BITS))) break;
+  }
+  shift = l * TIMER_SLOT_BITS;
+  head = &tw->slot[l][(t->expires >> shift) & TIMER_SLOT_MASK];
+  t->next = head;
+  t->prev = head->prev;
+  head->prev->next = t;
+  head->prev = t;
+}
+
+/**
+
+@brief Start a timer, or move it if it is already pending.
+
+A time already past expires on the next tick.
+
+@param tw Pointer to the wheel.
+@param t Pointer to the timer.
+@param expires Time to expire at, in microseconds.
+*/
+void timer_add(struct timer_wheel *tw, struct timer *t, long long expires) {
+  long long tick = (expires + TIMER_TICK - 1) / TIMER_TICK;
+
+  if (t->pending) {
+    timer_unlink(t);
+  } else {
+    tw->count++;
+  }
+  if (tick < tw->now_tick) tick = tw->now_tick;
+  if (tick - tw->now_tick >= TIMER_MAX_TICKS) {
+    tick = tw->now_tick + TIMER_MAX_TICKS - 1;
+  }
+  t->expires = tick;
+  t->pending = 1;
+  timer_place(tw, t);
+}
+
+/**
+
+@brief Stop a timer.  Nothing happens if it is not pending.
+@param tw Pointer to the wheel.
+@param t Pointer to the timer.
+*/
+void timer_cancel(struct timer_wheel *tw, struct timer *t) {
+  if (!t->pending) return;
+  timer_unlink(t);
+  t->pending = 0;
+  tw->count--;
+  tw->cancelled++;
+}
+
+/**
+
+@brief Move the timers of a slot down to the levels below.
+@param tw Pointer to the wheel.
+@param l Level of the slot.
+@param s Index of the slot.
+*/
+static void timer_cascade(struct timer_wheel *tw, int l, int s) {
+  struct timer *head = &tw->slot[l][s];
+  struct timer *t;
+
+  while (head->next != head) {
+    t = head->next;
+    timer_unlink(t);
+    timer_place(tw, t);
+  }
+}
+
+/**
+
+@brief Expire the timers due by now, calling each one's function.
+
+A function may add and cancel timers, including other timers due in the
+same tick.
+
+@param tw Pointer to the wheel.
+@param now Current time in microseconds.
+*/
+void timer_wheel_advance(struct timer_wheel *tw, long long now) {
+  long long target = now / TIMER_TICK;
+  struct timer expired;
+  struct timer *head;
+  struct timer *t;
+  int shift;
+  int l;
+
+  while (tw->now_tick <= target) {
+    if (tw->count == 0) {
+      tw->now_tick = target + 1;
+      break;
+    }
+
+    /* Bring the next slot of each level that wrapped around down */
+    for (l = 1; l < TIMER_LEVELS; l++) {
+      shift = l * TIMER_SLOT_BITS;
+      if ((tw->now_tick & ((1LL << shift) - 1)) != 0) break;
+      timer_cascade(tw, l, (tw->now_tick >> shift) & TIMER_SLOT_MASK);
+    }
+
+    /* Take the due timers out first, so ones added now wait a tick */
+    head = &tw->slot[0][tw->now_tick & TIMER_SLOT_MASK];
+    timer_list_init(&expired);
+    if (head->next != head) {
+      expired.next = head->next;
+      expired.prev = head->prev;
+      expired.next->prev = &expired;
+      expired.prev->next = &expired;
+      timer_list_init(head);
+    }
+    tw->now_tick++;
+
+    while (expired.next != &expired) {
+      t = expired.next;
+      timer_unlink(t);
+      t->pending = 0;
+      tw->count--;
+      tw->fired++;
+      t->fn(t->arg);
+    }
+  }
+}
+
+/**
+
+@brief Find when the next timer of the first level expires.
+@param tw Pointer to the wheel.
+@return Its time in microseconds, or -1 if none expires within
+TIMER_SLOTS ticks.
+*/
+long long timer_wheel_next(struct timer_wheel *tw) {
+  struct timer *head;
+  long long tick;
+
+  if (tw->count == 0) return -1;
+  for (tick = tw->now_tick; tick < tw->now_tick + TIMER_SLOTS; tick++) {
+    head = &tw->slot[0][tick & TIMER_SLOT_MASK];
+    if (head->next != head) return tick * TIMER_TICK;
+  }
+  return -1;
+}
@@ -0,0 +1,44 @@
+/*
+ * timer.h
+ *
+ * Hierarchical timer wheel of a host, which holds its ping and trace timeouts,
+ * retransmission timers and transfer idle timeouts and calls back when
+ * they expire.
+ */
+
+#define TIMER_TICK 1000       /* Resolution of the wheel (1 ms) */
+#define TIMER_LEVELS 4        /* Wheels, each TIMER_SLOTS times coarser */
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+#define TIMER_MAX_TICKS (1LL << (TIMER_LEVELS * TIMER_SLOT_BITS))   /* About 4.6 hours */
+
+/*
+ * A timer, kept in a slot's list while it is pending.  The owner embeds
+ * it in whatever it times, so adding and cancelling allocate nothing.
+ */
+struct timer {
+   struct timer *next;
+   struct timer *prev;
+   long long expires;   /* Tick it expires at */
+   int pending;
+   void (*fn)(void *arg);   /* Called once it expires */
+   void *arg;
+};
+
+struct timer_wheel {
+   struct timer slot[TIMER_LEVELS][TIMER_SLOTS];   /* List heads */
+   long long now_tick;  /* Next tick to expire */
+   int count;           /* Timers pending */
+
+   /* Statistics */
+   long long fired;
+   long long cancelled;
+};
+
+void timer_wheel_init(struct timer_wheel *tw, long long now);
+void timer_init(struct timer *t, void (*fn)(void *arg), void *arg);
+void timer_add(struct timer_wheel *tw, struct timer *t, long long expires);
+void timer_cancel(struct timer_wheel *tw, struct timer *t);
+void timer_wheel_advance(struct timer_wheel *tw, long long now);
+long long timer_wheel_next(struct timer_wheel *tw);
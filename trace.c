@@ -0,0 +1,275 @@
+/**
+
+@file trace.c
+@brief Traces of the path a packet takes to a host and back.
+
+A trace request (PKT_TRACE_REQ) starts with a 16-bit identifier, a count
+of stamps and flags.  Every node that forwards it appends a stamp: its
+node id, whether it is a host or a switch, the port the packet came in
+on, the port it goes out on and the low 32 bits of the monotonic clock
+in microseconds.  The host that sends the trace stamps it first, a
+switch stamps each copy as it leaves the egress queue (so the stamp
+includes the time queued), and the host traced stamps the request and
+sends it back as a PKT_TRACE_REPLY, which the switches stamp on the way
+back too.  The payload holds TRACE_MAX_STAMPS stamps; a longer path is
+flagged and the rest of it goes unrecorded.
+
+When the reply arrives, the tracing host adds a last stamp and reports
+every hop to the manager with the time since the stamp before it, so it
+shows where on the path, and in which direction, the time is spent.  The
+clock is the same for every process on a machine, but a hop to a node on
+another machine (over a socket link) also includes the difference
+between the clocks.  A trace that does not come back within
+TRACE_TIMEOUT is reported as timed out.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "packet.h"
+#include "time_util.h"
+#include "timer.h"
+#include "trace.h"
+
+/**
+
+@brief Store a 32-bit value in big-endian order.
+@param buf Destination, at least 4 bytes.
+@param v Value to store.
+*/
+static void trace_put_u32(char *buf, unsigned int v) {
+  buf[0] = (char)(v >> 24);
+  buf[1] = (char)(v >> 16);
+  buf[2] = (char)(v >> 8);
+  buf[3] = (char)v;
+}
+
+/**
+
+@brief Load a 32-bit value stored in big-endian order.
+@param buf Source, at least 4 bytes.
+@return The value.
+*/
+static unsigned int trace_get_u32(char *buf) {
+  return ((unsigned int)(unsigned char)buf[0] << 24) |
+         ((unsigned int)(unsigned char)buf[1] << 16) |
+         ((unsigned int)(unsigned char)buf[2] << 8) |
+         (unsigned int)(unsigned char)buf[3];
+}
+
+/**
+
+@brief Append the stamp of a node to a trace packet.
+
+Packets that are not traces, or whose stamps do not add up, are left
+as they are.
+
+@param pkt The packet about to be sent.
+@param node_id ID of the node sending it.
+@param kind TRACE_HOST or TRACE_SWITCH.
+@param in_port Index of the port it came in on, or -1.
+@param out_port Index of the port it goes out on, or -1.
+*/
+void trace_stamp(struct packet *pkt, int node_id, int kind, int in_port,
+                 int out_port) {
+  char *s;
+  int n;
+
+  if (pkt->type != (char)PKT_TRACE_REQ && pkt->type != (char)PKT_TRACE_REPLY) {
+    return;
+  }
+  if (pkt->length < TRACE_HDR_LEN) return;
+  n = (unsigned char)pkt->payload[2];
+  if (pkt->length != TRACE_HDR_LEN + n * TRACE_STAMP_LEN) return;
+  if (n >= TRACE_MAX_STAMPS) {
+    pkt->payload[3] |= TRACE_FLAG_FULL;
+    return;
+  }
+  s = pkt->payload + pkt->length;
+  s[0] = (char)node_id;
+  s[1] = (char)kind;
+  s[2] = (char)(in_port < 0 ? TRACE_NO_PORT : in_port);
+  s[3] = (char)(out_port < 0 ? TRACE_NO_PORT : out_port);
+  trace_put_u32(s + 4, (unsigned int)time_now_usec());
+  pkt->payload[2] = (char)(n + 1);
+  pkt->length += TRACE_STAMP_LEN;
+}
+
+/**
+
+@brief Send a trace packet on all ports of the host, stamped with the
+port each copy goes out on.
+@param tt Pointer to the table.
+@param pkt The packet.
+@param in_port Index of the port it came in on, or -1.
+*/
+static void trace_send_all_ports(struct trace_table *tt, struct packet *pkt,
+                                 int in_port) {
+  struct packet copy;
+  int k;
+
+  for (k = 0; k < tt->node_port_num; k++) {
+    copy = *pkt;
+    trace_stamp(&copy, tt->host_id, TRACE_HOST, in_port, k);
+    packet_send(tt->node_port[k], &copy);
+  }
+}
+
+/**
+
+@brief Send a message to the manager.
+@param tt Pointer to the table.
+@param msg The message.
+*/
+static void trace_report(struct trace_table *tt, char *msg) {
+  write(tt->man_fd, msg, strlen(msg) + 1);
+}
+
+/**
+
+@brief Report a trace that did not come back in time, when its timer
+goes off.
+@param arg Pointer to the table.
+*/
+static void trace_timed_out(void *arg) {
+  struct trace_table *tt = (struct trace_table *)arg;
+  char msg[100];
+
+  tt->active = 0;
+  sprintf(msg, "Trace time out! to %d: id=%u", tt->dst, tt->id);
+  trace_report(tt, msg);
+}
+
+/**
+
+@brief Initialize the table with no trace running.
+@param tt Pointer to the table.
+@param host_id ID of this host.
+@param man_fd Pipe to the manager.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+@param timers Pointer to the host's timer wheel.
+*/
+void trace_table_init(struct trace_table *tt, int host_id, int man_fd,
+                      struct net_port **node_port, int node_port_num,
+                      struct timer_wheel *timers) {
+  memset(tt, 0, sizeof(struct trace_table));
+  tt->host_id = host_id;
+  tt->man_fd = man_fd;
+  tt->node_port = node_port;
+  tt->node_port_num = node_port_num;
+  tt->timers = timers;
+  tt->next_id = (unsigned int)host_id << 8;
+  timer_init(&tt->timer, trace_timed_out, tt);
+}
+
+/**
+
+@brief Send a trace to a host and report its path or time out to the
+manager.
+@param tt Pointer to the table.
+@param dst Host to trace.
+@return 1 if the trace was sent, 0 if one is already running.
+*/
+int trace_send(struct trace_table *tt, int dst) {
+  struct packet pkt;
+
+  if (tt->active) return 0;
+  tt->active = 1;
+  tt->dst = dst;
+  tt->id = tt->next_id++ & 0xffff;
+
+  pkt.src = (char)tt->host_id;
+  pkt.dst = (char)dst;
+  pkt.type = (char)PKT_TRACE_REQ;
+  pkt.payload[0] = (char)(tt->id >> 8);
+  pkt.payload[1] = (char)tt->id;
+  pkt.payload[2] = 0;
+  pkt.payload[3] = 0;
+  pkt.length = TRACE_HDR_LEN;
+
+  tt->start_time = time_now_usec();
+  trace_send_all_ports(tt, &pkt, -1);
+  timer_add(tt->timers, &tt->timer, tt->start_time + TRACE_TIMEOUT);
+  return 1;
+}
+
+/**
+
+@brief Stamp a trace request for this host and send it back as a reply.
+@param tt Pointer to the table.
+@param pkt The PKT_TRACE_REQ packet.
+@param in_port Index of the port it came in on.
+*/
+void trace_request(struct trace_table *tt, struct packet *pkt, int in_port) {
+  struct packet reply;
+
+  reply = *pkt;
+  reply.src = (char)tt->host_id;
+  reply.dst = pkt->src;
+  reply.type = (char)PKT_TRACE_REPLY;
+  trace_send_all_ports(tt, &reply, in_port);
+}
+
+/**
+
+@brief Match a trace reply to the trace running and report its path.
+@param tt Pointer to the table.
+@param pkt The PKT_TRACE_REPLY packet.
+@param in_port Index of the port it came in on.
+*/
+void trace_reply(struct trace_table *tt, struct packet *pkt, int in_port) {
+  long long rtt = time_now_usec() - tt->start_time;
+  unsigned int id;
+  unsigned int t;
+  unsigned int prev;
+  char msg[800];
+  char in[8];
+  char out[8];
+  char *s;
+  int len;
+  int n;
+  int i;
+
+  if (!tt->active || pkt->src != (char)tt->dst || pkt->length < TRACE_HDR_LEN) {
+    return;
+  }
+  id = ((unsigned int)(unsigned char)pkt->payload[0] << 8) |
+       (unsigned char)pkt->payload[1];
+  if (id != tt->id) return;
+  timer_cancel(tt->timers, &tt->timer);
+  tt->active = 0;
+
+  trace_stamp(pkt, tt->host_id, TRACE_HOST, in_port, -1);
+  n = (pkt->length - TRACE_HDR_LEN) / TRACE_STAMP_LEN;
+  if (n > (unsigned char)pkt->payload[2]) n = (unsigned char)pkt->payload[2];
+
+  len = sprintf(msg, "Trace to %d: id=%u, %d hops, round trip %lld us%s",
+                tt->dst, id, n > 0 ? n - 1 : 0, rtt,
+                pkt->payload[3] & TRACE_FLAG_FULL
+                    ? " (some nodes not recorded)"
+                    : "");
+  prev = 0;
+  for (i = 0; i < n; i++) {
+    s = pkt->payload + TRACE_HDR_LEN + i * TRACE_STAMP_LEN;
+    t = trace_get_u32(s + 4);
+    if ((unsigned char)s[2] == TRACE_NO_PORT) {
+      strcpy(in, "-");
+    } else {
+      sprintf(in, "%d", (unsigned char)s[2]);
+    }
+    if ((unsigned char)s[3] == TRACE_NO_PORT) {
+      strcpy(out, "-");
+    } else {
+      sprintf(out, "%d", (unsigned char)s[3]);
+    }
+    len += sprintf(msg + len, "\n%3d  %-6s %3d  in %-2s out %-2s  +%d us", i,
+                   s[1] == TRACE_SWITCH ? "switch" : "host",
+                   (unsigned char)s[0], in, out,
+                   i == 0 ? 0 : (int)(t - prev));
+    prev = t;
+  }
+  trace_report(tt, msg);
+}
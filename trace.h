@@ -0,0 +1,42 @@
+/*
+ * trace.h
+ *
+ * Traces of the path to a host.  A trace packet is stamped by every host
+ * and switch it passes, there and back, and the host that sent it
+ * reports each hop and the time between hops to the manager.
+ * Requires main.h, packet.h and timer.h to be included first.
+ */
+
+#define TRACE_TIMEOUT 2000000     /* Time to wait for a trace to come back (2 s) */
+#define TRACE_HDR_LEN 4           /* Identifier, stamp count and flags before the stamps */
+#define TRACE_STAMP_LEN 8         /* Node id, kind, ports and time of one stamp */
+#define TRACE_MAX_STAMPS ((PAYLOAD_MAX - TRACE_HDR_LEN) / TRACE_STAMP_LEN)
+#define TRACE_FLAG_FULL 0x01      /* Nodes passed after the last stamp were not recorded */
+#define TRACE_NO_PORT 0xff        /* The stamp has no ingress or egress port */
+#define TRACE_HOST 'H'            /* Kinds of node that stamp */
+#define TRACE_SWITCH 'S'
+
+struct trace_table {
+   int host_id;
+   int man_fd;              /* Pipe the results are reported on */
+   struct net_port **node_port;
+   int node_port_num;
+   struct timer_wheel *timers;
+   unsigned int next_id;
+
+   /* The trace waiting to come back; one runs at a time */
+   int active;
+   int dst;
+   unsigned int id;         /* 16 bits, one per trace command */
+   long long start_time;    /* Monotonic clock, in microseconds */
+   struct timer timer;      /* Goes off after TRACE_TIMEOUT */
+};
+
+void trace_stamp(struct packet *pkt, int node_id, int kind, int in_port,
+      int out_port);
+void trace_table_init(struct trace_table *tt, int host_id, int man_fd,
+      struct net_port **node_port, int node_port_num,
+      struct timer_wheel *timers);
+int trace_send(struct trace_table *tt, int dst);
+void trace_request(struct trace_table *tt, struct packet *pkt, int in_port);
+void trace_reply(struct trace_table *tt, struct packet *pkt, int in_port);
@@ -0,0 +1,2195 @@
+/**
+
+@file transfer.c
+@brief Reliable sliding-window file transfer between hosts.
+
+Every packet of a transfer starts with a 1-byte transfer id and a 4-byte
+sequence number.  Sequence number 0 is the PKT_FILE_UPLOAD_START packet
+carrying the file size, a file id, flags and the name, the file contents
+follow as PKT_FILE_UPLOAD_CONT packets, and the last sequence number is the
+PKT_FILE_UPLOAD_END packet with the CRC32C of the whole file.  Every data
+packet but the last is full, so packet seq holds the file bytes from
+(seq - 1) * XFER_DATA_MAX.
+
+A host runs many transfers at once.  Each upload gets a transfer id from
+the host's xfer_table, and the receiver keeps a separate session for each
+(source host, transfer id) pair.
+
+The sender (xfer_send_pump()) keeps the packets in flight until they are
+acknowledged, within a congestion window, and resends those that time out
+or that the selective acknowledgements show to be lost.  The receiver
+(xfer_recv_packet()) writes each data packet at its offset as it arrives
+and answers it with a PKT_FILE_ACK.  File I/O on both ends goes through
+the host's I/O pool (io_pool.c), and an interrupted unicast transfer
+resumes from the receiver's checkpoint.
+
+Besides a file as it is, an upload can send the file compressed, a delta
+against the receiver's copy, the chunks the receiver does not store, or a
+range of the file for a download (see xfer_send_prepared() and
+xfer_send_range()).  Uploads to a multicast group are sent once without
+acknowledgements, and a throughput test sends synthetic data through the
+same path (xfer_send_test()).
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "host.h"
+#include "packet.h"
+#include "crc32c.h"
+#include "time_util.h"
+#include "io_pool.h"
+#include "store.h"
+#include "swarm.h"
+#include "timer.h"
+#include "transfer.h"
+
+/* Payload of every data packet of a throughput test */
+static char xfer_test_data[XFER_DATA_MAX];
+
+/**
+
+@brief Store a 32-bit value in big-endian order.
+@param buf Destination, at least 4 bytes.
+@param v Value to store.
+*/
+static void put_u32(char *buf, unsigned int v) {
+  buf[0] = (char)(v >> 24);
+  buf[1] = (char)(v >> 16);
+  buf[2] = (char)(v >> 8);
+  buf[3] = (char)v;
+}
+
+/**
+
+@brief Load a 32-bit value stored in big-endian order.
+@param buf Source, at least 4 bytes.
+@return The value.
+*/
+static unsigned int get_u32(char *buf) {
+  return ((unsigned int)(unsigned char)buf[0] << 24) |
+         ((unsigned int)(unsigned char)buf[1] << 16) |
+         ((unsigned int)(unsigned char)buf[2] << 8) |
+         (unsigned int)(unsigned char)buf[3];
+}
+
+/**
+
+@brief Store a 64-bit value in big-endian order.
+@param buf Destination, at least 8 bytes.
+@param v Value to store.
+*/
+static void put_u64(char *buf, long long v) {
+  put_u32(buf, (unsigned int)((unsigned long long)v >> 32));
+  put_u32(buf + 4, (unsigned int)v);
+}
+
+/**
+
+@brief Load a 64-bit value stored in big-endian order.
+@param buf Source, at least 8 bytes.
+@return The value.
+*/
+static long long get_u64(char *buf) {
+  return (long long)(((unsigned long long)get_u32(buf) << 32) |
+                     get_u32(buf + 4));
+}
+
+/**
+
+@brief Find where the name starts in a start packet.
+@param flags XFER_FLAG_ bits of the transfer.
+@return Offset of the name in the start packet payload.
+*/
+static int xfer_start_name(int flags) {
+  return XFER_START_LEN + (flags & XFER_FLAG_RANGE ? XFER_RANGE_LEN : 0);
+}
+
+/**
+
+@brief Fill in the start packet payload of an upload.
+
+The payload is the size of the data sent, the file id, the flags, the
+offset of a range and the name.
+
+@param xs Pointer to the sender state.
+*/
+static void xfer_send_start(struct xfer_send *xs) {
+  int n = xfer_start_name(xs->flags);
+  size_t len;
+
+  put_u64(xs->start, xs->size);
+  put_u64(xs->start + 8, xs->file_id);
+  xs->start[16] = (char)xs->flags;
+  if (xs->flags & XFER_FLAG_RANGE) {
+    put_u64(xs->start + XFER_START_LEN, xs->range_off);
+  }
+  len = strnlen(xs->name, XFER_DATA_MAX - n - 1);
+  memcpy(xs->start + n, xs->name, len);
+  xs->start[n + len] = '\0';
+}
+
+/**
+
+@brief Compute the id of a version of a file.
+
+The id is a 64-bit FNV-1a hash of the name, size and modification time,
+so a checkpoint is only resumed for the same, unchanged file.
+
+@param name Name of the file.
+@param st Status of the file.
+@return The file id.
+*/
+static long long xfer_file_id(char *name, struct stat *st) {
+  unsigned long long h = 14695981039346656037ULL;
+  long long v[3];
+  unsigned char *b;
+  size_t k;
+
+  for (b = (unsigned char *)name; *b != '\0'; b++) {
+    h = (h ^ *b) * 1099511628211ULL;
+  }
+  v[0] = st->st_size;
+  v[1] = st->st_mtim.tv_sec;
+  v[2] = st->st_mtim.tv_nsec;
+  b = (unsigned char *)v;
+  for (k = 0; k < sizeof(v); k++) {
+    h = (h ^ b[k]) * 1099511628211ULL;
+  }
+  return (long long)h;
+}
+
+/**
+
+@brief Send a packet on all ports of the host.
+@param pkt Packet to send.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void send_all_ports(struct packet *pkt, struct net_port **node_port,
+                           int node_port_num) {
+  int k;
+
+  for (k = 0; k < node_port_num; k++) {
+    packet_send(node_port[k], pkt);
+  }
+}
+
+/**
+
+@brief Send a packet whose payload continues in a separate buffer on all ports.
+@param pkt Packet holding the header and the start of the payload.
+@param data Rest of the payload.
+@param length Number of bytes at data.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+@return 1 if every port took the packet, 0 if a link was full.
+*/
+static int send_all_ports_iov(struct packet *pkt, char *data, int length,
+                              struct net_port **node_port,
+                              int node_port_num) {
+  int ok = 1;
+  int k;
+
+  for (k = 0; k < node_port_num; k++) {
+    if (packet_send_iov(node_port[k], pkt, data, length) < 0) ok = 0;
+  }
+  return ok;
+}
+
+/**
+
+@brief Transmit one slot of the send window.
+
+The frame is built from a small header plus a pointer into the mapped
+file (packet_send_iov()), so file data is copied once per hop, into the
+link, and the window holds only offsets.  In splice mode
+packet_send_splice() moves the file pages into pipe links by reference
+instead.  A packet of a unicast upload also starts its own timer in the
+host's timer wheel (timer.c), which is cancelled when the packet is
+acknowledged and otherwise marks it for the pump to resend.
+
+A full link does not take the frame (the pipes are nonblocking).  The
+slot is then left as it was, and the pump sends it again on a later pass.
+
+@param xs Pointer to the sender state.
+@param s Pointer to the slot, in the window or a repair of a group upload.
+@param seq Sequence number of the slot.
+@param host_id ID of this host.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+@return 1 if the frame went onto every link, 0 if a link was full.
+*/
+static int xfer_send_slot(struct xfer_send *xs, struct xfer_send_slot *s,
+                          unsigned int seq, int host_id,
+                          struct net_port **node_port, int node_port_num) {
+  struct packet pkt;
+  char *data;
+  int ok = 1;
+  int k;
+
+  pkt.src = (char)host_id;
+  pkt.dst = (char)xs->dst;
+  pkt.type = s->type;
+  pkt.payload[0] = (char)xs->id;
+  put_u32(pkt.payload + 1, seq);
+  pkt.length = XFER_HDR_LEN;
+
+  if (s->type == (char)PKT_FILE_UPLOAD_START) {
+    data = xs->start;
+  } else if (s->type == (char)PKT_FILE_UPLOAD_END) {
+    data = xs->digest;
+  } else if (xs->flags & XFER_FLAG_TEST) {
+    data = xfer_test_data;
+  } else if (xs->splice && s->type == (char)PKT_FILE_UPLOAD_CONT) {
+    for (k = 0; k < node_port_num; k++) {
+      if (packet_send_splice(node_port[k], &pkt, xs->fd,
+                             xs->range_off + s->offset, xs->map + s->offset,
+                             s->length) < 0) {
+        ok = 0;
+      }
+    }
+    data = NULL;
+  } else {
+    data = xs->map + s->offset;
+  }
+  if (data != NULL) {
+    ok = send_all_ports_iov(&pkt, data, s->length, node_port, node_port_num);
+  }
+  if (!ok) return 0;
+  s->sent_time = time_now_usec();
+  xs->last_sent = s->sent_time;
+  xs->packets++;
+  if (xs->reliable) {
+    s->expired = 0;
+    timer_add(xs->timers, &s->rtx, s->sent_time + xs->rto);
+  }
+  return 1;
+}
+
+/**
+
+@brief Fill in a slot with the packet of a sequence number.
+
+Sequence number 0 is the start packet, then chunk seq holds the data
+from (seq - 1) * XFER_DATA_MAX, and the number after the last chunk is
+the end packet.
+
+@param xs Pointer to the sender state.
+@param s Pointer to the slot.
+@param seq Sequence number.
+*/
+static void xfer_send_fill(struct xfer_send *xs, struct xfer_send_slot *s,
+                           unsigned int seq) {
+  long long offset = (long long)(seq - 1) * XFER_DATA_MAX;
+  int n;
+
+  s->acked = 0;
+  s->fast_rtx = 0;
+  s->resent = 0;
+  s->expired = 0;
+  if (seq == 0) {
+    s->type = (char)PKT_FILE_UPLOAD_START;
+    n = xfer_start_name(xs->flags);
+    s->length = n + strnlen(xs->start + n, XFER_DATA_MAX - n);
+  } else if (offset < xs->size) {
+    s->type = (char)PKT_FILE_UPLOAD_CONT;
+    s->offset = offset;
+    s->length = xs->size - offset < XFER_DATA_MAX ? (int)(xs->size - offset)
+                                                  : XFER_DATA_MAX;
+  } else {
+    s->type = (char)PKT_FILE_UPLOAD_END;
+    s->length = XFER_DIGEST_LEN;
+  }
+}
+
+/**
+
+@brief Initialize the transfer table with no sessions.
+@param t Pointer to the transfer table.
+@param io Pointer to the host's I/O pool.
+@param timers Pointer to the host's timer wheel.
+*/
+void xfer_table_init(struct xfer_table *t, struct io_pool *io,
+                     struct timer_wheel *timers) {
+  memset(t, 0, sizeof(struct xfer_table));
+  t->next_id = 1;
+  t->io = io;
+  t->timers = timers;
+}
+
+/**
+
+@brief Mark a packet in flight for resending, when its timer goes off.
+@param arg Pointer to the packet's slot.
+*/
+static void xfer_send_rtx_expired(void *arg) {
+  ((struct xfer_send_slot *)arg)->expired = 1;
+}
+
+/**
+
+@brief Empty the send window, stopping the timers of its packets.
+@param xs Pointer to the sender state.
+*/
+static void xfer_send_reset_slots(struct xfer_send *xs) {
+  int i;
+
+  for (i = 0; i < XFER_WINDOW; i++) {
+    timer_cancel(xs->timers, &xs->slot[i].rtx);
+    memset(&xs->slot[i], 0, sizeof(struct xfer_send_slot));
+    timer_init(&xs->slot[i].rtx, xfer_send_rtx_expired, &xs->slot[i]);
+  }
+}
+
+/**
+
+@brief Mark a packet in flight as acknowledged, stopping its timer.
+@param xs Pointer to the sender state.
+@param s Pointer to the packet's slot.
+*/
+static void xfer_send_acked(struct xfer_send *xs, struct xfer_send_slot *s) {
+  s->acked = 1;
+  timer_cancel(xs->timers, &s->rtx);
+}
+
+/**
+
+@brief Count the uploads in progress.
+@param t Pointer to the transfer table.
+@return The number of send sessions.
+*/
+int xfer_send_count(struct xfer_table *t) {
+  int i, n = 0;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    if (t->send[i] != NULL) n++;
+  }
+  return n;
+}
+
+/**
+
+@brief Find the upload with the given transfer id.
+@param t Pointer to the transfer table.
+@param id Transfer id.
+@return Pointer to the session, or NULL if there is none.
+*/
+static struct xfer_send *xfer_send_find(struct xfer_table *t, int id) {
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    if (t->send[i] != NULL && t->send[i]->id == id) return t->send[i];
+  }
+  return NULL;
+}
+
+/**
+
+@brief Give a send session a transfer id.
+
+Transfer ids run from 1 to 255, skipping ids still in use.
+
+@param t Pointer to the transfer table.
+@param xs Pointer to the session.
+*/
+static void xfer_send_new_id(struct xfer_table *t, struct xfer_send *xs) {
+  int id;
+
+  do {
+    id = t->next_id;
+    t->next_id = t->next_id % 255 + 1;
+  } while (xfer_send_find(t, id) != NULL);
+  xs->id = id;
+}
+
+/**
+
+@brief Open a file and start a send session for it.
+
+The session gets a transfer id that is not used by any other upload in
+progress on this host.  The caller must check that the table has room
+with xfer_send_count().  The file is mapped read-only.  An upload to a
+multicast group is sent once without acknowledgements, since several
+receivers would otherwise acknowledge the same packets.
+
+@param t Pointer to the transfer table.
+@param dir Host directory containing the file.
+@param fname Name of the file within the directory.
+@param dst Destination host or multicast group address.
+@param opts XFER_OPT_ bits.  With XFER_OPT_SIG a missing file is not an
+error: its signature is empty, so the whole file is sent.  With
+XFER_OPT_WANT the file is the manifest received for fname.
+@return Pointer to the new session, or NULL if the file could not be opened
+or mapped.
+*/
+struct xfer_send *xfer_send_open(struct xfer_table *t, char dir[],
+                                 char fname[], int dst, int opts) {
+  char path[MAX_DIR_NAME + MAX_FILE_NAME + 15];
+  struct xfer_send *xs;
+  struct stat st;
+  char *map;
+  int fd;
+  int i;
+
+  if (opts & XFER_OPT_WANT) {
+    sprintf(path, "../%s/.%s.manifest", dir, fname);
+  } else {
+    sprintf(path, "../%s/%s", dir, fname);
+  }
+  fd = open(path, O_RDONLY);
+  memset(&st, 0, sizeof(st));
+  if (fd < 0 && !(opts & XFER_OPT_SIG)) return NULL;
+  if (fd >= 0 && fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+
+  /* An empty file cannot be mapped, and needs no data packets */
+  map = NULL;
+  if (fd >= 0 && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      close(fd);
+      return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+  }
+
+  xs = (struct xfer_send *)calloc(1, sizeof(struct xfer_send));
+  xs->fd = fd;
+  xs->map = map;
+  xs->size = st.st_size;
+  xs->raw_size = st.st_size;
+  strncpy(xs->name, fname, MAX_FILE_NAME - 1);
+  xs->file_id = xfer_file_id(fname, &st);
+  xfer_send_start(xs);
+  xs->dst = dst;
+  xs->reliable = !IS_MCAST_ADDR(dst);
+  xs->splice = (opts & XFER_OPT_SPLICE) != 0;
+  xs->pool = t->io;
+  xs->timers = t->timers;
+  xfer_send_reset_slots(xs);
+  xs->io = io_file_new(t->io, fd);
+  xs->active = 1;
+  xs->start_time = time_now_usec();
+  xs->last_sent = xs->start_time;
+  xs->cc = t->cc;
+  xs->cwnd = XFER_INIT_CWND;
+  xs->ssthresh = XFER_WINDOW;
+  xs->rto = XFER_RTO;
+  if (opts & XFER_OPT_SIG) {
+    xs->sig = 1;
+    xs->io->owner = xs;
+    io_submit(t->io, xs->io, IO_SIGNATURE, NULL, 0, 0);
+    xs->preparing = 1;
+  } else if (opts & XFER_OPT_WANT) {
+    xs->sig = 1;
+    xs->io->owner = xs;
+    sprintf(path, "../%s/%s", dir, STORE_DIR);
+    io_submit(t->io, xs->io, IO_WANT, strdup(path), 0, 0);
+    xs->preparing = 1;
+  } else if ((opts & XFER_OPT_DEDUP) && xs->reliable) {
+    /* The manifest is sent first, through a handle of its own */
+    xs->dedup = 1;
+    xs->src_io = xs->io;
+    xs->io = io_file_new(t->io, dup(fd));
+    xs->io->owner = xs;
+    io_submit(t->io, xs->io, IO_MANIFEST, NULL, 0, 0);
+    xs->preparing = 1;
+  } else if ((opts & XFER_OPT_DELTA) && xs->reliable) {
+    /* A group has no single copy to send a delta from */
+    xs->sig_wait = 1;
+    xs->sig_since = time_now_usec();
+    xs->sig_time = xs->sig_since - XFER_SIG_RETRY;
+    xs->preparing = 1;
+  } else if ((opts & XFER_OPT_COMPRESS) && xs->size > 0) {
+    xs->io->owner = xs;
+    io_submit(t->io, xs->io, IO_COMPRESS, NULL, 0, 0);
+    xs->preparing = 1;
+  }
+
+  xfer_send_new_id(t, xs);
+  for (i = 0; i < XFER_MAX_SESSIONS && t->send[i] != NULL; i++)
+    ;
+  t->send[i] = xs;
+  return xs;
+}
+
+/**
+
+@brief Start a throughput test to a host.
+
+The test sends bytes of synthetic data, or sends for seconds, whichever
+ends first; with no byte count it announces XFER_TEST_MAX.  There is no
+file, so the data counts as read ahead and its digest is 0.  The caller
+must check that the table has room with xfer_send_count().
+
+Every data packet is sent from one static buffer, so neither end touches
+a disk, and the receiver only counts what arrives.  The test goes through
+the same window, congestion control and links as a file, so both ends
+report what a file would get: the sender its goodput and
+retransmissions, the receiver its goodput, duplicates and the sequence
+numbers that arrived out of turn.
+
+@param t Pointer to the transfer table.
+@param dst Destination host or multicast group address.
+@param bytes Bytes to send, or 0 to send until the time is up.
+@param seconds Time to send for, or 0 to send all the bytes.
+@return Pointer to the new session, or NULL if neither limit was given.
+*/
+struct xfer_send *xfer_send_test(struct xfer_table *t, int dst,
+                                 long long bytes, double seconds) {
+  struct xfer_send *xs;
+  int i;
+
+  if (bytes <= 0 && seconds <= 0) return NULL;
+
+  xs = (struct xfer_send *)calloc(1, sizeof(struct xfer_send));
+  xs->fd = -1;
+  xs->size = bytes > 0 && bytes < XFER_TEST_MAX ? bytes : XFER_TEST_MAX;
+  xs->raw_size = xs->size;
+  strcpy(xs->name, "test");
+  xs->start_time = time_now_usec();
+  xs->file_id = xs->start_time;
+  xs->flags = XFER_FLAG_TEST;
+  xfer_send_start(xs);
+  if (seconds > 0) xs->test_end = xs->start_time + (long long)(seconds * 1e6);
+  xs->dst = dst;
+  xs->reliable = !IS_MCAST_ADDR(dst);
+  xs->pool = t->io;
+  xs->timers = t->timers;
+  xfer_send_reset_slots(xs);
+  xs->io = io_file_new(t->io, -1);
+  xs->io->ready = xs->size;
+  xs->io->crc_len = xs->size;
+  xs->ra_next = xs->size;
+  xs->active = 1;
+  xs->last_sent = xs->start_time;
+  xs->cc = t->cc;
+  xs->cwnd = XFER_INIT_CWND;
+  xs->ssthresh = XFER_WINDOW;
+  xs->rto = XFER_RTO;
+
+  xfer_send_new_id(t, xs);
+  for (i = 0; i < XFER_MAX_SESSIONS && t->send[i] != NULL; i++)
+    ;
+  t->send[i] = xs;
+  return xs;
+}
+
+/**
+
+@brief Switch an upload over to the data the pool made from its file.
+
+Called when the pool has compressed the file, or made its signature, its
+delta, its manifest, a want list or a pack; the io_file now reads that
+data instead, and it is sent exactly as a file would be.  The data gets
+its own file id, so that a checkpoint of the plain file is not resumed
+with it, or the other way round.  A delta's id also depends on the
+signature, since it is only valid for that copy at the receiver.
+
+- Compressed (XFER_FLAG_LZ): a block stream (lz.c), stored by the
+  receiver as .<name>.lz and decompressed into the file once complete.
+  A file whose first block does not compress is sent as it is, and so is
+  each block of the stream that does not compress.
+- Delta (XFER_FLAG_DELTA, delta.c): the sender asks with
+  PKT_FILE_SIG_REQ for the signature of the receiver's copy, which comes
+  back as a transfer flagged XFER_FLAG_SIG.  The delta against it is
+  stored as .<name>.delta and applied by the receiver's pool.
+- Deduplicated (store.c): the manifest of the file goes first, flagged
+  XFER_FLAG_MANIFEST.  The sender asks with PKT_FILE_WANT_REQ for the
+  chunks the receiver lacks, which come back as a want list flagged
+  XFER_FLAG_WANT, and a pack of them follows under a new transfer id,
+  flagged XFER_FLAG_CHUNKS, from which the receiver assembles the file.
+
+@param xs Pointer to the sender state.
+@param flag XFER_FLAG_ bit describing the data.
+@param ok 1 if the data replaced the file, 0 if the file is sent as it is
+(it did not compress, or no delta or manifest could be made).
+*/
+static void xfer_send_prepared(struct xfer_send *xs, int flag, int ok) {
+  struct stat st;
+  char *map;
+
+  xs->preparing = 0;
+  xs->io->owner = NULL;
+  map = NULL;
+  if (ok && fstat(xs->io->fd, &st) == 0 && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, xs->io->fd, 0);
+  }
+  if (!ok || map == MAP_FAILED) {
+    if (xs->src_io != NULL) {
+      /* No manifest: the file goes as it is, through the second handle */
+      io_submit(xs->pool, xs->src_io, IO_CLOSE, NULL, 0, 0);
+      xs->src_io = NULL;
+      xs->dedup = 0;
+    } else if (xs->sig || xs->dedup) {
+      /* Sending the file in place of its signature would overwrite it */
+      xs->active = 0;
+    }
+    return;
+  }
+
+  if (xs->map != NULL) munmap(xs->map, xs->size);
+  xs->map = map;
+  xs->fd = xs->io->fd;
+  xs->size = st.st_size;
+  xs->flags |= flag;
+  xs->file_id = ~xs->file_id ^ ((long long)xs->sig_digest << 8) ^ flag;
+  xfer_send_start(xs);
+}
+
+/**
+
+@brief Ask the receiver for its signature or want list.
+
+The request is repeated every XFER_SIG_RETRY until the answer arrives.
+After XFER_SIG_TIMEOUT the whole file, or every chunk, is sent instead.
+
+@param xs Pointer to the sender state.
+@param host_id ID of this host.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void xfer_send_sig_req(struct xfer_send *xs, int host_id,
+                              struct net_port **node_port,
+                              int node_port_num) {
+  struct packet pkt;
+  long long now = time_now_usec();
+  int n;
+
+  if (now - xs->sig_since >= XFER_SIG_TIMEOUT && xs->dedup) {
+    printf("No want list for %s from %d, sending every chunk\n", xs->name,
+           xs->dst);
+    xs->sig_wait = 0;
+    xs->io->owner = xs;
+    io_submit(xs->pool, xs->io, IO_PACK, NULL, xs->sig_digest, 0);
+    return;
+  }
+  if (now - xs->sig_since >= XFER_SIG_TIMEOUT) {
+    printf("No signature of %s from %d, sending the whole file\n", xs->name,
+           xs->dst);
+    xs->sig_wait = 0;
+    xs->preparing = 0;
+    return;
+  }
+  if (now - xs->sig_time < XFER_SIG_RETRY) return;
+
+  pkt.src = (char)host_id;
+  pkt.dst = (char)xs->dst;
+  pkt.type = (char)(xs->dedup ? PKT_FILE_WANT_REQ : PKT_FILE_SIG_REQ);
+  n = strnlen(xs->name, PKT_PAYLOAD_MAX);
+  memcpy(pkt.payload, xs->name, n);
+  pkt.length = n;
+  send_all_ports(&pkt, node_port, node_port_num);
+  xs->sig_time = now;
+}
+
+/**
+
+@brief Check whether a signature or want list is already being sent.
+
+Used to ignore repeated requests while the first is answered.
+
+@param t Pointer to the transfer table.
+@param dst Host that asked.
+@param name Name of the file.
+@return 1 if an answer for the file is being sent to dst, 0 otherwise.
+*/
+int xfer_sig_pending(struct xfer_table *t, int dst, char *name) {
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    if (t->send[i] != NULL && t->send[i]->sig && t->send[i]->dst == dst &&
+        strcmp(t->send[i]->name, name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+
+@brief Send only a range of the file.
+
+Called right after xfer_send_open(), before the session is pumped, for a
+host downloading the file from several hosts at once (swarm.c).  The
+range is mapped by itself and its io_file reads from the range's offset,
+so the rest of the session sees a file the length of the range.  The
+start packet carries the offset after the flags, and the receiver writes
+the range into .<name>.swarm at that offset.  Ranges are not
+checkpointed; one that is cut off is asked for again.
+
+@param xs Pointer to the sender state.
+@param offset File offset of the range, a multiple of the page size.
+@param length Number of bytes in the range.
+@return 1 if the range was set, 0 if it is not within the file.
+*/
+int xfer_send_range(struct xfer_send *xs, long long offset, long long length) {
+  char *map;
+
+  if (xs->flags != 0 || xs->preparing || xs->sig_wait || offset < 0 ||
+      length <= 0 || offset + length > xs->raw_size ||
+      offset % sysconf(_SC_PAGESIZE) != 0) {
+    return 0;
+  }
+  map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, xs->fd, offset);
+  if (map == MAP_FAILED) return 0;
+  madvise(map, length, MADV_SEQUENTIAL);
+  munmap(xs->map, xs->size);
+  xs->map = map;
+  xs->size = length;
+  xs->range_off = offset;
+  xs->io->base = offset;
+  xs->flags |= XFER_FLAG_RANGE;
+  xfer_send_start(xs);
+  return 1;
+}
+
+/**
+
+@brief Check whether a range of a file is already being sent.
+
+Used to ignore a request for a range that is asked for again while the
+first request is answered.
+
+@param t Pointer to the transfer table.
+@param dst Host that asked.
+@param name Name of the file.
+@param offset File offset of the range.
+@return 1 if the range is being sent to dst, 0 otherwise.
+*/
+int xfer_range_pending(struct xfer_table *t, int dst, char *name,
+                       long long offset) {
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    if (t->send[i] != NULL && (t->send[i]->flags & XFER_FLAG_RANGE) &&
+        t->send[i]->dst == dst && t->send[i]->range_off == offset &&
+        strcmp(t->send[i]->name, name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+
+@brief Go on with an upload once the receiver's answer is here.
+
+A signature was received as .<name>.sig, and the pool makes the delta
+from it.  A want list was received as .<name>.want, and the pool packs
+the chunks it asks for.  If no upload of the file to the host that sent
+it is waiting, the answer is not needed any more.
+
+@param t Pointer to the transfer table.
+@param v The received signature or want list.
+@param ok 1 if it arrived intact.
+*/
+static void xfer_reply_received(struct xfer_table *t, struct xfer_verify *v,
+                                int ok) {
+  struct xfer_send *xs;
+  int want = (v->flags & XFER_FLAG_WANT) != 0;
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    xs = t->send[i];
+    if (ok && xs != NULL && xs->sig_wait && xs->dedup == want &&
+        xs->dst == v->src && strcmp(xs->name, v->name) == 0) {
+      xs->sig_wait = 0;
+      xs->io->owner = xs;
+      if (want) {
+        io_submit(t->io, xs->io, IO_PACK, strdup(v->path), xs->sig_digest,
+                  0);
+      } else {
+        xs->sig_digest = v->digest;
+        io_submit(t->io, xs->io, IO_DELTA, strdup(v->path), 0, 0);
+      }
+      io_submit(t->io, xs->io, IO_UNLINK, strdup(v->path), 0, 0);
+      return;
+    }
+  }
+  unlink(v->path);   /* A few kilobytes, not worth a trip to the pool */
+}
+
+/**
+
+@brief Wait for the want list once the manifest has been sent.
+
+The manifest's handle is closed and the session is emptied, so that the
+pack is sent as a new transfer on the file's own handle.
+
+@param xs Pointer to the sender state.
+*/
+static void xfer_send_manifest_sent(struct xfer_send *xs) {
+  xs->sig_digest = xs->io->crc;
+  if (xs->map != NULL) munmap(xs->map, xs->size);
+  xs->map = NULL;
+  io_submit(xs->pool, xs->io, IO_CLOSE, NULL, 0, 0);
+  xs->io = xs->src_io;
+  xs->src_io = NULL;
+  xs->size = 0;
+  xs->flags = 0;
+  xs->base = 0;
+  xs->next = 0;
+  xs->end_seq = 0;
+  xs->eof = 0;
+  xs->timeouts = 0;
+  xs->offset = 0;
+  xs->ra_next = 0;
+  xfer_send_reset_slots(xs);
+
+  xs->sig_wait = 1;
+  xs->preparing = 1;
+  xs->sig_since = time_now_usec();
+  xs->sig_time = xs->sig_since - XFER_SIG_RETRY;
+}
+
+/**
+
+@brief Keep the file read ahead of the send window.
+
+One read-ahead request is outstanding at a time.  The next one is queued
+once the previous one has completed and the window has moved to within
+IO_READAHEAD_BYTES of its end.  The pump only sends data that has been
+read, so it never waits on the disk.  The reads, which complete in file
+order, also give the file digest, so the end packet waits for the last
+of them.
+
+@param xs Pointer to the sender state.
+*/
+static void xfer_send_readahead(struct xfer_send *xs) {
+  long long off;
+  int length;
+
+  /*
+   * After skipping ahead on resume, read from the new position.  The
+   * part skipped is still read, after the data already queued, for the
+   * digest only.
+   */
+  if (xs->ra_next < xs->offset && xs->ra_next == xs->io->ready) {
+    for (off = xs->ra_next; off < xs->offset; off += length) {
+      length = xs->offset - off < XFER_CHECK_MAX ? (int)(xs->offset - off)
+                                                 : XFER_CHECK_MAX;
+      io_submit(xs->pool, xs->io, IO_CHECKSUM, NULL, off, length);
+    }
+    xs->ra_next = xs->offset;
+    xs->io->ready = xs->offset;
+  }
+
+  if (xs->ra_next >= xs->size || xs->ra_next > xs->io->ready ||
+      xs->ra_next - xs->offset >= IO_READAHEAD_BYTES) {
+    return;
+  }
+  length = xs->size - xs->ra_next < IO_READAHEAD_BYTES
+               ? (int)(xs->size - xs->ra_next)
+               : IO_READAHEAD_BYTES;
+  io_submit(xs->pool, xs->io, IO_READAHEAD, NULL, xs->ra_next, length);
+  xs->ra_next += length;
+}
+
+/**
+
+@brief Number of packets the upload may have in flight.
+@param xs Pointer to the sender state.
+@return The congestion window, within 1 and XFER_WINDOW.
+*/
+static int xfer_send_window(struct xfer_send *xs) {
+  int w = (int)xs->cwnd;
+
+  if (w > XFER_WINDOW) return XFER_WINDOW;
+  return w < 1 ? 1 : w;
+}
+
+/**
+
+@brief Check whether group members asked for packets not yet resent.
+@param xs Pointer to the sender state.
+@return 1 if a repair is waiting, 0 otherwise.
+*/
+static int xfer_send_repairing(struct xfer_send *xs) {
+  int k;
+
+  for (k = 0; k < XFER_SACK_BYTES; k++) {
+    if (xs->repair[k] != 0) return 1;
+  }
+  return 0;
+}
+
+/**
+
+@brief Cut the congestion window after a loss.
+
+A packet resent because of the SACK halves the window, and a timeout
+drops it to the minimum (Reno).  Only the first loss of a window of data
+counts, since the others were sent before the cut could take effect.  A
+timeout also doubles the retransmission timeout, if it is the oldest
+packet's.
+
+The window never goes below XFER_MIN_CWND, rather than Reno's one
+packet.  A smaller window cannot have XFER_DUP_THRESH packets SACKed
+above a hole, so under random loss every loss waited for a timeout,
+and the timeouts kept the window small.
+
+@param xs Pointer to the sender state.
+@param seq Sequence number of the lost packet.
+@param timeout 1 if the loss was a timeout, 0 if the SACK showed it.
+*/
+static void xfer_cc_loss(struct xfer_send *xs, unsigned int seq, int timeout) {
+  if (timeout && seq == xs->base) {
+    xs->rto = xs->rto * 2 < XFER_RTO_MAX ? xs->rto * 2 : XFER_RTO_MAX;
+  }
+  if (seq < xs->recover) return;
+  xs->ssthresh = xs->cwnd / 2 > XFER_MIN_CWND ? xs->cwnd / 2 : XFER_MIN_CWND;
+  xs->cwnd = timeout ? XFER_MIN_CWND : xs->ssthresh;
+  xs->recover = xs->next;
+  xs->cuts++;
+}
+
+/**
+
+@brief Open the congestion window for newly acknowledged packets.
+
+The window starts at XFER_INIT_CWND and doubles every round trip (slow
+start) up to the slow start threshold, then grows by one packet per
+round trip.  In the delay mode (XFER_CC_DELAY, Vegas) it also stops
+growing, and shrinks, when the round-trip time shows more than a few
+packets queued on the path, so the queues stay short before anything is
+lost.  The window does not grow while the packets sent before the last
+cut are still being recovered.
+
+A round-trip time sample, taken only on packets sent once, also updates
+the retransmission timeout: the smoothed RTT plus four times its
+variance (RFC 6298).
+
+@param xs Pointer to the sender state.
+@param acked Packets newly acknowledged.
+@param rtt Round-trip time of one of them, or 0 if none was sent once.
+*/
+static void xfer_cc_ack(struct xfer_send *xs, int acked, long long rtt) {
+  double queued;
+  long long var;
+
+  if (rtt > 0) {
+    if (xs->srtt == 0) {
+      xs->srtt = rtt;
+      xs->rttvar = rtt / 2;
+    } else {
+      var = xs->srtt > rtt ? xs->srtt - rtt : rtt - xs->srtt;
+      xs->rttvar = (3 * xs->rttvar + var) / 4;
+      xs->srtt = (7 * xs->srtt + rtt) / 8;
+    }
+    if (xs->min_rtt == 0 || rtt < xs->min_rtt) xs->min_rtt = rtt;
+    xs->rto = xs->srtt + (4 * xs->rttvar > XFER_RTO_GRAIN ? 4 * xs->rttvar
+                                                          : XFER_RTO_GRAIN);
+    if (xs->rto < XFER_RTO_MIN) xs->rto = XFER_RTO_MIN;
+    if (xs->rto > XFER_RTO_MAX) xs->rto = XFER_RTO_MAX;
+  }
+  if (acked == 0 || xs->base < xs->recover) return;
+
+  /* Packets waiting in queues along the path, by Vegas' estimate */
+  queued = xs->srtt > 0 ? xs->cwnd * (xs->srtt - xs->min_rtt) / xs->srtt : 0;
+
+  if (xs->cwnd < xs->ssthresh) {
+    if (xs->cc == XFER_CC_DELAY && queued > XFER_DELAY_BETA) {
+      xs->ssthresh = xs->cwnd;
+    } else {
+      xs->cwnd += acked;
+    }
+  } else if (xs->cc != XFER_CC_DELAY || queued < XFER_DELAY_ALPHA) {
+    xs->cwnd += (double)acked / xs->cwnd;
+  } else if (queued > XFER_DELAY_BETA) {
+    xs->cwnd -= (double)acked / xs->cwnd;
+    if (xs->cwnd < XFER_MIN_CWND) xs->cwnd = XFER_MIN_CWND;
+  }
+  if (xs->cwnd > XFER_WINDOW) xs->cwnd = XFER_WINDOW;
+}
+
+/**
+
+@brief Send new and lost packets of the transfer.
+
+Packets whose retransmission timer expired, or which the selective
+acknowledgements show to be lost (XFER_DUP_THRESH later packets
+acknowledged), are resent first, and the congestion window is cut.  Then
+new chunks of the mapped file are sent while the window has room and the
+chunks have been read ahead.  A packet that a full link did not take is
+sent on a later pass, and an upload whose link stays full for
+XFER_IDLE_TIMEOUT fails.
+
+Nobody acknowledges an upload to a group, so what was sent on the last
+pass counts as delivered and opens the window, unless a member asks for
+it again (xfer_send_nack()).  The packets asked for are resent to the
+whole group before new data, and once the end packet is out the upload
+goes on answering until no member has asked for XFER_MCAST_LINGER.
+
+@param xs Pointer to the sender state.
+@param host_id ID of this host.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+@return 1 when the transfer is finished (or abandoned), 0 otherwise.
+*/
+int xfer_send_pump(struct xfer_send *xs, int host_id,
+                   struct net_port **node_port, int node_port_num) {
+  struct xfer_send_slot repair;
+  struct xfer_send_slot *s;
+  unsigned int seq;
+  long long now;
+  int sacked_above;
+  int blocked = 0;
+  int k;
+
+  if (!xs->active) return 1;
+  if ((xs->flags & XFER_FLAG_MANIFEST) && xs->eof && xs->base > xs->end_seq) {
+    xfer_send_manifest_sent(xs);
+  }
+  if (xs->sig_wait) {
+    xfer_send_sig_req(xs, host_id, node_port, node_port_num);
+    return 0;
+  }
+  if (xs->preparing) return 0;
+  if (xs->io->read_failed) {
+    /* Data past what was read could not be sent from the mapping */
+    printf("Upload of %s to %d failed: the file could not be read\n",
+           xs->name, xs->dst);
+    return 1;
+  }
+
+  /* Spliced frames that did not fit in the link last pass go first */
+  if (xs->splice) {
+    for (k = 0; k < node_port_num; k++) {
+      if (node_port[k]->splice_pending > 0 ||
+          node_port[k]->splice_tail_len > 0) {
+        packet_splice_flush(node_port[k]);
+      }
+    }
+  }
+
+  now = time_now_usec();
+  if (!xs->reliable && xs->next > xs->base) {
+    xfer_cc_ack(xs, xs->next - xs->base, 0);
+    xs->base = xs->next;
+  }
+
+  /* Look for lost packets, scanning from the top of the window down */
+  sacked_above = 0;
+  for (seq = xs->next; seq-- > xs->base;) {
+    s = &xs->slot[seq % XFER_WINDOW];
+    if (s->acked) {
+      sacked_above++;
+    } else if (s->expired && now - s->sent_time < xs->rto) {
+      /*
+       * The timer ran on the RTO of when the packet was sent.  The RTO
+       * has grown since, as the queues filled, so the packet is not
+       * late yet; resending it would be spurious.
+       */
+      s->expired = 0;
+      timer_add(xs->timers, &s->rtx, s->sent_time + xs->rto);
+    } else if (s->expired) {
+      if (seq == xs->base && xs->timeouts >= XFER_MAX_TIMEOUTS) {
+        printf("Upload of %s to %d failed: no acknowledgement\n", xs->name,
+               xs->dst);
+        xs->failed = 1;
+        return 1;
+      }
+      blocked = !xfer_send_slot(xs, s, seq, host_id, node_port,
+                                node_port_num);
+      if (blocked) break;
+      if (seq == xs->base) xs->timeouts++;
+      xfer_cc_loss(xs, seq, 1);
+      /* The timer runs on the RTO as backed off for this loss */
+      timer_add(xs->timers, &s->rtx, s->sent_time + xs->rto);
+      s->resent = 1;
+      xs->retransmits++;
+    } else if (sacked_above >= XFER_DUP_THRESH && !s->fast_rtx) {
+      blocked = !xfer_send_slot(xs, s, seq, host_id, node_port,
+                                node_port_num);
+      if (blocked) break;
+      xfer_cc_loss(xs, seq, 0);
+      s->fast_rtx = 1;
+      s->resent = 1;
+      xs->retransmits++;
+    }
+  }
+
+  /* Packets that group members asked for again */
+  for (k = 0; k < XFER_WINDOW && !blocked; k++) {
+    if (!(xs->repair[k / 8] & (1 << (k % 8)))) continue;
+    seq = xs->repair_base + k;
+    xfer_send_fill(xs, &repair, seq);
+    blocked = !xfer_send_slot(xs, &repair, seq, host_id, node_port,
+                              node_port_num);
+    if (!blocked) {
+      xs->repair[k / 8] &= ~(1 << (k % 8));
+      xs->retransmits++;
+    }
+  }
+
+  xfer_send_readahead(xs);
+
+  /* A test whose time is up ends with the data already sent */
+  if (xs->test_end > 0 && xs->offset < xs->size &&
+      time_now_usec() >= xs->test_end) {
+    xs->size = xs->offset;
+  }
+
+  /* Fill the window with new packets, as far as the file has been read */
+  while (!blocked && !xs->eof &&
+         xs->next < xs->base + xfer_send_window(xs)) {
+    if (xs->next > 0 && xs->offset < xs->size && xs->offset >= xs->io->ready) {
+      break;
+    }
+    if (xs->next > 0 && xs->offset >= xs->size && xs->io->crc_len < xs->size) {
+      break;   /* The end packet waits for the digest */
+    }
+    s = &xs->slot[xs->next % XFER_WINDOW];
+    xfer_send_fill(xs, s, xs->next);
+    if (s->type == (char)PKT_FILE_UPLOAD_END) {
+      put_u32(xs->digest, xs->io->crc);
+    }
+    blocked = !xfer_send_slot(xs, s, xs->next, host_id, node_port,
+                              node_port_num);
+    if (blocked) break;
+    if (s->type == (char)PKT_FILE_UPLOAD_CONT) {
+      xs->offset += s->length;
+      xs->bytes += s->length;
+    } else if (s->type == (char)PKT_FILE_UPLOAD_END) {
+      xs->end_seq = xs->next;
+      xs->eof = 1;
+      xs->nack_time = now;
+    }
+    xs->next++;
+  }
+
+  if (blocked && now - xs->last_sent >= XFER_IDLE_TIMEOUT) {
+    printf("Upload of %s to %d failed: the link stayed full\n", xs->name,
+           xs->dst);
+    xs->failed = 1;
+    return 1;
+  }
+  if (!xs->reliable) {
+    return xs->eof && !xfer_send_repairing(xs) &&
+           now - xs->nack_time >= XFER_MCAST_LINGER;
+  }
+  return xs->eof && xs->base > xs->end_seq;
+}
+
+/**
+
+@brief Skip the part of the file that the receiver already has.
+
+Called when an acknowledgement is beyond the packets sent, which happens
+when the receiver resumed from a checkpoint.  The window moves to the
+acknowledged sequence number, and sending continues from its chunk.
+
+@param xs Pointer to the sender state.
+@param cum Cumulative acknowledgement from the receiver.
+@return 1 if the acknowledgement was valid, 0 otherwise.
+*/
+static int xfer_send_skip(struct xfer_send *xs, unsigned int cum) {
+  long long chunks = (xs->size + XFER_DATA_MAX - 1) / XFER_DATA_MAX;
+  long long offset;
+  unsigned int seq;
+
+  if (xs->next == 0 || xs->eof || cum > chunks + 1) return 0;
+
+  for (seq = xs->base; seq < xs->next; seq++) {
+    xfer_send_acked(xs, &xs->slot[seq % XFER_WINDOW]);
+  }
+  offset = (long long)(cum - 1) * XFER_DATA_MAX;
+  if (xs->resumed == 0) {
+    printf("Upload of %s to %d resuming at byte %lld\n", xs->name, xs->dst,
+           offset);
+  }
+  xs->resumed += offset - xs->offset;
+  xs->offset = offset;
+  xs->next = cum;
+  return 1;
+}
+
+/**
+
+@brief Note the packets a group member asks for again.
+
+A member that misses packets sends the acknowledgement a unicast
+receiver would (xfer_recv_pump()).  The packet it expects next is lost,
+and so are the holes below the highest packet it has; if it has none
+above, everything sent after it is.  Requests are merged into one map of
+XFER_WINDOW packets for the pump to resend, and a member whose request
+does not fit asks again.  Each request also counts as a loss for the
+congestion window.
+
+@param xs Pointer to the sender state.
+@param pkt The PKT_FILE_ACK packet.
+*/
+static void xfer_send_nack(struct xfer_send *xs, struct packet *pkt) {
+  unsigned int cum = get_u32(pkt->payload + 1);
+  unsigned int top = cum + XFER_WINDOW - 1;
+  unsigned int seq;
+  int have;
+  int i;
+
+  xs->nack_time = time_now_usec();
+  if (cum >= xs->next) return;
+  for (i = XFER_WINDOW - 2; i >= 0; i--) {
+    if (XFER_HDR_LEN + i / 8 < pkt->length &&
+        (pkt->payload[XFER_HDR_LEN + i / 8] & (1 << (i % 8)))) {
+      top = cum + 1 + i;
+      break;
+    }
+  }
+  if (!xfer_send_repairing(xs)) xs->repair_base = cum;
+  for (seq = cum; seq <= top && seq < xs->next; seq++) {
+    i = seq - cum - 1;
+    have = seq > cum && XFER_HDR_LEN + i / 8 < pkt->length &&
+           (pkt->payload[XFER_HDR_LEN + i / 8] & (1 << (i % 8)));
+    if (have || seq < xs->repair_base ||
+        seq >= xs->repair_base + XFER_WINDOW) {
+      continue;
+    }
+    i = seq - xs->repair_base;
+    xs->repair[i / 8] |= 1 << (i % 8);
+  }
+  xfer_cc_loss(xs, cum, 0);
+}
+
+/**
+
+@brief Process an acknowledgement from the receiver.
+
+The payload holds the cumulative acknowledgement (next expected sequence
+number) followed by a bitmap where bit i is set if sequence number
+cum + 1 + i has been received.  The newest packet it acknowledges that
+was sent only once gives a round-trip time sample.
+
+@param t Pointer to the transfer table.
+@param pkt The PKT_FILE_ACK packet.
+*/
+void xfer_send_ack(struct xfer_table *t, struct packet *pkt) {
+  struct xfer_send_slot *s;
+  struct xfer_send *xs;
+  long long rtt = 0;
+  unsigned int cum;
+  unsigned int seq;
+  int acked = 0;
+  int i;
+
+  if (pkt->length < XFER_HDR_LEN) return;
+  xs = xfer_send_find(t, (unsigned char)pkt->payload[0]);
+  if (xs == NULL || !xs->active) return;
+  if (!xs->reliable) {
+    xfer_send_nack(xs, pkt);   /* From any member of the group */
+    return;
+  }
+  if (pkt->src != (char)xs->dst) return;
+
+  cum = get_u32(pkt->payload + 1);
+  if (cum > xs->next) {
+    /* Skipped data was never sent, so it says nothing about the path */
+    if (!xfer_send_skip(xs, cum)) return;
+  } else {
+    for (seq = xs->base; seq < cum; seq++) {
+      s = &xs->slot[seq % XFER_WINDOW];
+      if (s->acked) continue;
+      xfer_send_acked(xs, s);
+      acked++;
+      if (!s->resent) rtt = time_now_usec() - s->sent_time;
+    }
+  }
+  for (i = 0; i < XFER_WINDOW - 1 && XFER_HDR_LEN + i / 8 < pkt->length;
+       i++) {
+    seq = cum + 1 + i;
+    if (seq >= xs->next) break;
+    if (seq < xs->base) continue;   /* A stale acknowledgement */
+    s = &xs->slot[seq % XFER_WINDOW];
+    if ((pkt->payload[XFER_HDR_LEN + i / 8] & (1 << (i % 8))) && !s->acked) {
+      xfer_send_acked(xs, s);
+      acked++;
+      if (!s->resent) rtt = time_now_usec() - s->sent_time;
+    }
+  }
+
+  if (cum > xs->base) {
+    xs->base = cum;
+    xs->timeouts = 0;
+  }
+  xfer_cc_ack(xs, acked, rtt);
+}
+
+/**
+
+@brief End a send session, report its statistics and free it.
+@param t Pointer to the transfer table.
+@param xs Pointer to the session.
+*/
+void xfer_send_close(struct xfer_table *t, struct xfer_send *xs) {
+  char note[64];
+  double secs;
+  int sent;
+  int i;
+
+  sent = xs->eof && xs->base > xs->end_seq && !xs->failed;
+  secs = (time_now_usec() - xs->start_time) / 1e6;
+  if (sent && xs->sig) {
+    printf("Sent %s of %s to %d: %lld bytes\n",
+           xs->flags & XFER_FLAG_WANT ? "want list" : "signature", xs->name,
+           xs->dst, xs->size);
+  } else if (sent && (xs->flags & XFER_FLAG_TEST)) {
+    printf("Throughput test to %d: %lld bytes in %.3f s, %.1f KB/s "
+           "goodput, %d packets (%.0f/s), %d retransmits\n",
+           xs->dst, xs->bytes, secs,
+           secs > 0 ? xs->bytes / secs / 1000 : 0.0, xs->packets,
+           secs > 0 ? xs->packets / secs : 0.0, xs->retransmits);
+    if (xs->reliable) {
+      printf("Congestion control (%s): window %.1f packets, cut %d times, "
+             "RTT %.1f ms (min %.1f ms), RTO %.1f ms\n",
+             xs->cc == XFER_CC_DELAY ? "delay" : "loss", xs->cwnd, xs->cuts,
+             xs->srtt / 1000.0, xs->min_rtt / 1000.0, xs->rto / 1000.0);
+    }
+  } else if (sent && !xs->reliable) {
+    /*
+     * Nobody acknowledges a group upload, so it is only known to be
+     * sent, repairs included; each member reports what it received
+     */
+    secs = (xs->last_sent - xs->start_time) / 1e6;
+    printf("Upload of %s to group %d sent: %lld bytes in %.3f s "
+           "(%.1f KB/s), %d packets, %d resent on request\n",
+           xs->name, MCAST_GROUP(xs->dst), xs->bytes, secs,
+           secs > 0 ? xs->bytes / secs / 1000 : 0.0, xs->packets,
+           xs->retransmits);
+  } else if (sent) {
+    strcpy(note, xs->splice ? " (splice)" : "");
+    if (xs->flags & XFER_FLAG_RANGE) {
+      sprintf(note + strlen(note), " (bytes %lld-%lld)", xs->range_off,
+              xs->range_off + xs->size - 1);
+    }
+    printf("Upload of %s to %d complete%s: %lld bytes in %.3f s "
+           "(%.1f KB/s), %d packets, %d retransmits, %lld bytes resumed\n",
+           xs->name, xs->dst, note, xs->bytes, secs,
+           secs > 0 ? xs->bytes / secs / 1000 : 0.0, xs->packets,
+           xs->retransmits, xs->resumed);
+    printf("Congestion control (%s): window %.1f packets, cut %d times, "
+           "RTT %.1f ms (min %.1f ms), RTO %.1f ms\n",
+           xs->cc == XFER_CC_DELAY ? "delay" : "loss", xs->cwnd, xs->cuts,
+           xs->srtt / 1000.0, xs->min_rtt / 1000.0, xs->rto / 1000.0);
+    if (xs->flags & XFER_FLAG_LZ) {
+      printf("Compressed %lld to %lld bytes (%.1f%%), %.1f KB/s effective\n",
+             xs->raw_size, xs->size, 100.0 * xs->size / xs->raw_size,
+             secs > 0 ? xs->raw_size / secs / 1000 : 0.0);
+    }
+    if (xs->flags & XFER_FLAG_DELTA) {
+      printf("Delta of %s: %lld bytes sent for %lld (%.1f%%), "
+             "%.1f KB/s effective\n",
+             xs->name, xs->size, xs->raw_size,
+             xs->raw_size > 0 ? 100.0 * xs->size / xs->raw_size : 0.0,
+             secs > 0 ? xs->raw_size / secs / 1000 : 0.0);
+    }
+    if (xs->flags & XFER_FLAG_CHUNKS) {
+      printf("Chunks of %s: %lld bytes sent for %lld (%.1f%%) with the "
+             "manifest, %.1f KB/s effective\n",
+             xs->name, xs->bytes, xs->raw_size,
+             xs->raw_size > 0 ? 100.0 * xs->bytes / xs->raw_size : 0.0,
+             secs > 0 ? xs->raw_size / secs / 1000 : 0.0);
+    }
+  }
+  /* Work still running in the pool no longer has anyone to tell */
+  xs->io->owner = NULL;
+  if (xs->src_io != NULL) io_submit(xs->pool, xs->src_io, IO_CLOSE, NULL, 0, 0);
+  if (xs->map != NULL) munmap(xs->map, xs->size);
+  /* The pool closes the file after any read-ahead still queued */
+  io_submit(xs->pool, xs->io, IO_CLOSE, NULL, 0, 0);
+  for (i = 0; i < XFER_WINDOW; i++) {
+    timer_cancel(xs->timers, &xs->slot[i].rtx);
+  }
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    if (t->send[i] == xs) t->send[i] = NULL;
+  }
+  free(xs);
+}
+
+/**
+
+@brief Find the receive session of a transfer.
+@param t Pointer to the transfer table.
+@param src Source host of the transfer.
+@param id Transfer id chosen by the source.
+@return Index of the session in the table, or -1 if there is none.
+*/
+static int xfer_recv_find(struct xfer_table *t, int src, int id) {
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    if (t->recv[i] != NULL && t->recv[i]->src == src && t->recv[i]->id == id) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+
+@brief Hand the buffered data of a transfer to the I/O pool.
+@param t Pointer to the transfer table.
+@param xr Pointer to the receiver state.
+*/
+static void xfer_recv_flush(struct xfer_table *t, struct xfer_recv *xr) {
+  if (xr->wlen == 0) return;
+  io_submit(t->io, xr->io, IO_WRITE, xr->wbuf, xr->woff, xr->wlen);
+  xr->wbuf = (char *)malloc(FILE_WRITE_BUFFER);
+  xr->wlen = 0;
+}
+
+/**
+
+@brief Write a chunk of the file at its offset.
+
+Chunks are collected into FILE_WRITE_BUFFER sized blocks before they are
+handed to the pool.  A chunk that continues the buffered block is added
+to it.  Any other chunk, such as one that fills a gap left by a lost
+packet, starts a new block.
+
+@param t Pointer to the transfer table.
+@param xr Pointer to the receiver state.
+@param offset File offset of the chunk.
+@param data The chunk.
+@param length Number of bytes in the chunk.
+*/
+static void xfer_recv_write(struct xfer_table *t, struct xfer_recv *xr,
+                            long long offset, char *data, int length) {
+  if (xr->wlen > 0 && (offset != xr->woff + xr->wlen ||
+                       xr->wlen + length > FILE_WRITE_BUFFER)) {
+    xfer_recv_flush(t, xr);
+  }
+  if (xr->wlen == 0) xr->woff = offset;
+  memcpy(xr->wbuf + xr->wlen, data, length);
+  xr->wlen += length;
+}
+
+/**
+
+@brief Check whether a data packet's chunk is already in the file.
+@param xr Pointer to the receiver state.
+@param seq Sequence number of the packet.
+@return 1 if the chunk has been written, 0 otherwise.
+*/
+static int xfer_recv_have(struct xfer_recv *xr, unsigned int seq) {
+  long long c = (long long)seq - 1;
+
+  if (xr->have == NULL || c < 0 || c >= xr->chunks) return 0;
+  return (xr->have[c / 8] >> (c % 8)) & 1;
+}
+
+/**
+
+@brief Save the checkpoint of a transfer.
+
+The checkpoint, .<name>.ckpt next to the file, holds the file id and a
+bitmap of the chunks written.  When the same file is sent again, those
+chunks count as received, so the first acknowledgement skips the sender
+past them (xfer_send_skip()).
+The buffered data is handed over and synced first.  The checkpoint file
+uses the same worker as the data file, so it is written after the data it
+describes.
+
+@param t Pointer to the transfer table.
+@param xr Pointer to the receiver state.
+*/
+static void xfer_recv_checkpoint(struct xfer_table *t, struct xfer_recv *xr) {
+  char *rec;
+  int n;
+
+  if (xr->ckpt == NULL) return;
+  xfer_recv_flush(t, xr);
+  io_submit(t->io, xr->io, IO_FSYNC, NULL, 0, 0);
+
+  n = XFER_CKPT_HDR + (xr->chunks + 7) / 8;
+  rec = (char *)malloc(n);
+  memcpy(rec, XFER_CKPT_MAGIC, 8);
+  put_u64(rec + 8, xr->file_id);
+  put_u64(rec + 16, xr->size);
+  memcpy(rec + XFER_CKPT_HDR, xr->have, n - XFER_CKPT_HDR);
+  io_submit(t->io, xr->ckpt, IO_WRITE, rec, 0, n);
+  xr->ckpt_time = time_now_usec();
+}
+
+/**
+
+@brief Load the checkpoint of an earlier, interrupted transfer of a file.
+
+The checkpoint is small and read once when a transfer starts, so it is
+read directly rather than through the I/O pool.
+
+@param xr Pointer to the receiver state, with the file id, size and an
+empty have bitmap.
+@return 1 if a checkpoint for the same file was loaded, 0 otherwise.
+*/
+static int xfer_recv_load_checkpoint(struct xfer_recv *xr) {
+  char hdr[XFER_CKPT_HDR];
+  size_t n = (xr->chunks + 7) / 8;
+  FILE *fp;
+  int ok;
+
+  fp = fopen(xr->ckpt_path, "r");
+  if (fp == NULL) return 0;
+  ok = fread(hdr, 1, XFER_CKPT_HDR, fp) == XFER_CKPT_HDR &&
+       memcmp(hdr, XFER_CKPT_MAGIC, 8) == 0 &&
+       get_u64(hdr + 8) == xr->file_id && get_u64(hdr + 16) == xr->size &&
+       fread(xr->have, 1, n, fp) == n;
+  fclose(fp);
+  if (!ok) memset(xr->have, 0, n);
+  return ok;
+}
+
+/**
+
+@brief Write out what was received and stop writing the file.
+
+A complete file is synced and its checkpoint removed.  If the sender sent
+a digest, the file is then read back to check it, and the result is
+reported when the file is closed.  A compressed stream is decompressed
+into the file, a delta applied to it and a pack assembled into it, and
+then removed.  A signature or want list is kept for the upload that
+asked for it, and a manifest for the pack that follows.  An incomplete
+file gets a last checkpoint so that it can be resumed.
+
+@param t Pointer to the transfer table.
+@param xr Pointer to the receiver state.
+@param complete 1 if the whole file arrived.
+*/
+static void xfer_recv_close(struct xfer_table *t, struct xfer_recv *xr,
+                            int complete) {
+  struct xfer_verify *v;
+  long long off;
+  int length;
+
+  if (xr->io == NULL) return;
+  if (!complete) xfer_recv_checkpoint(t, xr);
+  xfer_recv_flush(t, xr);
+  if (complete) io_submit(t->io, xr->io, IO_FSYNC, NULL, 0, 0);
+  if (complete) {
+    v = (struct xfer_verify *)calloc(1, sizeof(struct xfer_verify));
+    strcpy(v->name, xr->name);
+    v->src = xr->src;
+    v->size = xr->size;
+    v->has_digest = xr->has_digest;
+    v->digest = xr->digest;
+    v->flags = xr->flags;
+    v->range_off = xr->range_off;
+    strcpy(v->path, xr->stream_path);
+    if (xr->flags == 0) strcpy(v->dest, xr->path);
+    xr->io->owner = v;
+  }
+  if (complete && xr->has_digest) {
+    for (off = 0; off < xr->size; off += length) {
+      length = xr->size - off < XFER_CHECK_MAX ? (int)(xr->size - off)
+                                               : XFER_CHECK_MAX;
+      io_submit(t->io, xr->io, IO_CHECKSUM, NULL, off, length);
+    }
+  }
+  if (complete && (xr->flags & XFER_FLAG_LZ)) {
+    io_submit(t->io, xr->io, IO_DECOMPRESS, strdup(xr->path), 0, 0);
+    io_submit(t->io, xr->io, IO_UNLINK, strdup(xr->stream_path), 0, 0);
+  } else if (complete && (xr->flags & XFER_FLAG_DELTA)) {
+    io_submit(t->io, xr->io, IO_PATCH, strdup(xr->path), 0, 0);
+    io_submit(t->io, xr->io, IO_UNLINK, strdup(xr->stream_path), 0, 0);
+  } else if (complete && (xr->flags & XFER_FLAG_CHUNKS)) {
+    io_submit(t->io, xr->io, IO_ASSEMBLE, strdup(xr->path), 0, 0);
+    io_submit(t->io, xr->io, IO_UNLINK, strdup(xr->stream_path), 0, 0);
+  }
+  io_submit(t->io, xr->io, IO_CLOSE, NULL, 0, 0);
+  xr->io = NULL;
+  free(xr->wbuf);
+  xr->wbuf = NULL;
+
+  if (xr->ckpt != NULL) {
+    if (complete) {
+      io_submit(t->io, xr->ckpt, IO_UNLINK, strdup(xr->ckpt_path), 0, 0);
+    }
+    io_submit(t->io, xr->ckpt, IO_CLOSE, NULL, 0, 0);
+    xr->ckpt = NULL;
+  }
+}
+
+/**
+
+@brief Close and free a receive session.
+@param t Pointer to the transfer table.
+@param i Index of the session in the table.
+*/
+static void xfer_recv_free(struct xfer_table *t, int i) {
+  timer_cancel(t->timers, &t->recv[i]->idle);
+  xfer_recv_close(t, t->recv[i], 0);
+  free(t->recv[i]->have);
+  free(t->recv[i]);
+  t->recv[i] = NULL;
+}
+
+/**
+
+@brief Check whether another session is writing the same file.
+@param t Pointer to the transfer table.
+@param xr Pointer to the receiver state.
+@return 1 if another open session writes to xr's path, 0 otherwise.
+*/
+static int xfer_recv_shared(struct xfer_table *t, struct xfer_recv *xr) {
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    if (t->recv[i] != NULL && t->recv[i] != xr && t->recv[i]->io != NULL &&
+        strcmp(t->recv[i]->stream_path, xr->stream_path) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+
+@brief Free a receive session that is finished or abandoned, when its
+idle timer goes off.
+
+A finished session is kept for XFER_LINGER so that a resent end packet
+(after a lost final acknowledgement) is still acknowledged.  A session
+that has received nothing for XFER_IDLE_TIMEOUT is abandoned, and its
+partial file removed unless a checkpoint lets it be resumed.
+
+@param arg Pointer to the receiver state.
+*/
+static void xfer_recv_idle(void *arg) {
+  struct xfer_recv *xr = (struct xfer_recv *)arg;
+  struct xfer_table *t = xr->table;
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS && t->recv[i] != xr; i++)
+    ;
+  if (i == XFER_MAX_SESSIONS) return;
+  if (!xr->done) {
+    printf("Abandoned upload of %s from %d\n", xr->name, xr->src);
+  }
+  if (!xr->done && xr->io != NULL && xr->ckpt == NULL &&
+      !(xr->flags & XFER_FLAG_RANGE) && !xfer_recv_shared(t, xr)) {
+    io_submit(t->io, xr->io, IO_UNLINK, strdup(xr->stream_path), 0, 0);
+  }
+  xfer_recv_free(t, i);
+}
+
+/**
+
+@brief Send an acknowledgement for the packets received so far.
+@param xr Pointer to the receiver state.
+@param host_id ID of this host.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+static void xfer_recv_ack(struct xfer_recv *xr, int host_id,
+                          struct net_port **node_port, int node_port_num) {
+  struct packet pkt;
+  unsigned int seq;
+  int i;
+
+  pkt.src = (char)host_id;
+  pkt.dst = (char)xr->src;
+  pkt.type = (char)PKT_FILE_ACK;
+  pkt.payload[0] = (char)xr->id;
+  put_u32(pkt.payload + 1, xr->expected);
+  memset(pkt.payload + XFER_HDR_LEN, 0, XFER_SACK_BYTES);
+  for (i = 0; i < XFER_WINDOW - 1; i++) {
+    seq = xr->expected + 1 + i;
+    if (xr->slot[seq % XFER_WINDOW].valid || xfer_recv_have(xr, seq)) {
+      pkt.payload[XFER_HDR_LEN + i / 8] |= (char)(1 << (i % 8));
+    }
+  }
+  pkt.length = XFER_HDR_LEN + XFER_SACK_BYTES;
+
+  send_all_ports(&pkt, node_port, node_port_num);
+}
+
+/**
+
+@brief Open the file of a new transfer.
+
+The data is written to .<name>.part, or another hidden name for data
+that is not the file itself, which the I/O pool creates and
+preallocates to the size given in the start packet; the file is renamed
+to its own name once it is complete and checked (xfer_io_done()).  If an
+earlier transfer of the same file was interrupted, its chunks are taken
+over, either from a session that is still open or from the checkpoint
+on disk, and the partial file is kept.
+
+@param t Pointer to the transfer table.
+@param xr Pointer to the receiver state.
+@param data Payload of the start packet after the transfer header.
+@param length Length of data.
+@param dir Host directory to store the file in.
+@param dir_valid Whether the host directory has been set.
+*/
+static void xfer_recv_start(struct xfer_table *t, struct xfer_recv *xr,
+                            char *data, int length, char dir[],
+                            int dir_valid) {
+  char *path;
+  long long c;
+  int resume;
+  int keep;
+  int n;
+  int j;
+
+  xr->started = 1;
+  if (length < XFER_START_LEN) length = XFER_START_LEN;
+  xr->size = get_u64(data);
+  xr->file_id = get_u64(data + 8);
+  xr->flags = (unsigned char)data[16];
+  n = xfer_start_name(xr->flags);
+  if (length < n) length = n;
+  if (xr->flags & XFER_FLAG_RANGE) {
+    xr->range_off = get_u64(data + XFER_START_LEN);
+  }
+  memcpy(xr->name, data + n, length - n);
+  xr->name[length - n] = '\0';
+  if (xr->flags & XFER_FLAG_TEST) return;   /* Counted, not stored */
+  xr->chunks = (xr->size + XFER_DATA_MAX - 1) / XFER_DATA_MAX;
+  xr->have = (unsigned char *)calloc(xr->chunks / 8 + 1, 1);
+  if (dir_valid != 1) {
+    printf("No valid directory to receieve upload\n");
+    return;
+  }
+  if ((xr->flags & XFER_FLAG_RANGE) && !swarm_expects(t->swarm, xr->name)) {
+    printf("Range of %s from %d not asked for\n", xr->name, xr->src);
+    return;
+  }
+
+  /*
+   * Answers and manifests are small and made afresh, and a range is
+   * asked for again, so none of them is resumed
+   */
+  resume = 0;
+  keep = xr->reliable && !(xr->flags & (XFER_FLAG_SIG | XFER_FLAG_WANT |
+                                        XFER_FLAG_MANIFEST | XFER_FLAG_RANGE));
+  if (keep) {
+    sprintf(xr->ckpt_path, "../%s/.%s.ckpt", dir, xr->name);
+    for (j = 0; j < XFER_MAX_SESSIONS; j++) {
+      if (t->recv[j] != NULL && t->recv[j] != xr && !t->recv[j]->done &&
+          t->recv[j]->io != NULL && t->recv[j]->file_id == xr->file_id &&
+          strcmp(t->recv[j]->name, xr->name) == 0) {
+        /* The interrupted session is still open and knows the most */
+        memcpy(xr->have, t->recv[j]->have, xr->chunks / 8 + 1);
+        xfer_recv_free(t, j);
+        resume = 1;
+        break;
+      }
+    }
+    if (!resume) resume = xfer_recv_load_checkpoint(xr);
+  }
+
+  sprintf(xr->path, "../%s/%s", dir, xr->name);
+  sprintf(xr->stream_path, "../%s/.%s.%s", dir, xr->name,
+          xr->flags & XFER_FLAG_SIG        ? "sig"
+          : xr->flags & XFER_FLAG_DELTA    ? "delta"
+          : xr->flags & XFER_FLAG_MANIFEST ? "manifest.part"
+          : xr->flags & XFER_FLAG_WANT     ? "want"
+          : xr->flags & XFER_FLAG_CHUNKS   ? "chunks"
+          : xr->flags & XFER_FLAG_RANGE    ? "swarm"
+          : xr->flags & XFER_FLAG_LZ       ? "lz"
+                                           : "part");
+  path = strdup(xr->stream_path);
+  xr->io = io_file_new(t->io, -1);
+  if (xr->flags & XFER_FLAG_RANGE) {
+    /* The download made the file, and other ranges are written to it */
+    xr->io->base = xr->range_off;
+    io_submit(t->io, xr->io, IO_OPEN_KEEP, path, 0, 0);
+  } else {
+    io_submit(t->io, xr->io, resume ? IO_OPEN_KEEP : IO_OPEN_WRITE, path,
+              xr->size, 0);
+  }
+  xr->wbuf = (char *)malloc(FILE_WRITE_BUFFER);
+
+  if (keep) {
+    xr->ckpt = io_file_new(t->io, -1);
+    xr->ckpt->worker = xr->io->worker;
+    io_submit(t->io, xr->ckpt, IO_OPEN_KEEP, strdup(xr->ckpt_path), 0, 0);
+    xr->ckpt_time = time_now_usec();
+  }
+
+  if (resume) {
+    for (c = 0; c < xr->chunks; c++) {
+      if (xfer_recv_have(xr, c + 1)) {
+        xr->resumed += c == xr->chunks - 1
+                           ? xr->size - c * XFER_DATA_MAX
+                           : XFER_DATA_MAX;
+      }
+    }
+    printf("Resuming %s from %d: %lld of %lld bytes already received\n",
+           xr->name, xr->src, xr->resumed, xr->size);
+  }
+}
+
+/**
+
+@brief Finish a transfer whose packets have all arrived.
+@param t Pointer to the transfer table.
+@param xr Pointer to the receiver state.
+*/
+static void xfer_recv_finish(struct xfer_table *t, struct xfer_recv *xr) {
+  double secs;
+
+  xfer_recv_close(t, xr, 1);
+  xr->done = 1;
+  timer_add(t->timers, &xr->idle, time_now_usec() + XFER_LINGER);
+  if (xr->flags & XFER_FLAG_RANGE) return;   /* The download reports it */
+  secs = (time_now_usec() - xr->start_time) / 1e6;
+  if (xr->flags & XFER_FLAG_TEST) {
+    printf("Throughput test from %d: %lld bytes in %.3f s, %.1f KB/s "
+           "goodput, %u packets (%.0f/s), %d duplicates, %d out of order, "
+           "%lld skipped\n",
+           xr->src, xr->bytes, secs, secs > 0 ? xr->bytes / secs / 1000 : 0.0,
+           xr->expected + xr->duplicates,
+           secs > 0 ? (xr->expected + xr->duplicates) / secs : 0.0,
+           xr->duplicates, xr->out_of_order, xr->gaps);
+    return;
+  }
+  printf("Received %s from %d%s: %lld bytes in %.3f s, "
+         "%d duplicates, %d out of order, %lld bytes resumed\n",
+         xr->name, xr->src,
+         xr->flags & XFER_FLAG_LZ         ? " (compressed)"
+         : xr->flags & XFER_FLAG_DELTA    ? " (delta)"
+         : xr->flags & XFER_FLAG_SIG      ? " (signature)"
+         : xr->flags & XFER_FLAG_MANIFEST ? " (manifest)"
+         : xr->flags & XFER_FLAG_WANT     ? " (want list)"
+         : xr->flags & XFER_FLAG_CHUNKS   ? " (chunks)"
+                                          : "",
+         xr->bytes, secs, xr->duplicates,
+         xr->out_of_order, xr->resumed);
+}
+
+/**
+
+@brief Process a start, data or end packet of an incoming transfer.
+
+Data packets are written at their offset as they arrive, whatever their
+order, into a file preallocated to the size in the start packet, so no
+data is held back waiting for a lost packet.  The receive window only
+remembers which packets arrived, for the acknowledgements: the next
+sequence number expected and a bitmap of the XFER_WINDOW packets above
+it.  The transfer is finished once every packet up to the end packet
+has arrived, and the file is then synced and checked against its
+digest.  Every packet of a unicast transfer is acknowledged.  A start
+packet for an unknown (source, transfer id), or for another file than the
+session's, opens a new session.
+
+@param t Pointer to the transfer table.
+@param pkt The PKT_FILE_UPLOAD_START, _CONT or _END packet.
+@param dir Host directory to store the file in.
+@param dir_valid Whether the host directory has been set.
+@param host_id ID of this host.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+void xfer_recv_packet(struct xfer_table *t, struct packet *pkt, char dir[],
+                      int dir_valid, int host_id, struct net_port **node_port,
+                      int node_port_num) {
+  struct xfer_recv *xr;
+  struct xfer_recv_slot *s;
+  unsigned int seq;
+  char *data;
+  int length;
+  int id;
+  int i;
+
+  if (pkt->length < XFER_HDR_LEN) return;
+  id = (unsigned char)pkt->payload[0];
+  seq = get_u32(pkt->payload + 1);
+
+  i = xfer_recv_find(t, pkt->src, id);
+
+  /*
+   * A start packet for a different file means the sender restarted and
+   * reused the id, so the session starts over.  A start packet for the
+   * same file is a resend whose acknowledgement was lost, which is only
+   * acknowledged again, even if the transfer has finished; starting
+   * over would truncate the file just received.
+   */
+  if (i >= 0 && seq == 0 && pkt->length >= XFER_HDR_LEN + XFER_START_LEN &&
+      get_u64(pkt->payload + XFER_HDR_LEN + 8) != t->recv[i]->file_id) {
+    xfer_recv_free(t, i);
+    i = -1;
+  }
+  if (i < 0) {
+    /*
+     * Start packet lost: the sender of a unicast transfer resends it,
+     * and a group member opens the session to ask for it
+     */
+    if (seq != 0 && !IS_MCAST_ADDR((int)pkt->dst)) return;
+    for (i = 0; i < XFER_MAX_SESSIONS && t->recv[i] != NULL; i++)
+      ;
+    if (i == XFER_MAX_SESSIONS) return;   /* Full, the sender will retry */
+    t->recv[i] = (struct xfer_recv *)calloc(1, sizeof(struct xfer_recv));
+    t->recv[i]->active = 1;
+    t->recv[i]->src = pkt->src;
+    t->recv[i]->id = id;
+    t->recv[i]->reliable = !IS_MCAST_ADDR((int)pkt->dst);
+    t->recv[i]->start_time = time_now_usec();
+    t->recv[i]->table = t;
+    timer_init(&t->recv[i]->idle, xfer_recv_idle, t->recv[i]);
+  }
+  xr = t->recv[i];
+  xr->last_time = time_now_usec();
+  /*
+   * A finished group session outlasts the repairs sent to other members,
+   * which would otherwise open a new session
+   */
+  timer_add(t->timers, &xr->idle,
+            xr->last_time + (!xr->done  ? XFER_IDLE_TIMEOUT
+                             : xr->reliable ? XFER_LINGER
+                                            : XFER_MCAST_KEEP));
+
+  if (seq > xr->highest) {
+    xr->gaps += seq - xr->highest - 1;
+    xr->highest = seq;
+  }
+  if (seq < xr->expected) {
+    xr->duplicates++;
+  } else if (seq != 0 && !xr->started) {
+    /* Nowhere to write it until the start packet has been resent */
+  } else if (seq >= xr->expected + XFER_WINDOW && xr->reliable) {
+    /* Beyond the reorder buffer, the sender will resend it */
+  } else {
+    /*
+     * Nobody resends a group upload unasked, so what is beyond the
+     * window is kept rather than dropped: a file's chunk goes into the
+     * file without a slot, and a throughput test, which only counts what
+     * arrives, gives up the packets the window moves past
+     */
+    if (xr->have == NULL) {
+      while (seq >= xr->expected + XFER_WINDOW) {
+        xr->slot[xr->expected % XFER_WINDOW].valid = 0;
+        xr->expected++;
+      }
+    }
+    s = seq < xr->expected + XFER_WINDOW ? &xr->slot[seq % XFER_WINDOW]
+                                         : NULL;
+    if ((s != NULL && s->valid) || xfer_recv_have(xr, seq)) {
+      xr->duplicates++;
+    } else {
+      if (seq != xr->expected) xr->out_of_order++;
+      if (s != NULL) {
+        s->valid = 1;
+        s->type = pkt->type;
+      }
+      length = pkt->length - XFER_HDR_LEN;
+      data = pkt->payload + XFER_HDR_LEN;
+      if (pkt->type == (char)PKT_FILE_UPLOAD_START) {
+        xfer_recv_start(t, xr, data, length, dir, dir_valid);
+      } else if (pkt->type == (char)PKT_FILE_UPLOAD_CONT) {
+        if (xr->io != NULL) {
+          xfer_recv_write(t, xr, (long long)(seq - 1) * XFER_DATA_MAX, data,
+                          length);
+        }
+        if (xr->have != NULL && seq - 1 < xr->chunks) {
+          xr->have[(seq - 1) / 8] |= 1 << ((seq - 1) % 8);
+        }
+        xr->bytes += length;
+      } else if (pkt->type == (char)PKT_FILE_UPLOAD_END &&
+                 length >= XFER_DIGEST_LEN) {
+        xr->digest = get_u32(data);
+        xr->has_digest = 1;
+      }
+    }
+
+    /*
+     * Move the cumulative acknowledgement over what has arrived, and
+     * over chunks a resumed transfer already had
+     */
+    while (!xr->done) {
+      s = &xr->slot[xr->expected % XFER_WINDOW];
+      if (s->valid) {
+        s->valid = 0;
+        xr->expected++;
+        if (s->type == (char)PKT_FILE_UPLOAD_END) xfer_recv_finish(t, xr);
+      } else if (xfer_recv_have(xr, xr->expected)) {
+        xr->expected++;
+      } else if (xr->has_digest && xr->expected == xr->chunks + 1) {
+        /* The end packet came beyond the window */
+        xr->expected++;
+        xfer_recv_finish(t, xr);
+      } else {
+        break;
+      }
+    }
+    if (xr->ckpt != NULL &&
+        time_now_usec() - xr->ckpt_time >= XFER_CKPT_INTERVAL) {
+      xfer_recv_checkpoint(t, xr);
+    }
+  }
+
+  if (xr->reliable) {
+    xfer_recv_ack(xr, host_id, node_port, node_port_num);
+  }
+}
+
+/**
+
+@brief Ask the senders of group uploads for the packets missing.
+
+Nobody acknowledges a group upload, so each member asks for what it
+lacks with the acknowledgement a unicast receiver sends, addressed to the
+sender: the next sequence number expected and which of the packets after
+it have arrived (xfer_send_nack()).  A member asks when a packet is
+missing below the highest one received, or when no packet has come for
+XFER_NACK_INTERVAL before the transfer finished, and at most once per
+XFER_NACK_INTERVAL.  Throughput tests only count what arrives.
+
+@param t Pointer to the transfer table.
+@param host_id ID of this host.
+@param node_port Array of the host's ports.
+@param node_port_num Number of ports.
+*/
+void xfer_recv_pump(struct xfer_table *t, int host_id,
+                    struct net_port **node_port, int node_port_num) {
+  struct xfer_recv *xr;
+  long long now = time_now_usec();
+  int i;
+
+  for (i = 0; i < XFER_MAX_SESSIONS; i++) {
+    xr = t->recv[i];
+    if (xr == NULL || xr->reliable || xr->done ||
+        (xr->flags & XFER_FLAG_TEST) ||
+        now - xr->nack_time < XFER_NACK_INTERVAL) {
+      continue;
+    }
+    if (xr->expected > xr->highest &&
+        now - xr->last_time < XFER_NACK_INTERVAL) {
+      continue;   /* Nothing missing that is not still on its way */
+    }
+    xr->nack_time = now;
+    xfer_recv_ack(xr, host_id, node_port, node_port_num);
+  }
+}
+
+/**
+
+@brief Handle a completed file read or write.
+
+Read-ahead moves the point up to which an upload may send, and reads are
+chained into the file's checksum.  Failures are reported, and the file is
+freed once it has been closed, after a received file has been checked
+against its digest.
+
+@param t Pointer to the transfer table.
+@param req The completed request, freed here.
+*/
+void xfer_io_done(struct xfer_table *t, struct io_req *req) {
+  struct io_file *f = req->file;
+  struct xfer_send *xs = (struct xfer_send *)f->owner;
+  struct xfer_verify *v;
+  char *part;
+  int ok;
+
+  /* A want list for an older manifest is not a failure, just late */
+  if (req->op == IO_PACK && req->result == -ESTALE && xs != NULL) {
+    xs->sig_wait = 1;
+    free(req);
+    return;
+  }
+  /* A read ahead that comes up short means the file shrank while sent */
+  if (req->op == IO_READAHEAD && req->result >= 0 &&
+      req->result < req->length) {
+    req->result = -EIO;
+  }
+  if (req->op == IO_READAHEAD && req->result < 0) f->read_failed = 1;
+  if (req->result < 0 && !f->error) {
+    f->error = 1;
+    printf("File %s failed: %s\n",
+           req->op == IO_OPEN_WRITE   ? "create"
+           : req->op == IO_COMPRESS   ? "compress"
+           : req->op == IO_DECOMPRESS ? "decompress"
+           : req->op == IO_SIGNATURE  ? "sign"
+           : req->op == IO_DELTA      ? "make a delta of"
+           : req->op == IO_PATCH      ? "patch"
+           : req->op == IO_MANIFEST   ? "list the chunks of"
+           : req->op == IO_WANT       ? "look up the chunks of"
+           : req->op == IO_PACK       ? "pack"
+           : req->op == IO_ASSEMBLE   ? "assemble"
+                                      : "read or write",
+           strerror(-req->result));
+  }
+  if ((req->op == IO_COMPRESS || req->op == IO_SIGNATURE ||
+       req->op == IO_DELTA || req->op == IO_MANIFEST ||
+       req->op == IO_WANT || req->op == IO_PACK) &&
+      xs != NULL) {
+    if (req->op == IO_PACK && req->result == 1) {
+      /* The pack is a new transfer, not more of the manifest */
+      xfer_send_new_id(t, xs);
+    }
+    xfer_send_prepared(xs,
+                       req->op == IO_COMPRESS    ? XFER_FLAG_LZ
+                       : req->op == IO_SIGNATURE ? XFER_FLAG_SIG
+                       : req->op == IO_DELTA     ? XFER_FLAG_DELTA
+                       : req->op == IO_MANIFEST  ? XFER_FLAG_MANIFEST
+                       : req->op == IO_WANT      ? XFER_FLAG_WANT
+                                                 : XFER_FLAG_CHUNKS,
+                       req->result == 1);
+  } else if ((req->op == IO_DECOMPRESS || req->op == IO_PATCH ||
+              req->op == IO_ASSEMBLE) &&
+             f->owner != NULL) {
+    v = (struct xfer_verify *)f->owner;
+    if (req->result < 0) v->failed = 1;
+    if (req->op == IO_ASSEMBLE && req->result >= 0) v->reused = req->result;
+  }
+  if ((req->op == IO_READAHEAD || req->op == IO_CHECKSUM) &&
+      req->result >= 0 && req->offset == f->crc_len) {
+    f->crc = crc32c_combine(f->crc, req->crc, req->length);
+    f->crc_len += req->length;
+  }
+  if (req->op == IO_READAHEAD && req->result >= 0) {
+    f->ready = req->offset + req->length;
+  } else if (req->op == IO_CLOSE) {
+    v = (struct xfer_verify *)f->owner;
+    ok = v == NULL || !v->has_digest ||
+         (f->crc_len == v->size && f->crc == v->digest);
+    if (!ok) {
+      printf("Checksum mismatch in %s from %d: sent %08x, received %08x\n",
+             v->name, v->src, v->digest, f->crc);
+    } else if (v != NULL && v->has_digest &&
+               !(v->flags & (XFER_FLAG_SIG | XFER_FLAG_WANT |
+                             XFER_FLAG_MANIFEST | XFER_FLAG_RANGE))) {
+      printf("Verified %s from %d: CRC32C %08x\n", v->name, v->src, f->crc);
+    }
+    if (v != NULL && v->failed) {
+      printf("Could not %s %s from %d\n",
+             v->flags & XFER_FLAG_DELTA    ? "apply the delta to"
+             : v->flags & XFER_FLAG_CHUNKS ? "assemble"
+                                           : "decompress",
+             v->name, v->src);
+    } else if (v != NULL && (v->flags & XFER_FLAG_CHUNKS)) {
+      printf("Stored %s from %d: %d chunks were already here\n", v->name,
+             v->src, v->reused);
+    }
+    if (v != NULL && (v->flags & (XFER_FLAG_SIG | XFER_FLAG_WANT))) {
+      xfer_reply_received(t, v, ok);
+    }
+    if (v != NULL && (v->flags & XFER_FLAG_RANGE)) {
+      swarm_range_done(t->swarm, v->name, v->src, v->range_off, v->size,
+                       f->crc, ok && !f->error);
+    }
+    if (v != NULL && (v->flags & XFER_FLAG_MANIFEST)) {
+      /* Only a whole manifest is answered, so it gets its name now */
+      part = strdup(v->path);
+      part[strlen(part) - strlen(".part")] = '\0';
+      if (!ok || rename(v->path, part) < 0) unlink(v->path);
+      free(part);
+    } else if (v != NULL && v->dest[0] != '\0') {
+      /* A file only takes its name once it is whole and checked */
+      if (!ok || f->error || rename(v->path, v->dest) < 0) unlink(v->path);
+    }
+    free(v);
+    free(f);
+  }
+  free(req);
+}
@@ -0,0 +1,258 @@
+/*
+ * transfer.h
+ *
+ * Reliable file transfer used by the upload and download jobs.
+ * Requires main.h, host.h, packet.h, io_pool.h and timer.h to be included
+ * first.
+ */
+
+#define XFER_HDR_LEN 5        /* Transfer id and sequence number before the data */
+#define XFER_DATA_MAX (PKT_PAYLOAD_MAX - XFER_HDR_LEN)
+#define XFER_START_LEN 17     /* File size, file id and flags before the name in the start packet */
+#define XFER_FLAG_LZ 0x01     /* The data is the file's compressed stream (lz.h) */
+#define XFER_FLAG_SIG 0x02    /* The data is the signature of the file (delta.h) */
+#define XFER_FLAG_DELTA 0x04  /* The data is a delta from the receiver's copy */
+#define XFER_FLAG_MANIFEST 0x08   /* The data is the chunk manifest of the file (store.h) */
+#define XFER_FLAG_WANT 0x10   /* The data is the want list for a manifest */
+#define XFER_FLAG_CHUNKS 0x20 /* The data is a pack of the chunks wanted */
+#define XFER_FLAG_RANGE 0x40  /* The data is part of the file, at an offset */
+#define XFER_FLAG_TEST 0x80   /* The data is synthetic, for a throughput test */
+#define XFER_RANGE_LEN 8      /* Offset of a range, after the flags in the start packet */
+
+/* Options of an upload, for xfer_send_open() */
+#define XFER_OPT_SPLICE 0x01    /* Send the data with splice() on pipe links */
+#define XFER_OPT_COMPRESS 0x02  /* Compress the file if it compresses well */
+#define XFER_OPT_DELTA 0x04     /* Send only what differs from the receiver's copy */
+#define XFER_OPT_SIG 0x08       /* Send the signature of the file, asked for a delta */
+#define XFER_OPT_DEDUP 0x10     /* Send only the chunks the receiver does not store */
+#define XFER_OPT_WANT 0x20      /* Send the want list for a manifest, asked for it */
+#define XFER_OPT_RANGE 0x40     /* Send part of the file, set with xfer_send_range() */
+#define XFER_OPT_TEST 0x80      /* Send synthetic data, opened with xfer_send_test() */
+#define XFER_TEST_MAX (1LL << 40)   /* Bytes announced by a test that runs for a time */
+#define XFER_SIG_RETRY 1000000  /* Ask again for a signature or want list after 1 s */
+#define XFER_SIG_TIMEOUT 10000000  /* Send everything if no answer comes (10 s) */
+#define XFER_CKPT_MAGIC "N367CKP1"
+#define XFER_CKPT_HDR 24      /* Magic, file id and file size before the bitmap */
+#define XFER_CKPT_INTERVAL 1000000  /* Save a receive checkpoint this often (1 s) */
+#define XFER_DIGEST_LEN 4     /* CRC32C of the whole file in the end packet */
+#define XFER_CHECK_MAX (1 << 30)    /* Largest read of one IO_CHECKSUM request */
+#define XFER_WINDOW 64        /* Packets in flight, and receive reorder slots */
+#define XFER_SACK_BYTES (XFER_WINDOW / 8)
+#define XFER_RTO 200000       /* Retransmission timeout until the RTT is measured (200 ms) */
+#define XFER_RTO_MIN 30000    /* Lowest retransmission timeout (30 ms, three host passes) */
+#define XFER_RTO_MAX 2000000  /* Highest retransmission timeout, after backing off (2 s) */
+#define XFER_RTO_GRAIN 10000  /* Clock granularity added to the RTT variance (one host pass) */
+#define XFER_INIT_CWND 4      /* Congestion window of a new upload, packets */
+#define XFER_MIN_CWND 6       /* Smallest window, so the SACK can still show a loss */
+#define XFER_DELAY_ALPHA 2.0  /* Delay mode: grow while fewer packets than this are queued */
+#define XFER_DELAY_BETA 4.0   /* Delay mode: shrink while more packets than this are queued */
+
+#define XFER_CC_LOSS 0        /* Congestion control that backs off on loss (Reno) */
+#define XFER_CC_DELAY 1       /* Backs off as the round-trip time grows (Vegas) */
+#define XFER_DUP_THRESH 3     /* Later packets SACKed before a hole is resent */
+#define XFER_MAX_TIMEOUTS 50  /* Consecutive timeouts before giving up */
+#define XFER_MAX_SESSIONS 64  /* Transfers a host sends, and receives, at once */
+#define XFER_LINGER 2000000   /* Keep a finished receive session to re-ack its end (2 s) */
+#define XFER_IDLE_TIMEOUT 30000000  /* Abandon a receive session idle this long (30 s) */
+#define XFER_NACK_INTERVAL 100000   /* A group member asks for what it lacks this often (100 ms) */
+#define XFER_MCAST_LINGER 2000000   /* A group upload ends once no member asked for 2 s */
+#define XFER_MCAST_KEEP 10000000    /* Keep a finished group session after its last packet (10 s) */
+
+/*
+ * A packet in the send window, kept until it is acknowledged.  The
+ * data is not copied, it is referenced by its offset in the mapped file.
+ */
+struct xfer_send_slot {
+   char type;
+   long long offset;
+   int length;
+   long long sent_time;
+   int acked;
+   int fast_rtx;        /* Already resent because of the SACK */
+   int resent;          /* Sent more than once, so its RTT is ambiguous */
+   struct timer rtx;    /* Retransmission timer, pending until acknowledged */
+   int expired;         /* The timer went off; resend on the next pump */
+};
+
+/*
+ * A packet in the receive window.  Data is written as soon as it arrives,
+ * so the slot only records that the packet is here.
+ */
+struct xfer_recv_slot {
+   int valid;
+   char type;
+};
+
+/*
+ * Sender side.  Sequence number 0 is the start packet with the file
+ * name, then one number per chunk, then the end packet.
+ */
+struct xfer_send {
+   int active;
+   int id;              /* Transfer id, unique among this host's uploads */
+   int dst;
+   int reliable;        /* 0 for multicast, where members only ask for repairs */
+   int splice;          /* Send the data with splice() instead of writev() */
+   int flags;           /* XFER_FLAG_ bits sent in the start packet */
+   int sig;             /* Sending a signature or want list back, not a file */
+   int dedup;           /* Sending only chunks the receiver does not store */
+   int preparing;       /* Waiting for the pool to turn the file into the data */
+   int sig_wait;        /* Waiting for the receiver's signature or want list */
+   long long sig_since; /* When it was first asked for */
+   long long sig_time;  /* When it was last asked for */
+   unsigned int sig_digest;   /* CRC32C of the signature the delta is from,
+                                 or of the manifest that was sent */
+   struct io_file *src_io;    /* The file itself while its manifest is sent */
+   long long range_off; /* File offset of the data, when sending a range */
+   long long test_end;  /* A throughput test stops sending new data then, or 0 */
+   int fd;
+   char *map;           /* The whole file, mapped read-only */
+   long long size;      /* Bytes to send: the file or its compressed stream */
+   long long raw_size;  /* Size of the file itself */
+   long long offset;    /* File offset of the next new chunk */
+   long long file_id;   /* Identifies this version of the file */
+   struct io_pool *pool;
+   struct timer_wheel *timers;
+   struct io_file *io;  /* Reads the file ahead of the window */
+   long long ra_next;   /* File offset of the next read-ahead */
+   char name[MAX_FILE_NAME];
+   char start[XFER_DATA_MAX];   /* Payload of the start packet */
+   char digest[XFER_DIGEST_LEN];   /* Payload of the end packet */
+   unsigned int base;   /* Oldest unacknowledged sequence number */
+   unsigned int next;   /* Next sequence number to send */
+   unsigned int end_seq;
+   int eof;
+   int timeouts;
+   int failed;          /* Given up on, so not reported as sent */
+   long long last_sent; /* When a packet last went onto the link */
+   struct xfer_send_slot slot[XFER_WINDOW];
+
+   /* Packets of a group upload that members asked for again */
+   unsigned int repair_base;   /* Sequence number of bit 0 of repair */
+   unsigned char repair[XFER_SACK_BYTES];
+   long long nack_time; /* When a member last asked, or the end packet was sent */
+
+   /* Congestion control, in packets; new data waits while the window is full */
+   int cc;              /* XFER_CC_LOSS or XFER_CC_DELAY */
+   double cwnd;         /* Congestion window, at most XFER_WINDOW */
+   double ssthresh;     /* Slow start below it, one packet per RTT above */
+   unsigned int recover;   /* Losses below it were in the window already cut */
+   long long srtt;      /* Smoothed round-trip time; 0 until measured */
+   long long rttvar;
+   long long rto;       /* Retransmission timeout */
+   long long min_rtt;   /* Without queueing, for the delay mode */
+
+   /* Statistics */
+   long long start_time;
+   long long bytes;
+   int packets;
+   int retransmits;
+   int cuts;            /* Times the window was cut */
+   long long resumed;   /* Bytes the receiver already had */
+};
+
+/* Receiver side, one session per (source host, transfer id) */
+struct xfer_recv {
+   int active;
+   int done;
+   int src;
+   int id;
+   struct xfer_table *table;
+   struct timer idle;       /* Frees the session once it is idle, or has lingered */
+   int reliable;
+   struct io_file *io;      /* NULL if the file is not being written */
+   char *wbuf;              /* Consecutive data not yet handed to the pool */
+   int wlen;
+   long long woff;          /* File offset of wbuf */
+   long long size;          /* File size announced by the sender */
+   long long range_off;     /* File offset of a range */
+   long long file_id;
+   int flags;               /* XFER_FLAG_ bits from the start packet */
+   char name[MAX_FILE_NAME];
+   char path[MAX_DIR_NAME + MAX_FILE_NAME + 10];     /* The file */
+   char stream_path[MAX_DIR_NAME + MAX_FILE_NAME + 10];  /* Where the data is written */
+   long long chunks;        /* Data packets in the file */
+   unsigned char *have;     /* Bit per chunk already in the file */
+   unsigned int digest;     /* CRC32C of the file, from the end packet */
+   int has_digest;
+
+   /*
+    * Sidecar checkpoint .<name>.ckpt in the host directory, holding the
+    * file id, size and have bitmap, so an interrupted transfer resumes
+    * where it stopped
+    */
+   struct io_file *ckpt;
+   char ckpt_path[MAX_DIR_NAME + MAX_FILE_NAME + 10];
+   long long ckpt_time;
+   unsigned int expected;   /* Lowest sequence number not yet received */
+   struct xfer_recv_slot slot[XFER_WINDOW];
+   int started;             /* The start packet has arrived */
+   long long last_time;     /* When the last packet arrived */
+   long long nack_time;     /* When a group member last asked for repairs */
+
+   /* Statistics */
+   long long start_time;
+   long long bytes;
+   int duplicates;
+   int out_of_order;
+   unsigned int highest;    /* Highest sequence number received */
+   long long gaps;          /* Sequence numbers skipped on arrival, lost or late */
+   long long resumed;
+};
+
+/*
+ * A received file being checked against the sender's digest and, if it
+ * came compressed, decompressed.  It is the owner of the file's io_file
+ * until the file is closed.
+ */
+struct xfer_verify {
+   char name[MAX_FILE_NAME];
+   int src;
+   long long size;
+   int has_digest;
+   unsigned int digest;
+   int flags;           /* XFER_FLAG_ bits of the transfer */
+   long long range_off; /* File offset of a range */
+   char path[MAX_DIR_NAME + MAX_FILE_NAME + 10];   /* Where the data is */
+   char dest[MAX_DIR_NAME + MAX_FILE_NAME + 10];   /* Renamed to once checked, or "" */
+   int failed;          /* Decompressing, patching or assembling failed */
+   int reused;          /* Chunks of an assembled file that were not sent */
+};
+
+/*
+ * All transfers of a host.  Sessions are allocated when a transfer
+ * starts and freed when it ends, so each has its own window, file
+ * handle and progress.
+ */
+struct xfer_table {
+   struct xfer_send *send[XFER_MAX_SESSIONS];
+   struct xfer_recv *recv[XFER_MAX_SESSIONS];
+   int next_id;
+   int cc;                  /* XFER_CC_ mode of new uploads */
+   struct io_pool *io;      /* Does the file reads and writes */
+   struct timer_wheel *timers;  /* Retransmission and idle timers */
+   struct swarm_table *swarm;   /* Downloads the ranges received are for */
+};
+
+void xfer_table_init(struct xfer_table *t, struct io_pool *io,
+                     struct timer_wheel *timers);
+void xfer_io_done(struct xfer_table *t, struct io_req *req);
+int xfer_send_count(struct xfer_table *t);
+struct xfer_send *xfer_send_open(struct xfer_table *t, char dir[],
+      char fname[], int dst, int opts);
+struct xfer_send *xfer_send_test(struct xfer_table *t, int dst,
+      long long bytes, double seconds);
+int xfer_sig_pending(struct xfer_table *t, int dst, char *name);
+int xfer_send_range(struct xfer_send *xs, long long offset, long long length);
+int xfer_range_pending(struct xfer_table *t, int dst, char *name,
+      long long offset);
+int xfer_send_pump(struct xfer_send *xs, int host_id,
+      struct net_port **node_port, int node_port_num);
+void xfer_send_ack(struct xfer_table *t, struct packet *pkt);
+void xfer_send_close(struct xfer_table *t, struct xfer_send *xs);
+
+void xfer_recv_packet(struct xfer_table *t, struct packet *pkt,
+      char dir[], int dir_valid, int host_id,
+      struct net_port **node_port, int node_port_num);
+void xfer_recv_pump(struct xfer_table *t, int host_id,
+      struct net_port **node_port, int node_port_num);